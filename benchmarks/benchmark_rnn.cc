@@ -0,0 +1,1019 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cublas_v2.h>
+#include <cuda.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#include <cudnn.h>
+#include <functional>
+#include <getopt.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cudnn_wrappers.h"
+#include "haste.h"
+
+using std::string;
+using std::vector;
+
+static constexpr int DEFAULT_SAMPLE_SIZE = 10;
+static constexpr int DEFAULT_WARMUP = 2;
+
+static cudnnHandle_t g_cudnn_handle;
+static cublasHandle_t g_blas_handle;
+
+enum class Cell { LSTM, GRU };
+enum class Mode { INFERENCE, FORWARD, BACKWARD, TRAINING };
+
+const char* CellName(Cell cell) {
+  return cell == Cell::LSTM ? "lstm" : "gru";
+}
+
+const char* ModeName(Mode mode) {
+  switch (mode) {
+    case Mode::INFERENCE: return "inference";
+    case Mode::FORWARD: return "forward";
+    case Mode::BACKWARD: return "backward";
+    case Mode::TRAINING: return "training";
+  }
+  return "";
+}
+
+const char* ActivationTierName(const haste::v0::ActivationTier tier) {
+  switch (tier) {
+    case haste::v0::ActivationTier::kPrecise: return "precise";
+    case haste::v0::ActivationTier::kFast: return "fast";
+    case haste::v0::ActivationTier::kApprox: return "approx";
+    case haste::v0::ActivationTier::kHalf2: return "half2";
+  }
+  return "";
+}
+
+// A single point of the sweep.
+struct Config {
+  Cell cell;
+  Mode mode;
+  bool haste;
+  string dtype;
+  int time_steps;
+  int batch_size;
+  int hidden_size;
+  int input_size;
+  float zoneout;
+  bool interleaved;  // `GateLayout::kInterleaved` for the Haste LSTM.
+  bool fused;        // `EnableFusedRecurrence` for the Haste LSTM.
+  haste::v0::ActivationTier activations;  // `SetActivationTier` for Haste inference.
+  int sample_size;
+  int warmup;
+};
+
+struct Result {
+  vector<float> iteration_ms;  // One entry per timed iteration.
+  size_t allocated_bytes = 0;  // Device memory allocated since the start of the benchmark,
+                               // measured after the timed runs.
+  bool skipped = false;        // The implementation doesn't support this configuration.
+};
+
+// Uninitialized device memory. The benchmarks don't depend on the values of most
+// tensors, so only the ones that may change the amount of work are filled in.
+template<typename T>
+struct DeviceBuffer {
+  explicit DeviceBuffer(size_t size) : data(nullptr), size(size) {
+    void* tmp;
+    cudaMalloc(&tmp, size * sizeof(T));
+    data = static_cast<T*>(tmp);
+  }
+
+  ~DeviceBuffer() {
+    cudaFree(data);
+  }
+
+  DeviceBuffer(const DeviceBuffer&) = delete;
+  DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+
+  void zero() {
+    cudaMemset(data, 0, size * sizeof(T));
+  }
+
+  // Fills the buffer with values drawn uniformly from [lo, hi) or, if `binary` is set,
+  // with 0s and 1s (e.g. for zoneout masks).
+  void fill(float lo, float hi, bool binary = false) {
+    vector<T> host(size);
+    for (auto& value : host) {
+      const float u = static_cast<float>(rand()) / RAND_MAX;
+      value = T(binary ? std::round(u) : lo + (hi - lo) * u);
+    }
+    cudaMemcpy(data, host.data(), size * sizeof(T), cudaMemcpyHostToDevice);
+  }
+
+  T* data;
+  size_t size;
+};
+
+size_t FreeDeviceMemory() {
+  size_t free_bytes;
+  size_t total_bytes;
+  cudaDeviceSynchronize();
+  cudaMemGetInfo(&free_bytes, &total_bytes);
+  return free_bytes;
+}
+
+// Runs `fn` `warmup` times and then times each of the next `iterations` calls. Any
+// setup (pass construction, allocations) must happen before this is called.
+vector<float> TimeLoop(std::function<void()> fn, int warmup, int iterations) {
+  for (int i = 0; i < warmup; ++i)
+    fn();
+
+  vector<cudaEvent_t> events(iterations + 1);
+  for (auto& event : events)
+    cudaEventCreate(&event);
+
+  cudaDeviceSynchronize();
+  cudaEventRecord(events[0]);
+  for (int i = 0; i < iterations; ++i) {
+    fn();
+    cudaEventRecord(events[i + 1]);
+  }
+  cudaEventSynchronize(events[iterations]);
+
+  vector<float> elapsed_ms(iterations);
+  for (int i = 0; i < iterations; ++i)
+    cudaEventElapsedTime(&elapsed_ms[i], events[i], events[i + 1]);
+  for (auto& event : events)
+    cudaEventDestroy(event);
+  return elapsed_ms;
+}
+
+// Haste needs `x`, `W`, and `R` to be transposed between the forward pass and backward
+// pass. They're included in the training loop to get a fair measurement of the overall
+// time it takes to run an entire training step. cuBLAS has no `geam` for 16-bit types,
+// so training results for those exclude the transposes.
+template<typename T>
+void Transpose(int rows, int cols, const T* src, T* dst) {}
+
+template<>
+void Transpose<float>(int rows, int cols, const float* src, float* dst) {
+  static const float alpha = 1.0f;
+  static const float beta = 0.0f;
+  cublasSgeam(g_blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, rows, cols,
+      &alpha, src, cols, &beta, src, rows, dst, rows);
+}
+
+template<>
+void Transpose<double>(int rows, int cols, const double* src, double* dst) {
+  static const double alpha = 1.0;
+  static const double beta = 0.0;
+  cublasDgeam(g_blas_handle, CUBLAS_OP_T, CUBLAS_OP_N, rows, cols,
+      &alpha, src, cols, &beta, src, rows, dst, rows);
+}
+
+template<typename T>
+Result HasteLstm(const Config& config) {
+  using haste::v0::accum_t;
+  using haste::v0::lstm::BackwardPass;
+  using haste::v0::lstm::ForwardPass;
+
+  const int time_steps = config.time_steps;
+  const int batch_size = config.batch_size;
+  const int input_size = config.input_size;
+  const int hidden_size = config.hidden_size;
+  const size_t NH = static_cast<size_t>(batch_size) * hidden_size;
+  const bool training = config.mode != Mode::INFERENCE;
+  const bool backward_pass = config.mode == Mode::BACKWARD || config.mode == Mode::TRAINING;
+  const float zoneout_prob = config.zoneout;
+
+  Result result;
+  const size_t baseline = FreeDeviceMemory();
+
+  DeviceBuffer<T> W(input_size * hidden_size * 4);
+  DeviceBuffer<T> R(hidden_size * hidden_size * 4);
+  DeviceBuffer<T> b(hidden_size * 4);
+  DeviceBuffer<T> x(time_steps * batch_size * input_size);
+  DeviceBuffer<T> h((time_steps + 1) * NH);
+  DeviceBuffer<accum_t<T>> c((time_steps + 1) * NH);
+  DeviceBuffer<T> v(time_steps * NH * 4);
+  DeviceBuffer<T> tmp_Rh(NH * 4);
+  DeviceBuffer<T> zoneout_mask(zoneout_prob ? time_steps * NH : 0);
+
+  W.fill(-0.1f, 0.1f);
+  R.fill(-0.1f, 0.1f);
+  b.zero();
+  x.fill(-1.0f, 1.0f);
+  h.zero();
+  c.zero();
+  if (zoneout_prob)
+    zoneout_mask.fill(0.0f, 1.0f, true);
+
+  ForwardPass<T> forward(
+      training,
+      batch_size,
+      input_size,
+      hidden_size,
+      g_blas_handle,
+      0);  // stream
+  if (config.interleaved)
+    forward.SetGateLayout(haste::v0::GateLayout::kInterleaved);
+  if (config.fused)
+    forward.EnableFusedRecurrence();
+  forward.SetActivationTier(config.activations);
+
+  auto run_forward = [&]() {
+    forward.Run(
+        time_steps,
+        W.data,
+        R.data,
+        b.data,
+        x.data,
+        h.data,
+        c.data,
+        v.data,
+        tmp_Rh.data,
+        zoneout_prob,
+        zoneout_prob ? zoneout_mask.data : nullptr,
+        nullptr,
+        nullptr);
+  };
+
+  if (!backward_pass) {
+    result.iteration_ms = TimeLoop(run_forward, config.warmup, config.sample_size);
+    result.allocated_bytes = baseline - FreeDeviceMemory();
+    return result;
+  }
+
+  DeviceBuffer<T> W_t(W.size);
+  DeviceBuffer<T> R_t(R.size);
+  DeviceBuffer<T> x_t(x.size);
+  DeviceBuffer<T> dh_new((time_steps + 1) * NH);
+  DeviceBuffer<accum_t<T>> dc_new((time_steps + 1) * NH);
+  DeviceBuffer<T> dx(x.size);
+  DeviceBuffer<T> dW(W.size);
+  DeviceBuffer<T> dR(R.size);
+  DeviceBuffer<T> db(b.size);
+  DeviceBuffer<T> dh(NH);
+  DeviceBuffer<accum_t<T>> dc(NH);
+
+  dh_new.fill(-0.1f, 0.1f);
+  dc_new.zero();
+  dW.zero();
+  dR.zero();
+  db.zero();
+  dh.zero();
+  dc.zero();
+
+  BackwardPass<T> backward(
+      batch_size,
+      input_size,
+      hidden_size,
+      g_blas_handle,
+      0);  // stream
+  if (config.interleaved)
+    backward.SetGateLayout(haste::v0::GateLayout::kInterleaved);
+  if (config.fused)
+    backward.EnableFusedRecurrence();
+
+  auto transpose = [&]() {
+    Transpose(batch_size * time_steps, input_size, x.data, x_t.data);
+    Transpose(input_size, hidden_size * 4, W.data, W_t.data);
+    Transpose(hidden_size, hidden_size * 4, R.data, R_t.data);
+  };
+
+  // The backward pass overwrites `v` with its gradient, which doesn't change the amount
+  // of work that repeated backward passes do.
+  auto run_backward = [&]() {
+    backward.Run(
+        time_steps,
+        W_t.data,
+        R_t.data,
+        b.data,
+        x_t.data,
+        h.data,
+        c.data,
+        dh_new.data,
+        dc_new.data,
+        dx.data,
+        dW.data,
+        dR.data,
+        db.data,
+        dh.data,
+        dc.data,
+        v.data,
+        zoneout_prob ? zoneout_mask.data : nullptr,
+        nullptr,
+        nullptr);
+  };
+
+  if (config.mode == Mode::BACKWARD) {
+    run_forward();
+    transpose();
+    result.iteration_ms = TimeLoop(run_backward, config.warmup, config.sample_size);
+  } else {
+    result.iteration_ms = TimeLoop([&]() {
+      run_forward();
+      transpose();
+      run_backward();
+    }, config.warmup, config.sample_size);
+  }
+  result.allocated_bytes = baseline - FreeDeviceMemory();
+  return result;
+}
+
+template<typename T>
+Result HasteGru(const Config& config) {
+  using haste::v0::gru::BackwardPass;
+  using haste::v0::gru::ForwardPass;
+
+  const int time_steps = config.time_steps;
+  const int batch_size = config.batch_size;
+  const int input_size = config.input_size;
+  const int hidden_size = config.hidden_size;
+  const size_t NH = static_cast<size_t>(batch_size) * hidden_size;
+  const bool training = config.mode != Mode::INFERENCE;
+  const bool backward_pass = config.mode == Mode::BACKWARD || config.mode == Mode::TRAINING;
+  const float zoneout_prob = config.zoneout;
+
+  Result result;
+  const size_t baseline = FreeDeviceMemory();
+
+  DeviceBuffer<T> W(input_size * hidden_size * 3);
+  DeviceBuffer<T> R(hidden_size * hidden_size * 3);
+  DeviceBuffer<T> bx(hidden_size * 3);
+  DeviceBuffer<T> br(hidden_size * 3);
+  DeviceBuffer<T> x(time_steps * batch_size * input_size);
+  DeviceBuffer<T> h((time_steps + 1) * NH);
+  DeviceBuffer<T> v(training ? time_steps * NH * 4 : 0);
+  DeviceBuffer<T> tmp_Wx(time_steps * NH * 3);
+  DeviceBuffer<T> tmp_Rh(NH * 3);
+  DeviceBuffer<T> zoneout_mask(zoneout_prob ? time_steps * NH : 0);
+
+  W.fill(-0.1f, 0.1f);
+  R.fill(-0.1f, 0.1f);
+  bx.zero();
+  br.zero();
+  x.fill(-1.0f, 1.0f);
+  h.zero();
+  if (zoneout_prob)
+    zoneout_mask.fill(0.0f, 1.0f, true);
+
+  ForwardPass<T> forward(
+      training,
+      batch_size,
+      input_size,
+      hidden_size,
+      g_blas_handle,
+      0);  // stream
+  forward.SetActivationTier(config.activations);
+
+  auto run_forward = [&]() {
+    forward.Run(
+        time_steps,
+        W.data,
+        R.data,
+        bx.data,
+        br.data,
+        x.data,
+        h.data,
+        training ? v.data : nullptr,
+        tmp_Wx.data,
+        tmp_Rh.data,
+        zoneout_prob,
+        zoneout_prob ? zoneout_mask.data : nullptr,
+        nullptr,
+        nullptr);
+  };
+
+  if (!backward_pass) {
+    result.iteration_ms = TimeLoop(run_forward, config.warmup, config.sample_size);
+    result.allocated_bytes = baseline - FreeDeviceMemory();
+    return result;
+  }
+
+  DeviceBuffer<T> W_t(W.size);
+  DeviceBuffer<T> R_t(R.size);
+  DeviceBuffer<T> x_t(x.size);
+  DeviceBuffer<T> dh_new((time_steps + 1) * NH);
+  DeviceBuffer<T> dx(x.size);
+  DeviceBuffer<T> dW(W.size);
+  DeviceBuffer<T> dR(R.size);
+  DeviceBuffer<T> dbx(bx.size);
+  DeviceBuffer<T> dbr(br.size);
+  DeviceBuffer<T> dh(NH);
+  DeviceBuffer<T> dp(time_steps * NH * 3);
+  DeviceBuffer<T> dq(time_steps * NH * 3);
+
+  dh_new.fill(-0.1f, 0.1f);
+  dW.zero();
+  dR.zero();
+  dbx.zero();
+  dbr.zero();
+  dh.zero();
+
+  BackwardPass<T> backward(
+      batch_size,
+      input_size,
+      hidden_size,
+      g_blas_handle,
+      0);  // stream
+
+  auto transpose = [&]() {
+    Transpose(batch_size * time_steps, input_size, x.data, x_t.data);
+    Transpose(input_size, hidden_size * 3, W.data, W_t.data);
+    Transpose(hidden_size, hidden_size * 3, R.data, R_t.data);
+  };
+
+  auto run_backward = [&]() {
+    backward.Run(
+        time_steps,
+        W_t.data,
+        R_t.data,
+        bx.data,
+        br.data,
+        x_t.data,
+        h.data,
+        v.data,
+        dh_new.data,
+        dx.data,
+        dW.data,
+        dR.data,
+        dbx.data,
+        dbr.data,
+        dh.data,
+        dp.data,
+        dq.data,
+        zoneout_prob ? zoneout_mask.data : nullptr,
+        nullptr,
+        nullptr);
+  };
+
+  if (config.mode == Mode::BACKWARD) {
+    run_forward();
+    transpose();
+    result.iteration_ms = TimeLoop(run_backward, config.warmup, config.sample_size);
+  } else {
+    result.iteration_ms = TimeLoop([&]() {
+      run_forward();
+      transpose();
+      run_backward();
+    }, config.warmup, config.sample_size);
+  }
+  result.allocated_bytes = baseline - FreeDeviceMemory();
+  return result;
+}
+
+template<typename T>
+Result Cudnn(const Config& config) {
+  const int time_steps = config.time_steps;
+  const int batch_size = config.batch_size;
+  const int input_size = config.input_size;
+  const int hidden_size = config.hidden_size;
+  const size_t NH = static_cast<size_t>(batch_size) * hidden_size;
+  const bool training = config.mode != Mode::INFERENCE;
+
+  Result result;
+
+  // cuDNN has no zoneout.
+  if (config.zoneout) {
+    result.skipped = true;
+    return result;
+  }
+
+  const size_t baseline = FreeDeviceMemory();
+
+  DeviceBuffer<T> x(time_steps * batch_size * input_size);
+  DeviceBuffer<T> y(time_steps * NH);
+  DeviceBuffer<T> dy(time_steps * NH);
+  DeviceBuffer<T> dx(time_steps * batch_size * input_size);
+  DeviceBuffer<T> hx(NH);
+  DeviceBuffer<T> cx(NH);
+  DeviceBuffer<T> hy(NH);
+  DeviceBuffer<T> cy(NH);
+  DeviceBuffer<T> dhy(NH);
+  DeviceBuffer<T> dcy(NH);
+  DeviceBuffer<T> dhx(NH);
+  DeviceBuffer<T> dcx(NH);
+
+  x.fill(-1.0f, 1.0f);
+  dy.fill(-0.1f, 0.1f);
+  hx.zero();
+  cx.zero();
+  dhy.zero();
+  dcy.zero();
+
+  // Descriptors all the way down. Nice.
+  RnnDescriptor<T> rnn_descriptor(
+      g_cudnn_handle, hidden_size, config.cell == Cell::LSTM ? CUDNN_LSTM : CUDNN_GRU);
+
+  TensorDescriptorArray<T> x_descriptors(time_steps, { batch_size, input_size, 1 });
+  TensorDescriptorArray<T> y_descriptors(time_steps, { batch_size, hidden_size, 1 });
+
+  TensorDescriptor<T> h_descriptor({ 1, batch_size, hidden_size });
+  TensorDescriptor<T> c_descriptor({ 1, batch_size, hidden_size });
+
+  size_t workspace_size = 0;
+  cudnnGetRNNWorkspaceSize(
+      g_cudnn_handle,
+      *rnn_descriptor,
+      time_steps,
+      &x_descriptors,
+      &workspace_size);
+  DeviceBuffer<char> workspace(workspace_size);
+
+  size_t w_size = 0;
+  cudnnGetRNNParamsSize(
+      g_cudnn_handle,
+      *rnn_descriptor,
+      *&x_descriptors,
+      &w_size,
+      CudnnDataType<T>::value);
+  DeviceBuffer<T> w(w_size / sizeof(T));
+  DeviceBuffer<T> dw(w_size / sizeof(T));
+  FilterDescriptor<T> w_descriptor(w.size);
+  w.fill(-0.1f, 0.1f);
+  dw.zero();
+
+  size_t reserve_size = 0;
+  if (training) {
+    cudnnGetRNNTrainingReserveSize(
+        g_cudnn_handle,
+        *rnn_descriptor,
+        time_steps,
+        &x_descriptors,
+        &reserve_size);
+  }
+  DeviceBuffer<char> reserve(reserve_size);
+
+  auto run_inference = [&]() {
+    cudnnRNNForwardInference(
+        g_cudnn_handle,
+        *rnn_descriptor,
+        time_steps,
+        &x_descriptors,
+        x.data,
+        *h_descriptor,
+        hx.data,
+        *c_descriptor,
+        cx.data,
+        *w_descriptor,
+        w.data,
+        &y_descriptors,
+        y.data,
+        *h_descriptor,
+        hy.data,
+        *c_descriptor,
+        cy.data,
+        workspace.data,
+        workspace_size);
+  };
+
+  auto run_forward = [&]() {
+    cudnnRNNForwardTraining(
+        g_cudnn_handle,
+        *rnn_descriptor,
+        time_steps,
+        &x_descriptors,
+        x.data,
+        *h_descriptor,
+        hx.data,
+        *c_descriptor,
+        cx.data,
+        *w_descriptor,
+        w.data,
+        &y_descriptors,
+        y.data,
+        *h_descriptor,
+        hy.data,
+        *c_descriptor,
+        cy.data,
+        workspace.data,
+        workspace_size,
+        reserve.data,
+        reserve_size);
+  };
+
+  auto run_backward = [&]() {
+    cudnnRNNBackwardData(
+        g_cudnn_handle,
+        *rnn_descriptor,
+        time_steps,
+        &y_descriptors,
+        y.data,
+        &y_descriptors,
+        dy.data,
+        *h_descriptor,
+        dhy.data,
+        *c_descriptor,
+        dcy.data,
+        *w_descriptor,
+        w.data,
+        *h_descriptor,
+        hx.data,
+        *c_descriptor,
+        cx.data,
+        &x_descriptors,
+        dx.data,
+        *h_descriptor,
+        dhx.data,
+        *c_descriptor,
+        dcx.data,
+        workspace.data,
+        workspace_size,
+        reserve.data,
+        reserve_size);
+
+    cudnnRNNBackwardWeights(
+        g_cudnn_handle,
+        *rnn_descriptor,
+        time_steps,
+        &x_descriptors,
+        x.data,
+        *h_descriptor,
+        hx.data,
+        &y_descriptors,
+        y.data,
+        workspace.data,
+        workspace_size,
+        *w_descriptor,
+        dw.data,
+        reserve.data,
+        reserve_size);
+  };
+
+  switch (config.mode) {
+    case Mode::INFERENCE:
+      result.iteration_ms = TimeLoop(run_inference, config.warmup, config.sample_size);
+      break;
+    case Mode::FORWARD:
+      result.iteration_ms = TimeLoop(run_forward, config.warmup, config.sample_size);
+      break;
+    case Mode::BACKWARD:
+      run_forward();
+      result.iteration_ms = TimeLoop(run_backward, config.warmup, config.sample_size);
+      break;
+    case Mode::TRAINING:
+      result.iteration_ms = TimeLoop([&]() {
+        run_forward();
+        run_backward();
+      }, config.warmup, config.sample_size);
+      break;
+  }
+  result.allocated_bytes = baseline - FreeDeviceMemory();
+  return result;
+}
+
+template<typename T>
+Result Run(const Config& config) {
+  if (!config.haste)
+    return Cudnn<T>(config);
+  return config.cell == Cell::LSTM ? HasteLstm<T>(config) : HasteGru<T>(config);
+}
+
+// cuDNN's RNN API has no bfloat16 support.
+template<>
+Result Run<__nv_bfloat16>(const Config& config) {
+  if (!config.haste) {
+    Result result;
+    result.skipped = true;
+    return result;
+  }
+  return config.cell == Cell::LSTM ? HasteLstm<__nv_bfloat16>(config) : HasteGru<__nv_bfloat16>(config);
+}
+
+// Counts the multiply-adds of the GEMMs, which dominate the run time. The backward pass
+// has twice as many as the forward pass (one set for the input gradients and one for the
+// weight gradients).
+double Flops(const Config& config) {
+  const double gates = config.cell == Cell::LSTM ? 4 : 3;
+  const double forward = 2.0 * config.time_steps * config.batch_size *
+      gates * config.hidden_size * (config.input_size + config.hidden_size);
+  switch (config.mode) {
+    case Mode::INFERENCE:
+    case Mode::FORWARD:
+      return forward;
+    case Mode::BACKWARD:
+      return 2 * forward;
+    case Mode::TRAINING:
+      return 3 * forward;
+  }
+  return 0;
+}
+
+float Percentile(vector<float> values, float p) {
+  std::sort(values.begin(), values.end());
+  const size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+  return values[index];
+}
+
+static const char* CSV_HEADER =
+    "cell,implementation,mode,dtype,time_steps,batch_size,hidden_size,input_size,zoneout,"
+    "samples,mean_ms,p50_ms,p90_ms,p99_ms,tflops,allocated_mb";
+
+// Formats one result as a CSV row or a JSON object with the fields of `CSV_HEADER`.
+string Format(const Config& config, const Result& result, bool json) {
+  const auto& ms = result.iteration_ms;
+  double mean_ms = 0.0;
+  for (float value : ms)
+    mean_ms += value;
+  mean_ms /= ms.size();
+
+  // The percentiles are of whole iterations, which is what `TimeLoop` times.
+  const double tflops = Flops(config) / (mean_ms * 1e-3) / 1e12;
+  const double allocated_mb = result.allocated_bytes / (1024.0 * 1024.0);
+
+  char buffer[1024];
+  snprintf(buffer, sizeof(buffer), json
+      ? "{\"cell\": \"%s\", \"implementation\": \"%s\", \"mode\": \"%s\", \"dtype\": \"%s\", "
+        "\"time_steps\": %d, \"batch_size\": %d, \"hidden_size\": %d, \"input_size\": %d, "
+        "\"zoneout\": %g, \"samples\": %zu, \"mean_ms\": %f, \"p50_ms\": %f, "
+        "\"p90_ms\": %f, \"p99_ms\": %f, \"tflops\": %f, \"allocated_mb\": %f}"
+      : "%s,%s,%s,%s,%d,%d,%d,%d,%g,%zu,%f,%f,%f,%f,%f,%f",
+      CellName(config.cell),
+      config.haste ? "haste" : "cudnn",
+      ModeName(config.mode),
+      config.dtype.c_str(),
+      config.time_steps,
+      config.batch_size,
+      config.hidden_size,
+      config.input_size,
+      config.zoneout,
+      ms.size(),
+      mean_ms,
+      Percentile(ms, 0.50f),
+      Percentile(ms, 0.90f),
+      Percentile(ms, 0.99f),
+      tflops,
+      allocated_mb);
+  return buffer;
+}
+
+template<typename T>
+vector<T> ParseList(const char* arg) {
+  vector<T> values;
+  std::stringstream stream(arg);
+  string item;
+  while (std::getline(stream, item, ',')) {
+    std::stringstream parser(item);
+    T value;
+    parser >> value;
+    values.push_back(value);
+  }
+  return values;
+}
+
+template<typename T>
+string JoinList(const vector<T>& values) {
+  std::stringstream stream;
+  for (size_t i = 0; i < values.size(); ++i)
+    stream << (i ? "," : "") << values[i];
+  return stream.str();
+}
+
+void usage(const char* name) {
+  printf("Usage: %s [OPTION]...\n", name);
+  printf("  -h, --help\n");
+  printf("  -r, --cell CELL           <lstm|gru> (default: lstm)\n");
+  printf("  -i, --implementation IMPL <haste|cudnn> (default: haste)\n");
+  printf("  -m, --mode MODE           <inference|forward|backward|training> (default: training)\n");
+  printf("  -s, --sample_size NUM     number of timed runs per configuration (default: %d)\n",
+      DEFAULT_SAMPLE_SIZE);
+  printf("  -w, --warmup NUM          number of untimed runs per configuration (default: %d)\n",
+      DEFAULT_WARMUP);
+  printf("  -t, --time_steps LIST     time steps to sweep over (default: 50)\n");
+  printf("  -n, --batch_size LIST     batch sizes to sweep over (default: 1,16,32,64,128)\n");
+  printf("  -H, --hidden_size LIST    hidden sizes to sweep over\n");
+  printf("                            (default: 128,256,512,768,1024,1536,2048,3072,4096)\n");
+  printf("  -c, --input_size LIST     input sizes to sweep over (default: 64,128,256,512)\n");
+  printf("  -d, --dtype LIST          <float|double|half|bfloat16> (default: float)\n");
+  printf("  -z, --zoneout LIST        zoneout probabilities, 0 for off (default: 0)\n");
+  printf("  -g, --gate_layout LAYOUT  <blocked|interleaved> for the Haste LSTM (default: blocked)\n");
+  printf("  -F, --fused               fuse the recurrent GEMM and pointwise kernels of the Haste LSTM\n");
+  printf("  -a, --activations TIER    <precise|fast|approx|half2> gate nonlinearities of Haste\n");
+  printf("                            inference passes (default: precise)\n");
+  printf("  -f, --format FORMAT       <csv|json> (default: csv)\n");
+  printf("  -o, --output FILE         write results to FILE instead of stdout\n");
+  printf("\n");
+  printf("LIST is a comma-separated list of values. Every combination is benchmarked.\n");
+  printf("Each result reports the mean and the 50th, 90th and 99th percentile iteration\n");
+  printf("times, the achieved GEMM TFLOP/s and the device memory allocated by the\n");
+  printf("benchmark's buffers and passes.\n");
+}
+
+int main(int argc, char* const* argv) {
+  srand(time(0));
+
+  static struct option long_options[] = {
+    { "help", no_argument, 0, 'h' },
+    { "cell", required_argument, 0, 'r' },
+    { "implementation", required_argument, 0, 'i' },
+    { "mode", required_argument, 0, 'm' },
+    { "sample_size", required_argument, 0, 's' },
+    { "warmup", required_argument, 0, 'w' },
+    { "time_steps", required_argument, 0, 't' },
+    { "batch_size", required_argument, 0, 'n' },
+    { "hidden_size", required_argument, 0, 'H' },
+    { "input_size", required_argument, 0, 'c' },
+    { "dtype", required_argument, 0, 'd' },
+    { "zoneout", required_argument, 0, 'z' },
+    { "gate_layout", required_argument, 0, 'g' },
+    { "fused", no_argument, 0, 'F' },
+    { "activations", required_argument, 0, 'a' },
+    { "format", required_argument, 0, 'f' },
+    { "output", required_argument, 0, 'o' },
+    { 0, 0, 0, 0 }
+  };
+
+  Config base;
+  base.cell = Cell::LSTM;
+  base.mode = Mode::TRAINING;
+  base.haste = true;
+  base.interleaved = false;
+  base.fused = false;
+  base.activations = haste::v0::ActivationTier::kPrecise;
+  base.sample_size = DEFAULT_SAMPLE_SIZE;
+  base.warmup = DEFAULT_WARMUP;
+
+  vector<int> time_steps = { 50 };
+  vector<int> batch_sizes = { 1, 16, 32, 64, 128 };
+  vector<int> hidden_sizes = { 128, 256, 512, 768, 1024, 1536, 2048, 3072, 4096 };
+  vector<int> input_sizes = { 64, 128, 256, 512 };
+  vector<string> dtypes = { "float" };
+  vector<float> zoneouts = { 0.0f };
+  bool json = false;
+  const char* output_path = nullptr;
+
+  int c;
+  int opt_index;
+  while ((c = getopt_long(argc, argv, "hr:i:m:s:w:t:n:H:c:d:z:g:Fa:f:o:", long_options, &opt_index)) != -1)
+    switch (c) {
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      case 'r':
+        if (optarg[0] == 'g' || optarg[0] == 'G')
+          base.cell = Cell::GRU;
+        break;
+      case 'i':
+        if (optarg[0] == 'c' || optarg[0] == 'C')
+          base.haste = false;
+        break;
+      case 'm':
+        switch (optarg[0]) {
+          case 'i': case 'I': base.mode = Mode::INFERENCE; break;
+          case 'f': case 'F': base.mode = Mode::FORWARD; break;
+          case 'b': case 'B': base.mode = Mode::BACKWARD; break;
+          default: base.mode = Mode::TRAINING; break;
+        }
+        break;
+      case 's':
+        sscanf(optarg, "%d", &base.sample_size);
+        break;
+      case 'w':
+        sscanf(optarg, "%d", &base.warmup);
+        break;
+      case 't':
+        time_steps = ParseList<int>(optarg);
+        break;
+      case 'n':
+        batch_sizes = ParseList<int>(optarg);
+        break;
+      case 'H':
+        hidden_sizes = ParseList<int>(optarg);
+        break;
+      case 'c':
+        input_sizes = ParseList<int>(optarg);
+        break;
+      case 'd':
+        dtypes = ParseList<string>(optarg);
+        break;
+      case 'z':
+        zoneouts = ParseList<float>(optarg);
+        break;
+      case 'g':
+        base.interleaved = optarg[0] == 'i' || optarg[0] == 'I';
+        break;
+      case 'F':
+        base.fused = true;
+        break;
+      case 'a':
+        switch (optarg[0]) {
+          case 'f': case 'F': base.activations = haste::v0::ActivationTier::kFast; break;
+          case 'a': case 'A': base.activations = haste::v0::ActivationTier::kApprox; break;
+          case 'h': case 'H': base.activations = haste::v0::ActivationTier::kHalf2; break;
+          default: base.activations = haste::v0::ActivationTier::kPrecise; break;
+        }
+        break;
+      case 'f':
+        json = optarg[0] == 'j' || optarg[0] == 'J';
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+
+  for (const auto& dtype : dtypes) {
+    if (dtype != "float" && dtype != "double" && dtype != "half" && dtype != "bfloat16") {
+      fprintf(stderr, "Unknown dtype: %s\n", dtype.c_str());
+      return 1;
+    }
+  }
+
+  FILE* output = output_path ? fopen(output_path, "w") : stdout;
+  if (!output) {
+    fprintf(stderr, "Unable to open %s for writing.\n", output_path);
+    return 1;
+  }
+
+  cudnnCreate(&g_cudnn_handle);
+  cublasCreate(&g_blas_handle);
+  cublasSetMathMode(g_blas_handle, CUBLAS_DEFAULT_MATH);
+
+  // The configuration goes into comments in CSV output, which `report.py` skips.
+  if (json) {
+    fprintf(output, "[\n");
+  } else {
+    fprintf(output, "# Benchmark configuration:\n");
+    fprintf(output, "#   Cell: %s\n", CellName(base.cell));
+    fprintf(output, "#   Mode: %s\n", ModeName(base.mode));
+    fprintf(output, "#   Implementation: %s\n", base.haste ? "Haste" : "cuDNN");
+    fprintf(output, "#   Sample size: %d (warmup: %d)\n", base.sample_size, base.warmup);
+    fprintf(output, "#   Time steps: %s\n", JoinList(time_steps).c_str());
+    fprintf(output, "#   Data types: %s\n", JoinList(dtypes).c_str());
+    fprintf(output, "#   Zoneout: %s\n", JoinList(zoneouts).c_str());
+    fprintf(output, "#   Gate layout: %s\n", base.interleaved ? "interleaved" : "blocked");
+    fprintf(output, "#   Fused recurrence: %s\n", base.fused ? "yes" : "no");
+    fprintf(output, "#   Activations: %s\n", ActivationTierName(base.activations));
+    fprintf(output, "#\n");
+    fprintf(output, "%s\n", CSV_HEADER);
+  }
+
+  bool first = true;
+  for (const auto& dtype : dtypes) {
+    for (const float zoneout : zoneouts) {
+      for (const int T : time_steps) {
+        for (const int N : batch_sizes) {
+          for (const int H : hidden_sizes) {
+            for (const int C : input_sizes) {
+              Config config = base;
+              config.dtype = dtype;
+              config.zoneout = zoneout;
+              config.time_steps = T;
+              config.batch_size = N;
+              config.hidden_size = H;
+              config.input_size = C;
+
+              Result result;
+              if (dtype == "double")
+                result = Run<double>(config);
+              else if (dtype == "half")
+                result = Run<__half>(config);
+              else if (dtype == "bfloat16")
+                result = Run<__nv_bfloat16>(config);
+              else
+                result = Run<float>(config);
+
+              if (result.skipped)
+                continue;
+
+              if (json)
+                fprintf(output, "%s  %s", first ? "" : ",\n", Format(config, result, true).c_str());
+              else
+                fprintf(output, "%s\n", Format(config, result, false).c_str());
+              fflush(output);
+              first = false;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (json)
+    fprintf(output, "\n]\n");
+  if (output != stdout)
+    fclose(output);
+
+  cublasDestroy(g_blas_handle);
+  cudnnDestroy(g_cudnn_handle);
+  return 0;
+}
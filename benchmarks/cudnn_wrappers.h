@@ -16,20 +16,30 @@
 #pragma once
 
 #include <cassert>
+#include <cuda_fp16.h>
 #include <cudnn.h>
 #include <vector>
 
 template<typename T>
 struct CudnnDataType {};
 
+// `math` is the precision that RNN computations are carried out in.
+template<>
+struct CudnnDataType<__half> {
+  static constexpr auto value = CUDNN_DATA_HALF;
+  static constexpr auto math = CUDNN_DATA_FLOAT;
+};
+
 template<>
 struct CudnnDataType<float> {
   static constexpr auto value = CUDNN_DATA_FLOAT;
+  static constexpr auto math = CUDNN_DATA_FLOAT;
 };
 
 template<>
 struct CudnnDataType<double> {
   static constexpr auto value = CUDNN_DATA_DOUBLE;
+  static constexpr auto math = CUDNN_DATA_DOUBLE;
 };
 
 template<typename T>
@@ -124,7 +134,7 @@ class RnnDescriptor {
           CUDNN_UNIDIRECTIONAL,
           algorithm,
           CUDNN_RNN_ALGO_STANDARD,
-          CudnnDataType<T>::value);
+          CudnnDataType<T>::math);
     }
 
     ~RnnDescriptor() {
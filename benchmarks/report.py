@@ -14,59 +14,123 @@
 # ==============================================================================
 
 import argparse
-import matplotlib.pyplot as plt
+import csv
+import json
 import numpy as np
 import os
+import sys
 
 
-def extract(x, predicate):
-  return np.array(list(filter(predicate, x)))
+KEYS = ['cell', 'mode', 'dtype', 'time_steps', 'batch_size', 'hidden_size', 'input_size', 'zoneout']
+METRICS = ['mean_ms', 'p50_ms', 'p99_ms', 'tflops', 'allocated_mb']
+
+
+def load(filename):
+  """Loads the rows written by `benchmark_rnn` in either CSV or JSON format."""
+  with open(filename) as f:
+    if filename.endswith('.json'):
+      rows = json.load(f)
+    else:
+      rows = list(csv.DictReader(line for line in f if not line.startswith('#')))
+  results = {}
+  for row in rows:
+    key = tuple(str(row[k]) for k in KEYS)
+    results[key] = { m: float(row[m]) for m in METRICS }
+  return results
+
+
+def describe(key):
+  return ' '.join(f'{k}={v}' for k, v in zip(KEYS, key))
+
+
+def plot(args, keys, A, B):
+  import matplotlib.pyplot as plt
+
+  # One plot per configuration with hidden size on the x-axis.
+  H = KEYS.index('hidden_size')
+  groups = sorted(set(k[:H] + k[H+1:] for k in keys))
+  for group in groups:
+    cell, mode, dtype, time_steps, batch_size, input_size, zoneout = group
+    members = sorted((k for k in keys if k[:H] + k[H+1:] == group), key=lambda k: int(k[H]))
+    hidden_sizes = [int(k[H]) for k in members]
+    fig, ax = plt.subplots(dpi=200)
+    ax.set_xticks(hidden_sizes)
+    ax.set_xticklabels(hidden_sizes, rotation=60)
+    ax.tick_params(axis='y', which='both', length=0)
+    ax.spines['top'].set_visible(False)
+    ax.spines['right'].set_visible(False)
+    plt.title(f'{cell} {mode} {dtype}, batch size={batch_size}, input size={input_size}')
+    plt.plot(hidden_sizes, [A[k]['mean_ms'] for k in members], color=args.color[0])
+    plt.plot(hidden_sizes, [B[k]['mean_ms'] for k in members], color=args.color[1])
+    plt.xlabel('hidden size')
+    plt.ylabel('time (ms)')
+    plt.legend(args.name, frameon=False)
+    plt.tight_layout()
+    if args.save:
+      os.makedirs(args.save[0], exist_ok=True)
+      plt.savefig(f'{args.save[0]}/report_{cell}_{mode}_{dtype}_t={time_steps}_n={batch_size}_c={input_size}_z={zoneout}.png', dpi=200)
+    else:
+      plt.show()
+    plt.close(fig)
 
 
 def main(args):
   np.set_printoptions(suppress=True)
 
-  A = np.loadtxt(args.A, delimiter=',')
-  B = np.loadtxt(args.B, delimiter=',')
+  A = load(args.A)
+  B = load(args.B)
+  keys = [k for k in A if k in B]
+  if not keys:
+    print('No configurations in common.')
+    return 1
 
-  faster = 1.0 - A[:,-1] / B[:,-1]
+  faster = np.array([1.0 - A[k]['mean_ms'] / B[k]['mean_ms'] for k in keys])
 
-  print(f'A is faster than B by:')
+  print(f'{args.name[0]} is faster than {args.name[1]} by:')
   print(f'  mean:   {np.mean(faster)*100:7.4}%')
   print(f'  std:    {np.std(faster)*100:7.4}%')
   print(f'  median: {np.median(faster)*100:7.4}%')
   print(f'  min:    {np.min(faster)*100:7.4}%')
   print(f'  max:    {np.max(faster)*100:7.4}%')
 
-  for batch_size in np.unique(A[:,0]):
-    for input_size in np.unique(A[:,2]):
-      a = extract(A, lambda x: x[0] == batch_size and x[2] == input_size)
-      b = extract(B, lambda x: x[0] == batch_size and x[2] == input_size)
-      fig, ax = plt.subplots(dpi=200)
-      ax.set_xticks(a[:,1])
-      ax.set_xticklabels(a[:,1].astype(np.int32), rotation=60)
-      ax.tick_params(axis='y', which='both', length=0)
-      ax.spines['top'].set_visible(False)
-      ax.spines['right'].set_visible(False)
-      plt.title(f'batch size={int(batch_size)}, input size={int(input_size)}')
-      plt.plot(a[:,1], a[:,-1], color=args.color[0])
-      plt.plot(a[:,1], b[:,-1], color=args.color[1])
-      plt.xlabel('hidden size')
-      plt.ylabel('time (ms)')
-      plt.legend(args.name, frameon=False)
-      plt.tight_layout()
-      if args.save:
-        os.makedirs(args.save[0], exist_ok=True)
-        plt.savefig(f'{args.save[0]}/report_n={int(batch_size)}_c={int(input_size)}.png', dpi=200)
-      else:
-        plt.show()
+  # A row regresses if A is slower than B by more than the threshold.
+  regressions = []
+  if args.verbose:
+    print()
+  for key, delta in zip(keys, faster):
+    a, b = A[key], B[key]
+    line = (f'  {describe(key)}: {delta*100:+7.2f}% '
+            f'(mean {a["mean_ms"]:.3f} vs {b["mean_ms"]:.3f} ms, '
+            f'p50 {a["p50_ms"]:.3f} vs {b["p50_ms"]:.3f} ms, '
+            f'{a["tflops"]:.2f} vs {b["tflops"]:.2f} TFLOP/s, '
+            f'{a["allocated_mb"]:.1f} vs {b["allocated_mb"]:.1f} MiB allocated)')
+    if args.verbose:
+      print(line)
+    if -delta * 100 > args.threshold:
+      regressions.append(line)
+
+  if regressions:
+    print()
+    print(f'{len(regressions)} configuration(s) regressed by more than {args.threshold}%:')
+    for line in regressions:
+      print(line)
+
+  if args.plot or args.save:
+    plot(args, keys, A, B)
+
+  return 1 if regressions else 0
 
 
 if __name__ == '__main__':
-  parser = argparse.ArgumentParser()
+  parser = argparse.ArgumentParser(
+      description='Compares two benchmark_rnn result files (CSV or JSON), e.g. from two commits.')
   parser.add_argument('--name', nargs=2, default=['A', 'B'])
   parser.add_argument('--color', nargs=2, default=['#1f77b4', '#2ca02c'])
-  parser.add_argument('--save', nargs=1, default=None)
+  parser.add_argument('--threshold', type=float, default=5.0,
+      help='percentage by which A may be slower than B before it is reported as a regression')
+  parser.add_argument('--verbose', '-v', action='store_true', help='print every configuration')
+  parser.add_argument('--plot', action='store_true', help='plot time against hidden size')
+  parser.add_argument('--save', nargs=1, default=None, help='save plots to this directory')
   parser.add_argument('A')
   parser.add_argument('B')
-  main(parser.parse_args())
+  sys.exit(main(parser.parse_args()))
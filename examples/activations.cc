@@ -0,0 +1,259 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+// Runs LSTM and GRU inference passes with each `ActivationTier` and compares their
+// hidden states to those of `ActivationTier::kPrecise`, so the error of each tier can
+// be checked on the GPU at hand before turning it on.
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cuda.h>
+#include <cuda_runtime_api.h>
+#include <string>
+#include <unsupported/Eigen/CXX11/Tensor>
+
+#include "device_ptr.h"
+#include "haste.h"
+
+using haste::v0::ActivationTier;
+using std::string;
+
+using Tensor1 = Eigen::Tensor<float, 1>;
+using Tensor2 = Eigen::Tensor<float, 2>;
+using Tensor3 = Eigen::Tensor<float, 3>;
+
+constexpr int BATCH_SIZE = 64;
+constexpr int SEQUENCE_LEN = 200;
+constexpr int HIDDEN_DIMS = 512;
+constexpr int INPUT_DIMS = 512;
+
+static cublasHandle_t g_blas_handle;
+
+static const ActivationTier kTiers[] = {
+  ActivationTier::kPrecise,
+  ActivationTier::kFast,
+  ActivationTier::kApprox,
+  ActivationTier::kHalf2,
+};
+
+static const char* const kTierNames[] = {
+  "precise",
+  "fast",
+  "approx",
+  "half2",
+};
+
+constexpr int kNumTiers = sizeof(kTiers) / sizeof(kTiers[0]);
+
+// Times the passes of one tier without the one-time setup around them.
+class ScopeTimer {
+  public:
+    ScopeTimer() {
+      cudaEventCreate(&start_);
+      cudaEventCreate(&stop_);
+      cudaDeviceSynchronize();
+      cudaEventRecord(start_);
+    }
+
+    ~ScopeTimer() {
+      cudaEventDestroy(start_);
+      cudaEventDestroy(stop_);
+    }
+
+    float ElapsedMs() {
+      float elapsed_ms;
+      cudaEventRecord(stop_);
+      cudaEventSynchronize(stop_);
+      cudaEventElapsedTime(&elapsed_ms, start_, stop_);
+      return elapsed_ms;
+    }
+
+  private:
+    cudaEvent_t start_, stop_;
+};
+
+// Prints the largest absolute and relative difference between `h` and `h_ref`. The
+// relative error is only taken over elements whose magnitude isn't close to zero.
+void Report(const char* cell, const char* tier, const float elapsed_ms,
+            const Tensor2& h, const Tensor2& h_ref) {
+  float max_abs = 0.0f;
+  float max_rel = 0.0f;
+  for (int i = 0; i < h.size(); ++i) {
+    const float diff = std::abs(h.data()[i] - h_ref.data()[i]);
+    max_abs = std::max(max_abs, diff);
+    if (std::abs(h_ref.data()[i]) > 1e-2f)
+      max_rel = std::max(max_rel, diff / std::abs(h_ref.data()[i]));
+  }
+  printf("%s %-8s %8.2fms  max abs error %.3e  max rel error %.3e\n",
+      cell, tier, elapsed_ms, max_abs, max_rel);
+}
+
+void LstmTiers(const Tensor2& W, const Tensor2& R, const Tensor1& b, const Tensor3& x) {
+  const int time_steps = x.dimension(2);
+  const int batch_size = x.dimension(1);
+  const int input_size = x.dimension(0);
+  const int hidden_size = R.dimension(1);
+
+  device_ptr<Tensor2> W_dev(W);
+  device_ptr<Tensor2> R_dev(R);
+  device_ptr<Tensor1> b_dev(b);
+  device_ptr<Tensor3> x_dev(x);
+
+  device_ptr<Tensor2> h_dev((time_steps + 1) * batch_size * hidden_size);
+  device_ptr<Tensor2> c_dev((time_steps + 1) * batch_size * hidden_size);
+  device_ptr<Tensor3> v_dev(time_steps * batch_size * hidden_size * 4);
+  device_ptr<Tensor2> tmp_Rh_dev(batch_size * hidden_size * 4);
+
+  Tensor2 h_ref(hidden_size * batch_size, time_steps + 1);
+  Tensor2 h(hidden_size * batch_size, time_steps + 1);
+
+  for (int i = 0; i < kNumTiers; ++i) {
+    h_dev.zero();
+    c_dev.zero();
+
+    haste::v0::lstm::ForwardPass<float> forward(
+        false,  // training
+        batch_size,
+        input_size,
+        hidden_size,
+        g_blas_handle,
+        0);  // stream
+    forward.SetActivationTier(kTiers[i]);
+
+    ScopeTimer timer;
+    forward.Run(
+        time_steps,
+        W_dev.data,
+        R_dev.data,
+        b_dev.data,
+        x_dev.data,
+        h_dev.data,
+        c_dev.data,
+        v_dev.data,
+        tmp_Rh_dev.data,
+        0.0f,      // zoneout prob
+        nullptr,   // zoneout mask
+        nullptr,   // sequence lengths
+        nullptr);  // batch sizes
+    const float elapsed_ms = timer.ElapsedMs();
+
+    h_dev.ToHost(i == 0 ? h_ref : h);
+    Report("LSTM", kTierNames[i], elapsed_ms, i == 0 ? h_ref : h, h_ref);
+  }
+}
+
+void GruTiers(const Tensor2& W, const Tensor2& R, const Tensor1& bx, const Tensor1& br,
+              const Tensor3& x) {
+  const int time_steps = x.dimension(2);
+  const int batch_size = x.dimension(1);
+  const int input_size = x.dimension(0);
+  const int hidden_size = R.dimension(1);
+
+  device_ptr<Tensor2> W_dev(W);
+  device_ptr<Tensor2> R_dev(R);
+  device_ptr<Tensor1> bx_dev(bx);
+  device_ptr<Tensor1> br_dev(br);
+  device_ptr<Tensor3> x_dev(x);
+
+  device_ptr<Tensor2> h_dev((time_steps + 1) * batch_size * hidden_size);
+  device_ptr<Tensor3> tmp_Wx_dev(time_steps * batch_size * hidden_size * 3);
+  device_ptr<Tensor2> tmp_Rh_dev(batch_size * hidden_size * 3);
+
+  Tensor2 h_ref(hidden_size * batch_size, time_steps + 1);
+  Tensor2 h(hidden_size * batch_size, time_steps + 1);
+
+  for (int i = 0; i < kNumTiers; ++i) {
+    h_dev.zero();
+
+    haste::v0::gru::ForwardPass<float> forward(
+        false,  // training
+        batch_size,
+        input_size,
+        hidden_size,
+        g_blas_handle,
+        0);  // stream
+    forward.SetActivationTier(kTiers[i]);
+
+    ScopeTimer timer;
+    forward.Run(
+        time_steps,
+        W_dev.data,
+        R_dev.data,
+        bx_dev.data,
+        br_dev.data,
+        x_dev.data,
+        h_dev.data,
+        nullptr,   // v
+        tmp_Wx_dev.data,
+        tmp_Rh_dev.data,
+        0.0f,      // zoneout prob
+        nullptr,   // zoneout mask
+        nullptr,   // sequence lengths
+        nullptr);  // batch sizes
+    const float elapsed_ms = timer.ElapsedMs();
+
+    h_dev.ToHost(i == 0 ? h_ref : h);
+    Report("GRU ", kTierNames[i], elapsed_ms, i == 0 ? h_ref : h, h_ref);
+  }
+}
+
+int main() {
+  srand(time(0));
+
+  cublasCreate(&g_blas_handle);
+
+  // Uniform weights in [-1/sqrt(fan_in), 1/sqrt(fan_in)] keep the gates out of
+  // saturation, where every tier is exact and the comparison would say nothing.
+  const float W_scale = 1.0f / std::sqrt(static_cast<float>(INPUT_DIMS));
+  const float R_scale = 1.0f / std::sqrt(static_cast<float>(HIDDEN_DIMS));
+
+  Tensor3 x(INPUT_DIMS, BATCH_SIZE, SEQUENCE_LEN);
+  x.setRandom();
+  x = x * 2.0f - 1.0f;
+
+  {
+    Tensor2 W(HIDDEN_DIMS * 4, INPUT_DIMS);
+    Tensor2 R(HIDDEN_DIMS * 4, HIDDEN_DIMS);
+    Tensor1 b(HIDDEN_DIMS * 4);
+    W.setRandom();
+    R.setRandom();
+    b.setZero();
+    W = (W * 2.0f - 1.0f) * W_scale;
+    R = (R * 2.0f - 1.0f) * R_scale;
+    LstmTiers(W, R, b, x);
+  }
+
+  {
+    Tensor2 W(HIDDEN_DIMS * 3, INPUT_DIMS);
+    Tensor2 R(HIDDEN_DIMS * 3, HIDDEN_DIMS);
+    Tensor1 bx(HIDDEN_DIMS * 3);
+    Tensor1 br(HIDDEN_DIMS * 3);
+    W.setRandom();
+    R.setRandom();
+    bx.setZero();
+    br.setZero();
+    W = (W * 2.0f - 1.0f) * W_scale;
+    R = (R * 2.0f - 1.0f) * R_scale;
+    GruTiers(W, R, bx, br, x);
+  }
+
+  cublasDestroy(g_blas_handle);
+
+  return 0;
+}
@@ -80,7 +80,7 @@ void GruInference(const Tensor2& W, const Tensor2& R, const Tensor1& bx, const T
   device_ptr<Tensor1> br_dev(br);
   device_ptr<Tensor3> x_dev(x);
 
-  device_ptr<Tensor2> h_dev(batch_size * hidden_size);
+  device_ptr<Tensor2> h_dev((time_steps + 1) * batch_size * hidden_size);
   device_ptr<Tensor3> tmp_Wx_dev(time_steps * batch_size * hidden_size * 3);
   device_ptr<Tensor2> tmp_Rh_dev(batch_size * hidden_size * 3);
 
@@ -92,25 +92,24 @@ void GruInference(const Tensor2& W, const Tensor2& R, const Tensor1& bx, const T
       batch_size,
       input_size,
       hidden_size,
-      g_blas_handle);
-
-  for (int t = 0; t < time_steps; ++t) {
-    const float* x_cur_dev = x_dev.data + t * batch_size * input_size;
-    float* tmp_Wx_cur = tmp_Wx_dev.data + t * batch_size * hidden_size * 3;
-
-    forward.Iterate(W_dev.data,
-                    R_dev.data,
-                    bx_dev.data,
-                    br_dev.data,
-                    x_cur_dev,
-                    h_dev.data,
-                    h_dev.data,
-                    nullptr,  // v_out
-                    tmp_Wx_cur,
-                    tmp_Rh_dev.data,
-                    0.0f,      // zoneout prob
-                    nullptr);  // zoneout mask
-  }
+      g_blas_handle,
+      0);  // stream
+
+  forward.Run(
+      time_steps,
+      W_dev.data,
+      R_dev.data,
+      bx_dev.data,
+      br_dev.data,
+      x_dev.data,
+      h_dev.data,
+      nullptr,   // v
+      tmp_Wx_dev.data,
+      tmp_Rh_dev.data,
+      0.0f,      // zoneout prob
+      nullptr,   // zoneout mask
+      nullptr,   // sequence lengths
+      nullptr);  // batch sizes
 }
 
 int main() {
@@ -95,7 +95,8 @@ void LstmInference(const Tensor2& W, const Tensor2& R, const Tensor1& b, const T
       batch_size,
       input_size,
       hidden_size,
-      g_blas_handle);
+      g_blas_handle,
+      0);  // stream
 
   forward.Run(
       time_steps,
@@ -108,7 +109,9 @@ void LstmInference(const Tensor2& W, const Tensor2& R, const Tensor1& b, const T
       v_dev.data,
       tmp_Rh_dev.data,
       0.0f,      // zoneout prob
-      nullptr);  // zoneout mask
+      nullptr,   // zoneout mask
+      nullptr,   // sequence lengths
+      nullptr);  // batch sizes
 }
 
 void LstmTrain(const Tensor2& W, const Tensor2& R, const Tensor1& b, const Tensor3& x,
@@ -142,7 +145,8 @@ void LstmTrain(const Tensor2& W, const Tensor2& R, const Tensor1& b, const Tenso
         batch_size,
         input_size,
         hidden_size,
-        g_blas_handle);
+        g_blas_handle,
+        0);  // stream
 
     forward.Run(
         time_steps,
@@ -155,7 +159,9 @@ void LstmTrain(const Tensor2& W, const Tensor2& R, const Tensor1& b, const Tenso
         v_dev.data,
         tmp_Rh_dev.data,
         0.0f,      // zoneout prob
-        nullptr);  // zoneout mask
+        nullptr,   // zoneout mask
+        nullptr,   // sequence lengths
+        nullptr);  // batch sizes
   }
 
   Eigen::array<int, 3> transpose_x({ 1, 2, 0 });
@@ -193,7 +199,8 @@ void LstmTrain(const Tensor2& W, const Tensor2& R, const Tensor1& b, const Tenso
         batch_size,
         input_size,
         hidden_size,
-        g_blas_handle);
+        g_blas_handle,
+        0);  // stream
 
     backward.Run(
         time_steps,
@@ -212,6 +219,8 @@ void LstmTrain(const Tensor2& W, const Tensor2& R, const Tensor1& b, const Tenso
         dh_dev.data,
         dc_dev.data,
         v_dev.data,
+        nullptr,
+        nullptr,
         nullptr);
   }
 }
@@ -244,7 +253,8 @@ void LstmTrainIterative(const Tensor2& W, const Tensor2& R, const Tensor1& b, co
         batch_size,
         input_size,
         hidden_size,
-        g_blas_handle);
+        g_blas_handle,
+        0);  // stream
 
     const int NC = batch_size * input_size;
     const int NH = batch_size * hidden_size;
@@ -300,7 +310,8 @@ void LstmTrainIterative(const Tensor2& W, const Tensor2& R, const Tensor1& b, co
         batch_size,
         input_size,
         hidden_size,
-        g_blas_handle);
+        g_blas_handle,
+        0);  // stream
 
     const int NC = batch_size * input_size;
     const int NH = batch_size * hidden_size;
@@ -0,0 +1,271 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <mutex>
+#include <torch/extension.h>
+#include <vector>
+
+#include "haste.h"
+#include "support.h"
+
+namespace {
+
+// Haste passes for the Haste type that corresponds to ATen's element type `T`.
+template<typename T>
+using ForwardPass = haste::v0::gru::ForwardPass<typename HasteType<T>::type>;
+template<typename T>
+using BackwardPass = haste::v0::gru::BackwardPass<typename HasteType<T>::type>;
+template<typename T>
+using PackedWeights = haste::v0::gru::PackedWeights<typename HasteType<T>::type>;
+
+// x: [T,N,C], or [N,T,C] if `batch_first`.
+// kernel: [C,H*3]
+// recurrent_kernel: [H,H*3]
+// bias: [H*3]
+// recurrent_bias: [H*3]
+// sequence_length: [N] int32 on the CPU, or empty.
+// zoneout_seed, dropconnect_seed: [2] int64 on the CPU, or empty.
+// h0: [N,H] or empty.
+//
+// Returns `h` ([T+1,N,H], or [N,T+1,H] if `batch_first`) and `v` ([T,N,H*4] in
+// training, else empty).
+std::vector<at::Tensor> gru_forward(
+    const bool training,
+    const float zoneout_prob,
+    const float dropconnect_rate,
+    const bool batch_first,
+    const at::Tensor& x,
+    const at::Tensor& kernel,
+    const at::Tensor& recurrent_kernel,
+    const at::Tensor& bias,
+    const at::Tensor& recurrent_bias,
+    const at::Tensor& sequence_length,
+    const at::Tensor& zoneout_seed_tensor,
+    const at::Tensor& dropconnect_seed_tensor,
+    const at::Tensor& h0) {
+  const auto time_steps = x.size(batch_first ? 1 : 0);
+  const auto batch_size = x.size(batch_first ? 0 : 1);
+  const auto input_size = x.size(2);
+  const auto hidden_size = recurrent_kernel.size(0);
+
+  CHECK_INPUT(x);
+  CHECK_INPUT(kernel);
+  CHECK_INPUT(recurrent_kernel);
+  CHECK_INPUT(bias);
+  CHECK_INPUT(recurrent_bias);
+  TORCH_CHECK(dropconnect_rate >= 0.0f && dropconnect_rate < 1.0f,
+      "dropconnect_rate must be in [0, 1). Found ", dropconnect_rate);
+  TORCH_CHECK(input_size == kernel.size(0),
+      "x[2] and kernel[0] dimensions must match. Found ", input_size, " and ", kernel.size(0));
+
+  const RandomSeed zoneout_seed = GetRandomSeed(zoneout_seed_tensor, "zoneout_seed");
+  const RandomSeed dropconnect_seed = GetRandomSeed(dropconnect_seed_tensor, "dropconnect_seed");
+  const bool has_zoneout = zoneout_prob && zoneout_seed.enabled;
+  const bool has_dropconnect = dropconnect_rate > 0.0f && dropconnect_seed.enabled;
+
+  const at::cuda::OptionalCUDAGuard guard(x.device());
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
+  const cublasHandle_t blas_handle = at::cuda::getCurrentCUDABlasHandle();
+
+  // See `lstm_forward` for why the caching allocator is safe to use here, and for the
+  // batch-major layout.
+  at::Tensor h = batch_first
+      ? at::empty({ batch_size, time_steps + 1, hidden_size }, x.options())
+      : at::empty({ time_steps + 1, batch_size, hidden_size }, x.options());
+  at::Tensor v = training
+      ? at::empty({ time_steps, batch_size, hidden_size * 4 }, x.options())
+      : at::empty({ 0 }, x.options());
+
+  // The pass writes every state after the initial one.
+  SetInitialState(h0, "h0", batch_first ? 1 : 0, h);
+
+  at::Tensor sequence_length_dev;
+  SequenceLengths lengths;
+  PrepareSequenceLengths(sequence_length, time_steps, batch_size, x, &sequence_length_dev, &lengths);
+
+  // Receives the masked recurrent kernel for the duration of the call.
+  at::Tensor tmp_R = has_dropconnect ? at::empty_like(recurrent_kernel) : at::Tensor();
+
+  HASTE_DISPATCH_TYPES(x.scalar_type(), "haste_gru_forward", ([&] {
+    static PassCache<ForwardPass<scalar_t>> training_cache;
+    static PassCache<ForwardPass<scalar_t>> inference_cache;
+    PassCache<ForwardPass<scalar_t>>& cache = training ? training_cache : inference_cache;
+
+    std::lock_guard<std::mutex> lock(cache.mutex());
+    ForwardPass<scalar_t>& forward = cache.Get(stream, blas_handle, batch_size, input_size, hidden_size, [&]() {
+      return new ForwardPass<scalar_t>(
+          training,
+          batch_size,
+          input_size,
+          hidden_size,
+          blas_handle,
+          stream);
+    });
+    if (zoneout_seed.enabled)
+      forward.SetZoneoutSeed(zoneout_prob, zoneout_seed.seed, zoneout_seed.offset);
+    // A cached pass may have DropConnect enabled by an earlier call, so always set it.
+    forward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? ptr<scalar_t>(tmp_R) : nullptr);
+    forward.SetSequenceLayout(haste::v0::SequenceLayout{ batch_first, false, 0 });
+
+    at::Tensor workspace = at::empty(
+        { static_cast<int64_t>(forward.GetWorkspaceSize(time_steps)) },
+        x.options().dtype(at::kByte));
+
+    forward.Run(
+        time_steps,
+        ptr<scalar_t>(kernel),
+        ptr<scalar_t>(recurrent_kernel),
+        ptr<scalar_t>(bias),
+        ptr<scalar_t>(recurrent_bias),
+        ptr<scalar_t>(x),
+        ptr<scalar_t>(h),
+        training ? ptr<scalar_t>(v) : nullptr,
+        has_zoneout ? zoneout_prob : 0.0f,
+        nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.data_ptr());
+  }));
+
+  return { h, v };
+}
+
+// batch_first, x, kernel, recurrent_kernel, bias, recurrent_bias, sequence_length,
+//     zoneout_seed, dropconnect_seed: as given to `gru_forward`.
+// h, v: the outputs of `gru_forward` in training.
+// dh_new: the gradient of the loss with respect to `h`, shaped like it.
+//
+// Returns `dx`, `dW`, `dR`, `dbx`, `dbr`, and `dh0`, the gradient with respect to the
+// initial state through the recurrence, not including that of the first time step of
+// `dh_new`.
+std::vector<at::Tensor> gru_backward(
+    const float zoneout_prob,
+    const float dropconnect_rate,
+    const bool batch_first,
+    const at::Tensor& x,
+    const at::Tensor& kernel,
+    const at::Tensor& recurrent_kernel,
+    const at::Tensor& bias,
+    const at::Tensor& recurrent_bias,
+    const at::Tensor& h,
+    const at::Tensor& v,
+    const at::Tensor& dh_new,
+    const at::Tensor& sequence_length,
+    const at::Tensor& zoneout_seed_tensor,
+    const at::Tensor& dropconnect_seed_tensor) {
+  const auto time_steps = x.size(batch_first ? 1 : 0);
+  const auto batch_size = x.size(batch_first ? 0 : 1);
+  const auto input_size = x.size(2);
+  const auto hidden_size = recurrent_kernel.size(0);
+
+  CHECK_INPUT(x);
+  CHECK_INPUT(kernel);
+  CHECK_INPUT(recurrent_kernel);
+  CHECK_INPUT(bias);
+  CHECK_INPUT(recurrent_bias);
+  CHECK_INPUT(h);
+  CHECK_INPUT(v);
+  CHECK_INPUT(dh_new);
+
+  const RandomSeed zoneout_seed = GetRandomSeed(zoneout_seed_tensor, "zoneout_seed");
+  const RandomSeed dropconnect_seed = GetRandomSeed(dropconnect_seed_tensor, "dropconnect_seed");
+  const bool has_dropconnect = dropconnect_rate > 0.0f && dropconnect_seed.enabled;
+
+  const at::cuda::OptionalCUDAGuard guard(x.device());
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
+  const cublasHandle_t blas_handle = at::cuda::getCurrentCUDABlasHandle();
+
+  // The weight gradients are overwritten by the pass (see `SetAccumulateGradients`).
+  at::Tensor dx = at::empty_like(x);
+  at::Tensor dW = at::empty({ input_size, hidden_size * 3 }, x.options());
+  at::Tensor dR = at::empty({ hidden_size, hidden_size * 3 }, x.options());
+  at::Tensor dbx = at::empty({ hidden_size * 3 }, x.options());
+  at::Tensor dbr = at::empty({ hidden_size * 3 }, x.options());
+  at::Tensor dh = at::zeros({ batch_size, hidden_size }, x.options());
+
+  at::Tensor sequence_length_dev;
+  SequenceLengths lengths;
+  PrepareSequenceLengths(sequence_length, time_steps, batch_size, x, &sequence_length_dev, &lengths);
+
+  // Receives the masked recurrent kernel for the duration of the call.
+  at::Tensor tmp_R = has_dropconnect ? at::empty_like(recurrent_kernel) : at::Tensor();
+
+  HASTE_DISPATCH_TYPES(x.scalar_type(), "haste_gru_backward", ([&] {
+    static PassCache<BackwardPass<scalar_t>> cache;
+
+    std::lock_guard<std::mutex> lock(cache.mutex());
+    BackwardPass<scalar_t>& backward = cache.Get(stream, blas_handle, batch_size, input_size, hidden_size, [&]() {
+      return new BackwardPass<scalar_t>(
+          batch_size,
+          input_size,
+          hidden_size,
+          blas_handle,
+          stream);
+    });
+    // The weight gradient outputs start out uninitialized.
+    backward.SetAccumulateGradients(false);
+    // A cached pass may have been seeded by an earlier call, so always reset the seed.
+    backward.SetZoneoutSeed(
+        zoneout_seed.enabled ? zoneout_prob : 0.0f,
+        zoneout_seed.seed,
+        zoneout_seed.offset);
+    // DropConnect is also set on every call for the same reason.
+    backward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? ptr<scalar_t>(tmp_R) : nullptr);
+    backward.SetSequenceLayout(haste::v0::SequenceLayout{ batch_first, false, 0 });
+
+    at::Tensor workspace = at::empty(
+        { static_cast<int64_t>(backward.GetWorkspaceSize(time_steps)) },
+        x.options().dtype(at::kByte));
+
+    backward.Run(
+        time_steps,
+        PackedWeights<scalar_t>{
+            ptr<scalar_t>(kernel),
+            ptr<scalar_t>(recurrent_kernel),
+            ptr<scalar_t>(bias),
+            ptr<scalar_t>(recurrent_bias) },
+        ptr<scalar_t>(x),
+        ptr<scalar_t>(h),
+        ptr<scalar_t>(v),
+        ptr<scalar_t>(dh_new),
+        ptr<scalar_t>(dx),
+        ptr<scalar_t>(dW),
+        ptr<scalar_t>(dR),
+        ptr<scalar_t>(dbx),
+        ptr<scalar_t>(dbr),
+        ptr<scalar_t>(dh),
+        nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.data_ptr());
+  }));
+
+  return { dx, dW, dR, dbx, dbr, dh };
+}
+
+}  // anonymous namespace
+
+void gru_init(py::module& m) {
+  m.def("gru_forward", &gru_forward, "GRU forward", py::call_guard<py::gil_scoped_release>());
+  m.def("gru_backward", &gru_backward, "GRU backward", py::call_guard<py::gil_scoped_release>());
+}
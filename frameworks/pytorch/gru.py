@@ -0,0 +1,184 @@
+# Copyright 2020 LMNT, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Gated Recurrent Unit"""
+
+
+import haste_pytorch_lib as LIB
+import torch
+import torch.nn as nn
+
+from .support import final_state, random_seed, sequence_lengths, state_or_empty
+
+
+__all__ = [
+    'GRU'
+]
+
+
+class GRUFunction(torch.autograd.Function):
+  @staticmethod
+  def forward(ctx, training, zoneout, dropout, batch_first, x, kernel, recurrent_kernel, bias,
+      recurrent_bias, sequence_length, zoneout_seed, dropconnect_seed, h0):
+    h, v = LIB.gru_forward(
+        training,
+        zoneout,
+        dropout,
+        batch_first,
+        x.contiguous(),
+        kernel.contiguous(),
+        recurrent_kernel.contiguous(),
+        bias.contiguous(),
+        recurrent_bias.contiguous(),
+        sequence_length,
+        zoneout_seed,
+        dropconnect_seed,
+        h0.contiguous())
+    ctx.training = training
+    ctx.zoneout = zoneout
+    ctx.dropout = dropout
+    ctx.batch_first = batch_first
+    ctx.sequence_length = sequence_length
+    ctx.zoneout_seed = zoneout_seed
+    ctx.dropconnect_seed = dropconnect_seed
+    ctx.has_h0 = h0.numel() > 0
+    ctx.save_for_backward(x, kernel, recurrent_kernel, bias, recurrent_bias, h, v)
+    return h
+
+  @staticmethod
+  def backward(ctx, grad_h):
+    if not ctx.training:
+      raise RuntimeError('GRU can only compute gradients if `training=True` was specified '
+                         'during the forward pass.')
+
+    x, kernel, recurrent_kernel, bias, recurrent_bias, h, v = ctx.saved_tensors
+    dx, dW, dR, dbx, dbr, dh0 = LIB.gru_backward(
+        ctx.zoneout,
+        ctx.dropout,
+        ctx.batch_first,
+        x.contiguous(),
+        kernel.contiguous(),
+        recurrent_kernel.contiguous(),
+        bias.contiguous(),
+        recurrent_bias.contiguous(),
+        h,
+        v,
+        grad_h.contiguous(),
+        ctx.sequence_length,
+        ctx.zoneout_seed,
+        ctx.dropconnect_seed)
+
+    # The gradient of the t=0 output, which is the initial state itself, isn't part of
+    # what the recurrence propagates back.
+    dh0 = dh0 + grad_h.select(1 if ctx.batch_first else 0, 0) if ctx.has_h0 else None
+    return None, None, None, None, dx, dW, dR, dbx, dbr, None, None, None, dh0
+
+
+class GRU(nn.Module):
+  """
+  Gated Recurrent Unit layer.
+
+  This GRU layer runs the same fused CUDA passes as the TensorFlow `GRU` on
+  PyTorch's current stream, with its temporary memory taken from PyTorch's
+  caching allocator. DropConnect and Zoneout regularization are built-in.
+  """
+
+  def __init__(self,
+      input_size,
+      hidden_size,
+      batch_first=False,
+      dropout=0.0,
+      zoneout=0.0):
+    """
+    Initialize the parameters of the GRU layer.
+
+    Arguments:
+      input_size: int, the feature dimension of the input.
+      hidden_size: int, the feature dimension of the output.
+      batch_first: (optional) bool, if `True`, then the input and output
+        tensors are provided as `(batch, seq, feature)`.
+      dropout: (optional) float, sets the dropout rate for DropConnect
+        regularization on the recurrent matrix.
+      zoneout: (optional) float, sets the zoneout rate for Zoneout
+        regularization.
+    """
+    super(GRU, self).__init__()
+
+    if dropout < 0 or dropout >= 1:
+      raise ValueError('GRU: dropout must be in [0.0, 1.0)')
+    if zoneout < 0 or zoneout > 1:
+      raise ValueError('GRU: zoneout must be in [0.0, 1.0]')
+
+    self.input_size = input_size
+    self.hidden_size = hidden_size
+    self.batch_first = batch_first
+    self.dropout = dropout
+    self.zoneout = zoneout
+
+    self.kernel = nn.Parameter(torch.empty(input_size, hidden_size * 3))
+    self.recurrent_kernel = nn.Parameter(torch.empty(hidden_size, hidden_size * 3))
+    self.bias = nn.Parameter(torch.empty(hidden_size * 3))
+    self.recurrent_bias = nn.Parameter(torch.empty(hidden_size * 3))
+    self.reset_parameters()
+
+  def reset_parameters(self):
+    """Resets this layer's parameters to their initial values."""
+    hidden_size = self.hidden_size
+    for i in range(3):
+      nn.init.xavier_uniform_(self.kernel[:, i*hidden_size:(i+1)*hidden_size])
+      nn.init.orthogonal_(self.recurrent_kernel[:, i*hidden_size:(i+1)*hidden_size])
+    nn.init.zeros_(self.bias)
+    nn.init.zeros_(self.recurrent_bias)
+
+  def forward(self, input, state=None, lengths=None):
+    """
+    Runs a forward pass of the GRU layer.
+
+    Arguments:
+      input: Tensor, a batch of input sequences to pass through the GRU.
+        Dimensions (seq_len, batch_size, input_size) if `batch_first` is
+        `False`, otherwise (batch_size, seq_len, input_size).
+      state: (optional) Tensor, of shape (1, batch_size, hidden_size), the
+        hidden state before the first time step. Defaults to zeros.
+      lengths: (optional) Tensor, list of sequence lengths for each batch
+        element, on the CPU. Time steps past the end of a sequence leave its
+        state unchanged.
+
+    Returns:
+      output: Tensor, the output of the GRU layer. Dimensions
+        (seq_len, batch_size, hidden_size) if `batch_first` is `False` (default)
+        or (batch_size, seq_len, hidden_size) if `batch_first` is `True`.
+      h_n: the hidden state of each sequence after its last time step, of
+        shape (1, batch_size, hidden_size).
+    """
+    # A batch-first input is read in place and the output is written batch-first, so
+    # there's nothing to transpose.
+    h = GRUFunction.apply(
+        self.training,
+        self.zoneout,
+        self.dropout if self.training else 0.0,
+        self.batch_first,
+        input,
+        self.kernel,
+        self.recurrent_kernel,
+        self.bias,
+        self.recurrent_bias,
+        sequence_lengths(lengths),
+        random_seed(self.zoneout),
+        random_seed(self.dropout if self.training else 0.0),
+        state_or_empty(state, input))
+
+    output = h[:, 1:] if self.batch_first else h[1:]
+    return output, final_state(h, lengths, self.batch_first)
@@ -0,0 +1,280 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <mutex>
+#include <torch/extension.h>
+#include <vector>
+
+#include "haste.h"
+#include "support.h"
+
+namespace {
+
+// Haste passes for the Haste type that corresponds to ATen's element type `T`.
+template<typename T>
+using ForwardPass = haste::v0::lstm::ForwardPass<typename HasteType<T>::type>;
+template<typename T>
+using BackwardPass = haste::v0::lstm::BackwardPass<typename HasteType<T>::type>;
+template<typename T>
+using PackedWeights = haste::v0::lstm::PackedWeights<typename HasteType<T>::type>;
+
+// ATen's element type of the cell state tensors.
+template<typename T>
+using CellState = typename CellStateType<T>::type;
+
+// x: [T,N,C], or [N,T,C] if `batch_first`.
+// kernel: [C,H*4]
+// recurrent_kernel: [H,H*4]
+// bias: [H*4]
+// sequence_length: [N] int32 on the CPU, or empty.
+// zoneout_seed, dropconnect_seed: [2] int64 on the CPU, or empty.
+// h0, c0: [N,H] or empty.
+//
+// Returns `h` ([T+1,N,H], or [N,T+1,H] if `batch_first`), `c` ([T+1,N,H], float32 for
+// 16-bit `x`) and `v` ([T,N,H*4] in training, else empty).
+std::vector<at::Tensor> lstm_forward(
+    const bool training,
+    const float zoneout_prob,
+    const float dropconnect_rate,
+    const bool batch_first,
+    const at::Tensor& x,
+    const at::Tensor& kernel,
+    const at::Tensor& recurrent_kernel,
+    const at::Tensor& bias,
+    const at::Tensor& sequence_length,
+    const at::Tensor& zoneout_seed_tensor,
+    const at::Tensor& dropconnect_seed_tensor,
+    const at::Tensor& h0,
+    const at::Tensor& c0) {
+  const auto time_steps = x.size(batch_first ? 1 : 0);
+  const auto batch_size = x.size(batch_first ? 0 : 1);
+  const auto input_size = x.size(2);
+  const auto hidden_size = recurrent_kernel.size(0);
+
+  CHECK_INPUT(x);
+  CHECK_INPUT(kernel);
+  CHECK_INPUT(recurrent_kernel);
+  CHECK_INPUT(bias);
+  TORCH_CHECK(dropconnect_rate >= 0.0f && dropconnect_rate < 1.0f,
+      "dropconnect_rate must be in [0, 1). Found ", dropconnect_rate);
+  TORCH_CHECK(input_size == kernel.size(0),
+      "x[2] and kernel[0] dimensions must match. Found ", input_size, " and ", kernel.size(0));
+
+  const RandomSeed zoneout_seed = GetRandomSeed(zoneout_seed_tensor, "zoneout_seed");
+  const RandomSeed dropconnect_seed = GetRandomSeed(dropconnect_seed_tensor, "dropconnect_seed");
+  const bool has_zoneout = zoneout_prob && zoneout_seed.enabled;
+  const bool has_dropconnect = dropconnect_rate > 0.0f && dropconnect_seed.enabled;
+
+  const at::cuda::OptionalCUDAGuard guard(x.device());
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
+  const cublasHandle_t blas_handle = at::cuda::getCurrentCUDABlasHandle();
+
+  // Everything below comes from PyTorch's caching allocator on the current stream. The
+  // passes fork work onto their own streams but join it back into `stream` before
+  // returning, so the memory is safe to reuse once PyTorch frees it. A batch-major `x` is
+  // read in place through `SetSequenceLayout`, and `h` is written in the same order.
+  at::Tensor h = batch_first
+      ? at::empty({ batch_size, time_steps + 1, hidden_size }, x.options())
+      : at::empty({ time_steps + 1, batch_size, hidden_size }, x.options());
+  const auto cell_options = x.options().dtype(CellStateScalarType(x.scalar_type()));
+  at::Tensor c = at::empty({ time_steps + 1, batch_size, hidden_size }, cell_options);
+  at::Tensor v = training
+      ? at::empty({ time_steps, batch_size, hidden_size * 4 }, x.options())
+      : at::empty({ 0 }, x.options());
+
+  // The passes write every state after the initial one.
+  SetInitialState(h0, "h0", batch_first ? 1 : 0, h);
+  SetInitialState(c0, "c0", 0, c);
+
+  at::Tensor sequence_length_dev;
+  SequenceLengths lengths;
+  PrepareSequenceLengths(sequence_length, time_steps, batch_size, x, &sequence_length_dev, &lengths);
+
+  // Receives the masked recurrent kernel for the duration of the call.
+  at::Tensor tmp_R = has_dropconnect ? at::empty_like(recurrent_kernel) : at::Tensor();
+
+  HASTE_DISPATCH_TYPES(x.scalar_type(), "haste_lstm_forward", ([&] {
+    static PassCache<ForwardPass<scalar_t>> training_cache;
+    static PassCache<ForwardPass<scalar_t>> inference_cache;
+    PassCache<ForwardPass<scalar_t>>& cache = training ? training_cache : inference_cache;
+
+    std::lock_guard<std::mutex> lock(cache.mutex());
+    ForwardPass<scalar_t>& forward = cache.Get(stream, blas_handle, batch_size, input_size, hidden_size, [&]() {
+      return new ForwardPass<scalar_t>(
+          training,
+          batch_size,
+          input_size,
+          hidden_size,
+          blas_handle,
+          stream);
+    });
+    if (zoneout_seed.enabled)
+      forward.SetZoneoutSeed(zoneout_prob, zoneout_seed.seed, zoneout_seed.offset);
+    // A cached pass may have DropConnect enabled by an earlier call, so always set it.
+    forward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? ptr<scalar_t>(tmp_R) : nullptr);
+    forward.SetSequenceLayout(haste::v0::SequenceLayout{ batch_first, false, 0 });
+
+    at::Tensor workspace = at::empty(
+        { static_cast<int64_t>(forward.GetWorkspaceSize(time_steps)) },
+        x.options().dtype(at::kByte));
+
+    forward.Run(
+        time_steps,
+        ptr<scalar_t>(kernel),
+        ptr<scalar_t>(recurrent_kernel),
+        ptr<scalar_t>(bias),
+        ptr<scalar_t>(x),
+        ptr<scalar_t>(h),
+        ptr<CellState<scalar_t>>(c),
+        training ? ptr<scalar_t>(v) : nullptr,
+        has_zoneout ? zoneout_prob : 0.0f,
+        nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.data_ptr());
+  }));
+
+  return { h, c, v };
+}
+
+// batch_first, x, kernel, recurrent_kernel, bias, sequence_length, zoneout_seed,
+//     dropconnect_seed: as given to `lstm_forward`.
+// h, c, v: the outputs of `lstm_forward` in training.
+// dh_new, dc_new: the gradients of the loss with respect to `h` and `c`, shaped like them.
+//
+// Returns `dx`, `dW`, `dR`, `db`, and `dh0` and `dc0`, the gradients with respect to the
+// initial states through the recurrence, not including those of the first time step of
+// `dh_new` and `dc_new`.
+std::vector<at::Tensor> lstm_backward(
+    const float zoneout_prob,
+    const float dropconnect_rate,
+    const bool batch_first,
+    const at::Tensor& x,
+    const at::Tensor& kernel,
+    const at::Tensor& recurrent_kernel,
+    const at::Tensor& bias,
+    const at::Tensor& h,
+    const at::Tensor& c,
+    const at::Tensor& v,
+    const at::Tensor& dh_new,
+    const at::Tensor& dc_new,
+    const at::Tensor& sequence_length,
+    const at::Tensor& zoneout_seed_tensor,
+    const at::Tensor& dropconnect_seed_tensor) {
+  const auto time_steps = x.size(batch_first ? 1 : 0);
+  const auto batch_size = x.size(batch_first ? 0 : 1);
+  const auto input_size = x.size(2);
+  const auto hidden_size = recurrent_kernel.size(0);
+
+  CHECK_INPUT(x);
+  CHECK_INPUT(kernel);
+  CHECK_INPUT(recurrent_kernel);
+  CHECK_INPUT(bias);
+  CHECK_INPUT(h);
+  CHECK_INPUT(c);
+  CHECK_INPUT(v);
+  CHECK_INPUT(dh_new);
+  CHECK_INPUT(dc_new);
+
+  const RandomSeed zoneout_seed = GetRandomSeed(zoneout_seed_tensor, "zoneout_seed");
+  const RandomSeed dropconnect_seed = GetRandomSeed(dropconnect_seed_tensor, "dropconnect_seed");
+  const bool has_dropconnect = dropconnect_rate > 0.0f && dropconnect_seed.enabled;
+
+  const at::cuda::OptionalCUDAGuard guard(x.device());
+  const cudaStream_t stream = at::cuda::getCurrentCUDAStream();
+  const cublasHandle_t blas_handle = at::cuda::getCurrentCUDABlasHandle();
+
+  // The weight gradients are overwritten by the pass (see `SetAccumulateGradients`).
+  at::Tensor dx = at::empty_like(x);
+  at::Tensor dW = at::empty({ input_size, hidden_size * 4 }, x.options());
+  at::Tensor dR = at::empty({ hidden_size, hidden_size * 4 }, x.options());
+  at::Tensor db = at::empty({ hidden_size * 4 }, x.options());
+  at::Tensor dh = at::zeros({ batch_size, hidden_size }, x.options());
+  at::Tensor dc = at::zeros({ batch_size, hidden_size }, c.options());
+
+  // `Run` overwrites `v` with the gate gradients, but autograd may still need it for
+  // another backward pass if the graph is retained, so they go to a copy instead.
+  at::Tensor dv = v.clone();
+
+  at::Tensor sequence_length_dev;
+  SequenceLengths lengths;
+  PrepareSequenceLengths(sequence_length, time_steps, batch_size, x, &sequence_length_dev, &lengths);
+
+  // Receives the masked recurrent kernel for the duration of the call.
+  at::Tensor tmp_R = has_dropconnect ? at::empty_like(recurrent_kernel) : at::Tensor();
+
+  HASTE_DISPATCH_TYPES(x.scalar_type(), "haste_lstm_backward", ([&] {
+    static PassCache<BackwardPass<scalar_t>> cache;
+
+    std::lock_guard<std::mutex> lock(cache.mutex());
+    BackwardPass<scalar_t>& backward = cache.Get(stream, blas_handle, batch_size, input_size, hidden_size, [&]() {
+      return new BackwardPass<scalar_t>(
+          batch_size,
+          input_size,
+          hidden_size,
+          blas_handle,
+          stream);
+    });
+    // The weight gradient outputs start out uninitialized.
+    backward.SetAccumulateGradients(false);
+    // A cached pass may have been seeded by an earlier call, so always reset the seed.
+    backward.SetZoneoutSeed(
+        zoneout_seed.enabled ? zoneout_prob : 0.0f,
+        zoneout_seed.seed,
+        zoneout_seed.offset);
+    // DropConnect is also set on every call for the same reason.
+    backward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? ptr<scalar_t>(tmp_R) : nullptr);
+    backward.SetSequenceLayout(haste::v0::SequenceLayout{ batch_first, false, 0 });
+
+    backward.Run(
+        time_steps,
+        PackedWeights<scalar_t>{
+            ptr<scalar_t>(kernel),
+            ptr<scalar_t>(recurrent_kernel),
+            ptr<scalar_t>(bias) },
+        ptr<scalar_t>(x),
+        ptr<scalar_t>(h),
+        ptr<CellState<scalar_t>>(c),
+        ptr<scalar_t>(dh_new),
+        ptr<CellState<scalar_t>>(dc_new),
+        ptr<scalar_t>(dx),
+        ptr<scalar_t>(dW),
+        ptr<scalar_t>(dR),
+        ptr<scalar_t>(db),
+        ptr<scalar_t>(dh),
+        ptr<CellState<scalar_t>>(dc),
+        ptr<scalar_t>(dv),
+        nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }));
+
+  return { dx, dW, dR, db, dh, dc };
+}
+
+}  // anonymous namespace
+
+void lstm_init(py::module& m) {
+  m.def("lstm_forward", &lstm_forward, "LSTM forward", py::call_guard<py::gil_scoped_release>());
+  m.def("lstm_backward", &lstm_backward, "LSTM backward", py::call_guard<py::gil_scoped_release>());
+}
@@ -0,0 +1,199 @@
+# Copyright 2020 LMNT, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Long Short-Term Memory"""
+
+
+import haste_pytorch_lib as LIB
+import torch
+import torch.nn as nn
+
+from .support import final_state, random_seed, sequence_lengths, state_or_empty
+
+
+__all__ = [
+    'LSTM'
+]
+
+
+class LSTMFunction(torch.autograd.Function):
+  @staticmethod
+  def forward(ctx, training, zoneout, dropout, batch_first, x, kernel, recurrent_kernel, bias,
+      sequence_length, zoneout_seed, dropconnect_seed, h0, c0):
+    h, c, v = LIB.lstm_forward(
+        training,
+        zoneout,
+        dropout,
+        batch_first,
+        x.contiguous(),
+        kernel.contiguous(),
+        recurrent_kernel.contiguous(),
+        bias.contiguous(),
+        sequence_length,
+        zoneout_seed,
+        dropconnect_seed,
+        h0.contiguous(),
+        c0.contiguous())
+    ctx.training = training
+    ctx.zoneout = zoneout
+    ctx.dropout = dropout
+    ctx.batch_first = batch_first
+    ctx.sequence_length = sequence_length
+    ctx.zoneout_seed = zoneout_seed
+    ctx.dropconnect_seed = dropconnect_seed
+    ctx.has_h0 = h0.numel() > 0
+    ctx.has_c0 = c0.numel() > 0
+    ctx.save_for_backward(x, kernel, recurrent_kernel, bias, h, c, v)
+    return h, c
+
+  @staticmethod
+  def backward(ctx, grad_h, grad_c):
+    if not ctx.training:
+      raise RuntimeError('LSTM can only compute gradients if `training=True` was specified '
+                         'during the forward pass.')
+
+    x, kernel, recurrent_kernel, bias, h, c, v = ctx.saved_tensors
+    dx, dW, dR, db, dh0, dc0 = LIB.lstm_backward(
+        ctx.zoneout,
+        ctx.dropout,
+        ctx.batch_first,
+        x.contiguous(),
+        kernel.contiguous(),
+        recurrent_kernel.contiguous(),
+        bias.contiguous(),
+        h,
+        c,
+        v,
+        grad_h.contiguous(),
+        grad_c.contiguous(),
+        ctx.sequence_length,
+        ctx.zoneout_seed,
+        ctx.dropconnect_seed)
+
+    # The gradient of the t=0 outputs, which are the initial states themselves, isn't
+    # part of what the recurrence propagates back.
+    dh0 = dh0 + grad_h.select(1 if ctx.batch_first else 0, 0) if ctx.has_h0 else None
+    dc0 = dc0 + grad_c[0] if ctx.has_c0 else None
+    return None, None, None, None, dx, dW, dR, db, None, None, None, dh0, dc0
+
+
+class LSTM(nn.Module):
+  """
+  Long Short-Term Memory layer.
+
+  This LSTM layer runs the same fused CUDA passes as the TensorFlow `LSTM` on
+  PyTorch's current stream, with its temporary memory taken from PyTorch's
+  caching allocator. DropConnect and Zoneout regularization are built-in, and
+  this layer allows setting a non-zero initial forget gate bias.
+  """
+
+  def __init__(self,
+      input_size,
+      hidden_size,
+      batch_first=False,
+      forget_bias=1.0,
+      dropout=0.0,
+      zoneout=0.0):
+    """
+    Initialize the parameters of the LSTM layer.
+
+    Arguments:
+      input_size: int, the feature dimension of the input.
+      hidden_size: int, the feature dimension of the output.
+      batch_first: (optional) bool, if `True`, then the input and output
+        tensors are provided as `(batch, seq, feature)`.
+      forget_bias: (optional) float, sets the initial bias of the forget gate
+        for this LSTM cell.
+      dropout: (optional) float, sets the dropout rate for DropConnect
+        regularization on the recurrent matrix.
+      zoneout: (optional) float, sets the zoneout rate for Zoneout
+        regularization.
+    """
+    super(LSTM, self).__init__()
+
+    if dropout < 0 or dropout >= 1:
+      raise ValueError('LSTM: dropout must be in [0.0, 1.0)')
+    if zoneout < 0 or zoneout > 1:
+      raise ValueError('LSTM: zoneout must be in [0.0, 1.0]')
+
+    self.input_size = input_size
+    self.hidden_size = hidden_size
+    self.batch_first = batch_first
+    self.forget_bias = forget_bias
+    self.dropout = dropout
+    self.zoneout = zoneout
+
+    # The gate columns are in Haste's [i,g,f,o] order.
+    self.kernel = nn.Parameter(torch.empty(input_size, hidden_size * 4))
+    self.recurrent_kernel = nn.Parameter(torch.empty(hidden_size, hidden_size * 4))
+    self.bias = nn.Parameter(torch.empty(hidden_size * 4))
+    self.reset_parameters()
+
+  def reset_parameters(self):
+    """Resets this layer's parameters to their initial values."""
+    hidden_size = self.hidden_size
+    for i in range(4):
+      nn.init.xavier_uniform_(self.kernel[:, i*hidden_size:(i+1)*hidden_size])
+      nn.init.orthogonal_(self.recurrent_kernel[:, i*hidden_size:(i+1)*hidden_size])
+    nn.init.zeros_(self.bias)
+    nn.init.constant_(self.bias[hidden_size*2:hidden_size*3], self.forget_bias)
+
+  def forward(self, input, state=None, lengths=None):
+    """
+    Runs a forward pass of the LSTM layer.
+
+    Arguments:
+      input: Tensor, a batch of input sequences to pass through the LSTM.
+        Dimensions (seq_len, batch_size, input_size) if `batch_first` is
+        `False`, otherwise (batch_size, seq_len, input_size).
+      state: (optional) pair of Tensors `(h0, c0)`, each of shape
+        (1, batch_size, hidden_size), the states before the first time step.
+        Defaults to zeros.
+      lengths: (optional) Tensor, list of sequence lengths for each batch
+        element, on the CPU. Time steps past the end of a sequence leave its
+        state unchanged.
+
+    Returns:
+      output: Tensor, the output of the LSTM layer. Dimensions
+        (seq_len, batch_size, hidden_size) if `batch_first` is `False` (default)
+        or (batch_size, seq_len, hidden_size) if `batch_first` is `True`.
+      (h_n, c_n): the hidden and cell states of each sequence after its last
+        time step, each of shape (1, batch_size, hidden_size). `c_n` is
+        float32 for float16 and bfloat16 inputs.
+    """
+    # A batch-first input is read in place and the outputs are written batch-first,
+    # so there's nothing to transpose. The cell states are always time-major.
+    h0, c0 = state if state is not None else (None, None)
+    h, c = LSTMFunction.apply(
+        self.training,
+        self.zoneout,
+        self.dropout if self.training else 0.0,
+        self.batch_first,
+        input,
+        self.kernel,
+        self.recurrent_kernel,
+        self.bias,
+        sequence_lengths(lengths),
+        random_seed(self.zoneout),
+        random_seed(self.dropout if self.training else 0.0),
+        state_or_empty(h0, input),
+        state_or_empty(c0, input))
+
+    # States are carried through past the end of each sequence, so the last cell state
+    # is every sequence's final state.
+    state = (final_state(h, lengths, self.batch_first), c[-1].unsqueeze(0))
+
+    output = h[:, 1:] if self.batch_first else h[1:]
+    return output, state
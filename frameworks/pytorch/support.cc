@@ -0,0 +1,87 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <torch/extension.h>
+
+#include "support.h"
+
+void PrepareSequenceLengths(
+    const at::Tensor& sequence_length,
+    const int64_t time_steps,
+    const int64_t batch_size,
+    const at::Tensor& like,
+    at::Tensor* sequence_length_dev,
+    SequenceLengths* lengths) {
+  if (!sequence_length.numel())
+    return;
+
+  TORCH_CHECK(!sequence_length.is_cuda(), "sequence_length must be a CPU tensor");
+  TORCH_CHECK(sequence_length.dim() == 1 && sequence_length.size(0) == batch_size,
+      "sequence_length must be empty or have shape [", batch_size, "]. Found ",
+      sequence_length.sizes());
+
+  const at::Tensor host_lengths = sequence_length.to(at::kInt).contiguous();
+  const int* values = host_lengths.data_ptr<int>();
+  bool sorted = true;
+  for (int64_t i = 0; i < batch_size; ++i) {
+    TORCH_CHECK(values[i] >= 0 && values[i] <= time_steps,
+        "sequence_length[", i, "] = ", values[i], " is not in [0, ", time_steps, "]");
+    sorted = sorted && (i == 0 || values[i] <= values[i - 1]);
+  }
+
+  *sequence_length_dev = host_lengths.to(like.device(), /*non_blocking=*/true);
+  lengths->device = sequence_length_dev->data_ptr<int>();
+
+  // With a sorted batch, the items that are still running at step `t` are a prefix.
+  if (sorted) {
+    lengths->batch_sizes.assign(time_steps, 0);
+    for (int64_t i = 0; i < batch_size; ++i)
+      for (int t = 0; t < values[i]; ++t)
+        ++lengths->batch_sizes[t];
+  }
+}
+
+void SetInitialState(const at::Tensor& state, const char* name, const int64_t time_dim, at::Tensor& states) {
+  at::Tensor first = states.select(time_dim, 0);
+  if (!state.numel()) {
+    first.zero_();
+    return;
+  }
+
+  TORCH_CHECK(state.sizes() == first.sizes(),
+      name, " must be empty or have shape ", first.sizes(), ". Found ", state.sizes());
+  first.copy_(state);
+}
+
+RandomSeed GetRandomSeed(const at::Tensor& tensor, const char* name) {
+  RandomSeed seed;
+  if (!tensor.numel())
+    return seed;
+
+  TORCH_CHECK(!tensor.is_cuda(), name, " must be a CPU tensor");
+  TORCH_CHECK(tensor.dim() == 1 && tensor.size(0) == 2,
+      name, " must be empty or have shape [2]. Found ", tensor.sizes());
+
+  const at::Tensor values = tensor.to(at::kLong).contiguous();
+  seed.enabled = true;
+  seed.seed = static_cast<unsigned long long>(values.data_ptr<int64_t>()[0]);
+  seed.offset = static_cast<unsigned long long>(values.data_ptr<int64_t>()[1]);
+  return seed;
+}
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
+  lstm_init(m);
+  gru_init(m);
+}
@@ -0,0 +1,185 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <ATen/cuda/CUDAContext.h>
+#include <c10/cuda/CUDAGuard.h>
+#include <cstdint>
+#include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <torch/extension.h>
+#include <tuple>
+#include <vector>
+
+#include "haste.h"
+
+#define CHECK_CUDA(x) TORCH_CHECK(x.is_cuda(), #x " must be a CUDA tensor")
+#define CHECK_CONTIGUOUS(x) TORCH_CHECK(x.is_contiguous(), #x " must be contiguous")
+#define CHECK_INPUT(x) CHECK_CUDA(x); CHECK_CONTIGUOUS(x)
+
+// Runs `...` with `scalar_t` bound to the element type of `TYPE`, for each of the
+// element types that Haste is instantiated for.
+#define HASTE_DISPATCH_TYPES(TYPE, NAME, ...) \
+  AT_DISPATCH_FLOATING_TYPES_AND2(at::ScalarType::Half, at::ScalarType::BFloat16, TYPE, NAME, __VA_ARGS__)
+
+// Maps ATen element types to the types that Haste is instantiated for. The 16-bit types
+// have identical layouts, so tensor data can be handed to Haste as-is.
+template<typename T>
+struct HasteType {
+  typedef T type;
+};
+
+template<>
+struct HasteType<at::Half> {
+  typedef __half type;
+};
+
+template<>
+struct HasteType<at::BFloat16> {
+  typedef __nv_bfloat16 type;
+};
+
+// The element type of the LSTM cell state and its gradients for element type `T`. Haste
+// keeps them in FP32 for the 16-bit types (see `haste::v0::accum_t`).
+template<typename T>
+struct CellStateType {
+  typedef T type;
+};
+
+template<>
+struct CellStateType<at::Half> {
+  typedef float type;
+};
+
+template<>
+struct CellStateType<at::BFloat16> {
+  typedef float type;
+};
+
+// The same as `CellStateType`, for an element type known only at run time.
+inline at::ScalarType CellStateScalarType(const at::ScalarType type) {
+  return type == at::kHalf || type == at::kBFloat16 ? at::kFloat : type;
+}
+
+template<typename T>
+typename HasteType<T>::type* ptr(at::Tensor& tensor) {
+  return reinterpret_cast<typename HasteType<T>::type*>(tensor.data_ptr<T>());
+}
+
+template<typename T>
+const typename HasteType<T>::type* ptr(const at::Tensor& tensor) {
+  return reinterpret_cast<const typename HasteType<T>::type*>(tensor.data_ptr<T>());
+}
+
+// The per-sequence lengths of a batch, as `Run` takes them.
+struct SequenceLengths {
+  const int* device = nullptr;     // [N] or null if every sequence spans all steps.
+  std::vector<int> batch_sizes;    // [T] if the batch is sorted by decreasing length.
+
+  const int* batch_sizes_or_null() const {
+    return batch_sizes.empty() ? nullptr : batch_sizes.data();
+  }
+};
+
+// Checks the optional [N] int32 CPU tensor `sequence_length` (empty if every sequence
+// spans all time steps) and copies it to the device of `like` into `*sequence_length_dev`
+// on the current stream. Fills in `lengths->batch_sizes` if the lengths are sorted in
+// decreasing order. The copy doesn't block the host if `sequence_length` is pinned.
+void PrepareSequenceLengths(
+    const at::Tensor& sequence_length,
+    const int64_t time_steps,
+    const int64_t batch_size,
+    const at::Tensor& like,
+    at::Tensor* sequence_length_dev,
+    SequenceLengths* lengths);
+
+// Copies the optional [N,H] initial state `state` (empty to start from zeros) into the
+// first time step of `states`, whose time steps run along dimension `time_dim` ([T+1,N,H]
+// for 0, [N,T+1,H] for 1).
+void SetInitialState(const at::Tensor& state, const char* name, const int64_t time_dim, at::Tensor& states);
+
+// A seed and offset for the on-device random number generator of the passes (see
+// `ForwardPass::SetZoneoutSeed` and `ForwardPass::SetDropConnect`). The Python layers
+// draw them from PyTorch's CPU generator, so they follow `torch.manual_seed` without
+// reading anything back from the GPU.
+struct RandomSeed {
+  bool enabled = false;
+  unsigned long long seed = 0;
+  unsigned long long offset = 0;
+};
+
+// Reads a seed from an int64 CPU tensor of shape [2], or leaves it disabled if `tensor`
+// is empty.
+RandomSeed GetRandomSeed(const at::Tensor& tensor, const char* name);
+
+// Keeps `ForwardPass`/`BackwardPass` objects alive across calls so their CUDA streams and
+// events are created once per (device, stream, cuBLAS handle, N, C, H) instead of on
+// every call. The stream and handle are part of the key since a pass joins its work
+// back into the stream it was constructed with, and PyTorch's current stream and cuBLAS
+// handle may change between calls. A pass must only be used while holding `mutex()`
+// since calls on the same object share events.
+template<typename Pass>
+class PassCache {
+  public:
+    // Returns the cached pass for the current device, stream and problem size, and calls
+    // `create` to construct one if there isn't one yet.
+    template<typename Factory>
+    Pass& Get(
+        const cudaStream_t stream,
+        const cublasHandle_t blas_handle,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        Factory create) {
+      int device;
+      cudaGetDevice(&device);
+      const Key key(
+          device,
+          reinterpret_cast<uintptr_t>(stream),
+          reinterpret_cast<uintptr_t>(blas_handle),
+          batch_size,
+          input_size,
+          hidden_size);
+      auto it = passes_.find(key);
+      if (it == passes_.end()) {
+        // Bound the number of streams we hold on to if the batch size keeps changing.
+        if (passes_.size() >= kMaxEntries)
+          passes_.erase(passes_.begin());
+        it = passes_.emplace(key, std::unique_ptr<Pass>(create())).first;
+      }
+      return *it->second;
+    }
+
+    std::mutex& mutex() {
+      return mutex_;
+    }
+
+  private:
+    typedef std::tuple<int, uintptr_t, uintptr_t, int, int, int> Key;
+    static constexpr size_t kMaxEntries = 16;
+
+    std::mutex mutex_;
+    std::map<Key, std::unique_ptr<Pass>> passes_;
+};
+
+// Registers the LSTM and GRU functions with the extension module.
+void lstm_init(py::module& m);
+void gru_init(py::module& m);
@@ -0,0 +1,66 @@
+# Copyright 2020 LMNT, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Helpers shared by the PyTorch layers."""
+
+
+import torch
+
+
+def sequence_lengths(lengths):
+  """
+  Converts optional sequence lengths to the form the extension expects: an
+  int32 CPU tensor, or an empty one if every sequence spans all time steps.
+  """
+  if lengths is None:
+    return torch.zeros([0], dtype=torch.int32)
+  return torch.as_tensor(lengths, dtype=torch.int32, device='cpu')
+
+
+def state_or_empty(state, input):
+  """
+  Converts an optional (1,N,H) initial state to the form the extension expects:
+  an [N,H] tensor, or an empty one if the state starts out as zeros.
+  """
+  if state is None:
+    return input.new_zeros([0, 0])
+  return state.reshape(state.shape[-2:])
+
+
+def random_seed(rate):
+  """
+  Draws a seed and offset for the passes' on-device random number generator
+  from PyTorch's CPU generator, so that the masks follow `torch.manual_seed`
+  without a device round trip. Empty if `rate` is 0.
+  """
+  if not rate:
+    return torch.zeros([0], dtype=torch.int64)
+  info = torch.iinfo(torch.int64)
+  return torch.randint(info.min, info.max, [2], dtype=torch.int64)
+
+
+def final_state(h, lengths, batch_first=False):
+  """
+  Returns the (1,N,H) hidden state of each sequence after its last time step
+  from the hidden states `h`, which are [T+1,N,H], or [N,T+1,H] if
+  `batch_first`.
+  """
+  if batch_first:
+    h = h.transpose(0, 1)
+  if lengths is None:
+    return h[-1].unsqueeze(0)
+  lengths = torch.as_tensor(lengths, dtype=torch.int64, device='cpu').to(h.device, non_blocking=True)
+  batch = torch.arange(h.shape[1], device=h.device)
+  return h[lengths, batch].unsqueeze(0)
@@ -14,74 +14,55 @@
 // ==============================================================================
 
 #include <cuda_runtime_api.h>
-#include <vector>
+#include <mutex>
+#include <string>
 
 #include "haste.h"
+#include "support.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/shape_inference.h"
-#include "tensorflow/core/util/stream_executor_util.h"
-#include "tensorflow/stream_executor/stream.h"
 
 using namespace tensorflow;
 
-using haste::v0::gru::BackwardPass;
-using haste::v0::gru::ForwardPass;
-using tensorflow::se::Stream;
 using tensorflow::shape_inference::DimensionHandle;
 using tensorflow::shape_inference::InferenceContext;
 using tensorflow::shape_inference::ShapeHandle;
 
-#define REGISTER_GPU_KERNEL(NAME, T)                 \
-  REGISTER_KERNEL_BUILDER(Name(#NAME)                \
-                            .Device(DEVICE_GPU)      \
-                            .TypeConstraint<T>("R"), \
-                          NAME##Op<T>)
-
-// LOL.
-struct CublasHandleContainer {
-  CublasHandleContainer() {
-    int count;
-    int current_device;
-    cudaGetDevice(&current_device);
-    cudaGetDeviceCount(&count);
-    for (int i = 0; i < count; ++i) {
-      cublasHandle_t handle;
-      cudaSetDevice(i);
-      cublasCreate(&handle);
-      handles.push_back(handle);
-    }
-    cudaSetDevice(current_device);
-  }
-
-  ~CublasHandleContainer() {
-    for (auto h : handles)
-      cublasDestroy(h);
-  }
-
-  std::vector<cublasHandle_t> handles;
-};
-
-static cublasHandle_t GetCublasHandle() {
-  static CublasHandleContainer all_handles;
-  int device;
-  cudaGetDevice(&device);
-  return all_handles.handles[device];
-}
+// Haste passes for the Haste type that corresponds to TF's element type `T`.
+template<typename T>
+using ForwardPass = haste::v0::gru::ForwardPass<typename HasteType<T>::type>;
+template<typename T>
+using BackwardPass = haste::v0::gru::BackwardPass<typename HasteType<T>::type>;
+template<typename T>
+using PackedWeights = haste::v0::gru::PackedWeights<typename HasteType<T>::type>;
+template<typename T>
+using QuantizedWeights = haste::v0::gru::QuantizedWeights<typename HasteType<T>::type>;
+template<typename T>
+using BidirectionalForwardPass = haste::v0::gru::BidirectionalForwardPass<typename HasteType<T>::type>;
+template<typename T>
+using BidirectionalBackwardPass = haste::v0::gru::BidirectionalBackwardPass<typename HasteType<T>::type>;
 
 // Define the interface and shape function for the op.
 REGISTER_OP("HasteGru")
-    .Attr("R: {float, double}")         // Some real number type.
+    .Attr("R: {half, bfloat16, float, double}")  // Some real number type.
     .Attr("training: bool")
     .Attr("zoneout_prob: float")
+    .Attr("dropconnect_rate: float = 0.0")  // Only used with `dropconnect_seed`.
+    .Attr("activation_storage: {'native', 'half', 'fixed8'} = 'native'")
+    .Attr("time_major: bool = true")  // Else `x` is [N,T,C] and `h` is [N,T+1,H].
     .Input("x: R")                      // [T,N,C]
     .Input("kernel: R")                 // [C,H*3]
     .Input("recurrent_kernel: R")       // [H,H*3]
     .Input("bias: R")                   // [H*3]
     .Input("recurrent_bias: R")         // [H*3]
     .Input("zoneout_mask: R")           // [T,N,H]
-    .Output("h: R")                     // [T,N,H]
-    .Output("v: R")                     // [T,N,H*4]
+    .Input("sequence_length: int32")    // [N]
+    .Input("zoneout_seed: int64")       // [2] or [0]
+    .Input("dropconnect_seed: int64")   // [2] or [0]
+    .Input("h0: R")                     // [N,H] or [0,0]
+    .Output("h: R")                     // [T+1,N,H]
+    .Output("v: R")                     // [T,N,H*4] or compact
     .SetShapeFn([](InferenceContext* c) {
       ShapeHandle input_shape;
       ShapeHandle kernel_shape;
@@ -89,6 +70,13 @@ REGISTER_OP("HasteGru")
       ShapeHandle bias_shape;
       ShapeHandle recurrent_bias_shape;
       ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle zoneout_seed_shape;
+      ShapeHandle dropconnect_seed_shape;
+      ShapeHandle h0_shape;
+      bool training;
+      std::string activation_storage;
+      bool time_major;
 
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &input_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
@@ -96,16 +84,30 @@ REGISTER_OP("HasteGru")
       TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &bias_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &recurrent_bias_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 1, &zoneout_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 1, &dropconnect_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 2, &h0_shape));
+      TF_RETURN_IF_ERROR(c->GetAttr("training", &training));
+      TF_RETURN_IF_ERROR(c->GetAttr("activation_storage", &activation_storage));
+      TF_RETURN_IF_ERROR(c->GetAttr("time_major", &time_major));
 
-      const DimensionHandle time_steps = c->Dim(input_shape, 0);
-      const DimensionHandle batch_size = c->Dim(input_shape, 1);
+      const DimensionHandle time_steps = c->Dim(input_shape, time_major ? 0 : 1);
+      const DimensionHandle batch_size = c->Dim(input_shape, time_major ? 1 : 0);
       const DimensionHandle hidden_size = c->Dim(recurrent_shape, 0);
+      DimensionHandle time_steps_plus_1;
       DimensionHandle hidden_size_4;
 
+      TF_RETURN_IF_ERROR(c->Add(time_steps, 1, &time_steps_plus_1));
       TF_RETURN_IF_ERROR(c->Multiply(hidden_size, 4, &hidden_size_4));
 
-      c->set_output(0, c->MakeShape({ time_steps, batch_size, hidden_size }));
-      c->set_output(1, c->MakeShape({ time_steps, batch_size, hidden_size_4 }));
+      c->set_output(0, time_major
+          ? c->MakeShape({ time_steps_plus_1, batch_size, hidden_size })
+          : c->MakeShape({ batch_size, time_steps_plus_1, hidden_size }));
+      if (training && activation_storage != "native")
+        c->set_output(1, c->Vector(c->UnknownDim()));
+      else
+        c->set_output(1, c->MakeShape({ time_steps, batch_size, hidden_size_4 }));
       return Status::OK();
     });
 
@@ -114,6 +116,14 @@ struct HasteGruOp : public OpKernel {
   explicit HasteGruOp(OpKernelConstruction* context) : OpKernel(context) {
     OP_REQUIRES_OK(context, context->GetAttr("training", &training_));
     OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+    OP_REQUIRES_OK(context, context->GetAttr("dropconnect_rate", &dropconnect_rate_));
+    OP_REQUIRES(context, dropconnect_rate_ >= 0.0f && dropconnect_rate_ < 1.0f,
+        errors::InvalidArgument("dropconnect_rate must be in [0, 1). Found ",
+            dropconnect_rate_));
+    std::string activation_storage;
+    OP_REQUIRES_OK(context, context->GetAttr("activation_storage", &activation_storage));
+    compact_ = ParseActivationStorage(activation_storage, &storage_);
+    OP_REQUIRES_OK(context, context->GetAttr("time_major", &time_major_));
   }
 
   // When running on GPU, TF backs all inputs and outputs with device memory
@@ -126,20 +136,41 @@ struct HasteGruOp : public OpKernel {
     const Tensor& bias = context->input(3);
     const Tensor& recurrent_bias = context->input(4);
     const Tensor& zoneout_mask = context->input(5);
+    const Tensor& sequence_length = context->input(6);
 
-    const auto time_steps = input.shape().dim_size(0);
-    const auto batch_size = input.shape().dim_size(1);
+    RandomSeed zoneout_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(7), "zoneout_seed", &zoneout_seed));
+
+    RandomSeed dropconnect_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(8), "dropconnect_seed", &dropconnect_seed));
+
+    const Tensor& h0 = context->input(9);
+
+    const auto time_steps = input.shape().dim_size(time_major_ ? 0 : 1);
+    const auto batch_size = input.shape().dim_size(time_major_ ? 1 : 0);
     const auto input_size = input.shape().dim_size(2);
     const auto hidden_size = recurrent_kernel.shape().dim_size(0);
-    const bool has_zoneout = zoneout_prob_ && zoneout_mask.NumElements();
+    const bool has_zoneout = zoneout_prob_ && (zoneout_mask.NumElements() || zoneout_seed.enabled);
+    const bool has_zoneout_mask = has_zoneout && zoneout_mask.NumElements();
+    const bool compact = training_ && compact_;
+    const bool has_dropconnect = dropconnect_rate_ > 0.0f && dropconnect_seed.enabled;
     const auto data_type = DataTypeToEnum<T>::value;
 
     OP_REQUIRES(context, input_size == kernel.shape().dim_size(0),
         errors::InvalidArgument("input[2] and kernel[0] dimensions must match. Found ",
             input_size, " and ", kernel.shape().dim_size(0)));
+    // `RunCompact` only reads time-major sequences.
+    OP_REQUIRES(context, time_major_ || !compact,
+        errors::InvalidArgument("time_major must be true in training with a compact "
+            "activation_storage."));
 
-    const TensorShape output_shape = { time_steps, batch_size, hidden_size };
-    const TensorShape v_out_shape = { time_steps, batch_size, training_ ? hidden_size * 4 : 0 };
+    const TensorShape output_shape = time_major_
+        ? TensorShape({ time_steps + 1, batch_size, hidden_size })
+        : TensorShape({ batch_size, time_steps + 1, hidden_size });
+    const TensorShape v_out_shape = compact
+        ? TensorShape({ CompactActivationsElements<T>(haste::v0::gru::CompactActivationsSize(
+              time_steps, batch_size, hidden_size, storage_)) })
+        : TensorShape({ time_steps, batch_size, training_ ? hidden_size * 4 : 0 });
 
     Tensor* output = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
@@ -147,71 +178,139 @@ struct HasteGruOp : public OpKernel {
     Tensor* v_out = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(1, v_out_shape, &v_out));
 
+    // `Run` carves its temp memory from a single workspace allocation instead.
     Tensor tmp_Wx;
-    const TensorShape tmp_Wx_shape = { time_steps, batch_size, hidden_size * 3};
-    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Wx_shape, &tmp_Wx));
-
     Tensor tmp_Rh;
-    const TensorShape tmp_Rh_shape = { batch_size, hidden_size * 3 };
-    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
+    if (compact) {
+      const TensorShape tmp_Wx_shape = { time_steps, batch_size, hidden_size * 3};
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Wx_shape, &tmp_Wx));
 
-    cudaMemset(output->flat<T>().data(), 0, output->AllocatedBytes());
+      const TensorShape tmp_Rh_shape = { batch_size, hidden_size * 3 };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
+    }
 
-    ForwardPass<T> forward = ForwardPass<T>(
-        training_,
-        batch_size,
-        input_size,
-        hidden_size,
-        GetCublasHandle());
-
-    Tensor h = output->SubSlice(0);
-    for (int64 i = 0; i < time_steps; ++i) {
-      Tensor x = input.SubSlice(i);
-      Tensor new_h = output->SubSlice(i);
-      Tensor v = v_out->SubSlice(i);
-      Tensor tmp_Wx_cur = tmp_Wx.SubSlice(i);
-
-      forward.Iterate(
-          kernel.flat<T>().data(),
-          recurrent_kernel.flat<T>().data(),
-          bias.flat<T>().data(),
-          recurrent_bias.flat<T>().data(),
-          x.unaligned_flat<T>().data(),
-          h.unaligned_flat<T>().data(),
-          new_h.unaligned_flat<T>().data(),
-          training_ ? v.unaligned_flat<T>().data() : nullptr,
-          tmp_Wx_cur.unaligned_flat<T>().data(),
-          tmp_Rh.flat<T>().data(),
+    // Receives the masked recurrent kernel for the duration of the call.
+    Tensor tmp_R;
+    if (has_dropconnect) {
+      const TensorShape tmp_R_shape = recurrent_kernel.shape();
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_R_shape, &tmp_R));
+    }
+
+    // The passes write every state after the initial one. In a batch-major `h`, the
+    // initial states are (T+1)*H elements apart.
+    const cudaStream_t& stream = GetCudaStream(context);
+    OP_REQUIRES_OK(context, SetInitialState(
+        h0, "h0", batch_size, hidden_size, batch_size * hidden_size * sizeof(T), stream,
+        output->flat<T>().data(),
+        time_major_ ? 0 : (time_steps + 1) * hidden_size * sizeof(T)));
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    ForwardPass<T>& forward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new ForwardPass<T>(
+          training_,
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    // Reports the phases of earlier calls that have finished by now.
+    ExportPhaseStats(type_string(), forward.CollectPhaseStats());
+    if (zoneout_seed.enabled)
+      forward.SetZoneoutSeed(zoneout_prob_, zoneout_seed.seed, zoneout_seed.offset);
+    // A cached pass may have DropConnect enabled by an earlier call, so always set it.
+    forward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate_ : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? DevicePtr<T>(tmp_R) : nullptr);
+    // A cached pass may also have been used with the other layout.
+    forward.SetSequenceLayout(haste::v0::SequenceLayout{ !time_major_, false, 0 });
+
+    if (compact) {
+      forward.RunCompact(
+          time_steps,
+          storage_,
+          DevicePtr<T>(kernel),
+          DevicePtr<T>(recurrent_kernel),
+          DevicePtr<T>(bias),
+          DevicePtr<T>(recurrent_bias),
+          DevicePtr<T>(input),
+          DevicePtr<T>(*output),
+          DevicePtr<T>(*v_out),
+          DevicePtr<T>(tmp_Wx),
+          DevicePtr<T>(tmp_Rh),
           has_zoneout ? zoneout_prob_ : 0.0f,
-          has_zoneout ? zoneout_mask.SubSlice(i).unaligned_flat<T>().data() : nullptr);
-      h = new_h;
+          has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+          lengths.device,
+          lengths.batch_sizes_or_null());
+      return;
     }
+
+    Tensor workspace;
+    const TensorShape workspace_shape = { static_cast<int64>(forward.GetWorkspaceSize(time_steps)) };
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_UINT8, workspace_shape, &workspace));
+
+    forward.Run(
+        time_steps,
+        DevicePtr<T>(kernel),
+        DevicePtr<T>(recurrent_kernel),
+        DevicePtr<T>(bias),
+        DevicePtr<T>(recurrent_bias),
+        DevicePtr<T>(input),
+        DevicePtr<T>(*output),
+        training_ ? DevicePtr<T>(*v_out) : nullptr,
+        has_zoneout ? zoneout_prob_ : 0.0f,
+        has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.flat<uint8>().data());
   }
 
   private:
     bool training_;
     float zoneout_prob_;
+    float dropconnect_rate_;
+    bool compact_;
+    haste::v0::ActivationStorage storage_;
+    bool time_major_;
+    PassCache<ForwardPass<T>> cache_;
 };
 
-REGISTER_GPU_KERNEL(HasteGru, float);
-REGISTER_GPU_KERNEL(HasteGru, double);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGru, Eigen::half);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGru, bfloat16);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGru, float);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGru, double);
 
 REGISTER_OP("HasteGruGrad")
-    .Attr("R: {float, double}")
-    .Input("x_t: R")                   // [T,C,N]
-    .Input("kernel_t: R")              // [H*3,C]
-    .Input("recurrent_kernel_t: R")    // [H*3,H]
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("activation_storage: {'native', 'half', 'fixed8'} = 'native'")
+    .Attr("zoneout_prob: float = 0.0")  // Only used with `zoneout_seed`.
+    .Attr("dropconnect_rate: float = 0.0")  // Only used with `dropconnect_seed`.
+    .Attr("time_major: bool = true")  // Else `x`, `dx`, `h` and `dh_new` are batch-major.
+    .Input("x: R")                     // [T,N,C]
+    .Input("kernel: R")                // [C,H*3]
+    .Input("recurrent_kernel: R")      // [H,H*3]
     .Input("bias: R")                  // [H*3]
     .Input("recurrent_bias: R")        // [H*3]
-    .Input("h_t: R")                   // [T,H,N]
-    .Input("v: R")                     // [T,N,H*4]
-    .Input("dh_new: R")                // [T,N,H]
+    .Input("h: R")                     // [T+1,N,H]
+    .Input("v: R")                     // [T,N,H*4] or compact
+    .Input("dh_new: R")                // [T+1,N,H]
     .Input("zoneout_mask: R")          // [T,N,H]
+    .Input("sequence_length: int32")   // [N]
+    .Input("zoneout_seed: int64")      // [2] or [0]
+    .Input("dropconnect_seed: int64")  // [2] or [0]
     .Output("dx: R")                   // [T,N,C]
     .Output("dw: R")                   // [C,H*3]
     .Output("dr: R")                   // [H,H*3]
     .Output("dbx: R")                  // [H*3]
     .Output("dbr: R")                  // [H*3]
+    .Output("dh0: R")                  // [N,H]
     .SetShapeFn([](InferenceContext* c) {
       ShapeHandle x_shape;
       ShapeHandle kernel_shape;
@@ -222,33 +321,53 @@ REGISTER_OP("HasteGruGrad")
       ShapeHandle v_shape;
       ShapeHandle dh_new_shape;
       ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle zoneout_seed_shape;
+      ShapeHandle dropconnect_seed_shape;
+      std::string activation_storage;
+      bool time_major;
 
+      TF_RETURN_IF_ERROR(c->GetAttr("activation_storage", &activation_storage));
+      TF_RETURN_IF_ERROR(c->GetAttr("time_major", &time_major));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &x_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &recurrent_kernel_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &bias_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &recurrent_bias_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &h_shape));
-      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 3, &v_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), activation_storage == "native" ? 3 : 1, &v_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 3, &dh_new_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 3, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(10), 1, &zoneout_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(11), 1, &dropconnect_seed_shape));
 
-      DimensionHandle time_steps = c->Dim(x_shape, 0);
-      DimensionHandle input_size = c->Dim(x_shape, 1);
-      DimensionHandle batch_size = c->Dim(x_shape, 2);
-      DimensionHandle hidden_size = c->Dim(recurrent_kernel_shape, 1);
+      DimensionHandle batch_size = c->Dim(x_shape, time_major ? 1 : 0);
+      DimensionHandle input_size = c->Dim(x_shape, 2);
+      DimensionHandle hidden_size = c->Dim(recurrent_kernel_shape, 0);
 
-      c->set_output(0, c->MakeShape({ time_steps, batch_size, input_size }));
+      c->set_output(0, x_shape);
       c->set_output(1, c->MakeShape({ input_size, c->Value(hidden_size) * 3 }));
       c->set_output(2, c->MakeShape({ hidden_size, c->Value(hidden_size) * 3 }));
       c->set_output(3, bias_shape);
       c->set_output(4, recurrent_bias_shape);
+      c->set_output(5, c->MakeShape({ batch_size, hidden_size }));
       return Status::OK();
     });
 
 template<typename T>
 struct HasteGruGradOp : public OpKernel {
-  explicit HasteGruGradOp(OpKernelConstruction* context) : OpKernel(context) {}
+  explicit HasteGruGradOp(OpKernelConstruction* context) : OpKernel(context) {
+    std::string activation_storage;
+    OP_REQUIRES_OK(context, context->GetAttr("activation_storage", &activation_storage));
+    compact_ = ParseActivationStorage(activation_storage, &storage_);
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+    OP_REQUIRES_OK(context, context->GetAttr("dropconnect_rate", &dropconnect_rate_));
+    OP_REQUIRES_OK(context, context->GetAttr("time_major", &time_major_));
+    // `RunCompact` only reads time-major sequences.
+    OP_REQUIRES(context, time_major_ || !compact_,
+        errors::InvalidArgument("time_major must be true with a compact activation_storage."));
+  }
 
   void Compute(OpKernelContext* context) override {
     const Tensor& input = context->input(0);
@@ -260,11 +379,388 @@ struct HasteGruGradOp : public OpKernel {
     const Tensor& v_vector = context->input(6);
     const Tensor& dh_new = context->input(7);
     const Tensor& zoneout_mask = context->input(8);
+    const Tensor& sequence_length = context->input(9);
+
+    RandomSeed zoneout_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(10), "zoneout_seed", &zoneout_seed));
+
+    RandomSeed dropconnect_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(11), "dropconnect_seed", &dropconnect_seed));
+
+    const auto time_steps = input.shape().dim_size(time_major_ ? 0 : 1);
+    const auto batch_size = input.shape().dim_size(time_major_ ? 1 : 0);
+    const auto input_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+    const bool has_zoneout_mask = !!zoneout_mask.NumElements();
+    const bool has_dropconnect = dropconnect_rate_ > 0.0f && dropconnect_seed.enabled;
+    const auto data_type = DataTypeToEnum<T>::value;
+
+    // Can be uninitialized. Output only, no accumulation. Laid out like `x`.
+    Tensor* dx = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, input.shape(), &dx));
+
+    // Overwritten by the pass (see `SetAccumulateGradients`).
+    const TensorShape dW_shape = { input_size, hidden_size * 3 };
+    Tensor* dW = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, dW_shape, &dW));
+
+    // Overwritten by the pass.
+    const TensorShape dR_shape = { hidden_size, hidden_size * 3 };
+    Tensor* dR = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, dR_shape, &dR));
+
+    // Overwritten by the pass.
+    const TensorShape dbx_shape = { hidden_size * 3 };
+    Tensor* dbx = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(3, dbx_shape, &dbx));
+
+    // Overwritten by the pass.
+    const TensorShape dbr_shape = { hidden_size * 3 };
+    Tensor* dbr = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(4, dbr_shape, &dbr));
+
+    // Needs to be initialized to 0. Receives the gradient with respect to `h[0]` through
+    // the recurrence, not including `dh_new[0]`.
+    const TensorShape dh_shape = { batch_size, hidden_size };
+    Tensor* dh = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(5, dh_shape, &dh));
+
+    // Can be uninitialized. Output only, no accumulation. `Run` carves them from a single
+    // workspace allocation instead.
+    Tensor dp;
+    Tensor dq;
+    if (compact_) {
+      const TensorShape dp_shape = { time_steps, batch_size, hidden_size * 3 };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, dp_shape, &dp));
+
+      const TensorShape dq_shape = { time_steps, batch_size, hidden_size * 3 };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, dq_shape, &dq));
+    }
+
+    // Receives the masked recurrent kernel for the duration of the call.
+    Tensor tmp_R;
+    if (has_dropconnect) {
+      const TensorShape tmp_R_shape = { hidden_size, hidden_size * 3 };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_R_shape, &tmp_R));
+    }
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(dh->flat<T>().data(), 0, dh->AllocatedBytes(), stream);
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BackwardPass<T>& backward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new BackwardPass<T>(
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    // Reports the phases of earlier calls that have finished by now.
+    ExportPhaseStats(type_string(), backward.CollectPhaseStats());
+    // The weight gradient outputs start out uninitialized.
+    backward.SetAccumulateGradients(false);
+    // A cached pass may have been seeded by an earlier call, so always reset the seed.
+    backward.SetZoneoutSeed(
+        zoneout_seed.enabled ? zoneout_prob_ : 0.0f,
+        zoneout_seed.seed,
+        zoneout_seed.offset);
+    // DropConnect is also set on every call for the same reason.
+    backward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate_ : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? DevicePtr<T>(tmp_R) : nullptr);
+    // The layout is also set on every call, to match the forward op's.
+    backward.SetSequenceLayout(haste::v0::SequenceLayout{ !time_major_, false, 0 });
+
+    if (compact_) {
+      backward.RunCompact(
+          time_steps,
+          storage_,
+          PackedWeights<T>{
+              DevicePtr<T>(kernel),
+              DevicePtr<T>(recurrent_kernel),
+              DevicePtr<T>(bias),
+              DevicePtr<T>(recurrent_bias) },
+          DevicePtr<T>(input),
+          DevicePtr<T>(h_vector),
+          DevicePtr<T>(v_vector),
+          DevicePtr<T>(dh_new),
+          DevicePtr<T>(*dx),
+          DevicePtr<T>(*dW),
+          DevicePtr<T>(*dR),
+          DevicePtr<T>(*dbx),
+          DevicePtr<T>(*dbr),
+          DevicePtr<T>(*dh),
+          DevicePtr<T>(dp),
+          DevicePtr<T>(dq),
+          has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+          lengths.device,
+          lengths.batch_sizes_or_null());
+      return;
+    }
+
+    Tensor workspace;
+    const TensorShape workspace_shape = { static_cast<int64>(backward.GetWorkspaceSize(time_steps)) };
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_UINT8, workspace_shape, &workspace));
+
+    backward.Run(
+        time_steps,
+        PackedWeights<T>{
+            DevicePtr<T>(kernel),
+            DevicePtr<T>(recurrent_kernel),
+            DevicePtr<T>(bias),
+            DevicePtr<T>(recurrent_bias) },
+        DevicePtr<T>(input),
+        DevicePtr<T>(h_vector),
+        DevicePtr<T>(v_vector),
+        DevicePtr<T>(dh_new),
+        DevicePtr<T>(*dx),
+        DevicePtr<T>(*dW),
+        DevicePtr<T>(*dR),
+        DevicePtr<T>(*dbx),
+        DevicePtr<T>(*dbr),
+        DevicePtr<T>(*dh),
+        has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.flat<uint8>().data());
+  }
+
+  private:
+    bool compact_;
+    haste::v0::ActivationStorage storage_;
+    float zoneout_prob_;
+    float dropconnect_rate_;
+    bool time_major_;
+    PassCache<BackwardPass<T>> cache_;
+};
+
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGruGrad, Eigen::half);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGruGrad, bfloat16);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGruGrad, float);
+REGISTER_GPU_KERNEL_WITH_SEEDS(HasteGruGrad, double);
+
+REGISTER_OP("HasteGruBidirectional")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("training: bool")
+    .Attr("zoneout_prob: float")
+    .Input("x: R")                      // [T,N,C]
+    .Input("kernel: R")                 // [2,C,H*3]
+    .Input("recurrent_kernel: R")       // [2,H,H*3]
+    .Input("bias: R")                   // [2,H*3]
+    .Input("recurrent_bias: R")         // [2,H*3]
+    .Input("zoneout_mask: R")           // [2,T,N,H]
+    .Input("sequence_length: int32")    // [N]
+    .Output("h: R")                     // [2,T+1,N,H]
+    .Output("v: R")                     // [2,T,N,H*4]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle input_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle recurrent_bias_shape;
+      ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &input_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 3, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 3, &recurrent_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &recurrent_bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 4, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 1, &sequence_length_shape));
+
+      const DimensionHandle time_steps = c->Dim(input_shape, 0);
+      const DimensionHandle batch_size = c->Dim(input_shape, 1);
+      const DimensionHandle hidden_size = c->Dim(recurrent_shape, 1);
+      DimensionHandle time_steps_plus_1;
+      DimensionHandle hidden_size_4;
+
+      TF_RETURN_IF_ERROR(c->Add(time_steps, 1, &time_steps_plus_1));
+      TF_RETURN_IF_ERROR(c->Multiply(hidden_size, 4, &hidden_size_4));
+
+      c->set_output(0, c->MakeShape({ 2, time_steps_plus_1, batch_size, hidden_size }));
+      c->set_output(1, c->MakeShape({ 2, time_steps, batch_size, hidden_size_4 }));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteGruBidirectionalOp : public OpKernel {
+  explicit HasteGruBidirectionalOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("training", &training_));
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+  }
+
+  // Both directions share the input and write to their own slice of each output. The
+  // reverse direction's states are mirrored in time (see `BidirectionalForwardPass`).
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& bias = context->input(3);
+    const Tensor& recurrent_bias = context->input(4);
+    const Tensor& zoneout_mask = context->input(5);
+    const Tensor& sequence_length = context->input(6);
 
     const auto time_steps = input.shape().dim_size(0);
-    const auto input_size = input.shape().dim_size(1);
-    const auto batch_size = input.shape().dim_size(2);
+    const auto batch_size = input.shape().dim_size(1);
+    const auto input_size = input.shape().dim_size(2);
     const auto hidden_size = recurrent_kernel.shape().dim_size(1);
+    const bool has_zoneout = zoneout_prob_ && zoneout_mask.NumElements();
+    const auto data_type = DataTypeToEnum<T>::value;
+
+    OP_REQUIRES(context, input_size == kernel.shape().dim_size(1),
+        errors::InvalidArgument("input[2] and kernel[1] dimensions must match. Found ",
+            input_size, " and ", kernel.shape().dim_size(1)));
+
+    const TensorShape output_shape = { 2, time_steps + 1, batch_size, hidden_size };
+    const TensorShape v_out_shape = { 2, time_steps, batch_size, training_ ? hidden_size * 4 : 0 };
+
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+
+    Tensor* v_out = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, v_out_shape, &v_out));
+
+    Tensor tmp_Wx;
+    const TensorShape tmp_Wx_shape = { 2, time_steps, batch_size, hidden_size * 3 };
+    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Wx_shape, &tmp_Wx));
+
+    Tensor tmp_Rh;
+    const TensorShape tmp_Rh_shape = { 2, batch_size, hidden_size * 3 };
+    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(output->flat<T>().data(), 0, output->AllocatedBytes(), stream);
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    const auto mask = DirectionPtrs<T>(zoneout_mask);
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BidirectionalForwardPass<T>& forward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return new BidirectionalForwardPass<T>(
+          training_,
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream);
+    });
+
+    // `v` is only written in training mode.
+    forward.Run(
+        time_steps,
+        DirectionPtrs<T>(kernel).data(),
+        DirectionPtrs<T>(recurrent_kernel).data(),
+        DirectionPtrs<T>(bias).data(),
+        DirectionPtrs<T>(recurrent_bias).data(),
+        DevicePtr<T>(input),
+        DirectionPtrs<T>(*output).data(),
+        hidden_size,
+        DirectionPtrs<T>(*v_out).data(),
+        DirectionPtrs<T>(tmp_Wx).data(),
+        DirectionPtrs<T>(tmp_Rh).data(),
+        has_zoneout ? zoneout_prob_ : 0.0f,
+        has_zoneout ? mask.data() : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }
+
+  private:
+    bool training_;
+    float zoneout_prob_;
+    PassCache<BidirectionalForwardPass<T>> cache_;
+};
+
+REGISTER_GPU_KERNEL(HasteGruBidirectional, Eigen::half);
+REGISTER_GPU_KERNEL(HasteGruBidirectional, bfloat16);
+REGISTER_GPU_KERNEL(HasteGruBidirectional, float);
+REGISTER_GPU_KERNEL(HasteGruBidirectional, double);
+
+REGISTER_OP("HasteGruBidirectionalGrad")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Input("x_t: R")                   // [C,T,N]
+    .Input("kernel_t: R")              // [2,H*3,C]
+    .Input("recurrent_kernel_t: R")    // [2,H*3,H]
+    .Input("bias: R")                  // [2,H*3]
+    .Input("recurrent_bias: R")        // [2,H*3]
+    .Input("h: R")                     // [2,T+1,N,H]
+    .Input("v: R")                     // [2,T,N,H*4]
+    .Input("dh_new: R")                // [2,T+1,N,H]
+    .Input("zoneout_mask: R")          // [2,T,N,H]
+    .Input("sequence_length: int32")   // [N]
+    .Output("dx: R")                   // [T,N,C]
+    .Output("dw: R")                   // [2,C,H*3]
+    .Output("dr: R")                   // [2,H,H*3]
+    .Output("dbx: R")                  // [2,H*3]
+    .Output("dbr: R")                  // [2,H*3]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle x_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_kernel_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle recurrent_bias_shape;
+      ShapeHandle h_shape;
+      ShapeHandle v_shape;
+      ShapeHandle dh_new_shape;
+      ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &x_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 3, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 3, &recurrent_kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &recurrent_bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 4, &h_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 4, &v_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 4, &dh_new_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 4, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 1, &sequence_length_shape));
+
+      DimensionHandle input_size = c->Dim(x_shape, 0);
+      DimensionHandle time_steps = c->Dim(x_shape, 1);
+      DimensionHandle batch_size = c->Dim(x_shape, 2);
+      DimensionHandle hidden_size = c->Dim(recurrent_kernel_shape, 2);
+
+      c->set_output(0, c->MakeShape({ time_steps, batch_size, input_size }));
+      c->set_output(1, c->MakeShape({ 2, input_size, c->Value(hidden_size) * 3 }));
+      c->set_output(2, c->MakeShape({ 2, hidden_size, c->Value(hidden_size) * 3 }));
+      c->set_output(3, bias_shape);
+      c->set_output(4, recurrent_bias_shape);
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteGruBidirectionalGradOp : public OpKernel {
+  explicit HasteGruBidirectionalGradOp(OpKernelConstruction* context) : OpKernel(context) {}
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& bias = context->input(3);
+    const Tensor& recurrent_bias = context->input(4);
+    const Tensor& h_vector = context->input(5);
+    const Tensor& v_vector = context->input(6);
+    const Tensor& dh_new = context->input(7);
+    const Tensor& zoneout_mask = context->input(8);
+    const Tensor& sequence_length = context->input(9);
+
+    const auto input_size = input.shape().dim_size(0);
+    const auto time_steps = input.shape().dim_size(1);
+    const auto batch_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(2);
     const bool has_zoneout = !!zoneout_mask.NumElements();
     const auto data_type = DataTypeToEnum<T>::value;
 
@@ -274,93 +770,327 @@ struct HasteGruGradOp : public OpKernel {
     OP_REQUIRES_OK(context, context->allocate_output(0, dx_shape, &dx));
 
     // Needs to be initialized to 0.
-    const TensorShape dW_shape = { input_size, hidden_size * 3 };
+    const TensorShape dW_shape = { 2, input_size, hidden_size * 3 };
     Tensor* dW = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(1, dW_shape, &dW));
 
     // Needs to be initialized to 0.
-    const TensorShape dR_shape = { hidden_size, hidden_size * 3 };
+    const TensorShape dR_shape = { 2, hidden_size, hidden_size * 3 };
     Tensor* dR = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(2, dR_shape, &dR));
 
     // Needs to be initialized to 0.
-    const TensorShape dbx_shape = { hidden_size * 3 };
+    const TensorShape dbx_shape = { 2, hidden_size * 3 };
     Tensor* dbx = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(3, dbx_shape, &dbx));
 
     // Needs to be initialized to 0.
-    const TensorShape dbr_shape = { hidden_size * 3 };
+    const TensorShape dbr_shape = { 2, hidden_size * 3 };
     Tensor* dbr = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(4, dbr_shape, &dbr));
 
     // Needs to be initialized to 0.
-    const TensorShape dh_shape = { batch_size, hidden_size };
+    const TensorShape dh_shape = { 2, batch_size, hidden_size };
     Tensor dh;
     OP_REQUIRES_OK(context, context->allocate_temp(data_type, dh_shape, &dh));
 
     // Can be uninitialized. Output only, no accumulation.
-    const TensorShape dp_shape = { time_steps, batch_size, hidden_size * 3 };
+    const TensorShape dp_shape = { 2, time_steps, batch_size, hidden_size * 3 };
     Tensor dp;
     OP_REQUIRES_OK(context, context->allocate_temp(data_type, dp_shape, &dp));
 
     // Can be uninitialized. Output only, no accumulation.
-    const TensorShape dq_shape = { time_steps, batch_size, hidden_size * 3 };
+    const TensorShape dq_shape = { 2, time_steps, batch_size, hidden_size * 3 };
     Tensor dq;
     OP_REQUIRES_OK(context, context->allocate_temp(data_type, dq_shape, &dq));
 
-    // Needs to be initialized to 0.
-    const TensorShape zero_vector_shape = { batch_size, hidden_size };
-    Tensor zero_vector;
-    OP_REQUIRES_OK(context, context->allocate_temp(data_type, zero_vector_shape, &zero_vector));
-
-    cudaMemset(dW->flat<T>().data(), 0, dW->AllocatedBytes());
-    cudaMemset(dR->flat<T>().data(), 0, dR->AllocatedBytes());
-    cudaMemset(dbx->flat<T>().data(), 0, dbx->AllocatedBytes());
-    cudaMemset(dbr->flat<T>().data(), 0, dbr->AllocatedBytes());
-    cudaMemset(dh.flat<T>().data(), 0, dh.AllocatedBytes());
-    cudaMemset(zero_vector.flat<T>().data(), 0, zero_vector.AllocatedBytes());
-
-    BackwardPass<T> backward = BackwardPass<T>(
-        batch_size,
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(dW->flat<T>().data(), 0, dW->AllocatedBytes(), stream);
+    cudaMemsetAsync(dR->flat<T>().data(), 0, dR->AllocatedBytes(), stream);
+    cudaMemsetAsync(dbx->flat<T>().data(), 0, dbx->AllocatedBytes(), stream);
+    cudaMemsetAsync(dbr->flat<T>().data(), 0, dbr->AllocatedBytes(), stream);
+    cudaMemsetAsync(dh.flat<T>().data(), 0, dh.AllocatedBytes(), stream);
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    const auto mask = DirectionPtrs<T>(zoneout_mask);
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BidirectionalBackwardPass<T>& backward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return new BidirectionalBackwardPass<T>(
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream);
+    });
+
+    backward.Run(
+        time_steps,
+        DirectionPtrs<T>(kernel).data(),
+        DirectionPtrs<T>(recurrent_kernel).data(),
+        DirectionPtrs<T>(bias).data(),
+        DirectionPtrs<T>(recurrent_bias).data(),
+        DevicePtr<T>(input),
+        DirectionPtrs<T>(h_vector).data(),
+        hidden_size,
+        DirectionPtrs<T>(v_vector).data(),
+        DirectionPtrs<T>(dh_new).data(),
+        DevicePtr<T>(*dx),
+        DirectionPtrs<T>(*dW).data(),
+        DirectionPtrs<T>(*dR).data(),
+        DirectionPtrs<T>(*dbx).data(),
+        DirectionPtrs<T>(*dbr).data(),
+        DirectionPtrs<T>(dh).data(),
+        DirectionPtrs<T>(dp).data(),
+        DirectionPtrs<T>(dq).data(),
+        has_zoneout ? mask.data() : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }
+
+  private:
+    PassCache<BidirectionalBackwardPass<T>> cache_;
+};
+
+REGISTER_GPU_KERNEL(HasteGruBidirectionalGrad, Eigen::half);
+REGISTER_GPU_KERNEL(HasteGruBidirectionalGrad, bfloat16);
+REGISTER_GPU_KERNEL(HasteGruBidirectionalGrad, float);
+REGISTER_GPU_KERNEL(HasteGruBidirectionalGrad, double);
+
+// Quantizes trained GRU kernels to int8 for `HasteGruQuantized`, with the scale of the
+// inputs calibrated on `calibration_inputs`, e.g. a few representative batches.
+REGISTER_OP("HasteGruQuantize")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Input("kernel: R")                           // [C,H*3]
+    .Input("recurrent_kernel: R")                 // [H,H*3]
+    .Input("calibration_inputs: R")               // [...,C]
+    .Output("quantized_kernel: int8")             // [C,H*3]
+    .Output("quantized_recurrent_kernel: int8")   // [H,H*3]
+    .Output("kernel_scale: float")                // [H*3]
+    .Output("recurrent_kernel_scale: float")      // [H*3]
+    .Output("input_scale: float")                 // [1]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &recurrent_shape));
+
+      c->set_output(0, kernel_shape);
+      c->set_output(1, recurrent_shape);
+      c->set_output(2, c->Vector(c->Dim(recurrent_shape, 1)));
+      c->set_output(3, c->Vector(c->Dim(recurrent_shape, 1)));
+      c->set_output(4, c->Vector(1));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteGruQuantizeOp : public OpKernel {
+  explicit HasteGruQuantizeOp(OpKernelConstruction* context) : OpKernel(context) {}
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& kernel = context->input(0);
+    const Tensor& recurrent_kernel = context->input(1);
+    const Tensor& calibration_inputs = context->input(2);
+
+    const auto input_size = kernel.shape().dim_size(0);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+
+    OP_REQUIRES(context, recurrent_kernel.shape().dim_size(1) == hidden_size * 3,
+        errors::InvalidArgument("recurrent_kernel must have shape [H,H*3]. Found ",
+            recurrent_kernel.shape().DebugString()));
+    OP_REQUIRES(context, kernel.shape().dim_size(1) == hidden_size * 3,
+        errors::InvalidArgument("kernel[1] and recurrent_kernel[1] dimensions must match. Found ",
+            kernel.shape().dim_size(1), " and ", hidden_size * 3));
+
+    Tensor* quantized_kernel = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, kernel.shape(), &quantized_kernel));
+
+    Tensor* quantized_recurrent_kernel = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, recurrent_kernel.shape(), &quantized_recurrent_kernel));
+
+    Tensor* kernel_scale = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, { hidden_size * 3 }, &kernel_scale));
+
+    Tensor* recurrent_kernel_scale = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(3, { hidden_size * 3 }, &recurrent_kernel_scale));
+
+    Tensor* input_scale = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(4, { 1 }, &input_scale));
+
+    Tensor input_absmax;
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_FLOAT, { 1 }, &input_absmax));
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    float* absmax = input_absmax.flat<float>().data();
+    cudaMemsetAsync(absmax, 0, sizeof(float), stream);
+    QuantizedWeights<T>::Calibrate(
+        calibration_inputs.NumElements(),
+        DevicePtr<T>(calibration_inputs),
+        absmax,
+        stream);
+    QuantizedWeights<T>::Quantize(
         input_size,
         hidden_size,
-        GetCublasHandle());
-
-    for (int64 i = time_steps - 1; i >= 0; --i) {
-      Tensor x = input.SubSlice(i);
-
-      // These are slices of cell outputs so we use (i - 1) to get the
-      // cell inputs (i.e., h_t is the output of the t'th LSTM cell
-      // which is also the input to the t+1'th cell).
-      Tensor h = i != 0 ? h_vector.SubSlice(i - 1) : zero_vector;
-      Tensor v = v_vector.SubSlice(i);
-
-      Tensor dh_new_cur = dh_new.SubSlice(i);
-      Tensor dx_cur = dx->SubSlice(i);
-      Tensor dp_cur = dp.SubSlice(i);
-      Tensor dq_cur = dq.SubSlice(i);
-
-      backward.Iterate(
-          kernel.flat<T>().data(),
-          recurrent_kernel.flat<T>().data(),
-          bias.flat<T>().data(),
-          recurrent_bias.flat<T>().data(),
-          x.unaligned_flat<T>().data(),
-          h.unaligned_flat<T>().data(),
-          v.unaligned_flat<T>().data(),
-          dh_new_cur.unaligned_flat<T>().data(),
-          dx_cur.unaligned_flat<T>().data(),
-          dW->flat<T>().data(),
-          dR->flat<T>().data(),
-          dbx->flat<T>().data(),
-          dbr->flat<T>().data(),
-          dh.flat<T>().data(),
-          dp_cur.unaligned_flat<T>().data(),
-          dq_cur.unaligned_flat<T>().data(),
-          has_zoneout ? zoneout_mask.SubSlice(i).unaligned_flat<T>().data() : nullptr);
-    }
+        DevicePtr<T>(kernel),
+        DevicePtr<T>(recurrent_kernel),
+        nullptr,
+        nullptr,
+        absmax,
+        quantized_kernel->flat<int8>().data(),
+        quantized_recurrent_kernel->flat<int8>().data(),
+        kernel_scale->flat<float>().data(),
+        recurrent_kernel_scale->flat<float>().data(),
+        input_scale->flat<float>().data(),
+        stream);
   }
 };
 
-REGISTER_GPU_KERNEL(HasteGruGrad, float);
-REGISTER_GPU_KERNEL(HasteGruGrad, double);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteGruQuantize, Eigen::half);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteGruQuantize, bfloat16);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteGruQuantize, float);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteGruQuantize, double);
+
+// Inference with the int8 kernels of `HasteGruQuantize` (see `ForwardPass::RunQuantized`).
+REGISTER_OP("HasteGruQuantized")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("zoneout_prob: float")
+    .Input("x: R")                              // [T,N,C]
+    .Input("kernel: int8")                      // [C,H*3]
+    .Input("recurrent_kernel: int8")            // [H,H*3]
+    .Input("kernel_scale: float")               // [H*3]
+    .Input("recurrent_kernel_scale: float")     // [H*3]
+    .Input("input_scale: float")                // [1]
+    .Input("bias: R")                           // [H*3]
+    .Input("recurrent_bias: R")                 // [H*3]
+    .Input("sequence_length: int32")            // [N]
+    .Input("h0: R")                             // [N,H] or [0,0]
+    .Output("h: R")                             // [T+1,N,H]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle input_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_shape;
+      ShapeHandle kernel_scale_shape;
+      ShapeHandle recurrent_scale_shape;
+      ShapeHandle input_scale_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle recurrent_bias_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle h0_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &input_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &recurrent_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &kernel_scale_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &recurrent_scale_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &input_scale_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 1, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 1, &recurrent_bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 2, &h0_shape));
+
+      const DimensionHandle time_steps = c->Dim(input_shape, 0);
+      const DimensionHandle batch_size = c->Dim(input_shape, 1);
+      const DimensionHandle hidden_size = c->Dim(recurrent_shape, 0);
+      DimensionHandle time_steps_plus_1;
+
+      TF_RETURN_IF_ERROR(c->Add(time_steps, 1, &time_steps_plus_1));
+
+      c->set_output(0, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteGruQuantizedOp : public OpKernel {
+  explicit HasteGruQuantizedOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& kernel_scale = context->input(3);
+    const Tensor& recurrent_kernel_scale = context->input(4);
+    const Tensor& input_scale = context->input(5);
+    const Tensor& bias = context->input(6);
+    const Tensor& recurrent_bias = context->input(7);
+    const Tensor& sequence_length = context->input(8);
+    const Tensor& h0 = context->input(9);
+
+    const auto time_steps = input.shape().dim_size(0);
+    const auto batch_size = input.shape().dim_size(1);
+    const auto input_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+
+    OP_REQUIRES(context, input_size == kernel.shape().dim_size(0),
+        errors::InvalidArgument("input[2] and kernel[0] dimensions must match. Found ",
+            input_size, " and ", kernel.shape().dim_size(0)));
+    OP_REQUIRES(context, input_size % 4 == 0 && hidden_size % 4 == 0,
+        errors::InvalidArgument("The int8 GEMMs need the input and hidden sizes to be "
+            "multiples of 4. Found ", input_size, " and ", hidden_size));
+
+    const TensorShape output_shape = { time_steps + 1, batch_size, hidden_size };
+
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    const size_t state_bytes = batch_size * hidden_size * sizeof(T);
+    OP_REQUIRES_OK(context, SetInitialState(
+        h0, "h0", batch_size, hidden_size, state_bytes, stream, output->flat<T>().data()));
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    ForwardPass<T>& forward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new ForwardPass<T>(
+          false,
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    ExportPhaseStats(type_string(), forward.CollectPhaseStats());
+
+    Tensor workspace;
+    const TensorShape workspace_shape = { static_cast<int64>(forward.GetQuantizedWorkspaceSize(time_steps)) };
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_UINT8, workspace_shape, &workspace));
+
+    const QuantizedWeights<T> weights = {
+      kernel.flat<int8>().data(),
+      recurrent_kernel.flat<int8>().data(),
+      kernel_scale.flat<float>().data(),
+      recurrent_kernel_scale.flat<float>().data(),
+      input_scale.flat<float>().data(),
+      DevicePtr<T>(bias),
+      DevicePtr<T>(recurrent_bias),
+    };
+    forward.RunQuantized(
+        time_steps,
+        weights,
+        DevicePtr<T>(input),
+        DevicePtr<T>(*output),
+        zoneout_prob_,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.flat<uint8>().data());
+  }
+
+  private:
+    float zoneout_prob_;
+    PassCache<ForwardPass<T>> cache_;
+};
+
+REGISTER_GPU_KERNEL(HasteGruQuantized, Eigen::half);
+REGISTER_GPU_KERNEL(HasteGruQuantized, bfloat16);
+REGISTER_GPU_KERNEL(HasteGruQuantized, float);
+REGISTER_GPU_KERNEL(HasteGruQuantized, double);
@@ -30,15 +30,34 @@ __all__ = [
 LIB = tf.load_op_library(pkg_resources.resource_filename(__name__, 'libhaste_tf.so'))
 
 
-def reverse_sequence(sequence, sequence_length):
+def sequence_lengths(sequence_length):
   """
-  Reverses a batched sequence in time-major order [T,N,...]. The input sequence
-  may be padded, in which case sequence_length specifies the unpadded length of
-  each sequence.
+  Converts an optional `sequence_length` tensor to the form the ops expect. An
+  empty tensor means that every sequence spans all time steps.
   """
   if sequence_length is None:
-    return tf.reverse(sequence, axis=[0])
-  return tf.reverse_sequence(sequence, sequence_length, seq_axis=0, batch_axis=1)
+    return tf.zeros([0], dtype=tf.int32)
+  return tf.cast(sequence_length, tf.int32)
+
+
+def state_or_zeros(state, dtype):
+  """
+  Converts an optional [N,H] initial state tensor to the form the ops expect. An
+  empty [0,0] tensor means that the state starts out as zeros.
+  """
+  if state is None:
+    return tf.zeros([0, 0], dtype=dtype)
+  return state
+
+
+def initial_state_gradient(recurrent_grad, output_grad, state):
+  """
+  Returns the gradient with respect to an op's initial `state` input: the part
+  that reached it through the recurrence plus the gradient of the op's t=0
+  output, which is the state itself. Empty if `state` is.
+  """
+  grad = recurrent_grad + output_grad
+  return grad[:tf.shape(state)[0], :tf.shape(state)[1]]
 
 
 def transpose(tensor_or_tuple, perm):
@@ -62,18 +81,55 @@ def gru_gradient(op, *grads):
   bx = op.inputs[3]
   br = op.inputs[4]
   zoneout_mask = op.inputs[5]
+  sequence_length = op.inputs[6]
+  zoneout_seed = op.inputs[7]
+  dropconnect_seed = op.inputs[8]
+  h0 = op.inputs[9]
+  h = op.outputs[0]
+  v = op.outputs[1]
+
+  # The grad op reads `x`, `W` and `R` as given to the forward op; its GEMMs transpose
+  # them on the fly.
+  dx, dW, dR, dbx, dbr, dh0 = LIB.haste_gru_grad(
+      x, W, R, bx, br, h, v, grads[0], zoneout_mask, sequence_length, zoneout_seed,
+      dropconnect_seed,
+      activation_storage=op.get_attr('activation_storage'),
+      zoneout_prob=op.get_attr('zoneout_prob'),
+      dropconnect_rate=op.get_attr('dropconnect_rate'),
+      time_major=op.get_attr('time_major'))
+
+  dh_new0 = grads[0][0] if op.get_attr('time_major') else grads[0][:, 0]
+  dh0 = initial_state_gradient(dh0, dh_new0, h0)
+  return [dx, dW, dR, dbx, dbr, None, None, None, None, dh0]
+
+
+@tf.RegisterGradient("HasteGruBidirectional")
+def gru_bidirectional_gradient(op, *grads):
+  training = op.get_attr('training')
+  if not training:
+    raise ValueError(('GRU can only compute gradients if `training=True` was specified during the '
+                      'forward pass.\nFailed op: {}').format(op.name))
+
+  # Extract inputs and outputs from the op.
+  x = op.inputs[0]
+  W = op.inputs[1]
+  R = op.inputs[2]
+  bx = op.inputs[3]
+  br = op.inputs[4]
+  zoneout_mask = op.inputs[5]
+  sequence_length = op.inputs[6]
   h = op.outputs[0]
   v = op.outputs[1]
 
   # Pre-transpose matrices for better performance.
-  x = tf.transpose(x, [0, 2, 1])
-  W = tf.transpose(W, [1, 0])
-  R = tf.transpose(R, [1, 0])
-  h = tf.transpose(h, [0, 2, 1])
+  x = tf.transpose(x, [2, 0, 1])
+  W = tf.transpose(W, [0, 2, 1])
+  R = tf.transpose(R, [0, 2, 1])
 
-  dx, dW, dR, dbx, dbr = LIB.haste_gru_grad(x, W, R, bx, br, h, v, grads[0], zoneout_mask)
+  dx, dW, dR, dbx, dbr = LIB.haste_gru_bidirectional_grad(
+      x, W, R, bx, br, h, v, grads[0], zoneout_mask, sequence_length)
 
-  return [dx, dW, dR, dbx, dbr, None]
+  return [dx, dW, dR, dbx, dbr, None, None]
 
 
 class GRULayer(tf.Module):
@@ -84,6 +140,7 @@ class GRULayer(tf.Module):
         bias_initializer=None,
         dropout=0.0,
         zoneout=0.0,
+        activation_storage='native',
         dtype=None,
         name=None):
     super(GRULayer, self).__init__(name)
@@ -96,11 +153,13 @@ class GRULayer(tf.Module):
 
     self.dropout = dropout
     self.zoneout = zoneout
+    self.activation_storage = activation_storage
     self.dtype = dtype or tf.float32
     self.kernel = None
     self.recurrent_kernel = None
     self.bias = None
     self.recurrent_bias = None
+    self.quantized = None
     self.built = False
 
   def build(self, shape):
@@ -137,42 +196,94 @@ class GRULayer(tf.Module):
 
     self.built = True
 
-  def __call__(self, inputs, sequence_length, training):
-    self.build(inputs.shape)
-
-    shape = tf.shape(inputs)
-    time_steps = shape[0]
-    batch_size = shape[1]
-
+  def zoneout_mask(self, time_steps, batch_size):
     # Use an empty zoneout mask if no zoneout is going to be applied.
     # Sadly, we can't pass `None` to the op but at least we won't be wasting
     # memory or bandwidth on this tensor.
-    zoneout_mask = tf.zeros([0, 0, 0], dtype=self.dtype)
-    if self.zoneout:
-      zoneout_mask = 1.0 - self.zoneout
-      zoneout_mask += tf.random_uniform([time_steps, batch_size, self.num_units], dtype=self.dtype)
-      zoneout_mask = tf.floor(zoneout_mask)
-
-    recurrent_kernel = tf.nn.dropout(self.recurrent_kernel, rate=self.dropout)
-    result, _ = LIB.haste_gru(
-        inputs,
-        self.kernel,
-        recurrent_kernel,
-        self.bias,
-        self.recurrent_bias,
-        zoneout_mask,
-        training=training,
-        zoneout_prob=self.zoneout)
+    if not self.zoneout:
+      return tf.zeros([0, 0, 0], dtype=self.dtype)
+    zoneout_mask = 1.0 - self.zoneout
+    zoneout_mask += tf.random_uniform([time_steps, batch_size, self.num_units], dtype=self.dtype)
+    return tf.floor(zoneout_mask)
+
+  def zoneout_seed(self):
+    # The unidirectional op generates the zoneout mask on the GPU from a seed and
+    # offset instead, so no [T,N,H] mask is built or kept around for the gradient.
+    if not self.zoneout:
+      return tf.zeros([0], dtype=tf.int64)
+    return tf.random_uniform([2], minval=tf.int64.min, maxval=tf.int64.max, dtype=tf.int64)
+
+  def dropconnect_seed(self):
+    # The unidirectional op masks the recurrent kernel on the GPU from a seed and offset,
+    # so the masked kernel is never materialized as a TF tensor.
+    if not self.dropout:
+      return tf.zeros([0], dtype=tf.int64)
+    return tf.random_uniform([2], minval=tf.int64.min, maxval=tf.int64.max, dtype=tf.int64)
+
+  def dropped_recurrent_kernel(self):
+    return tf.nn.dropout(self.recurrent_kernel, rate=self.dropout)
+
+  def quantize(self, calibration_inputs):
+    self.build(calibration_inputs.shape)
+    self.quantized = LIB.haste_gru_quantize(
+        self.kernel, self.recurrent_kernel, calibration_inputs)
+
+  def reads_batch_major(self, training):
+    """
+    Whether the op that runs the layer in `training` mode reads and writes
+    batch-major sequences in place. Quantized inference and compact activation
+    storage only address time-major ones.
+    """
+    if self.quantized is not None and not training:
+      return False
+    return not training or self.activation_storage == 'native'
+
+  def __call__(self, inputs, sequence_length, training, state=None, time_major=True):
+    self.build(inputs.shape)
+
+    if not time_major and not self.reads_batch_major(training):
+      h, state = self(transpose(inputs, [1, 0, 2]), sequence_length, training, state)
+      return transpose(h, [1, 0, 2]), state
+
+    shape = tf.shape(inputs)
+    time_steps = shape[0] if time_major else shape[1]
+    batch_size = shape[1] if time_major else shape[0]
+
+    if self.quantized is not None and not training:
+      h = LIB.haste_gru_quantized(
+          inputs,
+          *self.quantized,
+          self.bias,
+          self.recurrent_bias,
+          sequence_lengths(sequence_length),
+          state_or_zeros(state, self.dtype),
+          zoneout_prob=self.zoneout)
+    else:
+      h, _ = LIB.haste_gru(
+          inputs,
+          self.kernel,
+          self.recurrent_kernel,
+          self.bias,
+          self.recurrent_bias,
+          tf.zeros([0, 0, 0], dtype=self.dtype),
+          sequence_lengths(sequence_length),
+          self.zoneout_seed(),
+          self.dropconnect_seed(),
+          state_or_zeros(state, self.dtype),
+          training=training,
+          zoneout_prob=self.zoneout,
+          dropconnect_rate=self.dropout,
+          activation_storage=self.activation_storage,
+          time_major=time_major)
 
     if sequence_length is not None:
-      # 0-indexed tensors, so length-1.
-      indices = sequence_length - 1
-      indices = tf.stack([indices, tf.range(batch_size, dtype=sequence_length.dtype)], axis=-1)
-      state = tf.gather_nd(result, indices)
+      indices = [sequence_length, tf.range(batch_size, dtype=sequence_length.dtype)]
+      indices = tf.stack(indices if time_major else indices[::-1], axis=-1)
+      state = tf.gather_nd(h, indices)
     else:
-      state = result[-1]
+      state = h[-1] if time_major else h[:, -1]
 
-    return result, state
+    return (h[1:] if time_major else h[:, 1:]), state
 
 
 class GRU(tf.Module):
@@ -211,6 +322,12 @@ class GRU(tf.Module):
         regularization on the recurrent matrix. Defaults to 0.
       zoneout: (optional) float, sets the zoneout rate for Zoneout
         regularization. Defaults to 0.
+      activation_storage: (optional) string, 'native', 'half', or 'fixed8'.
+        The format of the activations that training keeps for the backward
+        pass. 'half' stores them in FP16 and 'fixed8' stores the gates as
+        8-bit fixed point, which saves memory and bandwidth at the cost of
+        slightly less precise gradients. Unidirectional layers only. Defaults
+        to 'native'.
       dtype: (optional) the data type for this layer. Defaults to `tf.float32`.
       name: (optional) string, the name for this layer.
     """
@@ -256,7 +373,28 @@ class GRU(tf.Module):
       return self.fwd_gru.state_size, self.bwd_gru.state_size
     return self.fwd_gru.state_size
 
-  def __call__(self, inputs, training, sequence_length=None, time_major=False):
+  def quantize(self, calibration_inputs):
+    """
+    Switches inference to int8 weights.
+
+    Quantizes the kernels to int8 with a scale per gate column and calibrates
+    the scale of the inputs on `calibration_inputs`. Later calls with
+    `training=False` run on the quantized kernels, which take a quarter of the
+    memory of FP32 kernels, while training keeps using the full-precision
+    variables. Call it again after the variables change. The input and hidden
+    sizes must be multiples of 4, and the GPU must be of compute capability
+    6.1 or later. Unidirectional layers only.
+
+    Arguments:
+      calibration_inputs: Tensor, representative inputs of any shape whose
+        last dimension is the input size, e.g. a few batches of real data.
+        Inputs larger in magnitude than any of them are clamped.
+    """
+    if self.bwd_gru is not None:
+      raise ValueError('quantize is only supported by unidirectional layers.')
+    self.fwd_gru.quantize(calibration_inputs)
+
+  def __call__(self, inputs, training, sequence_length=None, time_major=False, initial_state=None):
     """
     Runs the GRU layer.
 
@@ -270,26 +408,67 @@ class GRU(tf.Module):
         length of each example in the input minibatch.
       time_major: (optional) bool, specifies whether `input` has shape [N,T,C]
         (`time_major=False`) or shape [T,N,C] (`time_major=True`).
+      initial_state: (optional) Tensor, a rank 2 tensor with shape [N,H], the
+        hidden state before the first time step. Defaults to zeros.
+        Unidirectional layers only.
 
     Returns:
       A pair, `(output, state)` for unidirectional layers, or a pair
       `([output_fwd, output_bwd], [state_fwd, state_bwd])` for bidirectional
       layers.
     """
+    if initial_state is not None and self.bwd_gru is not None:
+      raise ValueError('initial_state is only supported by unidirectional layers.')
+
     self.build(inputs.shape)
 
+    # The unidirectional op reads a batch-major input in place and writes its output
+    # in the same order.
+    if self.bwd_gru is not None:
+      return self._bidirectional(inputs, sequence_length, training, time_major)
+    return self.fwd_gru(inputs, sequence_length, training, initial_state, time_major)
+
+  def _bidirectional(self, inputs, sequence_length, training, time_major):
+    # The bidirectional op only addresses time-major sequences.
     if not time_major:
-      inputs = transpose(inputs, [1, 0, 2])
+      result, state = self._bidirectional(
+          transpose(inputs, [1, 0, 2]), sequence_length, training, True)
+      return transpose(result, [1, 0, 2]), state
 
-    result, state = self.fwd_gru(inputs, sequence_length, training)
+    # Both directions run in a single op on the same input. The reverse direction
+    # reads the input back to front in place (respecting `sequence_length`), so
+    # neither the input nor its output has to be reversed here.
+    fwd, bwd = self.fwd_gru, self.bwd_gru
 
-    if self.bwd_gru is not None:
-      inputs = reverse_sequence(inputs, sequence_length)
-      bwd_result, bwd_state = self.bwd_gru(inputs, sequence_length, training)
-      result = result, reverse_sequence(bwd_result, sequence_length)
-      state = state, bwd_state
+    shape = tf.shape(inputs)
+    time_steps = shape[0]
+    batch_size = shape[1]
 
-    if not time_major:
-      result = transpose(result, [1, 0, 2])
+    zoneout_mask = tf.zeros([0, 0, 0, 0], dtype=fwd.dtype)
+    if fwd.zoneout:
+      zoneout_mask = tf.stack([
+          fwd.zoneout_mask(time_steps, batch_size),
+          bwd.zoneout_mask(time_steps, batch_size)])
+
+    h, _ = LIB.haste_gru_bidirectional(
+        inputs,
+        tf.stack([fwd.kernel, bwd.kernel]),
+        tf.stack([fwd.dropped_recurrent_kernel(), bwd.dropped_recurrent_kernel()]),
+        tf.stack([fwd.bias, bwd.bias]),
+        tf.stack([fwd.recurrent_bias, bwd.recurrent_bias]),
+        zoneout_mask,
+        sequence_lengths(sequence_length),
+        training=training,
+        zoneout_prob=fwd.zoneout)
+
+    # The reverse direction's states are stored back to front: its output for step t
+    # is at index t and its final state is at index 0.
+    fwd_h, bwd_h = h[0], h[1]
+    if sequence_length is not None:
+      indices = sequence_length
+      indices = tf.stack([indices, tf.range(batch_size, dtype=sequence_length.dtype)], axis=-1)
+      fwd_state = tf.gather_nd(fwd_h, indices)
+    else:
+      fwd_state = fwd_h[-1]
 
-    return result, state
+    return (fwd_h[1:], bwd_h[:-1]), (fwd_state, bwd_h[0])
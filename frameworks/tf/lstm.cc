@@ -13,90 +13,122 @@
 // limitations under the License.
 // ==============================================================================
 
+#include <algorithm>
 #include <cuda_runtime_api.h>
-#include <vector>
+#include <mutex>
+#include <string>
 
 #include "haste.h"
+#include "support.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/shape_inference.h"
-#include "tensorflow/core/util/stream_executor_util.h"
-#include "tensorflow/stream_executor/stream.h"
 
 using namespace tensorflow;
 
-using haste::v0::lstm::ForwardPass;
-using haste::v0::lstm::BackwardPass;
-using tensorflow::se::Stream;
 using tensorflow::shape_inference::DimensionHandle;
 using tensorflow::shape_inference::InferenceContext;
 using tensorflow::shape_inference::ShapeHandle;
 
-#define REGISTER_GPU_KERNEL(NAME, T)                 \
-  REGISTER_KERNEL_BUILDER(Name(#NAME)                \
-                            .Device(DEVICE_GPU)      \
-                            .TypeConstraint<T>("R"), \
-                          NAME##Op<T>)
-
-// LOL.
-struct CublasHandleContainer {
-  CublasHandleContainer() {
-    int count;
-    int current_device;
-    cudaGetDevice(&current_device);
-    cudaGetDeviceCount(&count);
-    for (int i = 0; i < count; ++i) {
-      cublasHandle_t handle;
-      cudaSetDevice(i);
-      cublasCreate(&handle);
-      handles.push_back(handle);
-    }
-    cudaSetDevice(current_device);
-  }
-
-  ~CublasHandleContainer() {
-    for (auto h : handles)
-      cublasDestroy(h);
-  }
+// Haste passes for the Haste type that corresponds to TF's element type `T`.
+template<typename T>
+using ForwardPass = haste::v0::lstm::ForwardPass<typename HasteType<T>::type>;
+template<typename T>
+using BackwardPass = haste::v0::lstm::BackwardPass<typename HasteType<T>::type>;
+template<typename T>
+using PackedWeights = haste::v0::lstm::PackedWeights<typename HasteType<T>::type>;
+template<typename T>
+using QuantizedWeights = haste::v0::lstm::QuantizedWeights<typename HasteType<T>::type>;
+template<typename T>
+using BidirectionalForwardPass = haste::v0::lstm::BidirectionalForwardPass<typename HasteType<T>::type>;
+template<typename T>
+using BidirectionalBackwardPass = haste::v0::lstm::BidirectionalBackwardPass<typename HasteType<T>::type>;
 
-  std::vector<cublasHandle_t> handles;
-};
+// TF's element type of the cell state tensors.
+template<typename T>
+using CellState = typename CellStateType<T>::type;
 
-static cublasHandle_t GetCublasHandle() {
-  static CublasHandleContainer all_handles;
-  int device;
-  cudaGetDevice(&device);
-  return all_handles.handles[device];
+// Checks that the weights of the cell variants are either empty or [3,H] (`peephole`)
+// and [2,H*4] (`layer_norm`).
+static Status CheckCellVariants(
+    const Tensor& peephole,
+    const Tensor& layer_norm,
+    const int64 hidden_size) {
+  if (peephole.NumElements() && peephole.shape() != TensorShape({ 3, hidden_size })) {
+    return errors::InvalidArgument("peephole must be empty or have shape [3,", hidden_size,
+        "]. Found ", peephole.shape().DebugString());
+  }
+  if (layer_norm.NumElements() && layer_norm.shape() != TensorShape({ 2, hidden_size * 4 })) {
+    return errors::InvalidArgument("layer_norm must be empty or have shape [2,",
+        hidden_size * 4, "]. Found ", layer_norm.shape().DebugString());
+  }
+  return Status::OK();
 }
 
 // Define the interface and shape function for the op.
 REGISTER_OP("HasteLstm")
-    .Attr("R: {float, double}")         // Some real number type.
+    .Attr("R: {half, bfloat16, float, double}")  // Some real number type.
+    .Attr("S: {float, double}")  // The cell state type: float for 16-bit R.
     .Attr("training: bool")
     .Attr("zoneout_prob: float")
+    .Attr("dropconnect_rate: float = 0.0")  // Only used with `dropconnect_seed`.
+    .Attr("checkpoint_interval: int = 0")  // Only keep every K'th `c` and no `v` if K > 0.
+    .Attr("activation_storage: {'native', 'half', 'fixed8'} = 'native'")
+    .Attr("time_major: bool = true")  // Else `x` is [N,T,C] and `h` is [N,T+1,H].
+    .Attr("coupled_gates: bool = false")  // Ties the input gate to the forget gate.
     .Input("x: R")                      // [T,N,C]
     .Input("kernel: R")                 // [C,H*4]
     .Input("recurrent_kernel: R")       // [H,H*4]
     .Input("bias: R")                   // [H*4]
     .Input("zoneout_mask: R")           // [T,N,H]
-    .Output("h: R")                     // [T,N,H]
-    .Output("c: R")                     // [T,N,H]
-    .Output("v: R")                     // [T,N,H*4]
+    .Input("sequence_length: int32")    // [N]
+    .Input("zoneout_seed: int64")       // [2] or [0]
+    .Input("dropconnect_seed: int64")   // [2] or [0]
+    .Input("h0: R")                     // [N,H] or [0,0]
+    .Input("c0: S")                     // [N,H] or [0,0]
+    .Input("peephole: R")               // [3,H] or [0,0]
+    .Input("layer_norm: R")             // [2,H*4] or [0,0]
+    .Output("h: R")                     // [T+1,N,H]
+    .Output("c: S")                     // [T+1,N,H] or [ceil(T/K)+1,N,H]
+    .Output("v: R")                     // [T,N,H*4], [0] or compact
+    .Output("layer_norm_cache: R")      // [T,N,2,H*4] or [0,0,0,0]
     .SetShapeFn([](InferenceContext* c) {
       ShapeHandle input_shape;
       ShapeHandle kernel_shape;
       ShapeHandle recurrent_shape;
       ShapeHandle bias_shape;
       ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle zoneout_seed_shape;
+      ShapeHandle dropconnect_seed_shape;
+      ShapeHandle h0_shape;
+      ShapeHandle c0_shape;
+      ShapeHandle peephole_shape;
+      ShapeHandle layer_norm_shape;
+      bool training;
+      int checkpoint_interval;
+      std::string activation_storage;
+      bool time_major;
 
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &input_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &recurrent_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &bias_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 3, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 1, &zoneout_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 1, &dropconnect_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 2, &h0_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 2, &c0_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(10), 2, &peephole_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(11), 2, &layer_norm_shape));
+      TF_RETURN_IF_ERROR(c->GetAttr("training", &training));
+      TF_RETURN_IF_ERROR(c->GetAttr("checkpoint_interval", &checkpoint_interval));
+      TF_RETURN_IF_ERROR(c->GetAttr("activation_storage", &activation_storage));
+      TF_RETURN_IF_ERROR(c->GetAttr("time_major", &time_major));
 
-      const DimensionHandle time_steps = c->Dim(input_shape, 0);
-      const DimensionHandle batch_size = c->Dim(input_shape, 1);
+      const DimensionHandle time_steps = c->Dim(input_shape, time_major ? 0 : 1);
+      const DimensionHandle batch_size = c->Dim(input_shape, time_major ? 1 : 0);
       const DimensionHandle hidden_size = c->Dim(recurrent_shape, 0);
       DimensionHandle time_steps_plus_1;
       DimensionHandle hidden_size_4;
@@ -104,9 +136,25 @@ REGISTER_OP("HasteLstm")
       TF_RETURN_IF_ERROR(c->Add(time_steps, 1, &time_steps_plus_1));
       TF_RETURN_IF_ERROR(c->Multiply(hidden_size, 4, &hidden_size_4));
 
-      c->set_output(0, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
-      c->set_output(1, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
-      c->set_output(2, c->MakeShape({ time_steps, batch_size, hidden_size_4 }));
+      // `c` is time-major either way.
+      c->set_output(0, time_major
+          ? c->MakeShape({ time_steps_plus_1, batch_size, hidden_size })
+          : c->MakeShape({ batch_size, time_steps_plus_1, hidden_size }));
+      if (training && checkpoint_interval > 0) {
+        const DimensionHandle checkpoints = c->ValueKnown(time_steps)
+            ? c->MakeDim((c->Value(time_steps) + checkpoint_interval - 1) / checkpoint_interval + 1)
+            : c->UnknownDim();
+        c->set_output(1, c->MakeShape({ checkpoints, batch_size, hidden_size }));
+        c->set_output(2, c->MakeShape({ 0 }));
+      } else if (training && activation_storage != "native") {
+        c->set_output(1, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
+        c->set_output(2, c->Vector(c->UnknownDim()));
+      } else {
+        c->set_output(1, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
+        c->set_output(2, c->MakeShape({ time_steps, batch_size, hidden_size_4 }));
+      }
+      // Empty unless training with layer normalization.
+      c->set_output(3, c->UnknownShapeOfRank(4));
       return Status::OK();
     });
 
@@ -115,6 +163,22 @@ struct HasteLstmOp : public OpKernel {
   explicit HasteLstmOp(OpKernelConstruction* context) : OpKernel(context) {
     OP_REQUIRES_OK(context, context->GetAttr("training", &training_));
     OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+    OP_REQUIRES_OK(context, context->GetAttr("dropconnect_rate", &dropconnect_rate_));
+    OP_REQUIRES(context, dropconnect_rate_ >= 0.0f && dropconnect_rate_ < 1.0f,
+        errors::InvalidArgument("dropconnect_rate must be in [0, 1). Found ",
+            dropconnect_rate_));
+    OP_REQUIRES_OK(context, context->GetAttr("checkpoint_interval", &checkpoint_interval_));
+    OP_REQUIRES(context, checkpoint_interval_ >= 0,
+        errors::InvalidArgument("checkpoint_interval must be non-negative. Found ",
+            checkpoint_interval_));
+    std::string activation_storage;
+    OP_REQUIRES_OK(context, context->GetAttr("activation_storage", &activation_storage));
+    compact_ = ParseActivationStorage(activation_storage, &storage_);
+    OP_REQUIRES(context, !(compact_ && checkpoint_interval_ > 0),
+        errors::InvalidArgument("activation_storage must be 'native' when checkpoint_interval "
+            "is set since no activations are saved."));
+    OP_REQUIRES_OK(context, context->GetAttr("time_major", &time_major_));
+    OP_REQUIRES_OK(context, context->GetAttr("coupled_gates", &coupled_gates_));
   }
 
   // When running on GPU, TF backs all inputs and outputs with device memory
@@ -126,90 +190,263 @@ struct HasteLstmOp : public OpKernel {
     const Tensor& recurrent_kernel = context->input(2);
     const Tensor& bias = context->input(3);
     const Tensor& zoneout_mask = context->input(4);
+    const Tensor& sequence_length = context->input(5);
 
-    const auto time_steps = input.shape().dim_size(0);
-    const auto batch_size = input.shape().dim_size(1);
+    RandomSeed zoneout_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(6), "zoneout_seed", &zoneout_seed));
+
+    RandomSeed dropconnect_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(7), "dropconnect_seed", &dropconnect_seed));
+
+    const Tensor& h0 = context->input(8);
+    const Tensor& c0 = context->input(9);
+    const Tensor& peephole = context->input(10);
+    const Tensor& layer_norm = context->input(11);
+
+    const auto time_steps = input.shape().dim_size(time_major_ ? 0 : 1);
+    const auto batch_size = input.shape().dim_size(time_major_ ? 1 : 0);
     const auto input_size = input.shape().dim_size(2);
     const auto hidden_size = recurrent_kernel.shape().dim_size(0);
-    const bool has_zoneout = zoneout_prob_ && zoneout_mask.NumElements();
+    const bool has_zoneout = zoneout_prob_ && (zoneout_mask.NumElements() || zoneout_seed.enabled);
+    const bool has_zoneout_mask = has_zoneout && zoneout_mask.NumElements();
+    const bool checkpointed = training_ && checkpoint_interval_ > 0;
+    const bool compact = training_ && compact_;
+    const bool has_dropconnect = dropconnect_rate_ > 0.0f && dropconnect_seed.enabled;
+    const bool has_peephole = !!peephole.NumElements();
+    const bool has_layer_norm = !!layer_norm.NumElements();
     const auto data_type = DataTypeToEnum<T>::value;
 
     OP_REQUIRES(context, input_size == kernel.shape().dim_size(0),
         errors::InvalidArgument("input[2] and kernel[0] dimensions must match. Found ",
             input_size, " and ", kernel.shape().dim_size(0)));
+    OP_REQUIRES_OK(context, CheckCellVariants(peephole, layer_norm, hidden_size));
+    // `RunCheckpointed` and `RunCompact` only run the standard cell.
+    OP_REQUIRES(context, !(has_peephole || has_layer_norm || coupled_gates_) ||
+        !(checkpointed || compact),
+        errors::InvalidArgument("peephole, layer_norm and coupled_gates can't be used in "
+            "training with checkpoint_interval or a compact activation_storage."));
+    // `RunCheckpointed` and `RunCompact` only read time-major sequences.
+    OP_REQUIRES(context, time_major_ || !(checkpointed || compact),
+        errors::InvalidArgument("time_major must be true in training with "
+            "checkpoint_interval or a compact activation_storage."));
 
-    const TensorShape output_shape = { time_steps + 1, batch_size, hidden_size };
-    const TensorShape activations_shape = { time_steps, batch_size, hidden_size * 4 };
+    // In checkpointed mode, `v` only ever holds a single segment and isn't an output.
+    const auto segment_steps = checkpointed
+        ? std::min<int64>(checkpoint_interval_, time_steps)
+        : time_steps;
+    const auto cell_states = checkpointed
+        ? (time_steps + checkpoint_interval_ - 1) / checkpoint_interval_ + 1
+        : time_steps + 1;
+    const TensorShape output_shape = time_major_
+        ? TensorShape({ time_steps + 1, batch_size, hidden_size })
+        : TensorShape({ batch_size, time_steps + 1, hidden_size });
+    const TensorShape cell_state_shape = { cell_states, batch_size, hidden_size };
+    const TensorShape activations_shape = { segment_steps, batch_size, hidden_size * 4 };
+    const TensorShape layer_norm_cache_shape = training_ && has_layer_norm
+        ? TensorShape({ time_steps, batch_size, 2, hidden_size * 4 })
+        : TensorShape({ 0, 0, 0, 0 });
 
     Tensor* output = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
 
     Tensor* output_cell_state = nullptr;
-    OP_REQUIRES_OK(context, context->allocate_output(1, output_shape, &output_cell_state));
+    OP_REQUIRES_OK(context, context->allocate_output(1, cell_state_shape, &output_cell_state));
 
     Tensor output_v_temp;
     Tensor* output_v = nullptr;
-    if (training_) {
+    if (compact) {
+      // The compact activations are the output and `output_v_temp` receives Wx.
+      const size_t bytes = haste::v0::lstm::CompactActivationsSize(
+          time_steps, batch_size, hidden_size, storage_);
+      const TensorShape compact_shape = { CompactActivationsElements<T>(bytes) };
+      OP_REQUIRES_OK(context, context->allocate_output(2, compact_shape, &output_v));
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, activations_shape, &output_v_temp));
+    } else if (training_ && !checkpointed) {
       OP_REQUIRES_OK(context, context->allocate_output(2, activations_shape, &output_v));
     } else {
-      // Return an empty tensor in inference mode and provide temp memory
-      // to the forward pass instead.
+      // Return an empty tensor in inference and checkpointed modes. The checkpointed
+      // forward pass gets temp memory for `v` instead and inference takes it from the
+      // workspace below.
       OP_REQUIRES_OK(context, context->allocate_output(2, TensorShape({ 0 }), &output_v));
-      OP_REQUIRES_OK(context, context->allocate_temp(data_type, activations_shape, &output_v_temp));
-      output_v = &output_v_temp;
+      if (checkpointed) {
+        OP_REQUIRES_OK(context, context->allocate_temp(data_type, activations_shape, &output_v_temp));
+        output_v = &output_v_temp;
+      }
     }
 
+    Tensor* output_layer_norm_cache = nullptr;
+    OP_REQUIRES_OK(context,
+        context->allocate_output(3, layer_norm_cache_shape, &output_layer_norm_cache));
+
+    // `Run` carves its temp memory from a single workspace allocation instead.
     Tensor tmp_Rh;
-    const TensorShape tmp_Rh_shape = { batch_size, 4 * hidden_size };
-    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
-    cudaMemset(output->flat<T>().data(), 0, output->AllocatedBytes());
-    cudaMemset(output_cell_state->flat<T>().data(), 0, output_cell_state->AllocatedBytes());
+    if (checkpointed || compact) {
+      const TensorShape tmp_Rh_shape = { batch_size, 4 * hidden_size };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
+    }
 
-    ForwardPass<T> forward = ForwardPass<T>(
-        training_,
-        batch_size,
-        input_size,
-        hidden_size,
-        GetCublasHandle());
+    // Receives the masked recurrent kernel for the duration of the call.
+    Tensor tmp_R;
+    if (has_dropconnect) {
+      const TensorShape tmp_R_shape = recurrent_kernel.shape();
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_R_shape, &tmp_R));
+    }
+
+    // The passes write every state after the initial one. In a batch-major `h`, the
+    // initial states are (T+1)*H elements apart.
+    const cudaStream_t& stream = GetCudaStream(context);
+    const size_t state_bytes = batch_size * hidden_size * sizeof(T);
+    const size_t cell_state_bytes = batch_size * hidden_size * sizeof(CellState<T>);
+    const size_t state_pitch = time_major_ ? 0 : (time_steps + 1) * hidden_size * sizeof(T);
+    OP_REQUIRES_OK(context, SetInitialState(
+        h0, "h0", batch_size, hidden_size, state_bytes, stream, output->flat<T>().data(),
+        state_pitch));
+    OP_REQUIRES_OK(context, SetInitialState(
+        c0, "c0", batch_size, hidden_size, cell_state_bytes, stream,
+        output_cell_state->flat<CellState<T>>().data()));
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    ForwardPass<T>& forward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new ForwardPass<T>(
+          training_,
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    // Reports the phases of earlier calls that have finished by now.
+    ExportPhaseStats(type_string(), forward.CollectPhaseStats());
+    if (zoneout_seed.enabled)
+      forward.SetZoneoutSeed(zoneout_prob_, zoneout_seed.seed, zoneout_seed.offset);
+    // A cached pass may have DropConnect enabled by an earlier call, so always set it.
+    forward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate_ : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? DevicePtr<T>(tmp_R) : nullptr);
+    // A cached pass may also have been used with the other layout.
+    forward.SetSequenceLayout(haste::v0::SequenceLayout{ !time_major_, false, 0 });
+    // And with other cell variants.
+    forward.SetPeephole(has_peephole ? DevicePtr<T>(peephole) : nullptr);
+    forward.SetCoupledGates(coupled_gates_);
+    forward.SetLayerNorm(
+        has_layer_norm ? DevicePtr<T>(layer_norm) : nullptr,
+        output_layer_norm_cache->NumElements() ? DevicePtr<T>(*output_layer_norm_cache) : nullptr);
+
+    if (checkpointed) {
+      forward.RunCheckpointed(
+          time_steps,
+          checkpoint_interval_,
+          DevicePtr<T>(kernel),
+          DevicePtr<T>(recurrent_kernel),
+          DevicePtr<T>(bias),
+          DevicePtr<T>(input),
+          DevicePtr<T>(*output),
+          DevicePtr<CellState<T>>(*output_cell_state),
+          DevicePtr<T>(*output_v),
+          DevicePtr<T>(tmp_Rh),
+          has_zoneout ? zoneout_prob_ : 0.0f,
+          has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+          lengths.device,
+          lengths.batch_sizes_or_null());
+      return;
+    }
+
+    if (compact) {
+      forward.RunCompact(
+          time_steps,
+          storage_,
+          DevicePtr<T>(kernel),
+          DevicePtr<T>(recurrent_kernel),
+          DevicePtr<T>(bias),
+          DevicePtr<T>(input),
+          DevicePtr<T>(*output),
+          DevicePtr<CellState<T>>(*output_cell_state),
+          DevicePtr<T>(*output_v),
+          DevicePtr<T>(output_v_temp),
+          DevicePtr<T>(tmp_Rh),
+          has_zoneout ? zoneout_prob_ : 0.0f,
+          has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+          lengths.device,
+          lengths.batch_sizes_or_null());
+      return;
+    }
+
+    Tensor workspace;
+    const TensorShape workspace_shape = { static_cast<int64>(forward.GetWorkspaceSize(time_steps)) };
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_UINT8, workspace_shape, &workspace));
 
     forward.Run(
         time_steps,
-        kernel.flat<T>().data(),
-        recurrent_kernel.flat<T>().data(),
-        bias.flat<T>().data(),
-        input.flat<T>().data(),
-        output->flat<T>().data(),
-        output_cell_state->flat<T>().data(),
-        output_v->flat<T>().data(),
-        tmp_Rh.flat<T>().data(),
+        DevicePtr<T>(kernel),
+        DevicePtr<T>(recurrent_kernel),
+        DevicePtr<T>(bias),
+        DevicePtr<T>(input),
+        DevicePtr<T>(*output),
+        DevicePtr<CellState<T>>(*output_cell_state),
+        training_ ? DevicePtr<T>(*output_v) : nullptr,
         has_zoneout ? zoneout_prob_ : 0.0f,
-        has_zoneout ? zoneout_mask.flat<T>().data() : nullptr);
+        has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.flat<uint8>().data());
   }
 
   private:
     bool training_;
     float zoneout_prob_;
+    float dropconnect_rate_;
+    int checkpoint_interval_;
+    bool compact_;
+    haste::v0::ActivationStorage storage_;
+    bool time_major_;
+    bool coupled_gates_;
+    PassCache<ForwardPass<T>> cache_;
 };
 
-REGISTER_GPU_KERNEL(HasteLstm, float);
-REGISTER_GPU_KERNEL(HasteLstm, double);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstm, Eigen::half);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstm, bfloat16);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstm, float);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstm, double);
 
 REGISTER_OP("HasteLstmGrad")
-    .Attr("R: {float, double}")
-    .Input("x_t: R")                   // [C,N,T]
-    .Input("kernel_t: R")              // [H*4,C]
-    .Input("recurrent_kernel_t: R")    // [H*4,H]
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("S: {float, double}")  // The cell state type: float for 16-bit R.
+    .Attr("activation_storage: {'native', 'half', 'fixed8'} = 'native'")
+    .Attr("zoneout_prob: float = 0.0")  // Only used with `zoneout_seed`.
+    .Attr("dropconnect_rate: float = 0.0")  // Only used with `dropconnect_seed`.
+    .Attr("time_major: bool = true")  // Else `x`, `dx`, `h` and `dh_new` are batch-major.
+    .Attr("coupled_gates: bool = false")
+    .Input("x: R")                     // [T,N,C]
+    .Input("kernel: R")                // [C,H*4]
+    .Input("recurrent_kernel: R")      // [H,H*4]
     .Input("bias: R")                  // [H*4]
     .Input("h: R")                     // [T,N,H]
-    .Input("c: R")                     // [T,N,H]
-    .Input("v: R")                     // [T,N,H*4]
+    .Input("c: S")                     // [T,N,H]
+    .Input("v: R")                     // [T,N,H*4] or compact
     .Input("dh_new: R")                // [T,N,H]
-    .Input("dc_new: R")                // [T,N,H]
+    .Input("dc_new: S")                // [T,N,H]
     .Input("zoneout_mask: R")          // [T,N,H]
+    .Input("sequence_length: int32")   // [N]
+    .Input("zoneout_seed: int64")      // [2] or [0]
+    .Input("dropconnect_seed: int64")  // [2] or [0]
+    .Input("peephole: R")              // [3,H] or [0,0]
+    .Input("layer_norm: R")            // [2,H*4] or [0,0]
+    .Input("layer_norm_cache: R")      // [T,N,2,H*4] or [0,0,0,0]
     .Output("dx: R")                   // [T,N,C]
     .Output("dw: R")                   // [C,H*4]
     .Output("dr: R")                   // [H,H*4]
     .Output("db: R")                   // [H*4]
+    .Output("dh0: R")                  // [N,H]
+    .Output("dc0: S")                  // [N,H]
+    .Output("dpeephole: R")            // [3,H] or [0,0]
+    .Output("dlayer_norm: R")          // [2,H*4] or [0,0]
     .SetShapeFn([](InferenceContext* c) {
       ShapeHandle x_shape;
       ShapeHandle kernel_shape;
@@ -221,33 +458,727 @@ REGISTER_OP("HasteLstmGrad")
       ShapeHandle dh_new_shape;
       ShapeHandle dc_new_shape;
       ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle zoneout_seed_shape;
+      ShapeHandle dropconnect_seed_shape;
+      ShapeHandle peephole_shape;
+      ShapeHandle layer_norm_shape;
+      ShapeHandle layer_norm_cache_shape;
+      std::string activation_storage;
+      bool time_major;
 
+      TF_RETURN_IF_ERROR(c->GetAttr("activation_storage", &activation_storage));
+      TF_RETURN_IF_ERROR(c->GetAttr("time_major", &time_major));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &x_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &recurrent_kernel_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &bias_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 3, &h_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &c_shape));
-      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 3, &v_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), activation_storage == "native" ? 3 : 1, &v_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 3, &dh_new_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 3, &dc_new_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 3, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(10), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(11), 1, &zoneout_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(12), 1, &dropconnect_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(13), 2, &peephole_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(14), 2, &layer_norm_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(15), 4, &layer_norm_cache_shape));
+
+      DimensionHandle batch_size = c->Dim(x_shape, time_major ? 1 : 0);
+      DimensionHandle input_size = c->Dim(x_shape, 2);
+      DimensionHandle hidden_size = c->Dim(recurrent_kernel_shape, 0);
+
+      c->set_output(0, x_shape);
+      c->set_output(1, c->MakeShape({ input_size, c->Value(hidden_size) * 4 }));
+      c->set_output(2, c->MakeShape({ hidden_size, c->Value(hidden_size) * 4 }));
+      c->set_output(3, bias_shape);
+      c->set_output(4, c->MakeShape({ batch_size, hidden_size }));
+      c->set_output(5, c->MakeShape({ batch_size, hidden_size }));
+      c->set_output(6, peephole_shape);
+      c->set_output(7, layer_norm_shape);
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmGradOp : public OpKernel {
+  explicit HasteLstmGradOp(OpKernelConstruction* context) : OpKernel(context) {
+    std::string activation_storage;
+    OP_REQUIRES_OK(context, context->GetAttr("activation_storage", &activation_storage));
+    compact_ = ParseActivationStorage(activation_storage, &storage_);
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+    OP_REQUIRES_OK(context, context->GetAttr("dropconnect_rate", &dropconnect_rate_));
+    OP_REQUIRES_OK(context, context->GetAttr("time_major", &time_major_));
+    // `RunCompact` only reads time-major sequences.
+    OP_REQUIRES(context, time_major_ || !compact_,
+        errors::InvalidArgument("time_major must be true with a compact activation_storage."));
+    OP_REQUIRES_OK(context, context->GetAttr("coupled_gates", &coupled_gates_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& bias = context->input(3);
+    const Tensor& h_vector = context->input(4);
+    const Tensor& c_vector = context->input(5);
+    const Tensor& v_vector = context->input(6);
+    const Tensor& dh_new = context->input(7);
+    const Tensor& dc_new = context->input(8);
+    const Tensor& zoneout_mask = context->input(9);
+    const Tensor& sequence_length = context->input(10);
+
+    RandomSeed zoneout_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(11), "zoneout_seed", &zoneout_seed));
+
+    RandomSeed dropconnect_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(12), "dropconnect_seed", &dropconnect_seed));
+
+    const Tensor& peephole = context->input(13);
+    const Tensor& layer_norm = context->input(14);
+    const Tensor& layer_norm_cache = context->input(15);
+
+    const auto time_steps = input.shape().dim_size(time_major_ ? 0 : 1);
+    const auto batch_size = input.shape().dim_size(time_major_ ? 1 : 0);
+    const auto input_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+    const bool has_zoneout_mask = !!zoneout_mask.NumElements();
+    const bool has_dropconnect = dropconnect_rate_ > 0.0f && dropconnect_seed.enabled;
+    const bool has_peephole = !!peephole.NumElements();
+    const bool has_layer_norm = !!layer_norm.NumElements();
+    const auto data_type = DataTypeToEnum<T>::value;
+
+    OP_REQUIRES_OK(context, CheckCellVariants(peephole, layer_norm, hidden_size));
+    // `RunCompact` only runs the standard cell.
+    OP_REQUIRES(context, !(has_peephole || has_layer_norm || coupled_gates_) || !compact_,
+        errors::InvalidArgument("peephole, layer_norm and coupled_gates can't be used with a "
+            "compact activation_storage."));
+    const TensorShape layer_norm_cache_shape = { time_steps, batch_size, 2, hidden_size * 4 };
+    OP_REQUIRES(context, !has_layer_norm || layer_norm_cache.shape() == layer_norm_cache_shape,
+        errors::InvalidArgument("layer_norm_cache must have shape ",
+            layer_norm_cache_shape.DebugString(), ". Found ",
+            layer_norm_cache.shape().DebugString()));
+
+    // Can be uninitialized. Output only, no accumulation. Laid out like `x`.
+    Tensor* dx = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, input.shape(), &dx));
+
+    // Overwritten by the pass (see `SetAccumulateGradients`).
+    const TensorShape dW_shape = { input_size, hidden_size * 4 };
+    Tensor* dW = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, dW_shape, &dW));
+
+    // Overwritten by the pass.
+    const TensorShape dR_shape = { hidden_size, hidden_size * 4 };
+    Tensor* dR = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, dR_shape, &dR));
+
+    // Overwritten by the pass.
+    const TensorShape db_shape = { hidden_size * 4 };
+    Tensor* db = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(3, db_shape, &db));
+
+    // Needs to be initialized to 0. Receives the gradient with respect to `h[0]` through
+    // the recurrence, not including `dh_new[0]`.
+    const TensorShape dh_shape = { batch_size, hidden_size };
+    Tensor* dh = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(4, dh_shape, &dh));
+
+    // Needs to be initialized to 0. Likewise for `c[0]`.
+    const TensorShape dc_shape = { batch_size, hidden_size };
+    Tensor* dc = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(5, dc_shape, &dc));
+
+    // Compact activations are read-only; the gate gradients go to a separate buffer.
+    Tensor dv;
+    if (compact_) {
+      const TensorShape dv_shape = { time_steps, batch_size, hidden_size * 4 };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, dv_shape, &dv));
+    } else {
+      OP_REQUIRES_OK(context,
+          context->forward_input_or_allocate_temp({ 6 }, data_type, v_vector.shape(), &dv));
+    }
+
+    // Overwritten by the pass, like `db`.
+    Tensor* dpeephole = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(6, peephole.shape(), &dpeephole));
+
+    // Overwritten by the pass.
+    Tensor* dlayer_norm = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(7, layer_norm.shape(), &dlayer_norm));
+
+    // Receives the masked recurrent kernel for the duration of the call.
+    Tensor tmp_R;
+    if (has_dropconnect) {
+      const TensorShape tmp_R_shape = { hidden_size, hidden_size * 4 };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_R_shape, &tmp_R));
+    }
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(dh->flat<T>().data(), 0, dh->AllocatedBytes(), stream);
+    cudaMemsetAsync(dc->flat<CellState<T>>().data(), 0, dc->AllocatedBytes(), stream);
+
+    // The pass overwrites the layer normalization cache, so it works on a copy unless
+    // nothing else reads the forward op's output.
+    Tensor tmp_layer_norm_cache;
+    if (has_layer_norm) {
+      OP_REQUIRES_OK(context, context->forward_input_or_allocate_temp(
+          { 15 }, data_type, layer_norm_cache_shape, &tmp_layer_norm_cache));
+      if (!tmp_layer_norm_cache.SharesBufferWith(layer_norm_cache)) {
+        cudaMemcpyAsync(
+            tmp_layer_norm_cache.flat<T>().data(),
+            layer_norm_cache.flat<T>().data(),
+            layer_norm_cache.TotalBytes(),
+            cudaMemcpyDeviceToDevice,
+            stream);
+      }
+    }
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BackwardPass<T>& backward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new BackwardPass<T>(
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    // Reports the phases of earlier calls that have finished by now.
+    ExportPhaseStats(type_string(), backward.CollectPhaseStats());
+    // The weight gradient outputs start out uninitialized.
+    backward.SetAccumulateGradients(false);
+    // A cached pass may have been seeded by an earlier call, so always reset the seed.
+    backward.SetZoneoutSeed(
+        zoneout_seed.enabled ? zoneout_prob_ : 0.0f,
+        zoneout_seed.seed,
+        zoneout_seed.offset);
+    // DropConnect is also set on every call for the same reason.
+    backward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate_ : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? DevicePtr<T>(tmp_R) : nullptr);
+    // The layout is also set on every call, to match the forward op's.
+    backward.SetSequenceLayout(haste::v0::SequenceLayout{ !time_major_, false, 0 });
+    // And so are the cell variants.
+    backward.SetPeephole(
+        has_peephole ? DevicePtr<T>(peephole) : nullptr,
+        has_peephole ? DevicePtr<T>(*dpeephole) : nullptr);
+    backward.SetCoupledGates(coupled_gates_);
+    backward.SetLayerNorm(
+        has_layer_norm ? DevicePtr<T>(layer_norm) : nullptr,
+        has_layer_norm ? DevicePtr<T>(tmp_layer_norm_cache) : nullptr,
+        has_layer_norm ? DevicePtr<T>(*dlayer_norm) : nullptr);
+
+    if (compact_) {
+      backward.RunCompact(
+          time_steps,
+          storage_,
+          PackedWeights<T>{
+              DevicePtr<T>(kernel),
+              DevicePtr<T>(recurrent_kernel),
+              DevicePtr<T>(bias) },
+          DevicePtr<T>(input),
+          DevicePtr<T>(h_vector),
+          DevicePtr<CellState<T>>(c_vector),
+          DevicePtr<T>(dh_new),
+          DevicePtr<CellState<T>>(dc_new),
+          DevicePtr<T>(*dx),
+          DevicePtr<T>(*dW),
+          DevicePtr<T>(*dR),
+          DevicePtr<T>(*db),
+          DevicePtr<T>(*dh),
+          DevicePtr<CellState<T>>(*dc),
+          DevicePtr<T>(v_vector),
+          DevicePtr<T>(dv),
+          has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+          lengths.device,
+          lengths.batch_sizes_or_null());
+      return;
+    }
+
+    backward.Run(
+        time_steps,
+        PackedWeights<T>{
+            DevicePtr<T>(kernel),
+            DevicePtr<T>(recurrent_kernel),
+            DevicePtr<T>(bias) },
+        DevicePtr<T>(input),
+        DevicePtr<T>(h_vector),
+        DevicePtr<CellState<T>>(c_vector),
+        DevicePtr<T>(dh_new),
+        DevicePtr<CellState<T>>(dc_new),
+        DevicePtr<T>(*dx),
+        DevicePtr<T>(*dW),
+        DevicePtr<T>(*dR),
+        DevicePtr<T>(*db),
+        DevicePtr<T>(*dh),
+        DevicePtr<CellState<T>>(*dc),
+        DevicePtr<T>(dv),
+        has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }
+
+  private:
+    bool compact_;
+    haste::v0::ActivationStorage storage_;
+    float zoneout_prob_;
+    float dropconnect_rate_;
+    bool time_major_;
+    bool coupled_gates_;
+    PassCache<BackwardPass<T>> cache_;
+};
+
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmGrad, Eigen::half);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmGrad, bfloat16);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmGrad, float);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmGrad, double);
+
+// Gradient of `HasteLstm` with `checkpoint_interval > 0`. Unlike `HasteLstmGrad`, it
+// takes `x` and the kernels as they were passed to the forward op since it reruns the
+// forward pass segment by segment.
+REGISTER_OP("HasteLstmCheckpointedGrad")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("S: {float, double}")  // The cell state type: float for 16-bit R.
+    .Attr("zoneout_prob: float")
+    .Attr("dropconnect_rate: float = 0.0")  // Only used with `dropconnect_seed`.
+    .Attr("checkpoint_interval: int")
+    .Input("x: R")                     // [T,N,C]
+    .Input("kernel: R")                // [C,H*4]
+    .Input("recurrent_kernel: R")      // [H,H*4]
+    .Input("recurrent_kernel_t: R")    // [H*4,H]
+    .Input("bias: R")                  // [H*4]
+    .Input("h: R")                     // [T+1,N,H]
+    .Input("c: S")                     // [ceil(T/K)+1,N,H]
+    .Input("dh_new: R")                // [T+1,N,H]
+    .Input("dc_new: S")                // [ceil(T/K)+1,N,H]
+    .Input("zoneout_mask: R")          // [T,N,H]
+    .Input("sequence_length: int32")   // [N]
+    .Input("zoneout_seed: int64")      // [2] or [0]
+    .Input("dropconnect_seed: int64")  // [2] or [0]
+    .Output("dx: R")                   // [T,N,C]
+    .Output("dw: R")                   // [C,H*4]
+    .Output("dr: R")                   // [H,H*4]
+    .Output("db: R")                   // [H*4]
+    .Output("dh0: R")                  // [N,H]
+    .Output("dc0: S")                  // [N,H]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle x_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_kernel_shape;
+      ShapeHandle recurrent_kernel_t_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle h_shape;
+      ShapeHandle c_shape;
+      ShapeHandle dh_new_shape;
+      ShapeHandle dc_new_shape;
+      ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle zoneout_seed_shape;
+      ShapeHandle dropconnect_seed_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &x_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &recurrent_kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &recurrent_kernel_t_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &h_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 3, &c_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 3, &dh_new_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 3, &dc_new_shape));
       TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 3, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(10), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(11), 1, &zoneout_seed_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(12), 1, &dropconnect_seed_shape));
+
+      c->set_output(0, x_shape);
+      c->set_output(1, kernel_shape);
+      c->set_output(2, recurrent_kernel_shape);
+      c->set_output(3, bias_shape);
+      c->set_output(4, c->MakeShape({ c->Dim(x_shape, 1), c->Dim(recurrent_kernel_shape, 0) }));
+      c->set_output(5, c->MakeShape({ c->Dim(x_shape, 1), c->Dim(recurrent_kernel_shape, 0) }));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmCheckpointedGradOp : public OpKernel {
+  explicit HasteLstmCheckpointedGradOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+    OP_REQUIRES_OK(context, context->GetAttr("dropconnect_rate", &dropconnect_rate_));
+    OP_REQUIRES_OK(context, context->GetAttr("checkpoint_interval", &checkpoint_interval_));
+    OP_REQUIRES(context, checkpoint_interval_ > 0,
+        errors::InvalidArgument("checkpoint_interval must be positive. Found ",
+            checkpoint_interval_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& recurrent_kernel_t = context->input(3);
+    const Tensor& bias = context->input(4);
+    const Tensor& h_vector = context->input(5);
+    const Tensor& c_vector = context->input(6);
+    const Tensor& dh_new = context->input(7);
+    const Tensor& dc_new = context->input(8);
+    const Tensor& zoneout_mask = context->input(9);
+    const Tensor& sequence_length = context->input(10);
+
+    RandomSeed zoneout_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(11), "zoneout_seed", &zoneout_seed));
+
+    RandomSeed dropconnect_seed;
+    OP_REQUIRES_OK(context, GetRandomSeed(context->input(12), "dropconnect_seed", &dropconnect_seed));
+
+    const auto time_steps = input.shape().dim_size(0);
+    const auto batch_size = input.shape().dim_size(1);
+    const auto input_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+    const auto segment_steps = std::min<int64>(checkpoint_interval_, time_steps);
+    const bool has_zoneout = zoneout_prob_ && (zoneout_mask.NumElements() || zoneout_seed.enabled);
+    const bool has_zoneout_mask = has_zoneout && zoneout_mask.NumElements();
+    const bool has_dropconnect = dropconnect_rate_ > 0.0f && dropconnect_seed.enabled;
+    const auto data_type = DataTypeToEnum<T>::value;
+
+    // Can be uninitialized. Output only, no accumulation.
+    const TensorShape dx_shape = { time_steps, batch_size, input_size };
+    Tensor* dx = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, dx_shape, &dx));
+
+    // Overwritten by the pass (see `SetAccumulateGradients`).
+    const TensorShape dW_shape = { input_size, hidden_size * 4 };
+    Tensor* dW = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, dW_shape, &dW));
+
+    // Overwritten by the pass.
+    const TensorShape dR_shape = { hidden_size, hidden_size * 4 };
+    Tensor* dR = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, dR_shape, &dR));
+
+    // Overwritten by the pass.
+    const TensorShape db_shape = { hidden_size * 4 };
+    Tensor* db = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(3, db_shape, &db));
+
+    // Needs to be initialized to 0. Receives the gradients with respect to `h[0]` and
+    // `c[0]` through the recurrence, as in `HasteLstmGrad`.
+    const TensorShape state_shape = { batch_size, hidden_size };
+    Tensor* dh = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(4, state_shape, &dh));
+
+    Tensor* dc = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(5, state_shape, &dc));
+
+    // Recomputed activations and states of one segment.
+    Tensor tmp_c;
+    const TensorShape tmp_c_shape = { segment_steps, batch_size, hidden_size };
+    OP_REQUIRES_OK(context, context->allocate_temp(
+        DataTypeToEnum<CellState<T>>::value, tmp_c_shape, &tmp_c));
+
+    Tensor tmp_v;
+    const TensorShape tmp_v_shape = { segment_steps, batch_size, hidden_size * 4 };
+    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_v_shape, &tmp_v));
+
+    Tensor tmp_h;
+    OP_REQUIRES_OK(context, context->allocate_temp(data_type, state_shape, &tmp_h));
+
+    Tensor tmp_Rh;
+    const TensorShape tmp_Rh_shape = { batch_size, hidden_size * 4 };
+    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
+
+    // Receives the masked recurrent kernel and its transpose for the duration of the call.
+    Tensor tmp_R;
+    if (has_dropconnect) {
+      const TensorShape tmp_R_shape = { 2, hidden_size * 4, hidden_size };
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_R_shape, &tmp_R));
+    }
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(dh->flat<T>().data(), 0, dh->AllocatedBytes(), stream);
+    cudaMemsetAsync(dc->flat<CellState<T>>().data(), 0, dc->AllocatedBytes(), stream);
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BackwardPass<T>& backward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new BackwardPass<T>(
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    // Reports the phases of earlier calls that have finished by now.
+    ExportPhaseStats(type_string(), backward.CollectPhaseStats());
+    // The weight gradient outputs start out uninitialized.
+    backward.SetAccumulateGradients(false);
+    // A cached pass may have been seeded by an earlier call, so always reset the seed.
+    backward.SetZoneoutSeed(
+        zoneout_seed.enabled ? zoneout_prob_ : 0.0f,
+        zoneout_seed.seed,
+        zoneout_seed.offset);
+    // DropConnect is also set on every call for the same reason.
+    backward.SetDropConnect(
+        has_dropconnect ? dropconnect_rate_ : 0.0f,
+        dropconnect_seed.seed,
+        dropconnect_seed.offset,
+        has_dropconnect ? DevicePtr<T>(tmp_R) : nullptr);
+
+    backward.RunCheckpointed(
+        time_steps,
+        checkpoint_interval_,
+        DevicePtr<T>(kernel),
+        DevicePtr<T>(recurrent_kernel),
+        DevicePtr<T>(recurrent_kernel_t),
+        DevicePtr<T>(bias),
+        DevicePtr<T>(input),
+        DevicePtr<T>(h_vector),
+        DevicePtr<CellState<T>>(c_vector),
+        DevicePtr<T>(dh_new),
+        DevicePtr<CellState<T>>(dc_new),
+        DevicePtr<T>(*dx),
+        DevicePtr<T>(*dW),
+        DevicePtr<T>(*dR),
+        DevicePtr<T>(*db),
+        DevicePtr<T>(*dh),
+        DevicePtr<CellState<T>>(*dc),
+        DevicePtr<CellState<T>>(tmp_c),
+        DevicePtr<T>(tmp_v),
+        DevicePtr<T>(tmp_h),
+        DevicePtr<T>(tmp_Rh),
+        has_zoneout ? zoneout_prob_ : 0.0f,
+        has_zoneout_mask ? DevicePtr<T>(zoneout_mask) : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }
+
+  private:
+    float zoneout_prob_;
+    float dropconnect_rate_;
+    int checkpoint_interval_;
+    PassCache<BackwardPass<T>> cache_;
+};
+
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmCheckpointedGrad, Eigen::half);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmCheckpointedGrad, bfloat16);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmCheckpointedGrad, float);
+REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(HasteLstmCheckpointedGrad, double);
+
+REGISTER_OP("HasteLstmBidirectional")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("S: {float, double}")  // The cell state type: float for 16-bit R.
+    .Attr("training: bool")
+    .Attr("zoneout_prob: float")
+    .Input("x: R")                      // [T,N,C]
+    .Input("kernel: R")                 // [2,C,H*4]
+    .Input("recurrent_kernel: R")       // [2,H,H*4]
+    .Input("bias: R")                   // [2,H*4]
+    .Input("zoneout_mask: R")           // [2,T,N,H]
+    .Input("sequence_length: int32")    // [N]
+    .Output("h: R")                     // [2,T+1,N,H]
+    .Output("c: S")                     // [2,T+1,N,H]
+    .Output("v: R")                     // [2,T,N,H*4]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle input_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &input_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 3, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 3, &recurrent_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 4, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &sequence_length_shape));
+
+      const DimensionHandle time_steps = c->Dim(input_shape, 0);
+      const DimensionHandle batch_size = c->Dim(input_shape, 1);
+      const DimensionHandle hidden_size = c->Dim(recurrent_shape, 1);
+      DimensionHandle time_steps_plus_1;
+      DimensionHandle hidden_size_4;
+
+      TF_RETURN_IF_ERROR(c->Add(time_steps, 1, &time_steps_plus_1));
+      TF_RETURN_IF_ERROR(c->Multiply(hidden_size, 4, &hidden_size_4));
+
+      c->set_output(0, c->MakeShape({ 2, time_steps_plus_1, batch_size, hidden_size }));
+      c->set_output(1, c->MakeShape({ 2, time_steps_plus_1, batch_size, hidden_size }));
+      c->set_output(2, c->MakeShape({ 2, time_steps, batch_size, hidden_size_4 }));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmBidirectionalOp : public OpKernel {
+  explicit HasteLstmBidirectionalOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("training", &training_));
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+  }
+
+  // Both directions share the input and write to their own slice of each output. The
+  // reverse direction's states are mirrored in time (see `BidirectionalForwardPass`).
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& bias = context->input(3);
+    const Tensor& zoneout_mask = context->input(4);
+    const Tensor& sequence_length = context->input(5);
+
+    const auto time_steps = input.shape().dim_size(0);
+    const auto batch_size = input.shape().dim_size(1);
+    const auto input_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(1);
+    const bool has_zoneout = zoneout_prob_ && zoneout_mask.NumElements();
+    const auto data_type = DataTypeToEnum<T>::value;
+
+    OP_REQUIRES(context, input_size == kernel.shape().dim_size(1),
+        errors::InvalidArgument("input[2] and kernel[1] dimensions must match. Found ",
+            input_size, " and ", kernel.shape().dim_size(1)));
+
+    const TensorShape output_shape = { 2, time_steps + 1, batch_size, hidden_size };
+    const TensorShape activations_shape = { 2, time_steps, batch_size, hidden_size * 4 };
+
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+
+    Tensor* output_cell_state = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, output_shape, &output_cell_state));
+
+    Tensor output_v_temp;
+    Tensor* output_v = nullptr;
+    if (training_) {
+      OP_REQUIRES_OK(context, context->allocate_output(2, activations_shape, &output_v));
+    } else {
+      // Return an empty tensor in inference mode and provide temp memory
+      // to the forward pass instead.
+      OP_REQUIRES_OK(context, context->allocate_output(2, TensorShape({ 0 }), &output_v));
+      OP_REQUIRES_OK(context, context->allocate_temp(data_type, activations_shape, &output_v_temp));
+      output_v = &output_v_temp;
+    }
+
+    Tensor tmp_Rh;
+    const TensorShape tmp_Rh_shape = { 2, batch_size, 4 * hidden_size };
+    OP_REQUIRES_OK(context, context->allocate_temp(data_type, tmp_Rh_shape, &tmp_Rh));
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(output->flat<T>().data(), 0, output->AllocatedBytes(), stream);
+    cudaMemsetAsync(output_cell_state->flat<CellState<T>>().data(), 0, output_cell_state->AllocatedBytes(), stream);
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    const auto mask = DirectionPtrs<T>(zoneout_mask);
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BidirectionalForwardPass<T>& forward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return new BidirectionalForwardPass<T>(
+          training_,
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream);
+    });
+
+    forward.Run(
+        time_steps,
+        DirectionPtrs<T>(kernel).data(),
+        DirectionPtrs<T>(recurrent_kernel).data(),
+        DirectionPtrs<T>(bias).data(),
+        DevicePtr<T>(input),
+        DirectionPtrs<T>(*output).data(),
+        hidden_size,
+        DirectionPtrs<CellState<T>>(*output_cell_state).data(),
+        DirectionPtrs<T>(*output_v).data(),
+        DirectionPtrs<T>(tmp_Rh).data(),
+        has_zoneout ? zoneout_prob_ : 0.0f,
+        has_zoneout ? mask.data() : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }
+
+  private:
+    bool training_;
+    float zoneout_prob_;
+    PassCache<BidirectionalForwardPass<T>> cache_;
+};
+
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectional, Eigen::half);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectional, bfloat16);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectional, float);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectional, double);
+
+REGISTER_OP("HasteLstmBidirectionalGrad")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("S: {float, double}")  // The cell state type: float for 16-bit R.
+    .Input("x_t: R")                   // [C,N,T]
+    .Input("kernel_t: R")              // [2,H*4,C]
+    .Input("recurrent_kernel_t: R")    // [2,H*4,H]
+    .Input("bias: R")                  // [2,H*4]
+    .Input("h: R")                     // [2,T+1,N,H]
+    .Input("c: S")                     // [2,T+1,N,H]
+    .Input("v: R")                     // [2,T,N,H*4]
+    .Input("dh_new: R")                // [2,T+1,N,H]
+    .Input("dc_new: S")                // [2,T+1,N,H]
+    .Input("zoneout_mask: R")          // [2,T,N,H]
+    .Input("sequence_length: int32")   // [N]
+    .Output("dx: R")                   // [T,N,C]
+    .Output("dw: R")                   // [2,C,H*4]
+    .Output("dr: R")                   // [2,H,H*4]
+    .Output("db: R")                   // [2,H*4]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle x_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_kernel_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle h_shape;
+      ShapeHandle c_shape;
+      ShapeHandle v_shape;
+      ShapeHandle dh_new_shape;
+      ShapeHandle dc_new_shape;
+      ShapeHandle zoneout_mask_shape;
+      ShapeHandle sequence_length_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &x_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 3, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 3, &recurrent_kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 4, &h_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 4, &c_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 4, &v_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 4, &dh_new_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 4, &dc_new_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 4, &zoneout_mask_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(10), 1, &sequence_length_shape));
 
       DimensionHandle input_size = c->Dim(x_shape, 0);
       DimensionHandle time_steps = c->Dim(x_shape, 1);
       DimensionHandle batch_size = c->Dim(x_shape, 2);
-      DimensionHandle hidden_size = c->Dim(recurrent_kernel_shape, 1);
+      DimensionHandle hidden_size = c->Dim(recurrent_kernel_shape, 2);
 
       c->set_output(0, c->MakeShape({ time_steps, batch_size, input_size }));
-      c->set_output(1, c->MakeShape({ input_size, c->Value(hidden_size) * 4 }));
-      c->set_output(2, c->MakeShape({ hidden_size, c->Value(hidden_size) * 4 }));
+      c->set_output(1, c->MakeShape({ 2, input_size, c->Value(hidden_size) * 4 }));
+      c->set_output(2, c->MakeShape({ 2, hidden_size, c->Value(hidden_size) * 4 }));
       c->set_output(3, bias_shape);
       return Status::OK();
     });
 
 template<typename T>
-struct HasteLstmGradOp : public OpKernel {
-  explicit HasteLstmGradOp(OpKernelConstruction* context) : OpKernel(context) {}
+struct HasteLstmBidirectionalGradOp : public OpKernel {
+  explicit HasteLstmBidirectionalGradOp(OpKernelConstruction* context) : OpKernel(context) {}
 
   void Compute(OpKernelContext* context) override {
     const Tensor& input = context->input(0);
@@ -260,11 +1191,12 @@ struct HasteLstmGradOp : public OpKernel {
     const Tensor& dh_new = context->input(7);
     const Tensor& dc_new = context->input(8);
     const Tensor& zoneout_mask = context->input(9);
+    const Tensor& sequence_length = context->input(10);
 
     const auto input_size = input.shape().dim_size(0);
     const auto time_steps = input.shape().dim_size(1);
     const auto batch_size = input.shape().dim_size(2);
-    const auto hidden_size = recurrent_kernel.shape().dim_size(1);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(2);
     const bool has_zoneout = !!zoneout_mask.NumElements();
     const auto data_type = DataTypeToEnum<T>::value;
 
@@ -274,66 +1206,463 @@ struct HasteLstmGradOp : public OpKernel {
     OP_REQUIRES_OK(context, context->allocate_output(0, dx_shape, &dx));
 
     // Needs to be initialized to 0.
-    const TensorShape dW_shape = { input_size, hidden_size * 4 };
+    const TensorShape dW_shape = { 2, input_size, hidden_size * 4 };
     Tensor* dW = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(1, dW_shape, &dW));
 
     // Needs to be initialized to 0.
-    const TensorShape dR_shape = { hidden_size, hidden_size * 4 };
+    const TensorShape dR_shape = { 2, hidden_size, hidden_size * 4 };
     Tensor* dR = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(2, dR_shape, &dR));
 
     // Needs to be initialized to 0.
-    const TensorShape db_shape = { hidden_size * 4 };
+    const TensorShape db_shape = { 2, hidden_size * 4 };
     Tensor* db = nullptr;
     OP_REQUIRES_OK(context, context->allocate_output(3, db_shape, &db));
 
     // Needs to be initialized to 0.
-    const TensorShape dh_shape = { batch_size, hidden_size };
+    const TensorShape dh_shape = { 2, batch_size, hidden_size };
     Tensor dh;
     OP_REQUIRES_OK(context, context->allocate_temp(data_type, dh_shape, &dh));
 
     // Needs to be initialized to 0.
-    const TensorShape dc_shape = { batch_size, hidden_size };
+    const TensorShape dc_shape = { 2, batch_size, hidden_size };
     Tensor dc;
-    OP_REQUIRES_OK(context, context->allocate_temp(data_type, dc_shape, &dc));
+    OP_REQUIRES_OK(context, context->allocate_temp(
+        DataTypeToEnum<CellState<T>>::value, dc_shape, &dc));
 
     Tensor dv;
     OP_REQUIRES_OK(context,
         context->forward_input_or_allocate_temp({ 6 }, data_type, v_vector.shape(), &dv));
 
-    cudaMemset(dW->flat<T>().data(), 0, dW->AllocatedBytes());
-    cudaMemset(dR->flat<T>().data(), 0, dR->AllocatedBytes());
-    cudaMemset(db->flat<T>().data(), 0, db->AllocatedBytes());
-    cudaMemset(dh.flat<T>().data(), 0, dh.AllocatedBytes());
-    cudaMemset(dc.flat<T>().data(), 0, dc.AllocatedBytes());
+    const cudaStream_t& stream = GetCudaStream(context);
+    cudaMemsetAsync(dW->flat<T>().data(), 0, dW->AllocatedBytes(), stream);
+    cudaMemsetAsync(dR->flat<T>().data(), 0, dR->AllocatedBytes(), stream);
+    cudaMemsetAsync(db->flat<T>().data(), 0, db->AllocatedBytes(), stream);
+    cudaMemsetAsync(dh.flat<T>().data(), 0, dh.AllocatedBytes(), stream);
+    cudaMemsetAsync(dc.flat<CellState<T>>().data(), 0, dc.AllocatedBytes(), stream);
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    const auto mask = DirectionPtrs<T>(zoneout_mask);
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    BidirectionalBackwardPass<T>& backward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return new BidirectionalBackwardPass<T>(
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream);
+    });
+
+    backward.Run(
+        time_steps,
+        DirectionPtrs<T>(kernel).data(),
+        DirectionPtrs<T>(recurrent_kernel).data(),
+        DirectionPtrs<T>(bias).data(),
+        DevicePtr<T>(input),
+        DirectionPtrs<T>(h_vector).data(),
+        hidden_size,
+        DirectionPtrs<CellState<T>>(c_vector).data(),
+        DirectionPtrs<T>(dh_new).data(),
+        DirectionPtrs<CellState<T>>(dc_new).data(),
+        DevicePtr<T>(*dx),
+        DirectionPtrs<T>(*dW).data(),
+        DirectionPtrs<T>(*dR).data(),
+        DirectionPtrs<T>(*db).data(),
+        DirectionPtrs<T>(dh).data(),
+        DirectionPtrs<CellState<T>>(dc).data(),
+        DirectionPtrs<T>(dv).data(),
+        has_zoneout ? mask.data() : nullptr,
+        lengths.device,
+        lengths.batch_sizes_or_null());
+  }
+
+  private:
+    PassCache<BidirectionalBackwardPass<T>> cache_;
+};
+
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectionalGrad, Eigen::half);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectionalGrad, bfloat16);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectionalGrad, float);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmBidirectionalGrad, double);
+
+// Converts cuDNN's canonical LSTM parameters (see `WeightFormat::kCudnn`) into the
+// kernels and bias that `HasteLstm` takes, in place of splitting, reordering and
+// transposing them with separate TF ops.
+REGISTER_OP("HasteLstmPackCudnnWeights")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("input_size: int")
+    .Attr("num_units: int")
+    .Input("opaque: R")               // [H*4*C + H*4*H + H*8]
+    .Output("kernel: R")              // [C,H*4]
+    .Output("recurrent_kernel: R")    // [H,H*4]
+    .Output("bias: R")                // [H*4]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle opaque_shape;
+      int input_size;
+      int num_units;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &opaque_shape));
+      TF_RETURN_IF_ERROR(c->GetAttr("input_size", &input_size));
+      TF_RETURN_IF_ERROR(c->GetAttr("num_units", &num_units));
 
-    BackwardPass<T> backward = BackwardPass<T>(
-        batch_size,
+      c->set_output(0, c->MakeShape({ input_size, num_units * 4 }));
+      c->set_output(1, c->MakeShape({ num_units, num_units * 4 }));
+      c->set_output(2, c->MakeShape({ num_units * 4 }));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmPackCudnnWeightsOp : public OpKernel {
+  explicit HasteLstmPackCudnnWeightsOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("input_size", &input_size_));
+    OP_REQUIRES_OK(context, context->GetAttr("num_units", &num_units_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& opaque = context->input(0);
+    const auto format = haste::v0::WeightFormat::kCudnn;
+    const auto size = PackedWeights<T>::Size(format, input_size_, num_units_);
+
+    OP_REQUIRES(context, opaque.NumElements() == static_cast<int64>(size),
+        errors::InvalidArgument("opaque must have ", size, " elements, got ", opaque.NumElements()));
+
+    Tensor* kernel = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, { input_size_, num_units_ * 4 }, &kernel));
+
+    Tensor* recurrent_kernel = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, { num_units_, num_units_ * 4 }, &recurrent_kernel));
+
+    Tensor* bias = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, { num_units_ * 4 }, &bias));
+
+    PackedWeights<T>::Pack(
+        format,
+        haste::v0::GateLayout::kBlocked,
+        input_size_,
+        num_units_,
+        DevicePtr<T>(opaque),
+        DevicePtr<T>(*kernel),
+        DevicePtr<T>(*recurrent_kernel),
+        DevicePtr<T>(*bias),
+        GetCudaStream(context));
+  }
+
+  private:
+    int input_size_;
+    int num_units_;
+};
+
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmPackCudnnWeights, Eigen::half);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmPackCudnnWeights, bfloat16);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmPackCudnnWeights, float);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmPackCudnnWeights, double);
+
+// Gradient of `HasteLstmPackCudnnWeights`.
+REGISTER_OP("HasteLstmUnpackCudnnGradients")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Input("dkernel: R")              // [C,H*4]
+    .Input("drecurrent_kernel: R")    // [H,H*4]
+    .Input("dbias: R")                // [H*4]
+    .Output("dopaque: R")             // [H*4*C + H*4*H + H*8]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_kernel_shape;
+      ShapeHandle bias_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &recurrent_kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 1, &bias_shape));
+
+      const auto input_size = c->Value(c->Dim(kernel_shape, 0));
+      const auto hidden_size = c->Value(c->Dim(recurrent_kernel_shape, 0));
+      if (input_size == InferenceContext::kUnknownDim || hidden_size == InferenceContext::kUnknownDim) {
+        c->set_output(0, c->Vector(InferenceContext::kUnknownDim));
+        return Status::OK();
+      }
+      c->set_output(0, c->Vector(hidden_size * 4 * (input_size + hidden_size + 2)));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmUnpackCudnnGradientsOp : public OpKernel {
+  explicit HasteLstmUnpackCudnnGradientsOp(OpKernelConstruction* context) : OpKernel(context) {}
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& dkernel = context->input(0);
+    const Tensor& drecurrent_kernel = context->input(1);
+    const Tensor& dbias = context->input(2);
+
+    const auto input_size = dkernel.shape().dim_size(0);
+    const auto hidden_size = drecurrent_kernel.shape().dim_size(0);
+    const auto format = haste::v0::WeightFormat::kCudnn;
+    const auto size = PackedWeights<T>::Size(format, input_size, hidden_size);
+
+    Tensor* dopaque = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, { static_cast<int64>(size) }, &dopaque));
+
+    PackedWeights<T>::UnpackGradients(
+        format,
+        haste::v0::GateLayout::kBlocked,
         input_size,
         hidden_size,
-        GetCublasHandle());
+        DevicePtr<T>(dkernel),
+        DevicePtr<T>(drecurrent_kernel),
+        DevicePtr<T>(dbias),
+        DevicePtr<T>(*dopaque),
+        GetCudaStream(context));
+  }
+};
 
-    backward.Run(
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmUnpackCudnnGradients, Eigen::half);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmUnpackCudnnGradients, bfloat16);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmUnpackCudnnGradients, float);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmUnpackCudnnGradients, double);
+
+// Quantizes trained LSTM kernels to int8 for `HasteLstmQuantized`, with the scale of the
+// inputs calibrated on `calibration_inputs`, e.g. a few representative batches.
+REGISTER_OP("HasteLstmQuantize")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Input("kernel: R")                           // [C,H*4]
+    .Input("recurrent_kernel: R")                 // [H,H*4]
+    .Input("calibration_inputs: R")               // [...,C]
+    .Output("quantized_kernel: int8")             // [C,H*4]
+    .Output("quantized_recurrent_kernel: int8")   // [H,H*4]
+    .Output("kernel_scale: float")                // [H*4]
+    .Output("recurrent_kernel_scale: float")      // [H*4]
+    .Output("input_scale: float")                 // [1]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &recurrent_shape));
+
+      c->set_output(0, kernel_shape);
+      c->set_output(1, recurrent_shape);
+      c->set_output(2, c->Vector(c->Dim(recurrent_shape, 1)));
+      c->set_output(3, c->Vector(c->Dim(recurrent_shape, 1)));
+      c->set_output(4, c->Vector(1));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmQuantizeOp : public OpKernel {
+  explicit HasteLstmQuantizeOp(OpKernelConstruction* context) : OpKernel(context) {}
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& kernel = context->input(0);
+    const Tensor& recurrent_kernel = context->input(1);
+    const Tensor& calibration_inputs = context->input(2);
+
+    const auto input_size = kernel.shape().dim_size(0);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+
+    OP_REQUIRES(context, recurrent_kernel.shape().dim_size(1) == hidden_size * 4,
+        errors::InvalidArgument("recurrent_kernel must have shape [H,H*4]. Found ",
+            recurrent_kernel.shape().DebugString()));
+    OP_REQUIRES(context, kernel.shape().dim_size(1) == hidden_size * 4,
+        errors::InvalidArgument("kernel[1] and recurrent_kernel[1] dimensions must match. Found ",
+            kernel.shape().dim_size(1), " and ", hidden_size * 4));
+
+    Tensor* quantized_kernel = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, kernel.shape(), &quantized_kernel));
+
+    Tensor* quantized_recurrent_kernel = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, recurrent_kernel.shape(), &quantized_recurrent_kernel));
+
+    Tensor* kernel_scale = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, { hidden_size * 4 }, &kernel_scale));
+
+    Tensor* recurrent_kernel_scale = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(3, { hidden_size * 4 }, &recurrent_kernel_scale));
+
+    Tensor* input_scale = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(4, { 1 }, &input_scale));
+
+    Tensor input_absmax;
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_FLOAT, { 1 }, &input_absmax));
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    float* absmax = input_absmax.flat<float>().data();
+    cudaMemsetAsync(absmax, 0, sizeof(float), stream);
+    QuantizedWeights<T>::Calibrate(
+        calibration_inputs.NumElements(),
+        DevicePtr<T>(calibration_inputs),
+        absmax,
+        stream);
+    QuantizedWeights<T>::Quantize(
+        input_size,
+        hidden_size,
+        DevicePtr<T>(kernel),
+        DevicePtr<T>(recurrent_kernel),
+        nullptr,
+        absmax,
+        quantized_kernel->flat<int8>().data(),
+        quantized_recurrent_kernel->flat<int8>().data(),
+        kernel_scale->flat<float>().data(),
+        recurrent_kernel_scale->flat<float>().data(),
+        input_scale->flat<float>().data(),
+        stream);
+  }
+};
+
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmQuantize, Eigen::half);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmQuantize, bfloat16);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmQuantize, float);
+REGISTER_GPU_WEIGHTS_KERNEL(HasteLstmQuantize, double);
+
+// Inference with the int8 kernels of `HasteLstmQuantize` (see `ForwardPass::RunQuantized`).
+REGISTER_OP("HasteLstmQuantized")
+    .Attr("R: {half, bfloat16, float, double}")
+    .Attr("S: {float, double}")  // The cell state type: float for 16-bit R.
+    .Attr("zoneout_prob: float")
+    .Input("x: R")                              // [T,N,C]
+    .Input("kernel: int8")                      // [C,H*4]
+    .Input("recurrent_kernel: int8")            // [H,H*4]
+    .Input("kernel_scale: float")               // [H*4]
+    .Input("recurrent_kernel_scale: float")     // [H*4]
+    .Input("input_scale: float")                // [1]
+    .Input("bias: R")                           // [H*4]
+    .Input("sequence_length: int32")            // [N]
+    .Input("h0: R")                             // [N,H] or [0,0]
+    .Input("c0: S")                             // [N,H] or [0,0]
+    .Output("h: R")                             // [T+1,N,H]
+    .Output("c: S")                             // [T+1,N,H]
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle input_shape;
+      ShapeHandle kernel_shape;
+      ShapeHandle recurrent_shape;
+      ShapeHandle kernel_scale_shape;
+      ShapeHandle recurrent_scale_shape;
+      ShapeHandle input_scale_shape;
+      ShapeHandle bias_shape;
+      ShapeHandle sequence_length_shape;
+      ShapeHandle h0_shape;
+      ShapeHandle c0_shape;
+
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &input_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &kernel_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &recurrent_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &kernel_scale_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &recurrent_scale_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &input_scale_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 1, &bias_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(7), 1, &sequence_length_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(8), 2, &h0_shape));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(9), 2, &c0_shape));
+
+      const DimensionHandle time_steps = c->Dim(input_shape, 0);
+      const DimensionHandle batch_size = c->Dim(input_shape, 1);
+      const DimensionHandle hidden_size = c->Dim(recurrent_shape, 0);
+      DimensionHandle time_steps_plus_1;
+
+      TF_RETURN_IF_ERROR(c->Add(time_steps, 1, &time_steps_plus_1));
+
+      c->set_output(0, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
+      c->set_output(1, c->MakeShape({ time_steps_plus_1, batch_size, hidden_size }));
+      return Status::OK();
+    });
+
+template<typename T>
+struct HasteLstmQuantizedOp : public OpKernel {
+  explicit HasteLstmQuantizedOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("zoneout_prob", &zoneout_prob_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    const Tensor& kernel = context->input(1);
+    const Tensor& recurrent_kernel = context->input(2);
+    const Tensor& kernel_scale = context->input(3);
+    const Tensor& recurrent_kernel_scale = context->input(4);
+    const Tensor& input_scale = context->input(5);
+    const Tensor& bias = context->input(6);
+    const Tensor& sequence_length = context->input(7);
+    const Tensor& h0 = context->input(8);
+    const Tensor& c0 = context->input(9);
+
+    const auto time_steps = input.shape().dim_size(0);
+    const auto batch_size = input.shape().dim_size(1);
+    const auto input_size = input.shape().dim_size(2);
+    const auto hidden_size = recurrent_kernel.shape().dim_size(0);
+
+    OP_REQUIRES(context, input_size == kernel.shape().dim_size(0),
+        errors::InvalidArgument("input[2] and kernel[0] dimensions must match. Found ",
+            input_size, " and ", kernel.shape().dim_size(0)));
+    OP_REQUIRES(context, input_size % 4 == 0 && hidden_size % 4 == 0,
+        errors::InvalidArgument("The int8 GEMMs need the input and hidden sizes to be "
+            "multiples of 4. Found ", input_size, " and ", hidden_size));
+
+    const TensorShape output_shape = { time_steps + 1, batch_size, hidden_size };
+
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+
+    Tensor* output_cell_state = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(1, output_shape, &output_cell_state));
+
+    const cudaStream_t& stream = GetCudaStream(context);
+    const size_t state_bytes = batch_size * hidden_size * sizeof(T);
+    const size_t cell_state_bytes = batch_size * hidden_size * sizeof(CellState<T>);
+    OP_REQUIRES_OK(context, SetInitialState(
+        h0, "h0", batch_size, hidden_size, state_bytes, stream, output->flat<T>().data()));
+    OP_REQUIRES_OK(context, SetInitialState(
+        c0, "c0", batch_size, hidden_size, cell_state_bytes, stream,
+        output_cell_state->flat<CellState<T>>().data()));
+
+    Tensor sequence_length_dev;
+    SequenceLengths lengths;
+    OP_REQUIRES_OK(context, PrepareSequenceLengths(
+        context, sequence_length, time_steps, batch_size, stream, &sequence_length_dev, &lengths));
+
+    std::lock_guard<std::mutex> lock(cache_.mutex());
+    ForwardPass<T>& forward = cache_.Get(stream, GetCublasHandle(), batch_size, input_size, hidden_size, [&]() {
+      return WithPhaseTiming(new ForwardPass<T>(
+          false,
+          batch_size,
+          input_size,
+          hidden_size,
+          GetCublasHandle(),
+          stream));
+    });
+    ExportPhaseStats(type_string(), forward.CollectPhaseStats());
+
+    Tensor workspace;
+    const TensorShape workspace_shape = { static_cast<int64>(forward.GetQuantizedWorkspaceSize(time_steps)) };
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_UINT8, workspace_shape, &workspace));
+
+    const QuantizedWeights<T> weights = {
+      kernel.flat<int8>().data(),
+      recurrent_kernel.flat<int8>().data(),
+      kernel_scale.flat<float>().data(),
+      recurrent_kernel_scale.flat<float>().data(),
+      input_scale.flat<float>().data(),
+      DevicePtr<T>(bias),
+    };
+    forward.RunQuantized(
         time_steps,
-        kernel.flat<T>().data(),
-        recurrent_kernel.flat<T>().data(),
-        bias.flat<T>().data(),
-        input.flat<T>().data(),
-        h_vector.flat<T>().data(),
-        c_vector.flat<T>().data(),
-        dh_new.flat<T>().data(),
-        dc_new.flat<T>().data(),
-        dx->flat<T>().data(),
-        dW->flat<T>().data(),
-        dR->flat<T>().data(),
-        db->flat<T>().data(),
-        dh.flat<T>().data(),
-        dc.flat<T>().data(),
-        dv.flat<T>().data(),
-        has_zoneout ? zoneout_mask.flat<T>().data() : nullptr);
+        weights,
+        DevicePtr<T>(input),
+        DevicePtr<T>(*output),
+        DevicePtr<CellState<T>>(*output_cell_state),
+        zoneout_prob_,
+        lengths.device,
+        lengths.batch_sizes_or_null(),
+        workspace.flat<uint8>().data());
   }
+
+  private:
+    float zoneout_prob_;
+    PassCache<ForwardPass<T>> cache_;
 };
 
-REGISTER_GPU_KERNEL(HasteLstmGrad, float);
-REGISTER_GPU_KERNEL(HasteLstmGrad, double);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmQuantized, Eigen::half);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmQuantized, bfloat16);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmQuantized, float);
+REGISTER_GPU_LSTM_KERNEL(HasteLstmQuantized, double);
@@ -31,15 +31,44 @@ __all__ = [
 LIB = tf.load_op_library(pkg_resources.resource_filename(__name__, 'libhaste_tf.so'))
 
 
-def reverse_sequence(sequence, sequence_length):
+def sequence_lengths(sequence_length):
   """
-  Reverses a batched sequence in time-major order [T,N,...]. The input sequence
-  may be padded, in which case sequence_length specifies the unpadded length of
-  each sequence.
+  Converts an optional `sequence_length` tensor to the form the ops expect. An
+  empty tensor means that every sequence spans all time steps.
   """
   if sequence_length is None:
-    return tf.reverse(sequence, axis=[0])
-  return tf.reverse_sequence(sequence, sequence_length, seq_axis=0, batch_axis=1)
+    return tf.zeros([0], dtype=tf.int32)
+  return tf.cast(sequence_length, tf.int32)
+
+
+def state_or_zeros(state, dtype):
+  """
+  Converts an optional [N,H] initial state tensor to the form the ops expect, of
+  the given `dtype`. An empty [0,0] tensor means that the state starts out as zeros.
+  """
+  if state is None:
+    return tf.zeros([0, 0], dtype=dtype)
+  return tf.cast(state, dtype)
+
+
+def cell_state_dtype(dtype):
+  """
+  The dtype of the cell state tensors of the ops for a layer of the given `dtype`.
+  The cell state of 16-bit layers is kept in `tf.float32`.
+  """
+  if dtype in (tf.float16, tf.bfloat16):
+    return tf.float32
+  return dtype
+
+
+def initial_state_gradient(recurrent_grad, output_grad, state):
+  """
+  Returns the gradient with respect to an op's initial `state` input: the part
+  that reached it through the recurrence plus the gradient of the op's t=0
+  output, which is the state itself. Empty if `state` is.
+  """
+  grad = recurrent_grad + output_grad
+  return grad[:tf.shape(state)[0], :tf.shape(state)[1]]
 
 
 def transpose(tensor_or_tuple, perm):
@@ -62,17 +91,90 @@ def lstm_gradient(op, *grads):
   R = op.inputs[2]
   b = op.inputs[3]
   zoneout_mask = op.inputs[4]
+  sequence_length = op.inputs[5]
+  zoneout_seed = op.inputs[6]
+  dropconnect_seed = op.inputs[7]
+  h0 = op.inputs[8]
+  c0 = op.inputs[9]
+  P = op.inputs[10]
+  layer_norm = op.inputs[11]
+  h = op.outputs[0]
+  c = op.outputs[1]
+  v = op.outputs[2]
+  layer_norm_cache = op.outputs[3]
+
+  # `c` only holds checkpoints and `v` is empty, so the gradient op recomputes them.
+  checkpoint_interval = op.get_attr('checkpoint_interval')
+  if checkpoint_interval > 0:
+    dx, dW, dR, db, dh0, dc0 = LIB.haste_lstm_checkpointed_grad(
+        x,
+        W,
+        R,
+        tf.transpose(R, [1, 0]),
+        b,
+        h,
+        c,
+        grads[0],
+        grads[1],
+        zoneout_mask,
+        sequence_length,
+        zoneout_seed,
+        dropconnect_seed,
+        zoneout_prob=op.get_attr('zoneout_prob'),
+        dropconnect_rate=op.get_attr('dropconnect_rate'),
+        checkpoint_interval=checkpoint_interval)
+    # The forward op rejects the cell variants in checkpointed mode.
+    dP, dlayer_norm = None, None
+  else:
+    # The grad op reads `x`, `W` and `R` as given to the forward op; its GEMMs transpose
+    # them on the fly.
+    dx, dW, dR, db, dh0, dc0, dP, dlayer_norm = LIB.haste_lstm_grad(
+        x, W, R, b, h, c, v, grads[0], grads[1], zoneout_mask, sequence_length, zoneout_seed,
+        dropconnect_seed, P, layer_norm, layer_norm_cache,
+        activation_storage=op.get_attr('activation_storage'),
+        zoneout_prob=op.get_attr('zoneout_prob'),
+        dropconnect_rate=op.get_attr('dropconnect_rate'),
+        time_major=op.get_attr('time_major'),
+        coupled_gates=op.get_attr('coupled_gates'))
+
+  # `c` is time-major either way.
+  dh_new0 = grads[0][0] if op.get_attr('time_major') else grads[0][:, 0]
+  dh0 = initial_state_gradient(dh0, dh_new0, h0)
+  dc0 = initial_state_gradient(dc0, grads[1][0], c0)
+  return [dx, dW, dR, db, None, None, None, None, dh0, dc0, dP, dlayer_norm]
+
+
+@tf.RegisterGradient("HasteLstmPackCudnnWeights")
+def lstm_pack_cudnn_weights_gradient(op, *grads):
+  return LIB.haste_lstm_unpack_cudnn_gradients(grads[0], grads[1], grads[2])
+
+
+@tf.RegisterGradient("HasteLstmBidirectional")
+def lstm_bidirectional_gradient(op, *grads):
+  training = op.get_attr('training')
+  if not training:
+    raise ValueError(('LSTM can only compute gradients if `training=True` was specified during the '
+                      'forward pass.\nFailed op: {}').format(op.name))
+
+  # Extract inputs and outputs from the op.
+  x = op.inputs[0]
+  W = op.inputs[1]
+  R = op.inputs[2]
+  b = op.inputs[3]
+  zoneout_mask = op.inputs[4]
+  sequence_length = op.inputs[5]
   h = op.outputs[0]
   c = op.outputs[1]
   v = op.outputs[2]
 
   # Pre-transpose matrices for better performance.
   x = tf.transpose(x, [2, 0, 1])
-  W = tf.transpose(W, [1, 0])
-  R = tf.transpose(R, [1, 0])
+  W = tf.transpose(W, [0, 2, 1])
+  R = tf.transpose(R, [0, 2, 1])
 
-  dx, dW, dR, db = LIB.haste_lstm_grad(x, W, R, b, h, c, v, grads[0], grads[1], zoneout_mask)
-  return [dx, dW, dR, db, None]
+  dx, dW, dR, db = LIB.haste_lstm_bidirectional_grad(
+      x, W, R, b, h, c, v, grads[0], grads[1], zoneout_mask, sequence_length)
+  return [dx, dW, dR, db, None, None]
 
 
 class LSTMLayer(tf.Module):
@@ -84,6 +186,11 @@ class LSTMLayer(tf.Module):
         forget_bias=1.0,
         dropout=0.0,
         zoneout=0.0,
+        checkpoint_interval=0,
+        activation_storage='native',
+        peephole=False,
+        coupled_gates=False,
+        layer_norm=False,
         dtype=None,
         name=None,
         cudnn_compat=False):
@@ -98,11 +205,19 @@ class LSTMLayer(tf.Module):
     self.forget_bias = forget_bias
     self.dropout = dropout
     self.zoneout = zoneout
+    self.checkpoint_interval = checkpoint_interval
+    self.activation_storage = activation_storage
+    self.use_peephole = peephole
+    self.coupled_gates = coupled_gates
+    self.use_layer_norm = layer_norm
     self.dtype = dtype or tf.float32
     self.cudnn_compat = cudnn_compat
     self.kernel = None
     self.recurrent_kernel = None
     self.bias = None
+    self.peephole = None
+    self.layer_norm = None
+    self.quantized = None
     self.built = False
 
   def build(self, shape):
@@ -135,6 +250,7 @@ class LSTMLayer(tf.Module):
         self._kernel = v1.get_variable('kernel', initializer=weights)
         self.kernel, self.recurrent_kernel = tf.split(self._kernel, [input_size, num_units], axis=0)
         self.bias = v1.get_variable('bias', initializer=biases)
+        self.build_cell_variants()
         self.built = True
         return
 
@@ -149,32 +265,26 @@ class LSTMLayer(tf.Module):
         opaque_initial_value = tf.concat([kernel_weights, recurrent_weights, biases, extra_biases], axis=-1)
         self.opaque = v1.get_variable('opaque_kernel', initializer=opaque_initial_value)
 
-    # Split into 3 variables.
-    W_size = 4 * input_size * num_units
-    R_size = 4 * num_units * num_units
-    b_size = 8 * num_units
-    kernel, recurrent_kernel, bias = tf.split(opaque, [W_size, R_size, b_size])
-
-    # Convert from cuDNN [i, f, g, o] format to TF and LMNT [i, g, f, o] format.
-    # Note that we only use a single bias vector so we sum the two separate ones
-    # and then reorder formats.
-    Wi, Wf, Wg, Wo = tf.split(kernel, 4)
-    Ri, Rf, Rg, Ro = tf.split(recurrent_kernel, 4)
-    bi, bf, bg, bo = tf.split(tf.reduce_sum(tf.split(bias, 2), axis=0), 4)
-    kernel = tf.concat([Wi, Wg, Wf, Wo], axis=0)
-    recurrent_kernel = tf.concat([Ri, Rg, Rf, Ro], axis=0)
-    bias = tf.concat([bi, bg, bf, bo], axis=0)
-
-    # Shape them correctly.
-    self.kernel = tf.reshape(kernel, [4 * num_units, input_size])
-    self.recurrent_kernel = tf.reshape(recurrent_kernel, [4 * num_units, num_units])
-    self.bias = tf.reshape(bias, [4 * num_units])
-
-    # Pre-transpose the kernels.
-    self.kernel = tf.transpose(self.kernel, [1, 0])
-    self.recurrent_kernel = tf.transpose(self.recurrent_kernel, [1, 0])
+    # Convert from cuDNN's [i, f, g, o] format with two bias vectors to the LMNT
+    # [i, g, f, o] format with a single, summed bias vector in one op.
+    self.kernel, self.recurrent_kernel, self.bias = LIB.haste_lstm_pack_cudnn_weights(
+        self.opaque, input_size=input_size, num_units=num_units)
+    with self.name_scope, v1.variable_scope(self.realname, 'lstm_cell'):
+      self.build_cell_variants()
     self.built = True
 
+  def build_cell_variants(self):
+    # The peephole weights start out at zero, so the layer starts out as a standard
+    # LSTM. The layer normalization's gains start out at one and its biases at zero.
+    num_units = self.num_units
+    if self.use_peephole:
+      self.peephole = v1.get_variable(
+          'peephole', initializer=tf.zeros([3, num_units], dtype=self.dtype))
+    if self.use_layer_norm:
+      self.layer_norm = v1.get_variable('layer_norm', initializer=tf.concat([
+          tf.ones([1, num_units * 4], dtype=self.dtype),
+          tf.zeros([1, num_units * 4], dtype=self.dtype)], axis=0))
+
   @property
   def state_size(self):
     return rnn_cell.LSTMStateTuple(self.num_units, self.num_units)
@@ -183,40 +293,112 @@ class LSTMLayer(tf.Module):
   def output_size(self):
     return self.num_units
 
-  def __call__(self, x, sequence_length, training):
-    self.build(x.shape)
-
-    shape = tf.shape(x)
-    time_steps = shape[0]
-    batch_size = shape[1]
-
+  def zoneout_mask(self, time_steps, batch_size):
     # Use an empty zoneout mask if no zoneout is going to be applied.
     # Sadly, we can't pass `None` to the op but at least we won't be wasting
     # memory or bandwidth on this tensor.
-    zoneout_mask = tf.zeros([0, 0, 0], dtype=self.dtype)
-    if self.zoneout:
-      zoneout_mask = 1.0 - self.zoneout
-      zoneout_mask += tf.random_uniform([time_steps, batch_size, self.num_units], dtype=self.dtype)
-      zoneout_mask = tf.floor(zoneout_mask)
-
-    recurrent_kernel = tf.nn.dropout(self.recurrent_kernel, rate=self.dropout)
-    h, c, _ = LIB.haste_lstm(
-        x,
-        self.kernel,
-        recurrent_kernel,
-        self.bias,
-        zoneout_mask,
-        training=training,
-        zoneout_prob=self.zoneout)
+    if not self.zoneout:
+      return tf.zeros([0, 0, 0], dtype=self.dtype)
+    zoneout_mask = 1.0 - self.zoneout
+    zoneout_mask += tf.random_uniform([time_steps, batch_size, self.num_units], dtype=self.dtype)
+    return tf.floor(zoneout_mask)
+
+  def zoneout_seed(self):
+    # The unidirectional op generates the zoneout mask on the GPU from a seed and
+    # offset instead, so no [T,N,H] mask is built or kept around for the gradient.
+    if not self.zoneout:
+      return tf.zeros([0], dtype=tf.int64)
+    return tf.random_uniform([2], minval=tf.int64.min, maxval=tf.int64.max, dtype=tf.int64)
+
+  def dropconnect_seed(self):
+    # The unidirectional op masks the recurrent kernel on the GPU from a seed and offset,
+    # so the masked kernel is never materialized as a TF tensor.
+    if not self.dropout:
+      return tf.zeros([0], dtype=tf.int64)
+    return tf.random_uniform([2], minval=tf.int64.min, maxval=tf.int64.max, dtype=tf.int64)
+
+  def dropped_recurrent_kernel(self):
+    return tf.nn.dropout(self.recurrent_kernel, rate=self.dropout)
+
+  def has_cell_variant(self):
+    return self.use_peephole or self.coupled_gates or self.use_layer_norm
+
+  def cell_variants(self):
+    # Empty weights turn a variant off.
+    empty = tf.zeros([0, 0], dtype=self.dtype)
+    return (
+        empty if self.peephole is None else self.peephole,
+        empty if self.layer_norm is None else self.layer_norm)
+
+  def quantize(self, calibration_inputs):
+    if self.has_cell_variant():
+      raise ValueError('quantize does not support peephole, coupled_gates or layer_norm.')
+    self.build(calibration_inputs.shape)
+    self.quantized = LIB.haste_lstm_quantize(
+        self.kernel, self.recurrent_kernel, calibration_inputs)
+
+  def reads_batch_major(self, training):
+    """
+    Whether the op that runs the layer in `training` mode reads and writes
+    batch-major sequences in place. Quantized inference, activation
+    checkpointing and compact activation storage only address time-major ones.
+    """
+    if self.quantized is not None and not training:
+      return False
+    return not training or (not self.checkpoint_interval and self.activation_storage == 'native')
+
+  def __call__(self, x, sequence_length, training, state=None, time_major=True):
+    self.build(x.shape)
 
+    if not time_major and not self.reads_batch_major(training):
+      h, state = self(transpose(x, [1, 0, 2]), sequence_length, training, state)
+      return transpose(h, [1, 0, 2]), state
+
+    shape = tf.shape(x)
+    time_steps = shape[0] if time_major else shape[1]
+    batch_size = shape[1] if time_major else shape[0]
+
+    if self.quantized is not None and not training:
+      h, c = LIB.haste_lstm_quantized(
+          x,
+          *self.quantized,
+          self.bias,
+          sequence_lengths(sequence_length),
+          state_or_zeros(None if state is None else state.h, self.dtype),
+          state_or_zeros(None if state is None else state.c, cell_state_dtype(self.dtype)),
+          zoneout_prob=self.zoneout)
+    else:
+      h, c, _, _ = LIB.haste_lstm(
+          x,
+          self.kernel,
+          self.recurrent_kernel,
+          self.bias,
+          tf.zeros([0, 0, 0], dtype=self.dtype),
+          sequence_lengths(sequence_length),
+          self.zoneout_seed(),
+          self.dropconnect_seed(),
+          state_or_zeros(None if state is None else state.h, self.dtype),
+          state_or_zeros(None if state is None else state.c, cell_state_dtype(self.dtype)),
+          *self.cell_variants(),
+          training=training,
+          zoneout_prob=self.zoneout,
+          dropconnect_rate=self.dropout,
+          checkpoint_interval=self.checkpoint_interval,
+          activation_storage=self.activation_storage,
+          time_major=time_major,
+          coupled_gates=self.coupled_gates)
+
+    # States are carried through past the end of each sequence, so the last cell state
+    # is every sequence's final state even if `c` only holds checkpoints. `c` is
+    # time-major either way.
     if sequence_length is not None:
-      indices = sequence_length
-      indices = tf.stack([indices, tf.range(batch_size, dtype=sequence_length.dtype)], axis=-1)
-      state = rnn_cell.LSTMStateTuple(tf.gather_nd(c, indices), tf.gather_nd(h, indices))
+      indices = [sequence_length, tf.range(batch_size, dtype=sequence_length.dtype)]
+      indices = tf.stack(indices if time_major else indices[::-1], axis=-1)
+      state = rnn_cell.LSTMStateTuple(c[-1], tf.gather_nd(h, indices))
     else:
-      state = rnn_cell.LSTMStateTuple(c[-1], h[-1])
+      state = rnn_cell.LSTMStateTuple(c[-1], h[-1] if time_major else h[:, -1])
 
-    return h[1:], state
+    return (h[1:] if time_major else h[:, 1:]), state
 
 
 class LSTM(tf.Module):
@@ -258,6 +440,28 @@ class LSTM(tf.Module):
         regularization on the recurrent matrix. Defaults to 0.
       zoneout: (optional) float, sets the zoneout rate for Zoneout
         regularization. Defaults to 0.
+      checkpoint_interval: (optional) int, if positive, the training forward
+        pass only keeps the cell state of every `checkpoint_interval`'th time
+        step and the backward pass recomputes the rest. This trades roughly one
+        extra forward pass for most of the memory that training needs.
+        Unidirectional layers only. Defaults to 0 (disabled).
+      activation_storage: (optional) string, 'native', 'half', or 'fixed8'.
+        The format of the activations that training keeps for the backward
+        pass. 'half' stores them in FP16 and 'fixed8' as 8-bit fixed point,
+        which saves memory and bandwidth at the cost of slightly less precise
+        gradients. Can't be combined with `checkpoint_interval`.
+        Unidirectional layers only. Defaults to 'native'.
+      peephole: (optional) bool, if `True`, the input, forget and output gates
+        also see the cell state through a [3,H] `peephole` variable. Defaults
+        to `False`.
+      coupled_gates: (optional) bool, if `True`, the input gate is tied to the
+        forget gate as `1 - f` (CIFG). Defaults to `False`.
+      layer_norm: (optional) bool, if `True`, the pre-activations of each gate
+        are layer-normalized with the gains and biases of a [2,H*4]
+        `layer_norm` variable. Defaults to `False`.
+        The last three options are for unidirectional layers only and can't be
+        combined with `checkpoint_interval`, a compact `activation_storage` or
+        `quantize`.
       dtype: (optional) the data type for this layer. Defaults to `tf.float32`.
       name: (optional) string, the name for this layer.
       cudnn_compat: (optional) bool, if `True`, the variables created by this
@@ -267,6 +471,10 @@ class LSTM(tf.Module):
         `cudnn_compat=True` and restore it with CudnnLSTM. Defaults to `False`.
     """
     assert direction in ['unidirectional', 'bidirectional']
+    if direction == 'bidirectional' and any(
+        kwargs.get(key) for key in ['peephole', 'coupled_gates', 'layer_norm']):
+      raise ValueError('peephole, coupled_gates and layer_norm are only supported by '
+                       'unidirectional layers.')
 
     if direction == 'bidirectional':
       name = kwargs.pop('name', None)
@@ -308,7 +516,28 @@ class LSTM(tf.Module):
       return self.fwd_lstm.state_size, self.bwd_lstm.state_size
     return self.fwd_lstm.state_size
 
-  def __call__(self, inputs, training, sequence_length=None, time_major=False):
+  def quantize(self, calibration_inputs):
+    """
+    Switches inference to int8 weights.
+
+    Quantizes the kernels to int8 with a scale per gate column and calibrates
+    the scale of the inputs on `calibration_inputs`. Later calls with
+    `training=False` run on the quantized kernels, which take a quarter of the
+    memory of FP32 kernels, while training keeps using the full-precision
+    variables. Call it again after the variables change. The input and hidden
+    sizes must be multiples of 4, and the GPU must be of compute capability
+    6.1 or later. Unidirectional layers only.
+
+    Arguments:
+      calibration_inputs: Tensor, representative inputs of any shape whose
+        last dimension is the input size, e.g. a few batches of real data.
+        Inputs larger in magnitude than any of them are clamped.
+    """
+    if self.bwd_lstm is not None:
+      raise ValueError('quantize is only supported by unidirectional layers.')
+    self.fwd_lstm.quantize(calibration_inputs)
+
+  def __call__(self, inputs, training, sequence_length=None, time_major=False, initial_state=None):
     """
     Runs the LSTM layer.
 
@@ -322,26 +551,69 @@ class LSTM(tf.Module):
         length of each example in the input minibatch.
       time_major: (optional) bool, specifies whether `input` has shape [N,T,C]
         (`time_major=False`) or shape [T,N,C] (`time_major=True`).
+      initial_state: (optional) `LSTMStateTuple` of [N,H] tensors, the cell and
+        hidden states before the first time step. Defaults to zeros.
+        Unidirectional layers only.
 
     Returns:
       A pair, `(output, state)` for unidirectional layers, or a pair
       `([output_fwd, output_bwd], [state_fwd, state_bwd])` for bidirectional
-      layers. Each state object will be an instance of `LSTMStateTuple`.
+      layers. Each state object will be an instance of `LSTMStateTuple`. The
+      cell states of `tf.float16` and `tf.bfloat16` layers are `tf.float32`.
     """
+    if initial_state is not None and self.bwd_lstm is not None:
+      raise ValueError('initial_state is only supported by unidirectional layers.')
+
     self.build(inputs.shape)
 
+    # The unidirectional op reads a batch-major input in place and writes its output
+    # in the same order.
+    if self.bwd_lstm is not None:
+      return self._bidirectional(inputs, sequence_length, training, time_major)
+    return self.fwd_lstm(inputs, sequence_length, training, initial_state, time_major)
+
+  def _bidirectional(self, x, sequence_length, training, time_major):
+    # The bidirectional op only addresses time-major sequences.
     if not time_major:
-      inputs = transpose(inputs, [1, 0, 2])
+      result, state = self._bidirectional(
+          transpose(x, [1, 0, 2]), sequence_length, training, True)
+      return transpose(result, [1, 0, 2]), state
 
-    result, state = self.fwd_lstm(inputs, sequence_length, training)
+    # Both directions run in a single op on the same input. The reverse direction
+    # reads the input back to front in place (respecting `sequence_length`), so
+    # neither the input nor its output has to be reversed here.
+    fwd, bwd = self.fwd_lstm, self.bwd_lstm
 
-    if self.bwd_lstm is not None:
-      inputs = reverse_sequence(inputs, sequence_length)
-      bwd_result, bwd_state = self.bwd_lstm(inputs, sequence_length, training)
-      result = result, reverse_sequence(bwd_result, sequence_length)
-      state = state, bwd_state
+    shape = tf.shape(x)
+    time_steps = shape[0]
+    batch_size = shape[1]
 
-    if not time_major:
-      result = transpose(result, [1, 0, 2])
+    zoneout_mask = tf.zeros([0, 0, 0, 0], dtype=fwd.dtype)
+    if fwd.zoneout:
+      zoneout_mask = tf.stack([
+          fwd.zoneout_mask(time_steps, batch_size),
+          bwd.zoneout_mask(time_steps, batch_size)])
+
+    h, c, _ = LIB.haste_lstm_bidirectional(
+        x,
+        tf.stack([fwd.kernel, bwd.kernel]),
+        tf.stack([fwd.dropped_recurrent_kernel(), bwd.dropped_recurrent_kernel()]),
+        tf.stack([fwd.bias, bwd.bias]),
+        zoneout_mask,
+        sequence_lengths(sequence_length),
+        training=training,
+        zoneout_prob=fwd.zoneout)
+
+    # The reverse direction's states are stored back to front: its output for step t
+    # is at index t and its final state is at index 0.
+    fwd_h, bwd_h = h[0], h[1]
+    fwd_c, bwd_c = c[0], c[1]
+    if sequence_length is not None:
+      indices = sequence_length
+      indices = tf.stack([indices, tf.range(batch_size, dtype=sequence_length.dtype)], axis=-1)
+      fwd_state = rnn_cell.LSTMStateTuple(tf.gather_nd(fwd_c, indices), tf.gather_nd(fwd_h, indices))
+    else:
+      fwd_state = rnn_cell.LSTMStateTuple(fwd_c[-1], fwd_h[-1])
+    bwd_state = rnn_cell.LSTMStateTuple(bwd_c[0], bwd_h[0])
 
-    return result, state
+    return (fwd_h[1:], bwd_h[:-1]), (fwd_state, bwd_state)
@@ -0,0 +1,189 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include <cstdlib>
+#include <cstring>
+#include <cublas_v2.h>
+#include <cuda_runtime_api.h>
+#include <utility>
+#include <vector>
+
+#include "support.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
+
+using tensorflow::Status;
+using tensorflow::Tensor;
+using tensorflow::TensorShape;
+
+// LOL.
+struct CublasHandleContainer {
+  CublasHandleContainer() {
+    int count;
+    int current_device;
+    cudaGetDevice(&current_device);
+    cudaGetDeviceCount(&count);
+    for (int i = 0; i < count; ++i) {
+      cublasHandle_t handle;
+      cudaSetDevice(i);
+      cublasCreate(&handle);
+      handles.push_back(handle);
+    }
+    cudaSetDevice(current_device);
+  }
+
+  ~CublasHandleContainer() {
+    for (auto h : handles)
+      cublasDestroy(h);
+  }
+
+  std::vector<cublasHandle_t> handles;
+};
+
+cublasHandle_t GetCublasHandle() {
+  static CublasHandleContainer all_handles;
+  int device;
+  cudaGetDevice(&device);
+  return all_handles.handles[device];
+}
+
+bool PhaseTimingRequested() {
+  static const bool requested = [] {
+    const char* value = std::getenv("HASTE_PHASE_TIMING");
+    return value && std::strcmp(value, "1") == 0;
+  }();
+  return requested;
+}
+
+void ExportPhaseStats(const std::string& op, const haste::v0::PhaseStats& stats) {
+  static auto* phase_time = tensorflow::monitoring::Counter<2>::New(
+      "/haste/phase_time_usecs",
+      "GPU time spent in each phase of the Haste RNN ops.",
+      "op",
+      "phase");
+  static auto* timed_calls = tensorflow::monitoring::Counter<1>::New(
+      "/haste/timed_calls",
+      "Calls of the Haste RNN ops whose phases were timed.",
+      "op");
+  if (!PhaseTimingRequested())
+    return;
+
+  const std::pair<const char*, double> phases[] = {
+    { "input_projection", stats.input_projection_ms },
+    { "recurrence", stats.recurrence_ms },
+    { "pointwise", stats.pointwise_ms },
+    { "weight_gradient", stats.weight_gradient_ms },
+  };
+  for (const auto& phase : phases)
+    phase_time->GetCell(op, phase.first)->IncrementBy(static_cast<int64_t>(phase.second * 1000.0));
+  timed_calls->GetCell(op)->IncrementBy(stats.calls);
+}
+
+Status PrepareSequenceLengths(
+    tensorflow::OpKernelContext* context,
+    const Tensor& sequence_length,
+    const int time_steps,
+    const int batch_size,
+    const cudaStream_t& stream,
+    Tensor* sequence_length_dev,
+    SequenceLengths* lengths) {
+  if (!sequence_length.NumElements())
+    return Status::OK();
+
+  if (sequence_length.dims() != 1 || sequence_length.dim_size(0) != batch_size) {
+    return tensorflow::errors::InvalidArgument(
+        "sequence_length must be empty or have shape [", batch_size, "]. Found ",
+        sequence_length.shape().DebugString());
+  }
+
+  const auto host_lengths = sequence_length.flat<int>();
+  bool sorted = true;
+  for (int i = 0; i < batch_size; ++i) {
+    if (host_lengths(i) < 0 || host_lengths(i) > time_steps) {
+      return tensorflow::errors::InvalidArgument(
+          "sequence_length[", i, "] = ", host_lengths(i), " is not in [0, ", time_steps, "]");
+    }
+    sorted = sorted && (i == 0 || host_lengths(i) <= host_lengths(i - 1));
+  }
+
+  TF_RETURN_IF_ERROR(context->allocate_temp(
+      tensorflow::DT_INT32, TensorShape({ batch_size }), sequence_length_dev));
+  cudaMemcpyAsync(
+      sequence_length_dev->flat<int>().data(),
+      host_lengths.data(),
+      batch_size * sizeof(int),
+      cudaMemcpyHostToDevice,
+      stream);
+  lengths->device = sequence_length_dev->flat<int>().data();
+
+  // With a sorted batch, the items that are still running at step `t` are a prefix.
+  if (sorted) {
+    lengths->batch_sizes.assign(time_steps, 0);
+    for (int i = 0; i < batch_size; ++i)
+      for (int t = 0; t < host_lengths(i); ++t)
+        ++lengths->batch_sizes[t];
+  }
+  return Status::OK();
+}
+
+Status SetInitialState(
+    const Tensor& state,
+    const char* name,
+    const int batch_size,
+    const int hidden_size,
+    const size_t bytes,
+    const cudaStream_t& stream,
+    void* dst,
+    const size_t dst_pitch) {
+  const size_t row_bytes = batch_size ? bytes / batch_size : 0;
+  const bool dense = !dst_pitch || dst_pitch == row_bytes;
+  if (!state.NumElements()) {
+    if (dense)
+      cudaMemsetAsync(dst, 0, bytes, stream);
+    else
+      cudaMemset2DAsync(dst, dst_pitch, 0, row_bytes, batch_size, stream);
+    return Status::OK();
+  }
+
+  if (state.dims() != 2 || state.dim_size(0) != batch_size || state.dim_size(1) != hidden_size) {
+    return tensorflow::errors::InvalidArgument(
+        name, " must be empty or have shape [", batch_size, ",", hidden_size, "]. Found ",
+        state.shape().DebugString());
+  }
+
+  if (dense) {
+    cudaMemcpyAsync(dst, state.tensor_data().data(), bytes, cudaMemcpyDeviceToDevice, stream);
+  } else {
+    cudaMemcpy2DAsync(dst, dst_pitch, state.tensor_data().data(), row_bytes, row_bytes,
+        batch_size, cudaMemcpyDeviceToDevice, stream);
+  }
+  return Status::OK();
+}
+
+Status GetRandomSeed(const Tensor& tensor, const char* name, RandomSeed* seed) {
+  if (!tensor.NumElements())
+    return Status::OK();
+
+  if (tensor.dims() != 1 || tensor.dim_size(0) != 2) {
+    return tensorflow::errors::InvalidArgument(
+        name, " must be empty or have shape [2]. Found ",
+        tensor.shape().DebugString());
+  }
+
+  const auto values = tensor.flat<tensorflow::int64>();
+  seed->enabled = true;
+  seed->seed = static_cast<unsigned long long>(values(0));
+  seed->offset = static_cast<unsigned long long>(values(1));
+  return Status::OK();
+}
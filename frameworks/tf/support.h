@@ -0,0 +1,294 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "haste.h"
+#include "tensorflow/core/framework/numeric_types.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/stream_executor/stream.h"
+
+#define REGISTER_GPU_KERNEL(NAME, T)                          \
+  REGISTER_KERNEL_BUILDER(Name(#NAME)                         \
+                            .Device(DEVICE_GPU)               \
+                            .HostMemory("sequence_length")    \
+                            .TypeConstraint<T>("R"),          \
+                          NAME##Op<T>)
+
+// For the ops that also take `zoneout_seed` and `dropconnect_seed` inputs (see
+// `RandomSeed`).
+#define REGISTER_GPU_KERNEL_WITH_SEEDS(NAME, T)               \
+  REGISTER_KERNEL_BUILDER(Name(#NAME)                         \
+                            .Device(DEVICE_GPU)               \
+                            .HostMemory("sequence_length")    \
+                            .HostMemory("zoneout_seed")       \
+                            .HostMemory("dropconnect_seed")   \
+                            .TypeConstraint<T>("R"),          \
+                          NAME##Op<T>)
+
+// For the LSTM ops, whose cell state tensors have their own type `S` (see
+// `CellStateType`).
+#define REGISTER_GPU_LSTM_KERNEL(NAME, T)                                 \
+  REGISTER_KERNEL_BUILDER(Name(#NAME)                                     \
+                            .Device(DEVICE_GPU)                           \
+                            .HostMemory("sequence_length")                \
+                            .TypeConstraint<T>("R")                       \
+                            .TypeConstraint<CellStateType<T>::type>("S"), \
+                          NAME##Op<T>)
+
+#define REGISTER_GPU_LSTM_KERNEL_WITH_SEEDS(NAME, T)                      \
+  REGISTER_KERNEL_BUILDER(Name(#NAME)                                     \
+                            .Device(DEVICE_GPU)                           \
+                            .HostMemory("sequence_length")                \
+                            .HostMemory("zoneout_seed")                   \
+                            .HostMemory("dropconnect_seed")               \
+                            .TypeConstraint<T>("R")                       \
+                            .TypeConstraint<CellStateType<T>::type>("S"), \
+                          NAME##Op<T>)
+
+// For the ops that only convert weights and take no `sequence_length`.
+#define REGISTER_GPU_WEIGHTS_KERNEL(NAME, T)                  \
+  REGISTER_KERNEL_BUILDER(Name(#NAME)                         \
+                            .Device(DEVICE_GPU)               \
+                            .TypeConstraint<T>("R"),          \
+                          NAME##Op<T>)
+
+// Maps TF element types to the types that Haste is instantiated for. The 16-bit types
+// have identical layouts, so tensor data can be handed to Haste as-is.
+template<typename T>
+struct HasteType {
+  typedef T type;
+};
+
+template<>
+struct HasteType<Eigen::half> {
+  typedef __half type;
+};
+
+template<>
+struct HasteType<tensorflow::bfloat16> {
+  typedef __nv_bfloat16 type;
+};
+
+// The TF element type of the LSTM cell state and its gradients for element type `T`.
+// Haste keeps them in FP32 for the 16-bit types (see `haste::v0::accum_t`).
+template<typename T>
+struct CellStateType {
+  typedef T type;
+};
+
+template<>
+struct CellStateType<Eigen::half> {
+  typedef float type;
+};
+
+template<>
+struct CellStateType<tensorflow::bfloat16> {
+  typedef float type;
+};
+
+template<typename T>
+typename HasteType<T>::type* DevicePtr(tensorflow::Tensor& tensor) {
+  return reinterpret_cast<typename HasteType<T>::type*>(tensor.flat<T>().data());
+}
+
+template<typename T>
+const typename HasteType<T>::type* DevicePtr(const tensorflow::Tensor& tensor) {
+  return reinterpret_cast<const typename HasteType<T>::type*>(tensor.flat<T>().data());
+}
+
+// Splits a tensor whose leading dimension is 2 (e.g. the stacked per-direction weights
+// of a bidirectional layer) into pointers to its halves.
+template<typename T>
+std::array<typename HasteType<T>::type*, 2> DirectionPtrs(tensorflow::Tensor& tensor) {
+  auto data = DevicePtr<T>(tensor);
+  return { data, data + tensor.NumElements() / 2 };
+}
+
+template<typename T>
+std::array<const typename HasteType<T>::type*, 2> DirectionPtrs(const tensorflow::Tensor& tensor) {
+  auto data = DevicePtr<T>(tensor);
+  return { data, data + tensor.NumElements() / 2 };
+}
+
+// Parses the `activation_storage` attr of the RNN ops. Returns `false` for "native",
+// which keeps `v` in the op's element type, and `true` along with the format for the
+// `RunCompact` methods otherwise. Compact activations are passed between the forward
+// and gradient ops as an opaque vector of the op's element type.
+inline bool ParseActivationStorage(
+    const std::string& name,
+    haste::v0::ActivationStorage* storage) {
+  if (name == "half") {
+    *storage = haste::v0::ActivationStorage::kHalf;
+    return true;
+  }
+  if (name == "fixed8") {
+    *storage = haste::v0::ActivationStorage::kFixed8;
+    return true;
+  }
+  return false;
+}
+
+// The number of `T` elements needed to hold `bytes` bytes of compact activations.
+template<typename T>
+int64_t CompactActivationsElements(const size_t bytes) {
+  return (bytes + sizeof(T) - 1) / sizeof(T);
+}
+
+// Whether the `HASTE_PHASE_TIMING=1` environment variable asks for the phases of the
+// RNN ops to be timed (see `ForwardPass::EnablePhaseTiming`). Only has an effect on
+// builds with `make PROFILING=1`.
+bool PhaseTimingRequested();
+
+// Enables phase timing on a newly created `pass` if it was requested.
+template<typename Pass>
+Pass* WithPhaseTiming(Pass* pass) {
+  if (PhaseTimingRequested())
+    pass->EnablePhaseTiming();
+  return pass;
+}
+
+// Adds `stats` to TF's `/haste/phase_time_usecs` counter, labelled by `op` and phase,
+// and to `/haste/timed_calls`, so that the usual metric exporters pick them up.
+void ExportPhaseStats(const std::string& op, const haste::v0::PhaseStats& stats);
+
+// Returns the cuBLAS handle for the current device. Handles are created once per
+// process and shared by all Haste ops.
+cublasHandle_t GetCublasHandle();
+
+// Returns the CUDA stream that TensorFlow uses to run GPU kernels for this op. Haste
+// work is ordered against this stream so TF never needs to wait on the host for it.
+inline const cudaStream_t& GetCudaStream(tensorflow::OpKernelContext* context) {
+  const auto ptr = context->op_device_context()->stream()->implementation()->GpuStreamMemberHack();
+  return *reinterpret_cast<const cudaStream_t*>(ptr);
+}
+
+// Per-item sequence lengths in the form that `ForwardPass::Run` and `BackwardPass::Run`
+// expect. Both pointers are null if the op was given an empty `sequence_length`.
+struct SequenceLengths {
+  const int* device = nullptr;      // [N]
+  std::vector<int> batch_sizes;     // [T], empty unless the batch is sorted by length
+
+  const int* batch_sizes_or_null() const {
+    return batch_sizes.empty() ? nullptr : batch_sizes.data();
+  }
+};
+
+// Validates the host-memory `sequence_length` input ([N] or empty) against the number
+// of time steps, copies it to device memory on `stream`, and derives the per-step batch
+// sizes if the batch is sorted by decreasing length.
+tensorflow::Status PrepareSequenceLengths(
+    tensorflow::OpKernelContext* context,
+    const tensorflow::Tensor& sequence_length,
+    const int time_steps,
+    const int batch_size,
+    const cudaStream_t& stream,
+    tensorflow::Tensor* sequence_length_dev,
+    SequenceLengths* lengths);
+
+// Writes an op's initial state input `state` ([N,H], or [0,0] for zeros) called `name`
+// to `bytes` bytes of device memory at `dst` on `stream`. This is the t=0 slice of the
+// op's state output, the only part of it that the passes read without writing first.
+// `dst_pitch` is the number of bytes between the N rows of `dst`, for the t=0 slice of a
+// batch-major [N,T+1,H] output. 0 means that the rows are dense.
+tensorflow::Status SetInitialState(
+    const tensorflow::Tensor& state,
+    const char* name,
+    const int batch_size,
+    const int hidden_size,
+    const size_t bytes,
+    const cudaStream_t& stream,
+    void* dst,
+    const size_t dst_pitch = 0);
+
+// The seed and offset of an on-device zoneout or DropConnect mask (see
+// `ForwardPass::SetZoneoutSeed` and `ForwardPass::SetDropConnect`). `enabled` is false
+// if the op was given an empty seed, in which case it reads `zoneout_mask` instead or
+// doesn't apply DropConnect.
+struct RandomSeed {
+  bool enabled = false;
+  unsigned long long seed = 0;
+  unsigned long long offset = 0;
+};
+
+// Validates a host-memory seed input called `name` ([2] int64 holding the seed and
+// offset, or empty) and unpacks it into `seed`.
+tensorflow::Status GetRandomSeed(
+    const tensorflow::Tensor& tensor,
+    const char* name,
+    RandomSeed* seed);
+
+// Keeps `ForwardPass`/`BackwardPass` objects alive across calls to an op kernel so
+// their CUDA streams and events are created once per (device, stream, cuBLAS handle, N,
+// C, H) instead of on every `Compute`. The stream and handle are part of the key since a
+// pass joins its work back into the stream it was constructed with, and TF may run the
+// same kernel on different compute streams. A pass must only be used while holding
+// `mutex()` since calls on the same object share events.
+template<typename Pass>
+class PassCache {
+  public:
+    // Returns the cached pass for the current device, stream and problem size, and calls
+    // `create` to construct one if there isn't one yet.
+    template<typename Factory>
+    Pass& Get(
+        const cudaStream_t stream,
+        const cublasHandle_t blas_handle,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        Factory create) {
+      int device;
+      cudaGetDevice(&device);
+      const Key key(
+          device,
+          reinterpret_cast<uintptr_t>(stream),
+          reinterpret_cast<uintptr_t>(blas_handle),
+          batch_size,
+          input_size,
+          hidden_size);
+      auto it = passes_.find(key);
+      if (it == passes_.end()) {
+        // Bound the number of streams we hold on to if the batch size keeps changing.
+        if (passes_.size() >= kMaxEntries)
+          passes_.erase(passes_.begin());
+        it = passes_.emplace(key, std::unique_ptr<Pass>(create())).first;
+      }
+      return *it->second;
+    }
+
+    std::mutex& mutex() {
+      return mutex_;
+    }
+
+  private:
+    typedef std::tuple<int, uintptr_t, uintptr_t, int, int, int> Key;
+    static constexpr size_t kMaxEntries = 16;
+
+    std::mutex mutex_;
+    std::map<Key, std::unique_ptr<Pass>> passes_;
+};
@@ -0,0 +1,157 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "haste.h"
+
+// Returns a future that is already ready and holds an `Error` with the message `what`,
+// for a request that is refused instead of queued.
+template<typename Error>
+std::future<void> RefusedRequest(const char* what) {
+  std::promise<void> refused;
+  refused.set_exception(std::make_exception_ptr(Error(what)));
+  return refused.get_future();
+}
+
+// Collects requests pushed from any number of threads and hands them to `run` in
+// batches on a single worker thread. A batch is dispatched as soon as `max_batch_size`
+// requests are waiting or the oldest of them has waited `max_wait`, whichever comes
+// first. `run` must not return before the batch's results are complete, since the
+// futures returned by `Push` become ready as soon as it does.
+template<typename Request>
+class BatchQueue {
+  public:
+    typedef std::function<void(const std::vector<Request>&)> RunFn;
+
+    BatchQueue(const int max_batch_size, const std::chrono::microseconds max_wait, RunFn run)
+        : max_batch_size_(max_batch_size),
+          max_wait_(max_wait),
+          run_(std::move(run)),
+          stopping_(false),
+          max_queue_depth_(0),
+          requests_(0),
+          batches_(0),
+          batch_sizes_(max_batch_size + 1, 0) {
+      worker_ = std::thread(&BatchQueue::Loop, this);
+    }
+
+    // Runs whatever is still queued, then joins the worker thread.
+    ~BatchQueue() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+      }
+      cv_.notify_one();
+      worker_.join();
+    }
+
+    std::future<void> Push(const Request& request) {
+      std::future<void> done;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.emplace_back();
+        Entry& entry = queue_.back();
+        entry.request = request;
+        entry.arrival = std::chrono::steady_clock::now();
+        done = entry.done.get_future();
+        max_queue_depth_ = std::max(max_queue_depth_, queue_.size());
+      }
+      cv_.notify_one();
+      return done;
+    }
+
+    haste::v0::BatchSchedulerStats Stats() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      haste::v0::BatchSchedulerStats stats;
+      stats.queue_depth = queue_.size();
+      stats.max_queue_depth = max_queue_depth_;
+      stats.requests = requests_;
+      stats.batches = batches_;
+      stats.batch_sizes = batch_sizes_;
+      return stats;
+    }
+
+  private:
+    struct Entry {
+      Request request;
+      std::chrono::steady_clock::time_point arrival;
+      std::promise<void> done;
+    };
+
+    void Loop() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true) {
+        cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty())
+          return;
+
+        // Give the batch until the oldest request's deadline to fill up. Once stopping,
+        // drain without waiting.
+        const auto deadline = queue_.front().arrival + max_wait_;
+        cv_.wait_until(lock, deadline, [this] {
+          return stopping_ || queue_.size() >= static_cast<size_t>(max_batch_size_);
+        });
+
+        const size_t count = std::min(queue_.size(), static_cast<size_t>(max_batch_size_));
+        std::vector<Entry> batch;
+        std::vector<Request> requests;
+        batch.reserve(count);
+        requests.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+          batch.push_back(std::move(queue_.front()));
+          requests.push_back(batch.back().request);
+          queue_.pop_front();
+        }
+
+        lock.unlock();
+        run_(requests);
+        for (auto& entry : batch)
+          entry.done.set_value();
+        lock.lock();
+
+        requests_ += count;
+        ++batches_;
+        ++batch_sizes_[count];
+      }
+    }
+
+    const int max_batch_size_;
+    const std::chrono::microseconds max_wait_;
+    const RunFn run_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Entry> queue_;
+    bool stopping_;
+    size_t max_queue_depth_;
+    unsigned long long requests_;
+    unsigned long long batches_;
+    std::vector<unsigned long long> batch_sizes_;
+    std::thread worker_;
+};
@@ -15,22 +15,134 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+
+// 16-bit GEMMs go through `cublasGemmEx` so that they accumulate in FP32 and may use
+// tensor cores. The signature matches `cublasSgemm` et al., so `alpha` and `beta` are
+// given in the storage type and widened here.
+template<typename T, cudaDataType_t DataType>
+struct blas_ex {
+  static cublasStatus_t gemm(
+      cublasHandle_t handle,
+      cublasOperation_t transa,
+      cublasOperation_t transb,
+      int m,
+      int n,
+      int k,
+      const T* alpha,
+      const T* A,
+      int lda,
+      const T* B,
+      int ldb,
+      const T* beta,
+      T* C,
+      int ldc) {
+    const float alpha_f = static_cast<float>(*alpha);
+    const float beta_f = static_cast<float>(*beta);
+    return cublasGemmEx(
+        handle,
+        transa, transb,
+        m, n, k,
+        &alpha_f,
+        A, DataType, lda,
+        B, DataType, ldb,
+        &beta_f,
+        C, DataType, ldc,
+        CUBLAS_COMPUTE_32F,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+  }
+
+  static cublasStatus_t gemmStridedBatched(
+      cublasHandle_t handle,
+      cublasOperation_t transa,
+      cublasOperation_t transb,
+      int m,
+      int n,
+      int k,
+      const T* alpha,
+      const T* A,
+      int lda,
+      long long strideA,
+      const T* B,
+      int ldb,
+      long long strideB,
+      const T* beta,
+      T* C,
+      int ldc,
+      long long strideC,
+      int batchCount) {
+    const float alpha_f = static_cast<float>(*alpha);
+    const float beta_f = static_cast<float>(*beta);
+    return cublasGemmStridedBatchedEx(
+        handle,
+        transa, transb,
+        m, n, k,
+        &alpha_f,
+        A, DataType, lda, strideA,
+        B, DataType, ldb, strideB,
+        &beta_f,
+        C, DataType, ldc, strideC,
+        batchCount,
+        CUBLAS_COMPUTE_32F,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+  }
+};
 
 template<typename T>
 struct blas {};
 
 template<>
-struct blas<__half> {
-  static constexpr decltype(cublasHgemm)* gemm = cublasHgemm;
-};
+struct blas<__half> : blas_ex<__half, CUDA_R_16F> {};
+
+template<>
+struct blas<__nv_bfloat16> : blas_ex<__nv_bfloat16, CUDA_R_16BF> {};
 
 template<>
 struct blas<float> {
   static constexpr decltype(cublasSgemm)* gemm = cublasSgemm;
+  static constexpr decltype(cublasSgemmStridedBatched)* gemmStridedBatched =
+      cublasSgemmStridedBatched;
 };
 
 template<>
 struct blas<double> {
   static constexpr decltype(cublasDgemm)* gemm = cublasDgemm;
+  static constexpr decltype(cublasDgemmStridedBatched)* gemmStridedBatched =
+      cublasDgemmStridedBatched;
+};
+
+// Int8 GEMMs for `RunQuantized` accumulate exactly in int32, with `alpha` = 1 and
+// `beta` = 0. cuBLAS requires `m`, `k`, `lda` and `ldb` to be multiples of 4 and a GPU
+// of compute capability 6.1 or later, and uses the integer tensor cores where it can.
+struct blas_int8 {
+  static cublasStatus_t gemm(
+      cublasHandle_t handle,
+      cublasOperation_t transa,
+      cublasOperation_t transb,
+      int m,
+      int n,
+      int k,
+      const int8_t* A,
+      int lda,
+      const int8_t* B,
+      int ldb,
+      int32_t* C,
+      int ldc) {
+    const int32_t alpha = 1;
+    const int32_t beta = 0;
+    return cublasGemmEx(
+        handle,
+        transa, transb,
+        m, n, k,
+        &alpha,
+        A, CUDA_R_8I, lda,
+        B, CUDA_R_8I, ldb,
+        &beta,
+        C, CUDA_R_32I, ldc,
+        CUBLAS_COMPUTE_32I,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+  }
 };
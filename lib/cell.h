@@ -0,0 +1,181 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+#include "inline_ops.h"
+#include "packing.h"
+#include "reduce.h"
+
+// The gate math of an LSTM cell variant, as a template argument of the pointwise
+// kernels. `Peephole` adds the peephole terms `p_i*c_prev`, `p_f*c_prev` and `p_o*c` to
+// the input, forget and output gate pre-activations. `Coupled` couples the input gate
+// to the forget gate (CIFG) as `i = 1 - f`, which leaves the input gate's columns of
+// `W`, `R` and `b` unused. `Act` implements the gate nonlinearities (see
+// `PreciseActivations`).
+template<bool Peephole, bool Coupled, typename Act = PreciseActivations>
+struct CellPolicy {
+  static constexpr bool kPeephole = Peephole;
+  static constexpr bool kCoupled = Coupled;
+  typedef Act Activations;
+};
+
+typedef CellPolicy<false, false> StandardCell;
+
+// The cell variant of a pass (see `ForwardPass::SetPeephole`,
+// `ForwardPass::SetCoupledGates` and `ForwardPass::SetLayerNorm`). Each pointer is null
+// unless the variant is on, and the gradients are null in forward passes.
+template<typename T>
+struct CellConfig {
+  const T* peephole;       // [3,H]
+  T* dpeephole;            // [3,H]
+  bool coupled;
+  const T* layer_norm;     // [2,H*4]
+  T* layer_norm_cache;     // [T,N,2,H*4]
+  T* dlayer_norm;          // [2,H*4]
+
+  bool enabled() const { return peephole || coupled || layer_norm; }
+};
+
+// Layer normalization adds this to the variance before taking its square root.
+constexpr float kLayerNormEpsilon = 1e-5f;
+
+// The layer-normalized pointwise kernels run one block of at most this many threads
+// per batch item.
+constexpr int kLayerNormThreads = 256;
+
+// The block shape of the layer-normalized pointwise kernels for `hidden_size` units: a
+// multiple of 32 threads, so that every warp is full, up to `kLayerNormThreads`.
+inline int LayerNormBlockSize(const int hidden_size) {
+  int threads = 32;
+  while (threads < hidden_size && threads < kLayerNormThreads)
+    threads *= 2;
+  return threads;
+}
+
+// Replaces each thread's `value[k]` with its sum over the whole block, adding the
+// warps' partial sums in the same order in every thread so that they all agree.
+// `partial` is shared memory that may be reused once this returns.
+template<int G, typename Acc>
+__device__ __forceinline__
+void BlockSum(Acc value[G], Acc partial[G][kLayerNormThreads / 32]) {
+  const int lane = threadIdx.x % 32;
+  const int warp = threadIdx.x / 32;
+  const int warps = blockDim.x / 32;
+
+  #pragma unroll
+  for (int k = 0; k < G; ++k) {
+    for (int offset = 16; offset > 0; offset /= 2)
+      value[k] += __shfl_xor_sync(0xffffffff, value[k], offset);
+  }
+  if (lane == 0) {
+    #pragma unroll
+    for (int k = 0; k < G; ++k)
+      partial[k][warp] = value[k];
+  }
+  __syncthreads();
+
+  #pragma unroll
+  for (int k = 0; k < G; ++k) {
+    value[k] = static_cast<Acc>(0.0);
+    for (int i = 0; i < warps; ++i)
+      value[k] += partial[k][i];
+  }
+  __syncthreads();
+}
+
+// Stores (or adds, if `accumulate`) the gradients of the [3,H] peephole weights into
+// `dP`: the sums over the `rows` rows of `da` (whose rows are `ld` elements apart) of
+// each gate's pre-activation gradient times the cell state it multiplies, `c_prev` for
+// the input and forget gates and `c_new` for the output gate. Reduces in a fixed order
+// like `ColumnSum`, so the result is reproducible.
+template<typename T>
+__global__
+void PeepholeGradients(const int rows,
+                       const int hidden_dim,
+                       const bool interleaved,
+                       const bool accumulate,
+                       const T* __restrict__ da,
+                       const int ld,
+                       const accum_t<T>* __restrict__ c_prev,
+                       const accum_t<T>* __restrict__ c_new,
+                       T* __restrict__ dP) {
+  typedef typename accum_type<T>::type Acc;
+
+  __shared__ Acc partial[kColumnSumLanes][kColumnSumWidth + 1];
+
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+
+  Acc total = static_cast<Acc>(0.0);
+  if (col < hidden_dim * 3) {
+    const int peephole = col / hidden_dim;
+    const int unit = col - peephole * hidden_dim;
+    const int gate = peephole ? peephole + 1 : 0;  // [i,f,o] -> [i,g,f,o]
+    const int da_col = PackedGateColumn(gate, unit, hidden_dim, 4, interleaved);
+    const Acc* c = peephole == 2 ? c_new : c_prev;
+    for (int row = threadIdx.y; row < rows; row += blockDim.y)
+      total += Acc(da[static_cast<size_t>(row) * ld + da_col]) * c[static_cast<size_t>(row) * hidden_dim + unit];
+  }
+  partial[threadIdx.y][threadIdx.x] = total;
+  __syncthreads();
+
+  if (threadIdx.y != 0 || col >= hidden_dim * 3)
+    return;
+
+  for (int i = 1; i < blockDim.y; ++i)
+    total += partial[i][threadIdx.x];
+  dP[col] = accumulate ? T(Acc(dP[col]) + total) : T(total);
+}
+
+// Reduces the parameter gradients of the cell variant `cell` over `rows` rows of a
+// backward pass on `stream`, once its pointwise kernels have written `dv` ([rows,H*4])
+// and, with layer normalization, the [rows,2,H*4] `layer_norm_cache`. `c_prev` and
+// `c_new` are the [rows,H] cell states before and after each row's time step.
+template<typename T>
+void LaunchCellGradients(
+    const int rows,
+    const int hidden_size,
+    const bool interleaved,
+    const bool accumulate,
+    const CellConfig<T>& cell,
+    const accum_t<T>* c_prev,
+    const accum_t<T>* c_new,
+    const T* dv,
+    const cudaStream_t& stream) {
+  // The peephole terms are added after layer normalization, so their gradients come
+  // from the normalized pre-activations' gradients `da` in the cache rather than `dv`.
+  if (cell.peephole && cell.dpeephole) {
+    const bool layer_norm = cell.layer_norm != nullptr;
+    const dim3 blockDim(kColumnSumWidth, kColumnSumLanes);
+    const dim3 gridDim((hidden_size * 3 + blockDim.x - 1) / blockDim.x);
+    PeepholeGradients<T><<<gridDim, blockDim, 0, stream>>>(
+        rows,
+        hidden_size,
+        interleaved,
+        accumulate,
+        layer_norm ? cell.layer_norm_cache + hidden_size * 4 : dv,
+        layer_norm ? hidden_size * 8 : hidden_size * 4,
+        c_prev,
+        c_new,
+        cell.dpeephole);
+  }
+
+  // The cache rows hold `da*xhat` and `da`, whose column sums are the gradients of the
+  // gains and biases.
+  if (cell.layer_norm && cell.dlayer_norm)
+    StoreColumnSums(rows, hidden_size * 8, accumulate, cell.layer_norm_cache, cell.dlayer_norm, stream);
+}
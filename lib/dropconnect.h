@@ -0,0 +1,76 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cuda_runtime_api.h>
+
+#include "inline_ops.h"
+
+// The DropConnect mask on a recurrent weight matrix (see `ForwardPass::SetDropConnect`).
+// `tmp_R` receives the masked matrix for the duration of a call.
+template<typename T>
+struct DropConnectConfig {
+  float rate;
+  unsigned long long seed;
+  unsigned long long offset;
+  T* tmp_R;
+};
+
+// Writes `x` with DropConnect applied to `y`, which may be the same matrix. `x` is the
+// row-major [rows,cols] recurrent weight matrix, or its transpose if `transposed` is
+// `true`; either way, the mask of an element only depends on its index in the
+// untransposed matrix so `R`, `R_t` and `dR` are masked identically. Kept elements are
+// scaled by `1 / (1 - rate)` like `tf.nn.dropout`.
+template<typename T>
+__global__
+void DropConnect(const int rows,
+                 const int cols,
+                 const bool transposed,
+                 const float rate,
+                 const unsigned long long seed,
+                 const unsigned long long offset,
+                 const T* x,
+                 T* y) {
+  typedef typename accum_type<T>::type Acc;
+
+  const size_t size = static_cast<size_t>(rows) * cols;
+  const Acc scale = static_cast<Acc>(1.0f / (1.0f - rate));
+  for (size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+       i < size;
+       i += static_cast<size_t>(gridDim.x) * blockDim.x) {
+    const size_t index = transposed ? (i % rows) * cols + i / rows : i;
+    const bool keep = philox_uniform(seed, offset, index) >= rate;
+    y[i] = keep ? T(Acc(x[i]) * scale) : static_cast<T>(0.0);
+  }
+}
+
+// Launches `DropConnect` on `stream`.
+template<typename T>
+void LaunchDropConnect(
+    const int rows,
+    const int cols,
+    const bool transposed,
+    const DropConnectConfig<T>& config,
+    const T* x,
+    T* y,
+    const cudaStream_t& stream) {
+  const size_t size = static_cast<size_t>(rows) * cols;
+  const int blockDim = 256;
+  const int gridDim = static_cast<int>(std::min<size_t>((size + blockDim - 1) / blockDim, 4096));
+  DropConnect<T><<<gridDim, blockDim, 0, stream>>>(
+      rows, cols, transposed, config.rate, config.seed, config.offset, x, y);
+}
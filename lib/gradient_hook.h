@@ -0,0 +1,159 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_bf16.h>
+#include <cuda_runtime_api.h>
+
+#include "haste.h"
+
+#ifdef HASTE_WITH_NCCL
+#include "tensor_parallel.h"
+#endif
+
+#ifdef HASTE_WITH_NCCL
+// Sums `size` elements of `x` in place across the ranks of `comm`, on `stream`.
+template<typename T>
+void AllReduceGradient(T* x, const size_t size, const ncclComm_t comm, const cudaStream_t& stream) {
+  ncclAllReduce(x, x, size, nccl_type<T>::value, ncclSum, comm, stream);
+}
+
+// Whether NCCL can sum gradients of type `T`.
+template<typename T>
+struct nccl_supports {
+  static constexpr bool value = true;
+};
+
+#if !HASTE_NCCL_HAS_BF16
+// NCCL has no bfloat16 type before 2.10, so `GradientHook::SetAllReduce` refuses
+// bfloat16 passes and this is never called.
+template<>
+struct nccl_supports<__nv_bfloat16> {
+  static constexpr bool value = false;
+};
+
+template<>
+inline void AllReduceGradient(__nv_bfloat16*, const size_t, const ncclComm_t, const cudaStream_t&) {}
+#endif
+#endif  // HASTE_WITH_NCCL
+
+// What a backward pass does once a layer's weight gradients are final: call the
+// `GradientReadyCallback` and/or all-reduce the gradients on a communication stream of
+// its own (see `lstm::BackwardPass::SetGradientReadyCallback` and `SetGradientAllReduce`).
+// A single event marks each layer's gradients in turn, so the callback must wait on it
+// before returning.
+class GradientHook {
+  public:
+    GradientHook() : callback_(nullptr), user_data_(nullptr), created_(false) {
+#ifdef HASTE_WITH_NCCL
+      comm_ = nullptr;
+#endif
+    }
+
+    ~GradientHook() {
+      if (created_) {
+#ifdef HASTE_WITH_NCCL
+        cudaStreamDestroy(comm_stream_);
+#endif
+        cudaEventDestroy(event_);
+      }
+    }
+
+    void SetCallback(const haste::v0::GradientReadyCallback callback, void* user_data) {
+      Create();
+      callback_ = callback;
+      user_data_ = user_data;
+    }
+
+#ifdef HASTE_WITH_NCCL
+    // Returns false, and leaves the all-reduce off, if NCCL can't sum gradients of type
+    // `T`.
+    template<typename T>
+    bool SetAllReduce(const ncclComm_t comm) {
+      if (comm && !nccl_supports<T>::value) {
+        comm_ = nullptr;
+        return false;
+      }
+      Create();
+      comm_ = comm;
+      return true;
+    }
+#endif
+
+    bool enabled() const {
+#ifdef HASTE_WITH_NCCL
+      if (comm_)
+        return true;
+#endif
+      return callback_ != nullptr;
+    }
+
+    // Signals that the `count` gradients of `layer` in `gradients`, of `sizes` elements
+    // each, are final once the work enqueued on `stream` so far is done. Null gradients
+    // are skipped.
+    template<typename T>
+    void Signal(
+        const int layer,
+        const cudaStream_t& stream,
+        T* const* gradients,
+        const size_t* sizes,
+        const int count) {
+      cudaEventRecord(event_, stream);
+#ifdef HASTE_WITH_NCCL
+      // All layers share one stream so that every rank issues the all-reduces on the
+      // communicator in the same order.
+      if (comm_) {
+        cudaStreamWaitEvent(comm_stream_, event_, 0);
+        ncclGroupStart();
+        for (int i = 0; i < count; ++i) {
+          if (gradients[i])
+            AllReduceGradient(gradients[i], sizes[i], comm_, comm_stream_);
+        }
+        ncclGroupEnd();
+        cudaEventRecord(event_, comm_stream_);
+      }
+#endif
+      if (callback_)
+        callback_(layer, event_, user_data_);
+    }
+
+    // Makes `sync_stream` wait for the gradients of the last call to `Signal`, and so for
+    // the all-reduces of all of them.
+    void Join(const cudaStream_t& sync_stream) {
+      if (enabled())
+        cudaStreamWaitEvent(sync_stream, event_, 0);
+    }
+
+  private:
+    void Create() {
+      if (created_)
+        return;
+      cudaEventCreateWithFlags(&event_, cudaEventDisableTiming);
+#ifdef HASTE_WITH_NCCL
+      cudaStreamCreateWithFlags(&comm_stream_, cudaStreamNonBlocking);
+#endif
+      created_ = true;
+    }
+
+    haste::v0::GradientReadyCallback callback_;
+    void* user_data_;
+    bool created_;
+    cudaEvent_t event_;
+#ifdef HASTE_WITH_NCCL
+    ncclComm_t comm_;
+    cudaStream_t comm_stream_;
+#endif
+};
@@ -0,0 +1,170 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cstring>
+#include <cuda_runtime_api.h>
+#include <vector>
+
+// Wraps a host array that a capture depends on by value rather than by address (e.g.
+// per-step sizes that determine GEMM shapes) so `GraphCache::Lookup` compares contents.
+struct GraphKeyArray {
+  GraphKeyArray(const int* data, const int size) : data(data), size(size) {}
+  const int* data;
+  int size;
+};
+
+// Holds a single instantiated CUDA graph for a pass's `Run` method along with the
+// arguments it was captured with. The work is captured on a private stream so that the
+// caller's stream may be the legacy default stream, which can't be captured. When the
+// arguments change, the new capture is applied to the existing executable graph with
+// `cudaGraphExecUpdate` if possible, which is much cheaper than re-instantiating it.
+class GraphCache {
+  public:
+    GraphCache() : enabled_(false), failed_(false), capturing_(false), exec_(nullptr) {}
+
+    ~GraphCache() {
+      if (exec_)
+        cudaGraphExecDestroy(exec_);
+      if (enabled_) {
+        cudaEventDestroy(finished_event_);
+        cudaEventDestroy(ready_event_);
+        cudaStreamDestroy(stream_);
+      }
+    }
+
+    void Enable() {
+      if (enabled_)
+        return;
+      cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking);
+      cudaEventCreateWithFlags(&ready_event_, cudaEventDisableTiming);
+      cudaEventCreateWithFlags(&finished_event_, cudaEventDisableTiming);
+      enabled_ = true;
+    }
+
+    bool enabled() const { return enabled_ && !failed_; }
+    bool capturing() const { return capturing_; }
+
+    // Returns `true` if the cached graph was captured with exactly these arguments.
+    // Otherwise, remembers them for the capture that must follow.
+    template<typename... Args>
+    bool Lookup(const Args&... args) {
+      std::vector<unsigned char> key;
+      AppendKey(&key, args...);
+      if (exec_ && key == key_)
+        return true;
+      key_.swap(key);
+      return false;
+    }
+
+    // Starts capturing and returns the stream that must be used in place of the
+    // caller's stream until `EndCapture` is called.
+    cudaStream_t BeginCapture() {
+      capturing_ = true;
+      cudaStreamBeginCapture(stream_, cudaStreamCaptureModeThreadLocal);
+      return stream_;
+    }
+
+    // Returns `false` if the captured work couldn't be turned into an executable graph,
+    // in which case nothing has been enqueued and the caller must run the work directly.
+    // Capturing is disabled from then on since the failure is almost always structural
+    // (e.g. an operation that the CUDA runtime doesn't support in graphs).
+    bool EndCapture() {
+      capturing_ = false;
+
+      cudaGraph_t graph = nullptr;
+      if (cudaStreamEndCapture(stream_, &graph) != cudaSuccess || !graph) {
+        Fail();
+        return false;
+      }
+
+      if (exec_ && !TryUpdate(graph)) {
+        cudaGraphExecDestroy(exec_);
+        exec_ = nullptr;
+      }
+      if (!exec_ && !Instantiate(graph)) {
+        exec_ = nullptr;
+        Fail();
+      }
+      cudaGraphDestroy(graph);
+      return exec_ != nullptr;
+    }
+
+    // Replays the cached graph, ordered after work already enqueued on `sync_stream`
+    // and before any work enqueued on it afterwards.
+    void Launch(const cudaStream_t& sync_stream) {
+      cudaEventRecord(ready_event_, sync_stream);
+      cudaStreamWaitEvent(stream_, ready_event_, 0);
+      cudaGraphLaunch(exec_, stream_);
+      cudaEventRecord(finished_event_, stream_);
+      cudaStreamWaitEvent(sync_stream, finished_event_, 0);
+    }
+
+  private:
+    void AppendKey(std::vector<unsigned char>*) {}
+
+    template<typename... Args>
+    void AppendKey(std::vector<unsigned char>* key, const GraphKeyArray& arg, const Args&... args) {
+      const size_t offset = key->size();
+      key->resize(offset + sizeof(arg.size) + arg.size * sizeof(*arg.data));
+      std::memcpy(key->data() + offset, &arg.size, sizeof(arg.size));
+      if (arg.size)
+        std::memcpy(key->data() + offset + sizeof(arg.size), arg.data, arg.size * sizeof(*arg.data));
+      AppendKey(key, args...);
+    }
+
+    template<typename Arg, typename... Args>
+    void AppendKey(std::vector<unsigned char>* key, const Arg& arg, const Args&... args) {
+      const size_t offset = key->size();
+      key->resize(offset + sizeof(Arg));
+      std::memcpy(key->data() + offset, &arg, sizeof(Arg));
+      AppendKey(key, args...);
+    }
+
+    bool Instantiate(cudaGraph_t graph) {
+#if CUDART_VERSION >= 12000
+      return cudaGraphInstantiate(&exec_, graph, 0) == cudaSuccess;
+#else
+      return cudaGraphInstantiate(&exec_, graph, nullptr, nullptr, 0) == cudaSuccess;
+#endif
+    }
+
+    bool TryUpdate(cudaGraph_t graph) {
+#if CUDART_VERSION >= 12000
+      cudaGraphExecUpdateResultInfo result_info;
+      return cudaGraphExecUpdate(exec_, graph, &result_info) == cudaSuccess;
+#else
+      cudaGraphNode_t error_node;
+      cudaGraphExecUpdateResult result;
+      return cudaGraphExecUpdate(exec_, graph, &error_node, &result) == cudaSuccess;
+#endif
+    }
+
+    void Fail() {
+      failed_ = true;
+      key_.clear();
+      cudaGetLastError();  // Don't leave a sticky error behind for the caller.
+    }
+
+    bool enabled_;
+    bool failed_;
+    bool capturing_;
+    cudaStream_t stream_;
+    cudaEvent_t ready_event_;
+    cudaEvent_t finished_event_;
+    cudaGraphExec_t exec_;
+    std::vector<unsigned char> key_;
+};
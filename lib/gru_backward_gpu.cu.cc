@@ -13,86 +13,179 @@
 // limitations under the License.
 // ==============================================================================
 
+#include <algorithm>
 #include <cublas_v2.h>
 #include <cuda_runtime_api.h>
+#include <vector>
 
 #include "blas.h"
+#include "dropconnect.h"
+#include "gradient_hook.h"
+#include "graph.h"
 #include "haste.h"
 #include "inline_ops.h"
+#include "profiling.h"
+#include "reduce.h"
+#include "sequence.h"
+#include "workspace.h"
 
 namespace {
 
-template<typename T, bool ApplyZoneout>
+// The activations are read as `V` (z, r, g) and `Q` (q_g), which are `T` except for
+// `RunCompact`. Batch item `col` starts at `col * v_stride` in `v` and at
+// `col * q_stride` in `q`.
+template<typename T, typename V, typename Q, bool ApplyZoneout>
 __global__
 void PointwiseOperations(const int batch_dim,
                          const int hidden_dim,
-                         const T* h_t,
-                         const T* v,
+                         const int h_stride,  // Distance between batch items in `h` and `dh_new`
+                         const T* h,
+                         const V* v,
+                         const Q* q,
+                         const int v_stride,
+                         const int q_stride,
                          const T* dh_new,
-                         T* dbx_out,
-                         T* dbr_out,
                          T* dh_inout,
                          T* dp_out,
                          T* dq_out,
-                         const T* zoneout_mask) {  // Zoneout mask (only used if ApplyZoneout==true)
+                         const T* zoneout_mask,  // Zoneout mask (only used if ApplyZoneout==true), may be null
+                         const ZoneoutRng zoneout_rng,  // Regenerates the mask if `zoneout_mask` is null
+                         const int step,
+                         const int* sequence_lengths) {  // May be null
   const int row = blockDim.x * blockIdx.x + threadIdx.x;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
+  // Gradients are computed in (at least) FP32 for 16-bit types.
+  typedef typename accum_type<T>::type Acc;
+
   const int base_idx = col * hidden_dim + row;
-  const int base_idx_t = row * batch_dim + col;
+  const int h_idx = col * h_stride + row;
+
+  // The forward pass copied the state through for items past the end of their sequence,
+  // so the whole gradient flows to the previous step and none of it reaches the gates.
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    const int idx = col * (hidden_dim * 3) + row;
+    dh_inout[base_idx] = T(Acc(dh_new[h_idx]) + Acc(dh_inout[base_idx]));
+    for (int gate = 0; gate < 3; ++gate) {
+      dp_out[idx + gate * hidden_dim] = static_cast<T>(0.0);
+      dq_out[idx + gate * hidden_dim] = static_cast<T>(0.0);
+    }
+    return;
+  }
 
-  T dh_total = dh_new[base_idx] + dh_inout[base_idx];
+  Acc dh_total = Acc(dh_new[h_idx]) + Acc(dh_inout[base_idx]);
 
-  const int stride4_base_idx = col * (hidden_dim * 4) + row;
-  const int z_idx = stride4_base_idx + 0 * hidden_dim;
-  const int r_idx = stride4_base_idx + 1 * hidden_dim;
-  const int g_idx = stride4_base_idx + 2 * hidden_dim;
-  const int q_g_idx = stride4_base_idx + 3 * hidden_dim;
+  const int base_v_idx = col * v_stride + row;
+  const int z_idx = base_v_idx + 0 * hidden_dim;
+  const int r_idx = base_v_idx + 1 * hidden_dim;
+  const int g_idx = base_v_idx + 2 * hidden_dim;
+  const int q_g_idx = col * q_stride + row;
 
-  const T z = v[z_idx];
-  const T r = v[r_idx];
-  const T g = v[g_idx];
-  const T q_g = v[q_g_idx];
+  const Acc z = unpack_activation<Acc>(v[z_idx]);
+  const Acc r = unpack_activation<Acc>(v[r_idx]);
+  const Acc g = unpack_activation<Acc>(v[g_idx]);
+  const Acc q_g = unpack_activation<Acc>(q[q_g_idx]);
 
   if (ApplyZoneout) {
-    const T mask = zoneout_mask[base_idx];
-    dh_inout[base_idx] = (static_cast<T>(1.0) - mask) * dh_total;
+    const Acc mask = zoneout_mask
+        ? Acc(zoneout_mask[base_idx])
+        : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + base_idx);
+    const Acc dh_zoned = (static_cast<Acc>(1.0) - mask) * dh_total;
     dh_total = mask * dh_total;
-    dh_inout[base_idx] += z * dh_total;
+    dh_inout[base_idx] = T(dh_zoned + z * dh_total);
   } else {
-    dh_inout[base_idx] = z * dh_total;
+    dh_inout[base_idx] = T(z * dh_total);
   }
 
-  const T dg = (static_cast<T>(1.0) - z) * dh_total;
-  const T dz = (h_t[base_idx_t] - g) * dh_total;
-  const T dp_g = d_tanh(g) * dg;
-  const T dq_g = dp_g * r;
-  const T dr = dp_g * q_g;
-  const T dp_r = d_sigmoid(r) * dr;
-  const T dq_r = dp_r;
-  const T dp_z = d_sigmoid(z) * dz;
-  const T dq_z = dp_z;
+  const Acc dg = (static_cast<Acc>(1.0) - z) * dh_total;
+  const Acc dz = (Acc(h[h_idx]) - g) * dh_total;
+  const Acc dp_g = d_tanh(g) * dg;
+  const Acc dq_g = dp_g * r;
+  const Acc dr = dp_g * q_g;
+  const Acc dp_r = d_sigmoid(r) * dr;
+  const Acc dq_r = dp_r;
+  const Acc dp_z = d_sigmoid(z) * dz;
+  const Acc dq_z = dp_z;
 
   const int idx = col * (hidden_dim * 3) + row;
 
-  dp_out[idx + 0 * hidden_dim] = dp_z;
-  dp_out[idx + 1 * hidden_dim] = dp_r;
-  dp_out[idx + 2 * hidden_dim] = dp_g;
+  dp_out[idx + 0 * hidden_dim] = T(dp_z);
+  dp_out[idx + 1 * hidden_dim] = T(dp_r);
+  dp_out[idx + 2 * hidden_dim] = T(dp_g);
 
-  dq_out[idx + 0 * hidden_dim] = dq_z;
-  dq_out[idx + 1 * hidden_dim] = dq_r;
-  dq_out[idx + 2 * hidden_dim] = dq_g;
+  dq_out[idx + 0 * hidden_dim] = T(dq_z);
+  dq_out[idx + 1 * hidden_dim] = T(dq_r);
+  dq_out[idx + 2 * hidden_dim] = T(dq_g);
+}
 
-  atomicAdd(&dbx_out[row + 0 * hidden_dim], dp_z);
-  atomicAdd(&dbx_out[row + 1 * hidden_dim], dp_r);
-  atomicAdd(&dbx_out[row + 2 * hidden_dim], dp_g);
+// Launches `PointwiseOperations` for one time step of the whole batch.
+template<typename T, typename V, typename Q>
+void LaunchPointwiseOperations(
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* h,
+    const V* v,
+    const Q* q,
+    const int v_stride,
+    const int q_stride,
+    const T* dh_new,
+    T* dh,
+    T* dp,
+    T* dq,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  // Compute launch configuration for pointwise operations kernel.
+  const dim3 blockDim(32, 16);
+  const dim3 gridDim(
+      (hidden_size + blockDim.x - 1) / blockDim.x,
+      (batch_size + blockDim.y - 1) / blockDim.y);
 
-  atomicAdd(&dbr_out[row + 0 * hidden_dim], dq_z);
-  atomicAdd(&dbr_out[row + 1 * hidden_dim], dq_r);
-  atomicAdd(&dbr_out[row + 2 * hidden_dim], dq_g);
+  if (zoneout_mask || (zoneout_rng.enabled && zoneout_rng.prob)) {
+    PointwiseOperations<T, V, Q, true><<<gridDim, blockDim, 0, stream>>>(
+        batch_size,
+        hidden_size,
+        h_stride,
+        h,
+        v,
+        q,
+        v_stride,
+        q_stride,
+        dh_new,
+        dh,
+        dp,
+        dq,
+        zoneout_mask,
+        zoneout_rng,
+        step,
+        sequence_lengths
+    );
+  } else {
+    PointwiseOperations<T, V, Q, false><<<gridDim, blockDim, 0, stream>>>(
+        batch_size,
+        hidden_size,
+        h_stride,
+        h,
+        v,
+        q,
+        v_stride,
+        q_stride,
+        dh_new,
+        dh,
+        dp,
+        dq,
+        nullptr,
+        ZoneoutRng(),
+        step,
+        sequence_lengths
+    );
+  }
 }
 
 }  // anonymous namespace
@@ -107,8 +200,20 @@ struct BackwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
   cudaStream_t stream[2];
   cudaEvent_t event;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+  GraphCache graph;
+  ZoneoutRng zoneout_rng;
+  bool packed;  // Set by the `PackedWeights` overloads for the duration of a call.
+  DropConnectConfig<T> dropconnect;
+  SequenceLayout sequence_layout;
+  bool accumulate;
+  int gradient_chunk;
+  GradientHook gradient_hook;
+  PhaseProfiler profiler;
 };
 
 template<typename T>
@@ -116,26 +221,102 @@ BackwardPass<T>::BackwardPass(
     const int batch_size,
     const int input_size,
     const int hidden_size,
-    const cublasHandle_t& blas_handle) : data_(new private_data) {
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
   data_->batch_size = batch_size;
   data_->input_size = input_size;
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  data_->zoneout_rng = ZoneoutRng();
+  data_->packed = false;
+  data_->dropconnect = DropConnectConfig<T>();
+  data_->sequence_layout = SequenceLayout();
+  data_->accumulate = true;
+  data_->gradient_chunk = 0;
+  data_->profiler.SetName("gru::BackwardPass");
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
 }
 
 template<typename T>
 BackwardPass<T>::~BackwardPass() {
-  cudaStreamSynchronize(data_->stream[1]);
-  cudaStreamSynchronize(data_->stream[0]);
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
   cudaEventDestroy(data_->event);
   cudaStreamDestroy(data_->stream[1]);
   cudaStreamDestroy(data_->stream[0]);
   delete data_;
 }
 
+template<typename T>
+void BackwardPass<T>::EnableGraphCapture() {
+  data_->graph.Enable();
+}
+
+template<typename T>
+void BackwardPass<T>::EnablePhaseTiming() {
+  data_->profiler.EnableTiming();
+}
+
+template<typename T>
+PhaseStats BackwardPass<T>::CollectPhaseStats() {
+  return data_->profiler.Collect();
+}
+
+template<typename T>
+void BackwardPass<T>::SetZoneoutSeed(
+    const float zoneout_prob,
+    const unsigned long long seed,
+    const unsigned long long offset) {
+  data_->zoneout_rng.enabled = true;
+  data_->zoneout_rng.prob = zoneout_prob;
+  data_->zoneout_rng.seed = seed;
+  data_->zoneout_rng.offset = offset;
+}
+
+template<typename T>
+void BackwardPass<T>::SetDropConnect(
+    const float rate,
+    const unsigned long long seed,
+    const unsigned long long offset,
+    T* tmp_R) {
+  data_->dropconnect.rate = rate;
+  data_->dropconnect.seed = seed;
+  data_->dropconnect.offset = offset;
+  data_->dropconnect.tmp_R = tmp_R;
+}
+
+template<typename T>
+void BackwardPass<T>::SetSequenceLayout(const SequenceLayout& layout) {
+  data_->sequence_layout = layout;
+}
+
+template<typename T>
+void BackwardPass<T>::SetAccumulateGradients(const bool accumulate) {
+  data_->accumulate = accumulate;
+}
+
+template<typename T>
+void BackwardPass<T>::SetWeightGradientChunk(const int steps) {
+  data_->gradient_chunk = steps;
+}
+
+template<typename T>
+void BackwardPass<T>::SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data) {
+  data_->gradient_hook.SetCallback(callback, user_data);
+}
+
+#ifdef HASTE_WITH_NCCL
+template<typename T>
+bool BackwardPass<T>::SetGradientAllReduce(const ncclComm_t& comm) {
+  return data_->gradient_hook.template SetAllReduce<T>(comm);
+}
+#endif
+
 template<typename T>
 void BackwardPass<T>::Iterate(
     const T* W_t,     // [H*3,C]
@@ -143,7 +324,7 @@ void BackwardPass<T>::Iterate(
     const T* bx,      // [H*3]
     const T* br,      // [H*3]
     const T* x_t,     // [C,N]
-    const T* h_t,     // [H,N]
+    const T* h,       // [N,H]
     const T* v,       // [N,H*4]
     const T* dh_new,  // [N,H]
     T* dx,            // [N,C]
@@ -170,57 +351,34 @@ void BackwardPass<T>::Iterate(
   cudaStream_t save_stream;
   cublasGetStream(blas_handle, &save_stream);
 
-  // Compute launch configuration for pointwise operations kernel.
-  const dim3 blockDim(32, 16);
-  const dim3 gridDim(
-      (hidden_size + blockDim.x - 1) / blockDim.x,
-      (batch_size + blockDim.y - 1) / blockDim.y);
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
 
-  if (zoneout_mask) {
-    PointwiseOperations<T, true><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size,
-        hidden_size,
-        h_t,
-        v,
-        dh_new,
-        dbx,
-        dbr,
-        dh,
-        dp,
-        dq,
-        zoneout_mask
-    );
-  } else {
-    PointwiseOperations<T, false><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size,
-        hidden_size,
-        h_t,
-        v,
-        dh_new,
-        dbx,
-        dbr,
-        dh,
-        dp,
-        dq,
-        nullptr
-    );
-  }
-  cudaEventRecord(event, stream1);
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kRecurrence, stream1);
+  IterateInternal(
+      R_t,
+      h,
+      v,
+      dh_new,
+      dh,
+      dp,
+      dq,
+      zoneout_mask,
+      0,
+      data_->batch_size,
+      nullptr,
+      data_->hidden_size);
+  profiler.End(Phase::kRecurrence, stream1);
 
   // Wait for pointwise operations to complete since there's a
   // data dependency between its output (`dp`, `dq`) and the following matmuls.
   cudaStreamWaitEvent(stream2, event, 0);
 
-  cublasSetStream(blas_handle, stream1);
-  blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size * 3, input_size, batch_size,
-      &alpha,
-      dp, hidden_size * 3,
-      x_t, batch_size,
-      &beta_sum,
-      dW, hidden_size * 3);
-
+  profiler.Begin(Phase::kInputProjection, stream2);
   cublasSetStream(blas_handle, stream2);
   blas<T>::gemm(blas_handle,
       CUBLAS_OP_N, CUBLAS_OP_N,
@@ -230,35 +388,1214 @@ void BackwardPass<T>::Iterate(
       dp, hidden_size * 3,
       &beta_assign,
       dx, input_size);
+  profiler.End(Phase::kInputProjection, stream2);
+
+  // The bias gradients are the column sums of `dp` and `dq`. Reducing them here instead
+  // of with atomics in the pointwise kernel makes them deterministic.
+  profiler.Begin(Phase::kWeightGradient, stream2);
+  AddColumnSums(batch_size, hidden_size * 3, dp, dbx, stream2);
+  AddColumnSums(batch_size, hidden_size * 3, dq, dbr, stream2);
 
   cublasSetStream(blas_handle, stream2);
   blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
+      CUBLAS_OP_N, CUBLAS_OP_T,
       hidden_size * 3, hidden_size, batch_size,
       &alpha,
       dq, hidden_size * 3,
-      h_t, batch_size,
+      h, hidden_size,
       &beta_sum,
       dR, hidden_size * 3);
 
+  cublasSetStream(blas_handle, stream2);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, input_size, batch_size,
+      &alpha,
+      dp, hidden_size * 3,
+      x_t, batch_size,
+      &beta_sum,
+      dW, hidden_size * 3);
+  profiler.End(Phase::kWeightGradient, stream2);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void BackwardPass<T>::IterateInternal(
+    const T* R_t,     // [H*3,H]
+    const T* h,       // [N,H]
+    const T* v,       // [N,H*4]
+    const T* dh_new,  // [N,H]
+    T* dh,            // [N,H]
+    T* dp,            // [N,H*3]
+    T* dq,            // [N,H*3]
+    const T* zoneout_mask,  // [N,H]
+    const int step,
+    const int active_batch_size,
+    const int* sequence_lengths,  // [N]
+    const int h_stride) {
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaEvent_t event = data_->event;
+  const bool packed = data_->packed;  // `R_t` is `R` for the `PackedWeights` overloads.
+
+  data_->profiler.Begin(Phase::kPointwise, stream1);
+  LaunchPointwiseOperations(
+      batch_size,
+      hidden_size,
+      h_stride,
+      h,
+      v,
+      v + 3 * hidden_size,
+      hidden_size * 4,
+      hidden_size * 4,
+      dh_new,
+      dh,
+      dp,
+      dq,
+      zoneout_mask,
+      data_->zoneout_rng,
+      step,
+      sequence_lengths,
+      stream1);
+  data_->profiler.End(Phase::kPointwise, stream1);
+
+  // Signal completion of pointwise operations for data-dependent streams.
+  cudaEventRecord(event, stream1);
+
   // There's a data dependency between the output of this kernel (`dh`) and the input to
   // the pointwise op kernel above (`dh`). Make sure both kernels run on the same stream
   // to avoid explicit stream synchronization.
-  cublasSetStream(blas_handle,  stream1);
+  cublasSetStream(blas_handle, stream1);
   blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size, batch_size, hidden_size * 3,
+      packed ? CUBLAS_OP_T : CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size, active_batch_size, hidden_size * 3,
       &alpha,
-      R_t, hidden_size,
+      R_t, packed ? hidden_size * 3 : hidden_size,
       dq, hidden_size * 3,
       &beta_sum,
       dh, hidden_size);
+}
+
+template<typename T>
+void BackwardPass<T>::WeightGradients(
+    const int first_step,
+    const int steps,
+    const int total_steps,
+    const bool accumulate,
+    const T* W_t,     // [H*3,C]
+    const T* x_t,     // [C,T,N]
+    const T* h,       // [T+1,N,H]
+    const T* dp,      // [T,N,H*3]
+    const T* dq,      // [T,N,H*3]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*3]
+    T* dR,            // [H,H*3]
+    T* dbx,           // [H*3]
+    T* dbr) {         // [H*3]
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+  const T* beta_weights = accumulate ? &beta_sum : &beta_assign;
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaEvent_t event = data_->event;
+  const bool packed = data_->packed;
+  const cublasOperation_t op_t = packed ? CUBLAS_OP_T : CUBLAS_OP_N;
+  const SequenceStrides strides(data_->sequence_layout, total_steps, batch_size, input_size, hidden_size);
+
+  // `x_t` is [C,T,N] unless `packed`, when it's `x` as laid out by `strides`.
+  const int rows = batch_size * steps;
+  const T* dp_chunk = dp + first_step * batch_size * hidden_size * 3;
+  const T* dq_chunk = dq + first_step * batch_size * hidden_size * 3;
+  const T* x_chunk = packed
+      ? x_t + first_step * strides.x_step
+      : x_t + first_step * batch_size;
+
+  cudaEventRecord(event, stream1);
+  cudaStreamWaitEvent(stream2, event, 0);
+
+  data_->profiler.Begin(Phase::kWeightGradient, stream2);
+  StoreColumnSums(rows, hidden_size * 3, accumulate, dp_chunk, dbx, stream2);
+  StoreColumnSums(rows, hidden_size * 3, accumulate, dq_chunk, dbr, stream2);
+
+  cublasSetStream(blas_handle, stream2);
+  if (packed) {
+    StepwiseSumGemm(blas_handle,
+        hidden_size * 3, input_size,
+        steps, batch_size,
+        &alpha,
+        dp_chunk,
+        x_chunk, strides.x_ld, strides.x_step,
+        beta_weights,
+        dW, hidden_size * 3);
+  } else {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, op_t,
+        hidden_size * 3, input_size, rows,
+        &alpha,
+        dp_chunk, hidden_size * 3,
+        x_chunk, batch_size * total_steps,
+        beta_weights,
+        dW, hidden_size * 3);
+  }
+
+  StepwiseSumGemm(blas_handle,
+      hidden_size * 3, hidden_size,
+      steps, batch_size,
+      &alpha,
+      dq_chunk,
+      h + strides.In(first_step) * strides.h_step, strides.h_ld, strides.h_step,
+      beta_weights,
+      dR, hidden_size * 3);
+  data_->profiler.End(Phase::kWeightGradient, stream2);
+
+  data_->profiler.Begin(Phase::kInputProjection, stream2);
+  StepwiseGemm(blas_handle,
+      op_t,
+      input_size, hidden_size * 3,
+      steps, batch_size,
+      &alpha,
+      W_t, packed ? hidden_size * 3 : input_size,
+      dp_chunk, hidden_size * 3, static_cast<size_t>(batch_size) * hidden_size * 3,
+      &beta_assign,
+      dx + first_step * strides.x_step, strides.x_ld, strides.x_step);
+  data_->profiler.End(Phase::kInputProjection, stream2);
+}
+
+template<typename T>
+void BackwardPass<T>::GradientsReady(const cudaStream_t& stream, T* dW, T* dR, T* dbx, T* dbr) {
+  const size_t input_size = data_->input_size;
+  const size_t hidden_size = data_->hidden_size;
+  T* const gradients[] = { dW, dR, dbx, dbr };
+  const size_t sizes[] = {
+    input_size * hidden_size * 3,
+    hidden_size * hidden_size * 3,
+    hidden_size * 3,
+    hidden_size * 3,
+  };
+  data_->gradient_hook.Signal(0, stream, gradients, sizes, 4);
+}
+
+template<typename T>
+void BackwardPass<T>::Run(
+    const int steps,
+    const T* W_t,     // [H*3,C]
+    const T* R_t,     // [H*3,H]
+    const T* bx,      // [H*3]
+    const T* br,      // [H*3]
+    const T* x_t,     // [C,T,N]
+    const T* h,       // [T+1,N,H]
+    const T* v,       // [T,N,H*4]
+    const T* dh_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*3]
+    T* dR,            // [H,H*3]
+    T* dbx,           // [H*3]
+    T* dbr,           // [H*3]
+    T* dh,            // [N,H]
+    T* dp,            // [T,N,H*3]
+    T* dq,            // [T,N,H*3]
+    const T* zoneout_mask,  // [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // Replay the work captured on a previous call with the same arguments, capturing it
+  // first if there's no such call. The capture re-enters `Run` with the graph's stream
+  // standing in for the caller's stream.
+  GraphCache& graph = data_->graph;
+  if (graph.enabled() && !graph.capturing()) {
+    bool captured = graph.Lookup(
+        steps,
+        W_t,
+        R_t,
+        bx,
+        br,
+        x_t,
+        h,
+        v,
+        dh_new,
+        dx,
+        dW,
+        dR,
+        dbx,
+        dbr,
+        dh,
+        dp,
+        dq,
+        zoneout_mask,
+        data_->zoneout_rng.enabled,
+        data_->zoneout_rng.prob,
+        data_->zoneout_rng.seed,
+        data_->zoneout_rng.offset,
+        data_->dropconnect.rate,
+        data_->dropconnect.seed,
+        data_->dropconnect.offset,
+        data_->dropconnect.tmp_R,
+        data_->packed,
+        data_->sequence_layout.batch_major,
+        data_->sequence_layout.reverse,
+        data_->sequence_layout.h_stride,
+        data_->accumulate,
+        data_->gradient_chunk,
+        sequence_lengths,
+        GraphKeyArray(batch_sizes, batch_sizes ? steps : 0));
+    if (!captured) {
+      const cudaStream_t sync_stream = data_->sync_stream;
+      data_->sync_stream = graph.BeginCapture();
+      Run(
+          steps,
+          W_t,
+          R_t,
+          bx,
+          br,
+          x_t,
+          h,
+          v,
+          dh_new,
+          dx,
+          dW,
+          dR,
+          dbx,
+          dbr,
+          dh,
+          dp,
+          dq,
+          zoneout_mask,
+          sequence_lengths,
+          batch_sizes);
+      data_->sync_stream = sync_stream;
+      captured = graph.EndCapture();
+    }
+    if (captured) {
+      // The hook can't be part of the graph, so a replay only signals at the end.
+      graph.Launch(data_->sync_stream);
+      if (data_->gradient_hook.enabled()) {
+        GradientsReady(data_->sync_stream, dW, dR, dbx, dbr);
+        data_->gradient_hook.Join(data_->sync_stream);
+      }
+      return;
+    }
+  }
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+  const T* beta_weights = data_->accumulate ? &beta_sum : &beta_assign;
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaEvent_t event = data_->event;
+  const bool signal_gradients = data_->gradient_hook.enabled() && !data_->graph.capturing();
+
+  // The `PackedWeights` overloads pass `W`, `R` and `x` in place of `W_t`, `R_t` and
+  // `x_t`, and the GEMMs transpose them instead.
+  const bool packed = data_->packed;
+  const cublasOperation_t op_t = packed ? CUBLAS_OP_T : CUBLAS_OP_N;
+  const SequenceStrides strides(data_->sequence_layout, steps, batch_size, input_size, hidden_size);
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // The recurrence runs on the masked `R_t` that the forward pass used.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  const bool apply_dropconnect = dropconnect.rate > 0.0f && dropconnect.tmp_R;
+  if (apply_dropconnect) {
+    LaunchDropConnect(hidden_size, hidden_size * 3, !packed, dropconnect, R_t, dropconnect.tmp_R, stream1);
+    R_t = dropconnect.tmp_R;
+  }
+
+  // With chunking, the GEMMs of the iterations [i, i+chunk) are issued once the
+  // recurrence reaches iteration i, whose time steps are contiguous in either direction.
+  // The first chunk to be issued is the only one that may overwrite.
+  const int chunk = data_->gradient_chunk;
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kRecurrence, stream1);
+  const int NH = batch_size * hidden_size;
+  for (int i = steps - 1; i >= 0; --i) {
+    const int t = strides.Step(i, steps);
+    IterateInternal(
+        R_t,
+        h + strides.In(t) * strides.h_step,
+        v + t * NH * 4,
+        dh_new + strides.Out(t) * strides.h_step,
+        dh,
+        dp + t * NH * 3,
+        dq + t * NH * 3,
+        zoneout_mask ? zoneout_mask + t * NH : nullptr,
+        t,
+        batch_sizes ? batch_sizes[t] : batch_size,
+        sequence_lengths,
+        strides.h_ld);
+    if (chunk && i % chunk == 0) {
+      const int count = std::min(chunk, steps - i);
+      WeightGradients(strides.reverse ? steps - i - count : i, count, steps,
+          data_->accumulate || i + chunk < steps, W_t, x_t, h, dp, dq, dx, dW, dR, dbx, dbr);
+    }
+  }
+  profiler.End(Phase::kRecurrence, stream1);
+
+  if (chunk) {
+    // Only the kept elements of `R` took part in the recurrence. `dR` is complete once
+    // the last chunk's GEMMs on `stream2` are.
+    if (apply_dropconnect)
+      LaunchDropConnect(hidden_size, hidden_size * 3, false, dropconnect, dR, dR, stream2);
+    if (signal_gradients)
+      GradientsReady(stream2, dW, dR, dbx, dbr);
+  } else {
+    // Wait for pointwise operations to complete since there's a
+    // data dependency between its output (`dp`, `dq`) and the following matmuls.
+    cudaStreamWaitEvent(stream2, event, 0);
+
+    profiler.Begin(Phase::kWeightGradient, stream2);
+    StoreColumnSums(batch_size * steps, hidden_size * 3, data_->accumulate, dp, dbx, stream2);
+    StoreColumnSums(batch_size * steps, hidden_size * 3, data_->accumulate, dq, dbr, stream2);
+
+    cublasSetStream(blas_handle, stream2);
+    if (packed) {
+      StepwiseSumGemm(blas_handle,
+          hidden_size * 3, input_size,
+          steps, batch_size,
+          &alpha,
+          dp,
+          x_t, strides.x_ld, strides.x_step,
+          beta_weights,
+          dW, hidden_size * 3);
+    } else {
+      blas<T>::gemm(blas_handle,
+          CUBLAS_OP_N, op_t,
+          hidden_size * 3, input_size, batch_size * steps,
+          &alpha,
+          dp, hidden_size * 3,
+          x_t, batch_size * steps,
+          beta_weights,
+          dW, hidden_size * 3);
+    }
+    profiler.End(Phase::kWeightGradient, stream2);
+
+    profiler.Begin(Phase::kWeightGradient, stream1);
+    cublasSetStream(blas_handle, stream1);
+    StepwiseSumGemm(blas_handle,
+        hidden_size * 3, hidden_size,
+        steps, batch_size,
+        &alpha,
+        dq,
+        h + strides.In(0) * strides.h_step, strides.h_ld, strides.h_step,
+        beta_weights,
+        dR, hidden_size * 3);
+    profiler.End(Phase::kWeightGradient, stream1);
+
+    // Only the kept elements of `R` took part in the recurrence.
+    if (apply_dropconnect)
+      LaunchDropConnect(hidden_size, hidden_size * 3, false, dropconnect, dR, dR, stream1);
+
+    // Signal the weight gradients before `dx` is enqueued behind them on `stream1`.
+    if (signal_gradients) {
+      cudaEventRecord(event, stream1);
+      cudaStreamWaitEvent(stream2, event, 0);
+      GradientsReady(stream2, dW, dR, dbx, dbr);
+    }
+
+    profiler.Begin(Phase::kInputProjection, stream1);
+    cublasSetStream(blas_handle, stream1);
+    StepwiseGemm(blas_handle,
+        op_t,
+        input_size, hidden_size * 3,
+        steps, batch_size,
+        &alpha,
+        W_t, packed ? hidden_size * 3 : input_size,
+        dp, hidden_size * 3, static_cast<size_t>(NH) * 3,
+        &beta_assign,
+        dx, strides.x_ld, strides.x_step);
+    profiler.End(Phase::kInputProjection, stream1);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  if (signal_gradients)
+    data_->gradient_hook.Join(data_->sync_stream);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void BackwardPass<T>::Run(
+    const int steps,
+    const PackedWeights<T>& weights,
+    const T* x,       // [T,N,C]
+    const T* h,       // [T+1,N,H]
+    const T* v,       // [T,N,H*4]
+    const T* dh_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*3]
+    T* dR,            // [H,H*3]
+    T* dbx,           // [H*3]
+    T* dbr,           // [H*3]
+    T* dh,            // [N,H]
+    T* dp,            // [T,N,H*3]
+    T* dq,            // [T,N,H*3]
+    const T* zoneout_mask,  // [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  data_->packed = true;
+  Run(
+      steps,
+      weights.W,
+      weights.R,
+      weights.bx,
+      weights.br,
+      x,
+      h,
+      v,
+      dh_new,
+      dx,
+      dW,
+      dR,
+      dbx,
+      dbr,
+      dh,
+      dp,
+      dq,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+  data_->packed = false;
+}
+
+template<typename T>
+size_t BackwardPass<T>::GetWorkspaceSize(const int steps) const {
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  return 2 * WorkspaceBytes<T>(steps * NH * 3);  // dp, dq
+}
+
+template<typename T>
+void BackwardPass<T>::Run(
+    const int steps,
+    const PackedWeights<T>& weights,
+    const T* x,       // [T,N,C]
+    const T* h,       // [T+1,N,H]
+    const T* v,       // [T,N,H*4]
+    const T* dh_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*3]
+    T* dR,            // [H,H*3]
+    T* dbx,           // [H*3]
+    T* dbr,           // [H*3]
+    T* dh,            // [N,H]
+    const T* zoneout_mask,  // [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes,       // [T] host
+    void* workspace) {            // `GetWorkspaceSize(steps)` bytes
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  Workspace buffers(workspace);
+  T* dp = buffers.Take<T>(steps * NH * 3);
+  T* dq = buffers.Take<T>(steps * NH * 3);
+  Run(
+      steps,
+      weights,
+      x,
+      h,
+      v,
+      dh_new,
+      dx,
+      dW,
+      dR,
+      dbx,
+      dbr,
+      dh,
+      dp,
+      dq,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+}
+
+template<typename T>
+void BackwardPass<T>::RunCompact(
+    const int steps,
+    const ActivationStorage storage,
+    const T* W_t,     // [H*3,C]
+    const T* R_t,     // [H*3,H]
+    const T* bx,      // [H*3]
+    const T* br,      // [H*3]
+    const T* x_t,     // [C,T,N]
+    const T* h,       // [T+1,N,H]
+    const void* v,    // See `CompactActivationsSize`
+    const T* dh_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*3]
+    T* dR,            // [H,H*3]
+    T* dbx,           // [H*3]
+    T* dbr,           // [H*3]
+    T* dh,            // [N,H]
+    T* dp,            // [T,N,H*3]
+    T* dq,            // [T,N,H*3]
+    const T* zoneout_mask,  // [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+  const T* beta_weights = data_->accumulate ? &beta_sum : &beta_assign;
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaEvent_t event = data_->event;
+
+  // The `PackedWeights` overloads pass `W`, `R` and `x` in place of `W_t`, `R_t` and
+  // `x_t`, and the GEMMs transpose them instead.
+  const bool packed = data_->packed;
+  const cublasOperation_t op_t = packed ? CUBLAS_OP_T : CUBLAS_OP_N;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // The recurrence runs on the masked `R_t` that the forward pass used.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  const bool apply_dropconnect = dropconnect.rate > 0.0f && dropconnect.tmp_R;
+  if (apply_dropconnect) {
+    LaunchDropConnect(hidden_size, hidden_size * 3, !packed, dropconnect, R_t, dropconnect.tmp_R, stream1);
+    R_t = dropconnect.tmp_R;
+  }
+
+  // The pointwise kernel reads the compact activations and writes full-precision gate
+  // gradients to `dp` and `dq`, so the GEMMs below are the same as in `Run`.
+  cublasSetStream(blas_handle, stream1);
+  const int NH = batch_size * hidden_size;
+  const __half* v_half = reinterpret_cast<const __half*>(v);
+  const int8_t* v_fixed8 = reinterpret_cast<const int8_t*>(v_half + steps * NH);
+  for (int i = steps - 1; i >= 0; --i) {
+    switch (storage) {
+      case ActivationStorage::kHalf:
+        LaunchPointwiseOperations(
+            batch_size,
+            hidden_size,
+            hidden_size,
+            h + i * NH,
+            v_half + i * NH * 4,
+            v_half + i * NH * 4 + 3 * hidden_size,
+            hidden_size * 4,
+            hidden_size * 4,
+            dh_new + (i + 1) * NH,
+            dh,
+            dp + i * NH * 3,
+            dq + i * NH * 3,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+      case ActivationStorage::kFixed8:
+        LaunchPointwiseOperations(
+            batch_size,
+            hidden_size,
+            hidden_size,
+            h + i * NH,
+            v_fixed8 + i * NH * 3,
+            v_half + i * NH,
+            hidden_size * 3,
+            hidden_size,
+            dh_new + (i + 1) * NH,
+            dh,
+            dp + i * NH * 3,
+            dq + i * NH * 3,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+    }
+
+    blas<T>::gemm(blas_handle,
+        op_t, CUBLAS_OP_N,
+        hidden_size, batch_sizes ? batch_sizes[i] : batch_size, hidden_size * 3,
+        &alpha,
+        R_t, packed ? hidden_size * 3 : hidden_size,
+        dq + i * NH * 3, hidden_size * 3,
+        &beta_sum,
+        dh, hidden_size);
+  }
+  cudaEventRecord(event, stream1);
+
+  cudaStreamWaitEvent(stream2, event, 0);
+
+  StoreColumnSums(batch_size * steps, hidden_size * 3, data_->accumulate, dp, dbx, stream2);
+  StoreColumnSums(batch_size * steps, hidden_size * 3, data_->accumulate, dq, dbr, stream2);
+
+  cublasSetStream(blas_handle, stream2);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, op_t,
+      hidden_size * 3, input_size, batch_size * steps,
+      &alpha,
+      dp, hidden_size * 3,
+      x_t, packed ? input_size : batch_size * steps,
+      beta_weights,
+      dW, hidden_size * 3);
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_T,
+      hidden_size * 3, hidden_size, batch_size * steps,
+      &alpha,
+      dq, hidden_size * 3,
+      h, hidden_size,
+      beta_weights,
+      dR, hidden_size * 3);
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      op_t, CUBLAS_OP_N,
+      input_size, steps * batch_size, hidden_size * 3,
+      &alpha,
+      W_t, packed ? hidden_size * 3 : input_size,
+      dp, hidden_size * 3,
+      &beta_assign,
+      dx, input_size);
+
+  // Only the kept elements of `R` took part in the recurrence.
+  if (apply_dropconnect)
+    LaunchDropConnect(hidden_size, hidden_size * 3, false, dropconnect, dR, dR, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void BackwardPass<T>::RunCompact(
+    const int steps,
+    const ActivationStorage storage,
+    const PackedWeights<T>& weights,
+    const T* x,       // [T,N,C]
+    const T* h,       // [T+1,N,H]
+    const void* v,    // [T,N,H*4] in the `storage` format
+    const T* dh_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*3]
+    T* dR,            // [H,H*3]
+    T* dbx,           // [H*3]
+    T* dbr,           // [H*3]
+    T* dh,            // [N,H]
+    T* dp,            // [T,N,H*3]
+    T* dq,            // [T,N,H*3]
+    const T* zoneout_mask,  // [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  data_->packed = true;
+  RunCompact(
+      steps,
+      storage,
+      weights.W,
+      weights.R,
+      weights.bx,
+      weights.br,
+      x,
+      h,
+      v,
+      dh_new,
+      dx,
+      dW,
+      dR,
+      dbx,
+      dbr,
+      dh,
+      dp,
+      dq,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+  data_->packed = false;
+}
+
+template<typename T>
+struct StackedBackwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  std::vector<BackwardPass<T>*> layers;
+  std::vector<cudaEvent_t> layer_events;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+  GradientHook gradient_hook;
+};
+
+template<typename T>
+StackedBackwardPass<T>::StackedBackwardPass(
+    const int layers,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < layers; ++i) {
+    data_->layers.push_back(new BackwardPass<T>(
+        batch_size,
+        i ? hidden_size : input_size,
+        hidden_size,
+        blas_handle,
+        stream));
+    cudaEvent_t event;
+    cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+    data_->layer_events.push_back(event);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+StackedBackwardPass<T>::~StackedBackwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  for (int i = data_->layers.size() - 1; i >= 0; --i) {
+    cudaEventDestroy(data_->layer_events[i]);
+    delete data_->layers[i];
+  }
+  delete data_;
+}
+
+template<typename T>
+void StackedBackwardPass<T>::SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data) {
+  data_->gradient_hook.SetCallback(callback, user_data);
+}
+
+#ifdef HASTE_WITH_NCCL
+template<typename T>
+bool StackedBackwardPass<T>::SetGradientAllReduce(const ncclComm_t& comm) {
+  return data_->gradient_hook.template SetAllReduce<T>(comm);
+}
+#endif
+
+template<typename T>
+void StackedBackwardPass<T>::LayerGradients(
+    const int l,
+    const int steps,
+    const T* const* W_t,   // [L] [H*3,C] or [H*3,H]
+    const T* x_t,          // [C,T,N]
+    const T* const* h,     // [L] [T+1,N,H]
+    T* dx,                 // [T,N,C]
+    T* const* dW,          // [L] [C,H*3] or [H,H*3]
+    T* const* dR,          // [L] [H,H*3]
+    T* const* dbx,         // [L] [H*3]
+    T* const* dbr,         // [L] [H*3]
+    const T* const* dp,    // [L] [T,N,H*3]
+    const T* const* dq) {  // [L] [T,N,H*3]
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const int NH = batch_size * hidden_size;
+
+  auto layer = data_->layers[l]->data_;
+  const cudaStream_t stream1 = layer->stream[0];
+  const cudaStream_t stream2 = layer->stream[1];
+  const cudaEvent_t event = layer->event;
+  cudaEventRecord(event, stream1);
+
+  cudaStreamWaitEvent(stream2, event, 0);
+  AddColumnSums(batch_size * steps, hidden_size * 3, dp[l], dbx[l], stream2);
+  AddColumnSums(batch_size * steps, hidden_size * 3, dq[l], dbr[l], stream2);
+
+  cublasSetStream(blas_handle, stream2);
+  if (l == 0) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 3, input_size, batch_size * steps,
+        &alpha,
+        dp[0], hidden_size * 3,
+        x_t, batch_size * steps,
+        &beta_sum,
+        dW[0], hidden_size * 3);
+  } else {
+    // The input of every other layer is the untransposed `h` of the layer below.
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        hidden_size * 3, hidden_size, batch_size * steps,
+        &alpha,
+        dp[l], hidden_size * 3,
+        h[l - 1] + NH, hidden_size,
+        &beta_sum,
+        dW[l], hidden_size * 3);
+  }
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_T,
+      hidden_size * 3, hidden_size, batch_size * steps,
+      &alpha,
+      dq[l], hidden_size * 3,
+      h[l], hidden_size,
+      &beta_sum,
+      dR[l], hidden_size * 3);
+
+  // Signal the weight gradients before layer 0's `dx` is enqueued behind them.
+  if (data_->gradient_hook.enabled()) {
+    cudaEventRecord(event, stream1);
+    cudaStreamWaitEvent(stream2, event, 0);
+    const size_t layer_input_size = l ? hidden_size : input_size;
+    T* const gradients[] = { dW[l], dR[l], dbx[l], dbr[l] };
+    const size_t sizes[] = {
+      layer_input_size * hidden_size * 3,
+      static_cast<size_t>(hidden_size) * hidden_size * 3,
+      static_cast<size_t>(hidden_size) * 3,
+      static_cast<size_t>(hidden_size) * 3,
+    };
+    data_->gradient_hook.Signal(l, stream2, gradients, sizes, 4);
+  }
+
+  if (l == 0) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        input_size, steps * batch_size, hidden_size * 3,
+        &alpha,
+        W_t[0], input_size,
+        dp[0], hidden_size * 3,
+        &beta_assign,
+        dx, input_size);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+}
+
+template<typename T>
+void StackedBackwardPass<T>::Run(
+    const int steps,
+    const T* const* W_t,     // [L] [H*3,C] or [H*3,H]
+    const T* const* R_t,     // [L] [H*3,H]
+    const T* const* bx,      // [L] [H*3]
+    const T* const* br,      // [L] [H*3]
+    const T* x_t,            // [C,T,N]
+    const T* const* h,       // [L] [T+1,N,H]
+    const T* const* v,       // [L] [T,N,H*4]
+    T* const* dh_new,        // [L] [T+1,N,H]
+    T* dx,                   // [T,N,C]
+    T* const* dW,            // [L] [C,H*3] or [H,H*3]
+    T* const* dR,            // [L] [H,H*3]
+    T* const* dbx,           // [L] [H*3]
+    T* const* dbr,           // [L] [H*3]
+    T* const* dh,            // [L] [N,H]
+    T* const* dp,            // [L] [T,N,H*3]
+    T* const* dq,            // [L] [T,N,H*3]
+    const T* const* zoneout_mask,  // [L] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+
+  const int layers = data_->layers.size();
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (BackwardPass<T>* layer : data_->layers)
+    cudaStreamWaitEvent(layer->data_->stream[0], data_->ready_event, 0);
+
+  // Step `t` of layer `l` is issued on diagonal `(T - 1 - t) + (L - 1 - l)`, after step `t`
+  // of layer `l + 1` has added its input gradient to `dh_new[l]` on the previous diagonal.
+  // Each diagonal is issued from the bottom layer up so that `layer_events[l + 1]` still
+  // marks step `t` when layer `l` waits on it.
+  const int NH = batch_size * hidden_size;
+  for (int d = 0; d < steps + layers - 1; ++d) {
+    for (int l = std::max(0, layers - 1 - d); l < layers && d - (layers - 1 - l) < steps; ++l) {
+      const int t = steps - 1 - (d - (layers - 1 - l));
+      const int active_batch_size = batch_sizes ? batch_sizes[t] : batch_size;
+      BackwardPass<T>* layer = data_->layers[l];
+
+      if (l < layers - 1)
+        cudaStreamWaitEvent(layer->data_->stream[0], data_->layer_events[l + 1], 0);
+
+      const T* mask = zoneout_mask ? zoneout_mask[l] : nullptr;
+      layer->IterateInternal(
+          R_t[l],
+          h[l] + t * NH,
+          v[l] + t * NH * 4,
+          dh_new[l] + (t + 1) * NH,
+          dh[l],
+          dp[l] + t * NH * 3,
+          dq[l] + t * NH * 3,
+          mask ? mask + t * NH : nullptr,
+          t,
+          active_batch_size,
+          sequence_lengths,
+          hidden_size);
+
+      // The first layer's input gradient isn't needed until the end, so it's computed
+      // for all time steps at once by `LayerGradients`.
+      if (l > 0) {
+        const cudaStream_t stream2 = layer->data_->stream[1];
+        cudaStreamWaitEvent(stream2, layer->data_->event, 0);
+        cublasSetStream(blas_handle, stream2);
+        blas<T>::gemm(blas_handle,
+            CUBLAS_OP_N, CUBLAS_OP_N,
+            hidden_size, active_batch_size, hidden_size * 3,
+            &alpha,
+            W_t[l], hidden_size,
+            dp[l] + t * NH * 3, hidden_size * 3,
+            &beta_sum,
+            dh_new[l - 1] + (t + 1) * NH, hidden_size);
+        cudaEventRecord(data_->layer_events[l], stream2);
+      }
+
+      // The layer's weight gradients are final once its recurrence has reached the first
+      // time step, while the layers below still have `l` diagonals to go.
+      if (t == 0)
+        LayerGradients(l, steps, W_t, x_t, h, dx, dW, dR, dbx, dbr, dp, dq);
+    }
+  }
+
+  data_->gradient_hook.Join(data_->sync_stream);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct BidirectionalBackwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  BackwardPass<T>* directions[2];
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+BidirectionalBackwardPass<T>::BidirectionalBackwardPass(
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < 2; ++i) {
+    data_->directions[i] = new BackwardPass<T>(
+        batch_size,
+        input_size,
+        hidden_size,
+        blas_handle,
+        stream);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+BidirectionalBackwardPass<T>::~BidirectionalBackwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  delete data_->directions[1];
+  delete data_->directions[0];
+  delete data_;
+}
+
+template<typename T>
+void BidirectionalBackwardPass<T>::Run(
+    const int steps,
+    const T* const* W_t,     // [2] [H*3,C]
+    const T* const* R_t,     // [2] [H*3,H]
+    const T* const* bx,      // [2] [H*3]
+    const T* const* br,      // [2] [H*3]
+    const T* x_t,            // [C,T,N]
+    const T* const* h,       // [2] [T+1,N,H] with a stride of `h_stride`
+    const int h_stride,
+    const T* const* v,       // [2] [T,N,H*4]
+    const T* const* dh_new,  // [2] [T+1,N,H] with a stride of `h_stride`
+    T* dx,                   // [T,N,C]
+    T* const* dW,            // [2] [C,H*3]
+    T* const* dR,            // [2] [H,H*3]
+    T* const* dbx,           // [2] [H*3]
+    T* const* dbr,           // [2] [H*3]
+    T* const* dh,            // [2] [N,H]
+    T* const* dp,            // [2] [T,N,H*3]
+    T* const* dq,            // [2] [T,N,H*3]
+    const T* const* zoneout_mask,  // [2] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (BackwardPass<T>* direction : data_->directions)
+    cudaStreamWaitEvent(direction->data_->stream[0], data_->ready_event, 0);
+
+  // Each direction visits its steps in the opposite order of its forward pass: the
+  // forward direction goes from step `T - 1` down to 0 while the reverse direction goes
+  // from step 0 up to `T - 1`. See `BidirectionalForwardPass::Run` for the layout.
+  const int NH = batch_size * hidden_size;
+  const int h_step = batch_size * h_stride;
+  for (int s = 0; s < steps; ++s) {
+    for (int i = 0; i < 2; ++i) {
+      const int t = i ? s : steps - 1 - s;
+      const int in = i ? t + 1 : t;
+      const int out = i ? t : t + 1;
+      const T* mask = zoneout_mask ? zoneout_mask[i] : nullptr;
+      data_->directions[i]->IterateInternal(
+          R_t[i],
+          h[i] + in * h_step,
+          v[i] + t * NH * 4,
+          dh_new[i] + out * h_step,
+          dh[i],
+          dp[i] + t * NH * 3,
+          dq[i] + t * NH * 3,
+          mask ? mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          h_stride);
+    }
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    auto direction = data_->directions[i]->data_;
+    const cudaStream_t stream1 = direction->stream[0];
+    const cudaStream_t stream2 = direction->stream[1];
+    const cudaEvent_t event = direction->event;
+    cudaEventRecord(event, stream1);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    AddColumnSums(batch_size * steps, hidden_size * 3, dp[i], dbx[i], stream2);
+    AddColumnSums(batch_size * steps, hidden_size * 3, dq[i], dbr[i], stream2);
+
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 3, input_size, batch_size * steps,
+        &alpha,
+        dp[i], hidden_size * 3,
+        x_t, batch_size * steps,
+        &beta_sum,
+        dW[i], hidden_size * 3);
+
+    // The inputs of the reverse direction's steps start at index 1.
+    cublasSetStream(blas_handle, stream1);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        hidden_size * 3, hidden_size, batch_size * steps,
+        &alpha,
+        dq[i], hidden_size * 3,
+        i ? h[i] + h_step : h[i], h_stride,
+        &beta_sum,
+        dR[i], hidden_size * 3);
+  }
+
+  // Both directions' input gradients are summed into `dx` on a single stream so that
+  // the accumulation is ordered.
+  const cudaStream_t stream1 = data_->directions[0]->data_->stream[0];
+  cudaStreamWaitEvent(stream1, data_->directions[1]->data_->event, 0);
+  cublasSetStream(blas_handle, stream1);
+  for (int i = 0; i < 2; ++i) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        input_size, steps * batch_size, hidden_size * 3,
+        &alpha,
+        W_t[i], input_size,
+        dp[i], hidden_size * 3,
+        i ? &beta_sum : &beta_assign,
+        dx, input_size);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  for (BackwardPass<T>* direction : data_->directions) {
+    for (int i = 1; i >= 0; --i) {
+      cudaEventRecord(data_->finished_event, direction->data_->stream[i]);
+      cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+    }
+  }
 
   cublasSetStream(blas_handle, save_stream);
 }
 
+template struct BackwardPass<__half>;
+template struct BackwardPass<__nv_bfloat16>;
 template struct BackwardPass<float>;
 template struct BackwardPass<double>;
+template struct StackedBackwardPass<__half>;
+template struct StackedBackwardPass<__nv_bfloat16>;
+template struct StackedBackwardPass<float>;
+template struct StackedBackwardPass<double>;
+template struct BidirectionalBackwardPass<__half>;
+template struct BidirectionalBackwardPass<__nv_bfloat16>;
+template struct BidirectionalBackwardPass<float>;
+template struct BidirectionalBackwardPass<double>;
 
 }  // namespace gru
 }  // namespace v0
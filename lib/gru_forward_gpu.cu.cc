@@ -13,37 +13,73 @@
 // limitations under the License.
 // ==============================================================================
 
+#include <algorithm>
+#include <chrono>
+#include <cooperative_groups.h>
 #include <cublas_v2.h>
 #include <cuda_runtime_api.h>
+#include <vector>
 
+#include "batching.h"
 #include "blas.h"
+#include "dropconnect.h"
+#include "graph.h"
 #include "haste.h"
 #include "inline_ops.h"
+#include "packing.h"
+#include "persistent.h"
+#include "profiling.h"
+#include "quantize.h"
+#include "sequence.h"
+#include "state_pool.h"
+#include "workspace.h"
 
 namespace {
 
-template<typename T, bool Training, bool ApplyZoneout>
+// The activations are written as `V` (z, r, g) and `Q` (q_g), which are `T` except for
+// `RunCompact`. Batch item `col` starts at `col * v_stride` in `v_out` and at
+// `col * q_stride` in `q_out`. `Act` implements the gate nonlinearities (see
+// `ActivationTier`).
+template<typename T, typename V, typename Q, typename Act, bool Training, bool ApplyZoneout>
 __global__
 void PointwiseOperations(const int batch_dim,
                          const int hidden_dim,
+                         const int h_stride,  // Distance between batch items in `h` and `h_out`
                          const T* Wx,
                          const T* Rh,
                          const T* bx,
                          const T* br,
                          const T* h,
                          T* h_out,
-                         T* v_out,
+                         V* v_out,
+                         Q* q_out,
+                         const int v_stride,
+                         const int q_stride,
                          const float zoneout_prob,
-                         const T* zoneout_mask) {  // Zoneout mask (only used if ApplyZoneout==true)
+                         const T* zoneout_mask,  // Zoneout mask (only used if ApplyZoneout==true), may be null
+                         const ZoneoutRng zoneout_rng,  // Generates the mask if `zoneout_mask` is null
+                         const int step,
+                         const int* sequence_lengths) {  // May be null
   const int row = blockDim.x * blockIdx.x + threadIdx.x;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
+  // Items past the end of their sequence carry their state through unchanged. Their
+  // `v` and `Rh` are never read (and may not have been computed).
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    const int idx = col * h_stride + row;
+    h_out[idx] = h[idx];
+    return;
+  }
+
   const int weight_idx = col * (hidden_dim * 3) + row;
 
-  // Index into the `h` and `h_out` vectors (they have a stride of `hidden_dim`).
+  // Index into the `h` and `h_out` vectors (they have a stride of `h_stride`).
+  const int h_idx = col * h_stride + row;
+
+  // Index into the zoneout mask (it has a stride of `hidden_dim`).
   const int output_idx = col * hidden_dim + row;
 
   // Indicies into the Wx and Rh matrices (for each of the u, r, and e components).
@@ -56,30 +92,498 @@ void PointwiseOperations(const int batch_dim,
   const int br_idx = row + 1 * hidden_dim;
   const int bg_idx = row + 2 * hidden_dim;
 
-  const T z = sigmoid(Wx[z_idx] + Rh[z_idx] + bx[bz_idx] + br[bz_idx]);
-  const T r = sigmoid(Wx[r_idx] + Rh[r_idx] + bx[br_idx] + br[br_idx]);
-  const T g = tanh   (Wx[g_idx] + r * (Rh[g_idx] + br[bg_idx]) + bx[bg_idx]);
+  // Gate math is done in (at least) FP32 for 16-bit types.
+  typedef typename accum_type<T>::type Acc;
+
+  const Acc Rh_g = Acc(Rh[g_idx]) + Acc(br[bg_idx]);
+  Acc z;
+  Acc r;
+  Act::sigmoid2(
+      Acc(Wx[z_idx]) + Acc(Rh[z_idx]) + Acc(bx[bz_idx]) + Acc(br[bz_idx]),
+      Acc(Wx[r_idx]) + Acc(Rh[r_idx]) + Acc(bx[br_idx]) + Acc(br[br_idx]),
+      &z,
+      &r);
+  const Acc g = Act::tanh(Acc(Wx[g_idx]) + r * Rh_g + Acc(bx[bg_idx]));
 
   // Store internal activations if we're eventually going to backprop.
   if (Training) {
-    const int base_v_idx = col * (hidden_dim * 4) + row;
-    v_out[base_v_idx + 0 * hidden_dim] = z;
-    v_out[base_v_idx + 1 * hidden_dim] = r;
-    v_out[base_v_idx + 2 * hidden_dim] = g;
-    v_out[base_v_idx + 3 * hidden_dim] = Rh[g_idx] + br[bg_idx];
+    const int base_v_idx = col * v_stride + row;
+    v_out[base_v_idx + 0 * hidden_dim] = pack_activation<V>(z);
+    v_out[base_v_idx + 1 * hidden_dim] = pack_activation<V>(r);
+    v_out[base_v_idx + 2 * hidden_dim] = pack_activation<V>(g);
+    q_out[col * q_stride + row] = pack_activation<Q>(Rh_g);
   }
 
-  T cur_h_value = z * h[output_idx] + (static_cast<T>(1.0) - z) * g;
+  const Acc h_prev = Acc(h[h_idx]);
+  Acc cur_h_value = z * h_prev + (static_cast<Acc>(1.0) - z) * g;
 
   if (ApplyZoneout) {
     if (Training) {
-      cur_h_value = (cur_h_value - h[output_idx]) * zoneout_mask[output_idx] + h[output_idx];
+      const Acc mask = zoneout_mask
+          ? Acc(zoneout_mask[output_idx])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + output_idx);
+      cur_h_value = (cur_h_value - h_prev) * mask + h_prev;
+    } else {
+      cur_h_value = (zoneout_prob * h_prev) + ((1.0f - zoneout_prob) * cur_h_value);
+    }
+  }
+
+  h_out[h_idx] = T(cur_h_value);
+}
+
+// Launches `PointwiseOperations` for one time step of the whole batch.
+template<typename T, typename V, typename Q>
+void LaunchPointwiseOperations(
+    const bool training,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* Wx,
+    const T* Rh,
+    const T* bx,
+    const T* br,
+    const T* h,
+    T* h_out,
+    V* v_out,
+    Q* q_out,
+    const int v_stride,
+    const int q_stride,
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  // Compute launch configuration for pointwise operations kernel.
+  const dim3 blockDim(32, 16);
+  const dim3 gridDim(
+      (hidden_size + blockDim.x - 1) / blockDim.x,
+      (batch_size + blockDim.y - 1) / blockDim.y);
+
+  // Inference blends in the expectation of zoneout, so it needs no mask source.
+  const bool apply_zoneout = zoneout_prob && (!training || zoneout_mask || zoneout_rng.enabled);
+
+  if (training) {
+    if (apply_zoneout) {
+      PointwiseOperations<T, V, Q, PreciseActivations, true, true><<<gridDim, blockDim, 0, stream>>>(
+          batch_size,
+          hidden_size,
+          h_stride,
+          Wx,
+          Rh,
+          bx,
+          br,
+          h,
+          h_out,
+          v_out,
+          q_out,
+          v_stride,
+          q_stride,
+          zoneout_prob,
+          zoneout_mask,
+          zoneout_rng,
+          step,
+          sequence_lengths);
     } else {
-      cur_h_value = (zoneout_prob * h[output_idx]) + ((1.0f - zoneout_prob) * cur_h_value);
+      PointwiseOperations<T, V, Q, PreciseActivations, true, false><<<gridDim, blockDim, 0, stream>>>(
+          batch_size,
+          hidden_size,
+          h_stride,
+          Wx,
+          Rh,
+          bx,
+          br,
+          h,
+          h_out,
+          v_out,
+          q_out,
+          v_stride,
+          q_stride,
+          0.0f,
+          nullptr,
+          ZoneoutRng(),
+          step,
+          sequence_lengths);
+    }
+  } else {
+    if (apply_zoneout) {
+      PointwiseOperations<T, V, Q, PreciseActivations, false, true><<<gridDim, blockDim, 0, stream>>>(
+          batch_size,
+          hidden_size,
+          h_stride,
+          Wx,
+          Rh,
+          bx,
+          br,
+          h,
+          h_out,
+          nullptr,
+          nullptr,
+          v_stride,
+          q_stride,
+          zoneout_prob,
+          zoneout_mask,
+          zoneout_rng,
+          step,
+          sequence_lengths);
+    } else {
+      PointwiseOperations<T, V, Q, PreciseActivations, false, false><<<gridDim, blockDim, 0, stream>>>(
+          batch_size,
+          hidden_size,
+          h_stride,
+          Wx,
+          Rh,
+          bx,
+          br,
+          h,
+          h_out,
+          nullptr,
+          nullptr,
+          v_stride,
+          q_stride,
+          0.0f,
+          nullptr,
+          ZoneoutRng(),
+          step,
+          sequence_lengths);
     }
   }
+}
+
+// `LaunchPointwiseOperations` for an inference pass with the gate nonlinearities of
+// `Act` (see `ActivationTier`). Unlike `LaunchPointwiseOperations` it leaves out the
+// training kernels, which the activation tiers don't have.
+template<typename T, typename Act>
+void LaunchInferenceOperations(
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* Wx,
+    const T* Rh,
+    const T* bx,
+    const T* br,
+    const T* h,
+    T* h_out,
+    const float zoneout_prob,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(32, 16);
+  const dim3 gridDim(
+      (hidden_size + blockDim.x - 1) / blockDim.x,
+      (batch_size + blockDim.y - 1) / blockDim.y);
+
+  const bool apply_zoneout = zoneout_prob != 0.0f;
+  const auto kernel = apply_zoneout
+      ? PointwiseOperations<T, T, T, Act, false, true>
+      : PointwiseOperations<T, T, T, Act, false, false>;
+  kernel<<<gridDim, blockDim, 0, stream>>>(
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      bx,
+      br,
+      h,
+      h_out,
+      nullptr,
+      nullptr,
+      0,
+      0,
+      apply_zoneout ? zoneout_prob : 0.0f,
+      nullptr,
+      ZoneoutRng(),
+      step,
+      sequence_lengths);
+}
+
+// `LaunchInferenceOperations` for `tier`, which isn't `ActivationTier::kPrecise`: the
+// precise inference kernels are `LaunchPointwiseOperations`'s own.
+template<typename T>
+void LaunchTierOperations(
+    const haste::v0::ActivationTier tier,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* Wx,
+    const T* Rh,
+    const T* bx,
+    const T* br,
+    const T* h,
+    T* h_out,
+    const float zoneout_prob,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  typedef haste::v0::ActivationTier Tier;
+  const auto launch = tier == Tier::kHalf2 ? LaunchInferenceOperations<T, Half2Activations>
+      : tier == Tier::kApprox ? LaunchInferenceOperations<T, ApproxActivations>
+      :                         LaunchInferenceOperations<T, FastActivations>;
+  launch(
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      bx,
+      br,
+      h,
+      h_out,
+      zoneout_prob,
+      step,
+      sequence_lengths,
+      stream);
+}
+
+// The pointwise operations of `RunQuantized`: dequantizes the int32 products `Wx` and
+// `Rh` with the per-column weight scales and the scales of the quantized inputs and
+// hidden state, applies the gates in (at least) FP32 and writes the new hidden state
+// both in `T` and quantized, as `h_q`, for the next step's recurrent GEMM. `h` and
+// `h_out` may be aliased. `Act` implements the gate nonlinearities (see
+// `ActivationTier`).
+template<typename T, typename Act, bool ApplyZoneout>
+__global__
+void QuantizedPointwiseOperations(const int batch_dim,
+                                  const int hidden_dim,
+                                  const int32_t* Wx,       // [N,H*3] int8 products
+                                  const int32_t* Rh,       // [N,H*3] int8 products
+                                  const float* W_scale,    // [H*3]
+                                  const float* R_scale,    // [H*3]
+                                  const float* x_scale,    // [1]
+                                  const T* bx,
+                                  const T* br,
+                                  const T* h,
+                                  T* h_out,
+                                  int8_t* h_q,             // [N,H]
+                                  const float zoneout_prob,
+                                  const int step,
+                                  const int* sequence_lengths) {  // May be null
+  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+  const int col = blockDim.y * blockIdx.y + threadIdx.y;
+
+  if (row >= hidden_dim || col >= batch_dim)
+    return;
+
+  typedef typename accum_type<T>::type Acc;
+
+  const int idx = col * hidden_dim + row;
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    h_out[idx] = h[idx];
+    h_q[idx] = pack_activation<int8_t>(Acc(h[idx]));
+    return;
+  }
+
+  const int weight_idx = col * (hidden_dim * 3) + row;
+  const float Wx_scale = *x_scale;
+  const float Rh_scale = 1.0f / 127.0f;
+  Acc Wx_in[3];
+  Acc Rh_in[3];
+  #pragma unroll
+  for (int k = 0; k < 3; ++k) {
+    const int gate_col = row + k * hidden_dim;
+    Wx_in[k] = Acc(W_scale[gate_col] * Wx_scale * static_cast<float>(Wx[weight_idx + k * hidden_dim]));
+    Rh_in[k] = Acc(R_scale[gate_col] * Rh_scale * static_cast<float>(Rh[weight_idx + k * hidden_dim]));
+  }
+
+  const int bz_idx = row + 0 * hidden_dim;
+  const int br_idx = row + 1 * hidden_dim;
+  const int bg_idx = row + 2 * hidden_dim;
+
+  const Acc Rh_g = Rh_in[2] + Acc(br[bg_idx]);
+  Acc z;
+  Acc r;
+  Act::sigmoid2(
+      Wx_in[0] + Rh_in[0] + Acc(bx[bz_idx]) + Acc(br[bz_idx]),
+      Wx_in[1] + Rh_in[1] + Acc(bx[br_idx]) + Acc(br[br_idx]),
+      &z,
+      &r);
+  const Acc g = Act::tanh(Wx_in[2] + r * Rh_g + Acc(bx[bg_idx]));
+
+  const Acc h_prev = Acc(h[idx]);
+  Acc cur_h_value = z * h_prev + (static_cast<Acc>(1.0) - z) * g;
+  if (ApplyZoneout)
+    cur_h_value = (zoneout_prob * h_prev) + ((1.0f - zoneout_prob) * cur_h_value);
+
+  h_out[idx] = T(cur_h_value);
+  h_q[idx] = pack_activation<int8_t>(cur_h_value);
+}
+
+// Launches `QuantizedPointwiseOperations` for one time step of the whole batch, with
+// the gate nonlinearities of `tier`.
+template<typename T>
+void LaunchQuantizedPointwiseOperations(
+    const haste::v0::ActivationTier tier,
+    const int batch_size,
+    const int hidden_size,
+    const int32_t* Wx,
+    const int32_t* Rh,
+    const float* W_scale,
+    const float* R_scale,
+    const float* x_scale,
+    const T* bx,
+    const T* br,
+    const T* h,
+    T* h_out,
+    int8_t* h_q,
+    const float zoneout_prob,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(32, 16);
+  const dim3 gridDim(
+      (hidden_size + blockDim.x - 1) / blockDim.x,
+      (batch_size + blockDim.y - 1) / blockDim.y);
+  typedef haste::v0::ActivationTier Tier;
+  const auto kernel = zoneout_prob
+      ? (tier == Tier::kHalf2 ? QuantizedPointwiseOperations<T, Half2Activations, true>
+       : tier == Tier::kApprox ? QuantizedPointwiseOperations<T, ApproxActivations, true>
+       : tier == Tier::kFast ? QuantizedPointwiseOperations<T, FastActivations, true>
+       :                       QuantizedPointwiseOperations<T, PreciseActivations, true>)
+      : (tier == Tier::kHalf2 ? QuantizedPointwiseOperations<T, Half2Activations, false>
+       : tier == Tier::kApprox ? QuantizedPointwiseOperations<T, ApproxActivations, false>
+       : tier == Tier::kFast ? QuantizedPointwiseOperations<T, FastActivations, false>
+       :                       QuantizedPointwiseOperations<T, PreciseActivations, false>);
+  kernel<<<gridDim, blockDim, 0, stream>>>(
+      batch_size,
+      hidden_size,
+      Wx,
+      Rh,
+      W_scale,
+      R_scale,
+      x_scale,
+      bx,
+      br,
+      h,
+      h_out,
+      h_q,
+      zoneout_prob,
+      step,
+      sequence_lengths);
+}
+
+// Runs the recurrence for all time steps in a single cooperative launch. Each block owns
+// `units` consecutive hidden units and keeps the matching columns of R for all three gates
+// in shared memory, so R is read from DRAM once per call instead of once per step. The
+// block's threads are laid out as [splits, units*3]: each thread accumulates a partial
+// dot product over a strided subset of `h` for one gate column. A grid-wide barrier
+// separates time steps since every block reads all of the previous step's `h`.
+template<typename T, bool Training, bool ApplyZoneout>
+__global__
+void PersistentRecurrence(const int steps,
+                          const int batch_dim,
+                          const int hidden_dim,
+                          const int units,
+                          const T* R,   // [H,H*3]
+                          const T* Wx,  // [T,N,H*3]
+                          const T* bx,  // [H*3]
+                          const T* br,  // [H*3]
+                          T* h,         // [T+1,N,H]
+                          T* v,         // [T,N,H*4]
+                          const float zoneout_prob,
+                          const T* zoneout_mask,    // [T,N,H], may be null
+                          const ZoneoutRng zoneout_rng,  // Generates the mask if `zoneout_mask` is null
+                          const int* sequence_lengths) {  // [N], may be null
+  typedef typename accum_type<T>::type Acc;
+  extern __shared__ __align__(16) unsigned char shared_storage[];
+
+  const int cols = units * 3;
+  const int splits = blockDim.y;
+  T* R_s = reinterpret_cast<T*>(shared_storage);  // [H,units*3]
+  Acc* Rh_s = reinterpret_cast<Acc*>(             // [splits,N,units*3]
+      shared_storage + PersistentAccumOffset(hidden_dim, cols, sizeof(T)));
+
+  const int base_row = blockIdx.x * units;
+  const int block_units = min(units, hidden_dim - base_row);
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  const int num_threads = blockDim.x * blockDim.y;
+
+  // Column `gate * units + u` of the slice is column `gate * H + base_row + u` of R.
+  for (int i = tid; i < hidden_dim * cols; i += num_threads) {
+    const int k = i / cols;
+    const int gate = (i - k * cols) / units;
+    const int u = i - k * cols - gate * units;
+    R_s[i] = u < block_units
+        ? R[k * hidden_dim * 3 + gate * hidden_dim + base_row + u]
+        : static_cast<T>(0.0);
+  }
+  __syncthreads();
+
+  cooperative_groups::grid_group grid = cooperative_groups::this_grid();
+  const int NH = batch_dim * hidden_dim;
+
+  for (int t = 0; t < steps; ++t) {
+    // `h` is written by other blocks during the kernel, so always load it from L2.
+    const T* h_cur = h + t * NH;
+    for (int n = 0; n < batch_dim; ++n) {
+      Acc sum = static_cast<Acc>(0.0);
+      for (int k = threadIdx.y; k < hidden_dim; k += splits)
+        sum += Acc(R_s[k * cols + threadIdx.x]) * Acc(__ldcg(h_cur + n * hidden_dim + k));
+      Rh_s[(threadIdx.y * batch_dim + n) * cols + threadIdx.x] = sum;
+    }
+    __syncthreads();
+
+    for (int i = tid; i < block_units * batch_dim; i += num_threads) {
+      const int n = i / block_units;
+      const int u = i - n * block_units;
+      const int row = base_row + u;
+      const int output_idx = n * hidden_dim + row;
+
+      if (sequence_lengths && t >= sequence_lengths[n]) {
+        h[(t + 1) * NH + output_idx] = __ldcg(h_cur + output_idx);
+        continue;
+      }
+
+      Acc Rh[3];
+      for (int gate = 0; gate < 3; ++gate) {
+        Rh[gate] = static_cast<Acc>(0.0);
+        for (int split = 0; split < splits; ++split)
+          Rh[gate] += Rh_s[(split * batch_dim + n) * cols + gate * units + u];
+      }
+
+      const int weight_idx = t * NH * 3 + n * (hidden_dim * 3) + row;
+
+      const int z_idx = weight_idx + 0 * hidden_dim;
+      const int r_idx = weight_idx + 1 * hidden_dim;
+      const int g_idx = weight_idx + 2 * hidden_dim;
+
+      const int bz_idx = row + 0 * hidden_dim;
+      const int br_idx = row + 1 * hidden_dim;
+      const int bg_idx = row + 2 * hidden_dim;
 
-  h_out[output_idx] = cur_h_value;
+      const Acc Rh_g = Rh[2] + Acc(br[bg_idx]);
+      const Acc z = sigmoid(Acc(Wx[z_idx]) + Rh[0] + Acc(bx[bz_idx]) + Acc(br[bz_idx]));
+      const Acc r = sigmoid(Acc(Wx[r_idx]) + Rh[1] + Acc(bx[br_idx]) + Acc(br[br_idx]));
+      const Acc g = tanh   (Acc(Wx[g_idx]) + r * Rh_g + Acc(bx[bg_idx]));
+
+      if (Training) {
+        const int base_v_idx = t * NH * 4 + n * (hidden_dim * 4) + row;
+        v[base_v_idx + 0 * hidden_dim] = T(z);
+        v[base_v_idx + 1 * hidden_dim] = T(r);
+        v[base_v_idx + 2 * hidden_dim] = T(g);
+        v[base_v_idx + 3 * hidden_dim] = T(Rh_g);
+      }
+
+      const Acc h_prev = Acc(__ldcg(h_cur + output_idx));
+      Acc cur_h_value = z * h_prev + (static_cast<Acc>(1.0) - z) * g;
+
+      if (ApplyZoneout) {
+        if (Training) {
+          const Acc mask = zoneout_mask
+              ? Acc(zoneout_mask[t * NH + output_idx])
+              : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(t) * NH + output_idx);
+          cur_h_value = (cur_h_value - h_prev) * mask + h_prev;
+        } else {
+          cur_h_value = (zoneout_prob * h_prev) + ((1.0f - zoneout_prob) * cur_h_value);
+        }
+      }
+
+      h[(t + 1) * NH + output_idx] = T(cur_h_value);
+    }
+
+    // Also stops this block from overwriting `Rh_s` while it's still being read.
+    grid.sync();
+  }
 }
 
 }  // anonymous namespace
@@ -95,8 +599,18 @@ struct ForwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
   cudaStream_t stream[2];
   cudaEvent_t event;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+  PersistentConfig persistent;
+  GraphCache graph;
+  ZoneoutRng zoneout_rng;
+  DropConnectConfig<T> dropconnect;
+  SequenceLayout sequence_layout;
+  ActivationTier activations;
+  PhaseProfiler profiler;
 };
 
 template<typename T>
@@ -105,27 +619,103 @@ ForwardPass<T>::ForwardPass(
     const int batch_size,
     const int input_size,
     const int hidden_size,
-    const cublasHandle_t& blas_handle) : data_(new private_data) {
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
   data_->training = training;
   data_->batch_size = batch_size;
   data_->input_size = input_size;
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  data_->zoneout_rng = ZoneoutRng();
+  data_->dropconnect = DropConnectConfig<T>();
+  data_->sequence_layout = SequenceLayout();
+  data_->activations = ActivationTier::kPrecise;
+  data_->profiler.SetName("gru::ForwardPass");
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
 }
 
 template<typename T>
 ForwardPass<T>::~ForwardPass() {
-  cudaStreamSynchronize(data_->stream[1]);
-  cudaStreamSynchronize(data_->stream[0]);
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
   cudaEventDestroy(data_->event);
   cudaStreamDestroy(data_->stream[1]);
   cudaStreamDestroy(data_->stream[0]);
   delete data_;
 }
 
+template<typename T>
+bool ForwardPass<T>::EnablePersistentKernel() {
+  const decltype(&PersistentRecurrence<T, true, true>) kernels[] = {
+    PersistentRecurrence<T, true, true>,
+    PersistentRecurrence<T, true, false>,
+    PersistentRecurrence<T, false, true>,
+    PersistentRecurrence<T, false, false>,
+  };
+  data_->persistent = ConfigurePersistentKernel(
+      kernels,
+      sizeof(kernels) / sizeof(kernels[0]),
+      3,
+      data_->batch_size,
+      data_->hidden_size,
+      sizeof(T),
+      sizeof(typename accum_type<T>::type));
+  return data_->persistent.enabled;
+}
+
+template<typename T>
+void ForwardPass<T>::EnableGraphCapture() {
+  data_->graph.Enable();
+}
+
+template<typename T>
+void ForwardPass<T>::EnablePhaseTiming() {
+  data_->profiler.EnableTiming();
+}
+
+template<typename T>
+PhaseStats ForwardPass<T>::CollectPhaseStats() {
+  return data_->profiler.Collect();
+}
+
+template<typename T>
+void ForwardPass<T>::SetZoneoutSeed(
+    const float zoneout_prob,
+    const unsigned long long seed,
+    const unsigned long long offset) {
+  data_->zoneout_rng.enabled = true;
+  data_->zoneout_rng.prob = zoneout_prob;
+  data_->zoneout_rng.seed = seed;
+  data_->zoneout_rng.offset = offset;
+}
+
+template<typename T>
+void ForwardPass<T>::SetDropConnect(
+    const float rate,
+    const unsigned long long seed,
+    const unsigned long long offset,
+    T* tmp_R) {
+  data_->dropconnect.rate = rate;
+  data_->dropconnect.seed = seed;
+  data_->dropconnect.offset = offset;
+  data_->dropconnect.tmp_R = tmp_R;
+}
+
+template<typename T>
+void ForwardPass<T>::SetSequenceLayout(const SequenceLayout& layout) {
+  data_->sequence_layout = layout;
+}
+
+template<typename T>
+void ForwardPass<T>::SetActivationTier(const ActivationTier tier) {
+  data_->activations = tier;
+}
+
 template<typename T>
 void ForwardPass<T>::Iterate(
     const T* W,  // [C,H*3]
@@ -135,7 +725,7 @@ void ForwardPass<T>::Iterate(
     const T* x,  // [N,C]
     const T* h,  // [N,H]
     T* h_out,    // [N,H]
-    T* v_out,    // [N,H*4]
+    T* v,        // [N,H*4]
     T* tmp_Wx,   // [N,H*3]
     T* tmp_Rh,   // [N,H*3]
     const float zoneout_prob,
@@ -144,7 +734,6 @@ void ForwardPass<T>::Iterate(
   static const T alpha = static_cast<T>(1.0);
   static const T beta = static_cast<T>(0.0);
 
-  const bool training = data_->training;
   const int batch_size = data_->batch_size;
   const int input_size = data_->input_size;
   const int hidden_size = data_->hidden_size;
@@ -156,6 +745,14 @@ void ForwardPass<T>::Iterate(
   cudaStream_t save_stream;
   cublasGetStream(blas_handle, &save_stream);
 
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+  cudaStreamWaitEvent(stream2, data_->ready_event, 0);
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kInputProjection, stream2);
   cublasSetStream(blas_handle, stream2);
   blas<T>::gemm(blas_handle,
       CUBLAS_OP_N, CUBLAS_OP_N,
@@ -165,89 +762,1433 @@ void ForwardPass<T>::Iterate(
       x, input_size,
       &beta,
       tmp_Wx, hidden_size * 3);
+  profiler.End(Phase::kInputProjection, stream2);
   cudaEventRecord(event, stream2);
 
+  profiler.Begin(Phase::kRecurrence, stream1);
+  IterateInternal(
+      R,
+      bx,
+      br,
+      h,
+      h_out,
+      v,
+      tmp_Wx,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      0,
+      data_->batch_size,
+      nullptr,
+      data_->hidden_size);
+  profiler.End(Phase::kRecurrence, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void ForwardPass<T>::IterateInternal(
+    const T* R,  // [H,H*3]
+    const T* bx, // [H*3]
+    const T* br, // [H*3]
+    const T* h,  // [N,H]
+    T* h_out,    // [N,H]
+    T* v,        // [N,H*4]
+    T* tmp_Wx,   // [N,H*3]
+    T* tmp_Rh,   // [N,H*3]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [N,H]
+    const int step,
+    const int active_batch_size,
+    const int* sequence_lengths,  // [N]
+    const int h_stride) {
+  // Constants for GEMM
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const bool training = data_->training;
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaEvent_t event = data_->event;
+
   cublasSetStream(blas_handle, stream1);
   blas<T>::gemm(blas_handle,
       CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size * 3, batch_size, hidden_size,
+      hidden_size * 3, active_batch_size, hidden_size,
       &alpha,
       R, hidden_size * 3,
-      h, hidden_size,
+      h, h_stride,
       &beta,
       tmp_Rh, hidden_size * 3);
 
-  // Compute launch configuration for pointwise operations kernel.
-  const dim3 blockDim(32, 16);
-  const dim3 gridDim(
-      (hidden_size + blockDim.x - 1) / blockDim.x,
-      (batch_size + blockDim.y - 1) / blockDim.y);
-
   cudaStreamWaitEvent(stream1, event, 0);
 
-  if (training) {
-    if (zoneout_prob && zoneout_mask) {
-      PointwiseOperations<T, true, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size,
-          hidden_size,
-          tmp_Wx,
-          tmp_Rh,
-          bx,
-          br,
-          h,
-          h_out,
-          v_out,
-          zoneout_prob,
-          zoneout_mask);
-    } else {
-      PointwiseOperations<T, true, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size,
-          hidden_size,
-          tmp_Wx,
-          tmp_Rh,
-          bx,
-          br,
-          h,
-          h_out,
-          v_out,
-          0.0f,
-          nullptr);
-    }
+  data_->profiler.Begin(Phase::kPointwise, stream1);
+  if (!training && data_->activations != ActivationTier::kPrecise) {
+    LaunchTierOperations(
+        data_->activations,
+        batch_size,
+        hidden_size,
+        h_stride,
+        tmp_Wx,
+        tmp_Rh,
+        bx,
+        br,
+        h,
+        h_out,
+        zoneout_prob,
+        step,
+        sequence_lengths,
+        stream1);
   } else {
-    if (zoneout_prob && zoneout_mask) {
-      PointwiseOperations<T, false, true><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size,
-          hidden_size,
-          tmp_Wx,
-          tmp_Rh,
+    LaunchPointwiseOperations(
+        training,
+        batch_size,
+        hidden_size,
+        h_stride,
+        tmp_Wx,
+        tmp_Rh,
+        bx,
+        br,
+        h,
+        h_out,
+        v,
+        v ? v + 3 * hidden_size : nullptr,
+        hidden_size * 4,
+        hidden_size * 4,
+        zoneout_prob,
+        zoneout_mask,
+        data_->zoneout_rng,
+        step,
+        sequence_lengths,
+        stream1);
+  }
+  data_->profiler.End(Phase::kPointwise, stream1);
+}
+
+template<typename T>
+void ForwardPass<T>::Run(
+    const int steps,
+    const T* W,  // [C,H*3]
+    const T* R,  // [H,H*3]
+    const T* bx, // [H*3]
+    const T* br, // [H*3]
+    const T* x,  // [T,N,C]
+    T* h,        // [T+1,N,H]
+    T* v,        // [T,N,H*4]
+    T* tmp_Wx,   // [T,N,H*3]
+    T* tmp_Rh,   // [N,H*3]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // Replay the work captured on a previous call with the same arguments, capturing it
+  // first if there's no such call. The capture re-enters `Run` with the graph's stream
+  // standing in for the caller's stream.
+  GraphCache& graph = data_->graph;
+  if (graph.enabled() && !graph.capturing()) {
+    bool captured = graph.Lookup(
+        steps,
+        W,
+        R,
+        bx,
+        br,
+        x,
+        h,
+        v,
+        tmp_Wx,
+        tmp_Rh,
+        zoneout_prob,
+        zoneout_mask,
+        data_->zoneout_rng.enabled,
+        data_->zoneout_rng.seed,
+        data_->zoneout_rng.offset,
+        data_->dropconnect.rate,
+        data_->dropconnect.seed,
+        data_->dropconnect.offset,
+        data_->dropconnect.tmp_R,
+        data_->sequence_layout.batch_major,
+        data_->sequence_layout.reverse,
+        data_->sequence_layout.h_stride,
+        data_->activations,
+        sequence_lengths,
+        GraphKeyArray(batch_sizes, batch_sizes ? steps : 0));
+    if (!captured) {
+      const cudaStream_t sync_stream = data_->sync_stream;
+      data_->sync_stream = graph.BeginCapture();
+      Run(
+          steps,
+          W,
+          R,
           bx,
           br,
+          x,
           h,
-          h_out,
-          nullptr,
-          zoneout_prob,
-          zoneout_mask);
-    } else {
-      PointwiseOperations<T, false, false><<<gridDim, blockDim, 0, stream1>>>(
-          batch_size,
-          hidden_size,
+          v,
           tmp_Wx,
           tmp_Rh,
-          bx,
-          br,
-          h,
-          h_out,
-          nullptr,
-          0.0f,
-          nullptr);
+          zoneout_prob,
+          zoneout_mask,
+          sequence_lengths,
+          batch_sizes);
+      data_->sync_stream = sync_stream;
+      captured = graph.EndCapture();
+    }
+    if (captured) {
+      graph.Launch(data_->sync_stream);
+      return;
     }
   }
 
-  cublasSetStream(blas_handle, save_stream);
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const bool training = data_->training;
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const SequenceStrides strides(data_->sequence_layout, steps, batch_size, input_size, hidden_size);
+  const int NH = batch_size * hidden_size;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // Every step reads the same masked copy of `R`, so draw the mask once up front.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  if (dropconnect.rate > 0.0f && dropconnect.tmp_R) {
+    LaunchDropConnect(hidden_size, hidden_size * 3, false, dropconnect, R, dropconnect.tmp_R, stream1);
+    R = dropconnect.tmp_R;
+  }
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kInputProjection, stream1);
+  cublasSetStream(blas_handle, stream1);
+  StepwiseGemm(blas_handle,
+      CUBLAS_OP_N,
+      hidden_size * 3, input_size,
+      steps, batch_size,
+      &alpha,
+      W, hidden_size * 3,
+      x, strides.x_ld, strides.x_step,
+      &beta,
+      tmp_Wx, hidden_size * 3, static_cast<size_t>(NH) * 3);
+  profiler.End(Phase::kInputProjection, stream1);
+
+  // `IterateInternal` waits on `event` for the Wx GEMM, which we've already ordered on
+  // `stream1`. Record it here so that the wait never refers to work outside this call
+  // (which would also break graph capture).
+  cudaEventRecord(data_->event, stream1);
+
+  profiler.Begin(Phase::kRecurrence, stream1);
+  // The persistent kernel walks dense time-major states.
+  if (data_->persistent.enabled && strides.dense) {
+    const bool apply_zoneout =
+        zoneout_prob && (!training || zoneout_mask || data_->zoneout_rng.enabled);
+    auto kernel = training
+        ? (apply_zoneout ? PersistentRecurrence<T, true, true> : PersistentRecurrence<T, true, false>)
+        : (apply_zoneout ? PersistentRecurrence<T, false, true> : PersistentRecurrence<T, false, false>);
+
+    int steps_arg = steps;
+    int batch_size_arg = batch_size;
+    int hidden_size_arg = hidden_size;
+    int units_arg = data_->persistent.units;
+    const T* Wx_arg = tmp_Wx;
+    T* v_arg = training ? v : nullptr;
+    float zoneout_prob_arg = apply_zoneout ? zoneout_prob : 0.0f;
+    const T* zoneout_mask_arg = apply_zoneout ? zoneout_mask : nullptr;
+    ZoneoutRng zoneout_rng_arg = data_->zoneout_rng;
+    void* args[] = {
+      &steps_arg,
+      &batch_size_arg,
+      &hidden_size_arg,
+      &units_arg,
+      &R,
+      &Wx_arg,
+      &bx,
+      &br,
+      &h,
+      &v_arg,
+      &zoneout_prob_arg,
+      &zoneout_mask_arg,
+      &zoneout_rng_arg,
+      &sequence_lengths,
+    };
+    cudaLaunchCooperativeKernel(
+        kernel,
+        data_->persistent.grid,
+        data_->persistent.block,
+        args,
+        data_->persistent.shared_bytes,
+        stream1);
+  } else {
+    for (int i = 0; i < steps; ++i) {
+      const int t = strides.Step(i, steps);
+      IterateInternal(
+          R,
+          bx,
+          br,
+          h + strides.In(t) * strides.h_step,
+          h + strides.Out(t) * strides.h_step,
+          training ? v + t * NH * 4 : nullptr,
+          tmp_Wx + t * NH * 3,
+          tmp_Rh,
+          zoneout_prob,
+          zoneout_mask ? zoneout_mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          strides.h_ld);
+    }
+  }
+  profiler.End(Phase::kRecurrence, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void ForwardPass<T>::Run(
+    const int steps,
+    const PackedWeights<T>& weights,
+    const T* x,  // [T,N,C]
+    T* h,        // [T+1,N,H]
+    T* v,        // [T,N,H*4]
+    T* tmp_Wx,   // [T,N,H*3]
+    T* tmp_Rh,   // [N,H*3]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  Run(
+      steps,
+      weights.W,
+      weights.R,
+      weights.bx,
+      weights.br,
+      x,
+      h,
+      v,
+      tmp_Wx,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+}
+
+template<typename T>
+size_t ForwardPass<T>::GetWorkspaceSize(const int steps) const {
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  return WorkspaceBytes<T>(steps * NH * 3)  // tmp_Wx
+      + WorkspaceBytes<T>(NH * 3);          // tmp_Rh
+}
+
+template<typename T>
+void ForwardPass<T>::Run(
+    const int steps,
+    const T* W,  // [C,H*3]
+    const T* R,  // [H,H*3]
+    const T* bx, // [H*3]
+    const T* br, // [H*3]
+    const T* x,  // [T,N,C]
+    T* h,        // [T+1,N,H]
+    T* v,        // [T,N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes,       // [T] host
+    void* workspace) {            // `GetWorkspaceSize(steps)` bytes
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  Workspace buffers(workspace);
+  T* tmp_Wx = buffers.Take<T>(steps * NH * 3);
+  T* tmp_Rh = buffers.Take<T>(NH * 3);
+  Run(
+      steps,
+      W,
+      R,
+      bx,
+      br,
+      x,
+      h,
+      v,
+      tmp_Wx,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+}
+
+template<typename T>
+void ForwardPass<T>::RunCompact(
+    const int steps,
+    const ActivationStorage storage,
+    const T* W,  // [C,H*3]
+    const T* R,  // [H,H*3]
+    const T* bx, // [H*3]
+    const T* br, // [H*3]
+    const T* x,  // [T,N,C]
+    T* h,        // [T+1,N,H]
+    void* v,     // See `CompactActivationsSize`
+    T* tmp_Wx,   // [T,N,H*3]
+    T* tmp_Rh,   // [N,H*3]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // Every step reads the same masked copy of `R`, so draw the mask once up front.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  if (dropconnect.rate > 0.0f && dropconnect.tmp_R) {
+    LaunchDropConnect(hidden_size, hidden_size * 3, false, dropconnect, R, dropconnect.tmp_R, stream1);
+    R = dropconnect.tmp_R;
+  }
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, steps * batch_size, input_size,
+      &alpha,
+      W, hidden_size * 3,
+      x, input_size,
+      &beta,
+      tmp_Wx, hidden_size * 3);
+
+  const int NH = batch_size * hidden_size;
+  __half* v_half = reinterpret_cast<__half*>(v);
+  int8_t* v_fixed8 = reinterpret_cast<int8_t*>(v_half + steps * NH);
+  for (int i = 0; i < steps; ++i) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 3, batch_sizes ? batch_sizes[i] : batch_size, hidden_size,
+        &alpha,
+        R, hidden_size * 3,
+        h + i * NH, hidden_size,
+        &beta,
+        tmp_Rh, hidden_size * 3);
+
+    // The activations are only rounded on their way out, so the recurrence itself runs
+    // at full precision.
+    switch (storage) {
+      case ActivationStorage::kHalf:
+        LaunchPointwiseOperations(
+            true,
+            batch_size,
+            hidden_size,
+            hidden_size,
+            tmp_Wx + i * NH * 3,
+            tmp_Rh,
+            bx,
+            br,
+            h + i * NH,
+            h + (i + 1) * NH,
+            v_half + i * NH * 4,
+            v_half + i * NH * 4 + 3 * hidden_size,
+            hidden_size * 4,
+            hidden_size * 4,
+            zoneout_prob,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+      case ActivationStorage::kFixed8:
+        LaunchPointwiseOperations(
+            true,
+            batch_size,
+            hidden_size,
+            hidden_size,
+            tmp_Wx + i * NH * 3,
+            tmp_Rh,
+            bx,
+            br,
+            h + i * NH,
+            h + (i + 1) * NH,
+            v_fixed8 + i * NH * 3,
+            v_half + i * NH,
+            hidden_size * 3,
+            hidden_size,
+            zoneout_prob,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+    }
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+size_t ForwardPass<T>::GetQuantizedWorkspaceSize(const int steps) const {
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  const size_t NC = static_cast<size_t>(data_->batch_size) * data_->input_size;
+  return WorkspaceBytes<int32_t>(steps * NH * 3)  // tmp_Wx
+      + WorkspaceBytes<int32_t>(NH * 3)            // tmp_Rh
+      + WorkspaceBytes<int8_t>(steps * NC)         // x_q
+      + WorkspaceBytes<int8_t>(NH);                // h_q
+}
+
+template<typename T>
+void ForwardPass<T>::RunQuantized(
+    const int steps,
+    const QuantizedWeights<T>& weights,
+    const T* x,  // [T,N,C]
+    T* h,        // [T+1,N,H]
+    const float zoneout_prob,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes,       // [T] host
+    void* workspace) {            // `GetQuantizedWorkspaceSize(steps)` bytes
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  const int NH = batch_size * hidden_size;
+  const size_t NC = static_cast<size_t>(batch_size) * input_size;
+  Workspace buffers(workspace);
+  int32_t* tmp_Wx = buffers.Take<int32_t>(steps * static_cast<size_t>(NH) * 3);
+  int32_t* tmp_Rh = buffers.Take<int32_t>(static_cast<size_t>(NH) * 3);
+  int8_t* x_q = buffers.Take<int8_t>(steps * NC);
+  int8_t* h_q = buffers.Take<int8_t>(NH);
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kInputProjection, stream1);
+  LaunchQuantizeValues(steps * NC, x, weights.x_scale, x_q, stream1);
+  LaunchQuantizeValues(NH, h, nullptr, h_q, stream1);
+  cublasSetStream(blas_handle, stream1);
+  blas_int8::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, steps * batch_size, input_size,
+      weights.W, hidden_size * 3,
+      x_q, input_size,
+      tmp_Wx, hidden_size * 3);
+  profiler.End(Phase::kInputProjection, stream1);
+
+  profiler.Begin(Phase::kRecurrence, stream1);
+  for (int i = 0; i < steps; ++i) {
+    const int step_batch_size = batch_sizes ? batch_sizes[i] : batch_size;
+    blas_int8::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 3, step_batch_size, hidden_size,
+        weights.R, hidden_size * 3,
+        h_q, hidden_size,
+        tmp_Rh, hidden_size * 3);
+
+    LaunchQuantizedPointwiseOperations(
+        data_->activations,
+        batch_size,
+        hidden_size,
+        tmp_Wx + i * NH * 3,
+        tmp_Rh,
+        weights.W_scale,
+        weights.R_scale,
+        weights.x_scale,
+        weights.bx,
+        weights.br,
+        h + i * NH,
+        h + (i + 1) * NH,
+        h_q,
+        zoneout_prob,
+        i,
+        sequence_lengths,
+        stream1);
+  }
+  profiler.End(Phase::kRecurrence, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct StackedForwardPass<T>::private_data {
+  bool training;
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  std::vector<ForwardPass<T>*> layers;
+  std::vector<cudaEvent_t> layer_events;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+StackedForwardPass<T>::StackedForwardPass(
+    const bool training,
+    const int layers,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->training = training;
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < layers; ++i) {
+    data_->layers.push_back(new ForwardPass<T>(
+        training,
+        batch_size,
+        i ? hidden_size : input_size,
+        hidden_size,
+        blas_handle,
+        stream));
+    cudaEvent_t event;
+    cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+    data_->layer_events.push_back(event);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+StackedForwardPass<T>::~StackedForwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  for (int i = data_->layers.size() - 1; i >= 0; --i) {
+    cudaEventDestroy(data_->layer_events[i]);
+    delete data_->layers[i];
+  }
+  delete data_;
+}
+
+template<typename T>
+void StackedForwardPass<T>::Run(
+    const int steps,
+    const T* const* W,       // [L] [C,H*3] or [H,H*3]
+    const T* const* R,       // [L] [H,H*3]
+    const T* const* bx,      // [L] [H*3]
+    const T* const* br,      // [L] [H*3]
+    const T* x,              // [T,N,C]
+    T* const* h,             // [L] [T+1,N,H]
+    T* const* v,             // [L] [T,N,H*4]
+    T* const* tmp_Wx,        // [L] [T,N,H*3]
+    T* const* tmp_Rh,        // [L] [N,H*3]
+    const float zoneout_prob,
+    const T* const* zoneout_mask,  // [L] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const bool training = data_->training;
+  const int layers = data_->layers.size();
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (ForwardPass<T>* layer : data_->layers) {
+    cudaStreamWaitEvent(layer->data_->stream[0], data_->ready_event, 0);
+    cudaStreamWaitEvent(layer->data_->stream[1], data_->ready_event, 0);
+  }
+
+  // The input sequence of the first layer is available upfront, so its Wx GEMM covers
+  // all time steps just like in `ForwardPass::Run`.
+  auto first = data_->layers[0]->data_;
+  cublasSetStream(blas_handle, first->stream[0]);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, steps * batch_size, input_size,
+      &alpha,
+      W[0], hidden_size * 3,
+      x, input_size,
+      &beta,
+      tmp_Wx[0], hidden_size * 3);
+  cudaEventRecord(first->event, first->stream[0]);
+
+  // Step `t` of layer `l` is issued on diagonal `t + l`, after step `t` of layer `l - 1`
+  // which was issued on the previous diagonal. Each diagonal is issued from the top layer
+  // down so that `layer_events[l - 1]` still marks step `t` when layer `l` waits on it.
+  const int NH = batch_size * hidden_size;
+  for (int d = 0; d < steps + layers - 1; ++d) {
+    for (int l = std::min(d, layers - 1); l >= 0 && d - l < steps; --l) {
+      const int t = d - l;
+      const int active_batch_size = batch_sizes ? batch_sizes[t] : batch_size;
+      ForwardPass<T>* layer = data_->layers[l];
+
+      if (l > 0) {
+        const cudaStream_t stream2 = layer->data_->stream[1];
+        cudaStreamWaitEvent(stream2, data_->layer_events[l - 1], 0);
+        cublasSetStream(blas_handle, stream2);
+        blas<T>::gemm(blas_handle,
+            CUBLAS_OP_N, CUBLAS_OP_N,
+            hidden_size * 3, active_batch_size, hidden_size,
+            &alpha,
+            W[l], hidden_size * 3,
+            h[l - 1] + (t + 1) * NH, hidden_size,
+            &beta,
+            tmp_Wx[l] + t * NH * 3, hidden_size * 3);
+        cudaEventRecord(layer->data_->event, stream2);
+      }
+
+      const T* mask = zoneout_mask ? zoneout_mask[l] : nullptr;
+      layer->IterateInternal(
+          R[l],
+          bx[l],
+          br[l],
+          h[l] + t * NH,
+          h[l] + (t + 1) * NH,
+          training ? v[l] + t * NH * 4 : nullptr,
+          tmp_Wx[l] + t * NH * 3,
+          tmp_Rh[l],
+          zoneout_prob,
+          mask ? mask + t * NH : nullptr,
+          t,
+          active_batch_size,
+          sequence_lengths,
+          hidden_size);
+      cudaEventRecord(data_->layer_events[l], layer->data_->stream[0]);
+    }
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  for (ForwardPass<T>* layer : data_->layers) {
+    cudaEventRecord(data_->finished_event, layer->data_->stream[0]);
+    cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  }
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct BidirectionalForwardPass<T>::private_data {
+  bool training;
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  ForwardPass<T>* directions[2];
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+BidirectionalForwardPass<T>::BidirectionalForwardPass(
+    const bool training,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->training = training;
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < 2; ++i) {
+    data_->directions[i] = new ForwardPass<T>(
+        training,
+        batch_size,
+        input_size,
+        hidden_size,
+        blas_handle,
+        stream);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+BidirectionalForwardPass<T>::~BidirectionalForwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  delete data_->directions[1];
+  delete data_->directions[0];
+  delete data_;
+}
+
+template<typename T>
+void BidirectionalForwardPass<T>::Run(
+    const int steps,
+    const T* const* W,       // [2] [C,H*3]
+    const T* const* R,       // [2] [H,H*3]
+    const T* const* bx,      // [2] [H*3]
+    const T* const* br,      // [2] [H*3]
+    const T* x,              // [T,N,C]
+    T* const* h,             // [2] [T+1,N,H] with a stride of `h_stride`
+    const int h_stride,
+    T* const* v,             // [2] [T,N,H*4]
+    T* const* tmp_Wx,        // [2] [T,N,H*3]
+    T* const* tmp_Rh,        // [2] [N,H*3]
+    const float zoneout_prob,
+    const T* const* zoneout_mask,  // [2] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const bool training = data_->training;
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. Both directions
+  // consume the whole input sequence, so each one's Wx GEMM covers all time steps.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (int i = 0; i < 2; ++i) {
+    auto direction = data_->directions[i]->data_;
+    cudaStreamWaitEvent(direction->stream[0], data_->ready_event, 0);
+    cublasSetStream(blas_handle, direction->stream[0]);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 3, steps * batch_size, input_size,
+        &alpha,
+        W[i], hidden_size * 3,
+        x, input_size,
+        &beta,
+        tmp_Wx[i], hidden_size * 3);
+    cudaEventRecord(direction->event, direction->stream[0]);
+  }
+
+  // The reverse direction visits step `T - 1 - s` while the forward direction visits
+  // step `s`. Its state after step `t` is at index `t`, so it reads index `t + 1`.
+  const int NH = batch_size * hidden_size;
+  const int h_step = batch_size * h_stride;
+  for (int s = 0; s < steps; ++s) {
+    for (int i = 0; i < 2; ++i) {
+      const int t = i ? steps - 1 - s : s;
+      const int in = i ? t + 1 : t;
+      const int out = i ? t : t + 1;
+      const T* mask = zoneout_mask ? zoneout_mask[i] : nullptr;
+      data_->directions[i]->IterateInternal(
+          R[i],
+          bx[i],
+          br[i],
+          h[i] + in * h_step,
+          h[i] + out * h_step,
+          training ? v[i] + t * NH * 4 : nullptr,
+          tmp_Wx[i] + t * NH * 3,
+          tmp_Rh[i],
+          zoneout_prob,
+          mask ? mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          h_stride);
+    }
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  for (int i = 0; i < 2; ++i) {
+    cudaEventRecord(data_->finished_event, data_->directions[i]->data_->stream[0]);
+    cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  }
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct InferenceSession<T>::private_data {
+  int max_streams;
+  int max_frames;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t stream;
+  T* buffer;     // Backs all of the tensors below.
+  T* h;          // Per-stream hidden state [S,H]
+  T* step_h;     // Gathered hidden state of a `Step` [S,H]
+  T* tmp_Wx;     // Input projections [max(K,S),H*3]
+  T* tmp_Rh;     // Recurrent projection [S,H*3]
+};
+
+template<typename T>
+InferenceSession<T>::InferenceSession(
+    const int max_streams,
+    const int max_frames,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->max_streams = max_streams;
+  data_->max_frames = max_frames;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->stream = stream;
+
+  const size_t NH = static_cast<size_t>(max_streams) * hidden_size;
+  const size_t wx_rows = std::max(max_frames, max_streams);
+  const size_t elements = NH * 2 + wx_rows * hidden_size * 3 + NH * 3;
+  if (cudaMalloc(reinterpret_cast<void**>(&data_->buffer), elements * sizeof(T)) != cudaSuccess) {
+    // Every other call checks for this and returns false.
+    data_->buffer = nullptr;
+    return;
+  }
+  cudaMemset(data_->buffer, 0, NH * sizeof(T));
+  data_->h = data_->buffer;
+  data_->step_h = data_->h + NH;
+  data_->tmp_Wx = data_->step_h + NH;
+  data_->tmp_Rh = data_->tmp_Wx + wx_rows * hidden_size * 3;
+}
+
+template<typename T>
+InferenceSession<T>::~InferenceSession() {
+  cudaFree(data_->buffer);
+  delete data_;
+}
+
+template<typename T>
+int InferenceSession<T>::StateSize() const {
+  return data_->hidden_size;
+}
+
+template<typename T>
+bool InferenceSession<T>::Reset(const int id) {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams)
+    return false;
+
+  const int hidden_size = data_->hidden_size;
+  cudaMemsetAsync(data_->h + id * hidden_size, 0, hidden_size * sizeof(T), data_->stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::SaveState(const int id, T* state) const {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams)
+    return false;
+
+  const int hidden_size = data_->hidden_size;
+  const size_t bytes = hidden_size * sizeof(T);
+  cudaMemcpyAsync(state, data_->h + id * hidden_size, bytes, cudaMemcpyDeviceToDevice, data_->stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::RestoreState(const int id, const T* state) {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams)
+    return false;
+
+  const int hidden_size = data_->hidden_size;
+  const size_t bytes = hidden_size * sizeof(T);
+  cudaMemcpyAsync(data_->h + id * hidden_size, state, bytes, cudaMemcpyDeviceToDevice, data_->stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::Run(
+    const int id,
+    const int frames,
+    const T* W,  // Weight matrix for input (Wx) [C,H*3]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*3]
+    const T* bx, // Bias for gates (Wx) [H*3]
+    const T* br, // Bias for gates (Rh) [H*3]
+    const T* x,  // Input vectors [K,C]
+    T* h_out,    // Output recurrent states [K,H]
+    const float zoneout_prob) {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams || frames < 1 ||
+      frames > data_->max_frames)
+    return false;
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream = data_->stream;
+  T* h = data_->h + id * hidden_size;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cublasSetStream(blas_handle, stream);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, frames, input_size,
+      &alpha,
+      W, hidden_size * 3,
+      x, input_size,
+      &beta,
+      data_->tmp_Wx, hidden_size * 3);
+
+  // Each frame reads the previous frame's output, and the final hidden state is copied
+  // back to the stream's state once at the end.
+  for (int i = 0; i < frames; ++i) {
+    const T* h_in = i ? h_out + (i - 1) * hidden_size : h;
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 3, 1, hidden_size,
+        &alpha,
+        R, hidden_size * 3,
+        h_in, hidden_size,
+        &beta,
+        data_->tmp_Rh, hidden_size * 3);
+
+    LaunchPointwiseOperations<T, T, T>(
+        false,
+        1,
+        hidden_size,
+        hidden_size,
+        data_->tmp_Wx + i * hidden_size * 3,
+        data_->tmp_Rh,
+        bx,
+        br,
+        h_in,
+        h_out + i * hidden_size,
+        nullptr,
+        nullptr,
+        hidden_size * 4,
+        hidden_size * 4,
+        zoneout_prob,
+        nullptr,
+        ZoneoutRng(),
+        i,
+        nullptr,
+        stream);
+  }
+  cudaMemcpyAsync(
+      h,
+      h_out + (frames - 1) * hidden_size,
+      hidden_size * sizeof(T),
+      cudaMemcpyDeviceToDevice,
+      stream);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::Step(
+    const int count,
+    const int* ids,  // Stream IDs [count] device
+    const T* W,      // Weight matrix for input (Wx) [C,H*3]
+    const T* R,      // Weight matrix for recurrent state (Rh) [H,H*3]
+    const T* bx,     // Bias for gates (Wx) [H*3]
+    const T* br,     // Bias for gates (Rh) [H*3]
+    const T* x,      // Input vectors [count,C]
+    T* h_out,        // Output recurrent states [count,H]
+    const float zoneout_prob) {
+  if (!data_->buffer || count < 1 || count > data_->max_streams)
+    return false;
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream = data_->stream;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  GatherPoolRows(count, hidden_size, ids, data_->h, data_->step_h, stream);
+
+  cublasSetStream(blas_handle, stream);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, count, input_size,
+      &alpha,
+      W, hidden_size * 3,
+      x, input_size,
+      &beta,
+      data_->tmp_Wx, hidden_size * 3);
+
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 3, count, hidden_size,
+      &alpha,
+      R, hidden_size * 3,
+      data_->step_h, hidden_size,
+      &beta,
+      data_->tmp_Rh, hidden_size * 3);
+
+  LaunchPointwiseOperations<T, T, T>(
+      false,
+      count,
+      hidden_size,
+      hidden_size,
+      data_->tmp_Wx,
+      data_->tmp_Rh,
+      bx,
+      br,
+      data_->step_h,
+      h_out,
+      nullptr,
+      nullptr,
+      hidden_size * 4,
+      hidden_size * 4,
+      zoneout_prob,
+      nullptr,
+      ZoneoutRng(),
+      0,
+      nullptr,
+      stream);
+
+  ScatterPoolRows(count, hidden_size, ids, h_out, data_->h, stream);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+struct BatchScheduler<T>::private_data {
+  int max_batch_size;
+  int max_steps;
+  int input_size;
+  int hidden_size;
+  int device;
+  const T* W;
+  const T* R;
+  const T* bx;
+  const T* br;
+  float zoneout_prob;
+  cudaStream_t stream;
+  ForwardPass<T>* forward;
+  void* buffer;        // Backs all of the tensors below.
+  T* x;                // Packed inputs [max_steps,N,C]
+  T* h;                // Packed hidden states [max_steps+1,N,H]
+  T* v;                // Activations [max_steps,N,H*4]
+  T* tmp_Wx;           // Input projections [max_steps,N,H*3]
+  T* tmp_Rh;           // Recurrent projection [N,H*3]
+  int* lengths;        // Per-item lengths [N] device
+  int* host_lengths;   // Staging for `lengths` [N] pinned host
+  bool allocated;      // Whether all of the above could be allocated.
+  std::vector<int> batch_sizes;
+  BatchQueue<Request>* queue;
+};
+
+template<typename T>
+BatchScheduler<T>::BatchScheduler(
+    const int max_batch_size,
+    const int max_steps,
+    const int max_wait_us,
+    const int input_size,
+    const int hidden_size,
+    const T* W,
+    const T* R,
+    const T* bx,
+    const T* br,
+    const float zoneout_prob,
+    const cublasHandle_t& blas_handle) : data_(new private_data) {
+  data_->max_batch_size = max_batch_size;
+  data_->max_steps = max_steps;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->W = W;
+  data_->R = R;
+  data_->bx = bx;
+  data_->br = br;
+  data_->zoneout_prob = zoneout_prob;
+  cudaGetDevice(&data_->device);
+  cudaStreamCreateWithFlags(&data_->stream, cudaStreamNonBlocking);
+  data_->forward = new ForwardPass<T>(false, max_batch_size, input_size, hidden_size, blas_handle, data_->stream);
+
+  const size_t NC = static_cast<size_t>(max_batch_size) * input_size;
+  const size_t NH = static_cast<size_t>(max_batch_size) * hidden_size;
+  const size_t bytes = WorkspaceBytes<T>(max_steps * NC)
+      + WorkspaceBytes<T>((max_steps + 1) * NH)
+      + WorkspaceBytes<T>(max_steps * NH * 4)
+      + WorkspaceBytes<T>(max_steps * NH * 3)
+      + WorkspaceBytes<T>(NH * 3);
+  // Each pointer is null if its allocation failed, in which case `Submit` refuses every
+  // request.
+  if (cudaMalloc(&data_->buffer, bytes) != cudaSuccess)
+    data_->buffer = nullptr;
+  if (cudaMalloc(reinterpret_cast<void**>(&data_->lengths), max_batch_size * sizeof(int)) != cudaSuccess)
+    data_->lengths = nullptr;
+  if (cudaMallocHost(reinterpret_cast<void**>(&data_->host_lengths), max_batch_size * sizeof(int)) != cudaSuccess)
+    data_->host_lengths = nullptr;
+  data_->allocated = data_->buffer && data_->lengths && data_->host_lengths;
+  Workspace buffers(data_->buffer);
+  data_->x = buffers.Take<T>(max_steps * NC);
+  data_->h = buffers.Take<T>((max_steps + 1) * NH);
+  data_->v = buffers.Take<T>(max_steps * NH * 4);
+  data_->tmp_Wx = buffers.Take<T>(max_steps * NH * 3);
+  data_->tmp_Rh = buffers.Take<T>(NH * 3);
+
+  data_->queue = new BatchQueue<Request>(
+      max_batch_size,
+      std::chrono::microseconds(max_wait_us),
+      [this](const std::vector<Request>& requests) { RunBatch(requests); });
+}
+
+template<typename T>
+BatchScheduler<T>::~BatchScheduler() {
+  delete data_->queue;
+  delete data_->forward;
+  cudaFree(data_->buffer);
+  cudaFree(data_->lengths);
+  cudaFreeHost(data_->host_lengths);
+  cudaStreamDestroy(data_->stream);
+  delete data_;
+}
+
+template<typename T>
+std::future<void> BatchScheduler<T>::Submit(const Request& request) {
+  if (!data_->allocated)
+    return RefusedRequest<std::runtime_error>("BatchScheduler: out of memory");
+  if (request.steps < 1 || request.steps > data_->max_steps)
+    return RefusedRequest<std::invalid_argument>("BatchScheduler: steps not in [1, max_steps]");
+  return data_->queue->Push(request);
+}
+
+template<typename T>
+BatchSchedulerStats BatchScheduler<T>::Stats() const {
+  return data_->queue->Stats();
+}
+
+template<typename T>
+void BatchScheduler<T>::RunBatch(const std::vector<Request>& requests) {
+  const int batch_size = data_->max_batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const int count = requests.size();
+  const size_t NC = static_cast<size_t>(batch_size) * input_size;
+  const size_t NH = static_cast<size_t>(batch_size) * hidden_size;
+  const cudaStream_t stream = data_->stream;
+
+  cudaSetDevice(data_->device);
+
+  // `batch_sizes` requires the items to be sorted by decreasing length. The unused
+  // slots get a length of 0 so the pointwise kernels only carry their state forward.
+  std::vector<int> order(count);
+  for (int i = 0; i < count; ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&requests](const int a, const int b) {
+    return requests[a].steps > requests[b].steps;
+  });
+  const int steps = requests[order[0]].steps;
+
+  data_->batch_sizes.assign(steps, 0);
+  for (int n = 0; n < batch_size; ++n) {
+    const int length = n < count ? requests[order[n]].steps : 0;
+    data_->host_lengths[n] = length;
+    for (int t = 0; t < length; ++t)
+      ++data_->batch_sizes[t];
+  }
+  cudaMemcpyAsync(data_->lengths, data_->host_lengths, batch_size * sizeof(int), cudaMemcpyHostToDevice, stream);
+
+  for (int n = 0; n < count; ++n) {
+    const Request& request = requests[order[n]];
+    cudaMemcpy2DAsync(
+        data_->x + n * input_size, NC * sizeof(T),
+        request.x, input_size * sizeof(T),
+        input_size * sizeof(T), request.steps,
+        cudaMemcpyDeviceToDevice, stream);
+    if (request.h0)
+      cudaMemcpyAsync(data_->h + n * hidden_size, request.h0, hidden_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    else
+      cudaMemsetAsync(data_->h + n * hidden_size, 0, hidden_size * sizeof(T), stream);
+  }
+
+  data_->forward->Run(
+      steps,
+      data_->W,
+      data_->R,
+      data_->bx,
+      data_->br,
+      data_->x,
+      data_->h,
+      data_->v,
+      data_->tmp_Wx,
+      data_->tmp_Rh,
+      data_->zoneout_prob,
+      nullptr,
+      data_->lengths,
+      data_->batch_sizes.data());
+
+  for (int n = 0; n < count; ++n) {
+    const Request& request = requests[order[n]];
+    cudaMemcpy2DAsync(
+        request.h, hidden_size * sizeof(T),
+        data_->h + NH + n * hidden_size, NH * sizeof(T),
+        hidden_size * sizeof(T), request.steps,
+        cudaMemcpyDeviceToDevice, stream);
+  }
+
+  cudaStreamSynchronize(stream);
+}
+
+template<typename T>
+size_t PackedWeights<T>::Size(
+    const WeightFormat format,
+    const int input_size,
+    const int hidden_size) {
+  // Both formats keep separate input and recurrent biases.
+  const size_t matrices = static_cast<size_t>(input_size + hidden_size) * hidden_size * 3;
+  return matrices + hidden_size * 6;
+}
+
+template<typename T>
+PackedWeights<T> PackedWeights<T>::Pack(
+    const WeightFormat format,
+    const int input_size,
+    const int hidden_size,
+    const T* weights,
+    T* W,   // [C,H*3]
+    T* R,   // [H,H*3]
+    T* bx,  // [H*3]
+    T* br,  // [H*3]
+    const cudaStream_t& stream) {
+  const size_t W_size = static_cast<size_t>(input_size) * hidden_size * 3;
+  const size_t R_size = static_cast<size_t>(hidden_size) * hidden_size * 3;
+  const size_t b_size = static_cast<size_t>(hidden_size) * 3;
+  if (format == WeightFormat::kCudnn) {
+    // cuDNN orders the gates [r,z,h].
+    const GateMap map = {{1, 0, 2, 0}};
+    PackCudnnWeights<T>(input_size, hidden_size, 3, map, false, weights, W, R, bx, br, stream);
+  } else {
+    cudaMemcpyAsync(W, weights, W_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(R, weights + W_size, R_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(bx, weights + W_size + R_size, b_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(br, weights + W_size + R_size + b_size, b_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+  }
+  PackedWeights<T> packed = { W, R, bx, br };
+  return packed;
+}
+
+template<typename T>
+void PackedWeights<T>::UnpackGradients(
+    const WeightFormat format,
+    const int input_size,
+    const int hidden_size,
+    const T* dW,   // [C,H*3]
+    const T* dR,   // [H,H*3]
+    const T* dbx,  // [H*3]
+    const T* dbr,  // [H*3]
+    T* gradients,
+    const cudaStream_t& stream) {
+  const size_t W_size = static_cast<size_t>(input_size) * hidden_size * 3;
+  const size_t R_size = static_cast<size_t>(hidden_size) * hidden_size * 3;
+  const size_t b_size = static_cast<size_t>(hidden_size) * 3;
+  if (format == WeightFormat::kCudnn) {
+    const GateMap map = {{1, 0, 2, 0}};
+    UnpackCudnnGradients<T>(input_size, hidden_size, 3, map, false, dW, dR, dbx, dbr, gradients, stream);
+  } else {
+    cudaMemcpyAsync(gradients, dW, W_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(gradients + W_size, dR, R_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(gradients + W_size + R_size, dbx, b_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(gradients + W_size + R_size + b_size, dbr, b_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+  }
+}
+
+template<typename T>
+void QuantizedWeights<T>::Calibrate(
+    const size_t size,
+    const T* x,
+    float* x_absmax,  // [1]
+    const cudaStream_t& stream) {
+  LaunchAbsMax(size, x, x_absmax, stream);
+}
+
+template<typename T>
+QuantizedWeights<T> QuantizedWeights<T>::Quantize(
+    const int input_size,
+    const int hidden_size,
+    const T* W,   // [C,H*3]
+    const T* R,   // [H,H*3]
+    const T* bx,  // [H*3]
+    const T* br,  // [H*3]
+    const float* x_absmax,  // [1]
+    int8_t* W_q,      // [C,H*3]
+    int8_t* R_q,      // [H,H*3]
+    float* W_scale,   // [H*3]
+    float* R_scale,   // [H*3]
+    float* x_scale,   // [1]
+    const cudaStream_t& stream) {
+  LaunchQuantizeColumns(input_size, hidden_size * 3, W, W_q, W_scale, stream);
+  LaunchQuantizeColumns(hidden_size, hidden_size * 3, R, R_q, R_scale, stream);
+  CalibratedScale<<<1, 1, 0, stream>>>(x_absmax, x_scale);
+  QuantizedWeights<T> quantized = { W_q, R_q, W_scale, R_scale, x_scale, bx, br };
+  return quantized;
 }
 
+template struct PackedWeights<__half>;
+template struct PackedWeights<__nv_bfloat16>;
+template struct PackedWeights<float>;
+template struct PackedWeights<double>;
+template struct QuantizedWeights<__half>;
+template struct QuantizedWeights<__nv_bfloat16>;
+template struct QuantizedWeights<float>;
+template struct QuantizedWeights<double>;
+template struct ForwardPass<__half>;
+template struct ForwardPass<__nv_bfloat16>;
 template struct ForwardPass<float>;
 template struct ForwardPass<double>;
+template struct StackedForwardPass<__half>;
+template struct StackedForwardPass<__nv_bfloat16>;
+template struct StackedForwardPass<float>;
+template struct StackedForwardPass<double>;
+template struct BidirectionalForwardPass<__half>;
+template struct BidirectionalForwardPass<__nv_bfloat16>;
+template struct BidirectionalForwardPass<float>;
+template struct BidirectionalForwardPass<double>;
+template struct InferenceSession<__half>;
+template struct InferenceSession<__nv_bfloat16>;
+template struct InferenceSession<float>;
+template struct InferenceSession<double>;
+template struct BatchScheduler<__half>;
+template struct BatchScheduler<__nv_bfloat16>;
+template struct BatchScheduler<float>;
+template struct BatchScheduler<double>;
 
 }  // namespace gru
 }  // namespace v0
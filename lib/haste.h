@@ -15,10 +15,26 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <cublas_v2.h>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
 #include <cuda_runtime_api.h>
+#include <future>
+#include <vector>
+
+#ifdef HASTE_WITH_NCCL
+#include <nccl.h>
+#endif
 
 // GENERAL NOTES:
+// All classes are instantiated for `__half`, `__nv_bfloat16`, `float`, and `double`.
+// For the 16-bit types, GEMMs accumulate in FP32 (and may use tensor cores) and all
+// pointwise math is done in FP32; tensors are still stored in the 16-bit type, except
+// for the LSTM cell state `c` and its gradients, which are stored as `accum_t<T>` (FP32)
+// so that the cell state isn't rounded between steps.
+// Bias gradients are reduced without atomics, so they are reproducible run to run.
 // No pointers may be null unless otherwise specified.
 // All pointers are expected to point to device memory.
 // The square brackets below describe tensor shapes, where
@@ -30,8 +46,216 @@
 
 namespace haste {
 namespace v0 {
+
+// Reduced-precision formats for the activations that the `RunCompact` methods save
+// between the forward and backward passes in place of the [T,N,H*4] `v` tensor of type `T`.
+enum class ActivationStorage {
+  kHalf,    // IEEE FP16, 2 bytes per activation.
+  kFixed8,  // 8-bit fixed point with a scale of 1/127, 1 byte per activation. Only for
+            // activations in [-1, 1]; larger values are clamped.
+};
+
+// Parameter layouts that `PackedWeights` converts from and to.
+enum class WeightFormat {
+  kHaste,  // `W`, `R` and the bias vector(s) concatenated, each laid out as the passes
+           // take them.
+  kCudnn,  // cuDNN's canonical layout, as in the opaque parameters of `CudnnLSTM` and
+           // `CudnnGRU`: the [H,C] input matrix of each gate, then the [H,H] recurrent
+           // matrix of each gate, then the input and recurrent bias vectors of each gate,
+           // all in cuDNN's gate order ([i,f,g,o] for LSTM, [r,z,h] for GRU).
+};
+
+// Order of the gate columns of LSTM weights, biases and activations (see
+// `lstm::ForwardPass::SetGateLayout`).
+enum class GateLayout {
+  kBlocked,      // [4,H]: each gate's H units are contiguous. The default.
+  kInterleaved,  // [H,4]: the four gates of each hidden unit are adjacent.
+};
+
+// Implementations of the sigmoid and tanh gate nonlinearities that an inference pass
+// may trade accuracy for throughput with (see `lstm::ForwardPass::SetActivationTier`),
+// from the most to the least accurate. The errors are those of FP32 passes; FP64 passes
+// always use `kPrecise`, and 16-bit passes round the results to their storage type.
+enum class ActivationTier {
+  kPrecise,  // `1/(1+exp(-x))` and `tanh`. The default.
+  kFast,     // Both from the `ex2.approx` instruction, within a few ulps.
+  kApprox,   // The `tanh.approx` instruction of sm_75 and newer, with sigmoid as
+             // `tanh(x/2)/2 + 1/2`: an error of about 5e-4 for tanh and 2.5e-4 for
+             // sigmoid. Needs code built for sm_75 or newer, which the Makefile's
+             // default `NVCC_ARCH` includes; `kFast` on GPUs that run older code.
+  kHalf2,    // `kApprox`, with pairs of independent sigmoids (i and f of an LSTM unit, z
+             // and r of a GRU unit) computed together by the `tanh.approx.f16x2`
+             // instruction in FP16, with an error of about 1e-3. Also needs CUDA 11;
+             // `kApprox` otherwise.
+};
+
+// How the `Run` methods of a pass address their sequences (see
+// `lstm::ForwardPass::SetSequenceLayout`). The value-initialized layout, `SequenceLayout()`,
+// is the default: dense, time-major, first step first.
+struct SequenceLayout {
+  bool batch_major;  // `x` and `dx` are [N,T,C] and `h` and `dh_new` are [N,T+1,H].
+  bool reverse;      // Step T-1 runs first. The initial state is at index T of `h` (and
+                     // `c`), and the state after step t is at index t, as in the reverse
+                     // direction of `BidirectionalForwardPass`.
+  int h_stride;      // Elements between the rows of `h` and `dh_new`, for a slice of a
+                     // wider buffer such as one direction of [T+1,N,2H]. 0 means H.
+};
+
+// Counters of a `BatchScheduler`, as of the call to `BatchScheduler::Stats`.
+struct BatchSchedulerStats {
+  size_t queue_depth;            // Requests waiting to be batched.
+  size_t max_queue_depth;        // The most requests that have waited at once.
+  unsigned long long requests;   // Requests that have completed.
+  unsigned long long batches;    // Batches that have completed.
+  std::vector<unsigned long long> batch_sizes;  // [max_batch_size+1] number of
+                                                 // completed batches of each size.
+};
+
+// GPU time in milliseconds that a pass spent in each phase of its calls, as returned by
+// `CollectPhaseStats`. Phases that run concurrently on different streams (e.g. the
+// weight gradients) are each counted in full, so the sum can exceed the wall time.
+struct PhaseStats {
+  unsigned long long calls;   // Timed calls of `Run`, `Iterate` etc.
+  double input_projection_ms; // The `W·x` GEMM, or the `dx` GEMM of a backward pass.
+  double recurrence_ms;       // The time step loop, including its pointwise kernels.
+  double pointwise_ms;        // The separately launched pointwise kernels of the loop.
+  double weight_gradient_ms;  // The `dW`, `dR` and bias gradient reductions.
+};
+
+// Called by a backward pass from the host thread, while it enqueues its work, once it has
+// enqueued everything that the weight gradients of layer `layer` (0 for a single-layer
+// pass) depend on. The gradients are final when `ready` completes. `ready` is re-recorded
+// for the next layer and call, so the callback should wait on it (e.g. with
+// `cudaStreamWaitEvent` on the stream that communicates the gradients) before it returns.
+// It must not enqueue work on the pass's own stream or call into the pass.
+typedef void (*GradientReadyCallback)(const int layer, const cudaEvent_t ready, void* user_data);
+
+// The type that pointwise math is carried out in for tensors stored as `T`, and that the
+// LSTM cell state and its gradients are stored in. 16-bit types are widened to FP32.
+template<typename T>
+struct accum_type {
+  typedef T type;
+};
+
+template<>
+struct accum_type<__half> {
+  typedef float type;
+};
+
+template<>
+struct accum_type<__nv_bfloat16> {
+  typedef float type;
+};
+
+template<typename T>
+using accum_t = typename accum_type<T>::type;
+
 namespace lstm {
 
+template<typename T>
+class BackwardPass;
+
+template<typename T>
+class StackedForwardPass;
+
+template<typename T>
+class StackedBackwardPass;
+
+template<typename T>
+class BidirectionalForwardPass;
+
+template<typename T>
+class BidirectionalBackwardPass;
+
+// A set of LSTM weights in the layout that the passes read: `W` [C,H*4], `R` [H,H*4] and
+// `b` [H*4], with gates in [i,g,f,o] order. The `PackedWeights` overloads of the passes
+// read `W` and `R` in this layout in both directions, with the backward GEMMs
+// transposing them on the fly, so callers don't keep transposed copies of `W`, `R` and
+// `x` for the backward pass. Weights in another format are converted once with `Pack`,
+// e.g. whenever they're loaded or updated, rather than on every call.
+template<typename T>
+struct PackedWeights {
+  const T* W;
+  const T* R;
+  const T* b;
+
+  // The number of `T` elements that a layer's parameters take up in `format`.
+  static size_t Size(const WeightFormat format, const int input_size, const int hidden_size);
+
+  // Converts `weights` ([Size(format, ...)] in device memory) from `format` into `W`
+  // [C,H*4], `R` [H,H*4] and `b` [H*4] with their gate columns in `layout` on `stream`
+  // and returns a view of them. `weights` is always in the blocked layout.
+  static PackedWeights Pack(
+      const WeightFormat format,
+      const GateLayout layout,
+      const int input_size,
+      const int hidden_size,
+      const T* weights,
+      T* W,
+      T* R,
+      T* b,
+      const cudaStream_t& stream);
+
+  // Converts the gradients `dW`, `dR` and `db` that `BackwardPass` accumulates in the
+  // packed layout into `gradients` ([Size(format, ...)] in device memory) in `format` on
+  // `stream`, so they can be applied to the weights that were packed. With `kCudnn`, both
+  // of cuDNN's bias vectors receive `db` since the passes only use their sum. `layout`
+  // must match the one given to `Pack`.
+  static void UnpackGradients(
+      const WeightFormat format,
+      const GateLayout layout,
+      const int input_size,
+      const int hidden_size,
+      const T* dW,
+      const T* dR,
+      const T* db,
+      T* gradients,
+      const cudaStream_t& stream);
+};
+
+// A set of LSTM weights quantized to int8 for `ForwardPass::RunQuantized`: `W` [C,H*4]
+// and `R` [H,H*4] with a symmetric scale per gate column, `W_scale` [H*4] and `R_scale`
+// [H*4], so that element [k][j] of the full-precision `W` is about `W_scale[j] * W[k][j]`.
+// The inputs are quantized with the single scale `x_scale` [1] and the bias `b` [H*4]
+// stays in `T`. All pointers are to device memory. The weight matrices take up a quarter
+// of their FP32 size and the gate columns may be in either `GateLayout`.
+template<typename T>
+struct QuantizedWeights {
+  const int8_t* W;
+  const int8_t* R;
+  const float* W_scale;
+  const float* R_scale;
+  const float* x_scale;
+  const T* b;
+
+  // Calibrates the scale of the inputs by folding the largest magnitude of the `size`
+  // elements of `x` into `x_absmax` ([1] in device memory, zeroed before the first call)
+  // on `stream`. Called on representative inputs, e.g. a few batches of the serving
+  // traffic, before `Quantize`. Inputs beyond the calibrated range are clamped.
+  static void Calibrate(
+      const size_t size,
+      const T* x,
+      float* x_absmax,
+      const cudaStream_t& stream);
+
+  // Quantizes the trained `W` [C,H*4] and `R` [H,H*4] into `W_q` and `R_q` with the
+  // per-column scales `W_scale` [H*4] and `R_scale` [H*4], and turns the calibrated
+  // `x_absmax` [1] into `x_scale` [1], on `stream`. Returns a view of them with `b`.
+  static QuantizedWeights Quantize(
+      const int input_size,
+      const int hidden_size,
+      const T* W,
+      const T* R,
+      const T* b,
+      const float* x_absmax,
+      int8_t* W_q,
+      int8_t* R_q,
+      float* W_scale,
+      float* R_scale,
+      float* x_scale,
+      const cudaStream_t& stream);
+};
+
 template<typename T>
 class ForwardPass {
   public:
@@ -40,17 +264,141 @@ class ForwardPass {
     // input_size: the dimension of each input vector.
     // hidden_size: the expected dimension of each output vector.
     // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass. Each call waits for work already enqueued on `stream` before it starts, and
+    //     work enqueued on `stream` after a call returns will see its results. The host
+    //     thread is never blocked. Use `0` for the default stream.
     ForwardPass(
         const bool training,
         const int batch_size,
         const int input_size,
         const int hidden_size,
-        const cublasHandle_t& blas_handle);
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
 
-    // Releases internal resources.
-    // Blocks until all iterations have completed executing on the GPU.
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
     ~ForwardPass();
 
+    // Opts in to running the recurrence in `Run` as a single persistent kernel that keeps
+    // `R` in on-chip memory across all time steps instead of launching a GEMM and a
+    // pointwise kernel per step. This is typically a win for small batch sizes where the
+    // per-step GEMM is dominated by launch overhead and re-reading `R`. Returns `false`
+    // (and leaves `Run` unchanged) if `R` doesn't fit on-chip for this hidden size or if
+    // the device doesn't support cooperative launches. `Iterate` is unaffected.
+    bool EnablePersistentKernel();
+
+    // Opts in to capturing the work enqueued by `Run` into a CUDA graph and replaying it
+    // on subsequent calls with the same arguments (`steps`, pointers and scalars), which
+    // removes nearly all of the per-step host launch overhead. When the arguments change,
+    // the graph is recaptured and the executable graph is updated in place when possible.
+    // Callers that want replays should keep their buffers at stable addresses. Capture
+    // is silently abandoned in favor of regular launches if the CUDA runtime rejects it.
+    // `Iterate` is unaffected.
+    void EnableGraphCapture();
+
+    // Opts in to timing the phases of `Run` and `Iterate` (see `PhaseStats`) with CUDA
+    // events. Only builds with `make PROFILING=1` have the instrumentation, which also
+    // wraps each phase in an NVTX range whether or not timing is enabled; otherwise this
+    // has no effect. Calls replayed from a CUDA graph aren't timed.
+    void EnablePhaseTiming();
+
+    // Returns the time spent in each phase by the timed work that has finished since the
+    // previous call, without waiting for work that's still running, which a later call
+    // will count. `calls` counts the calls enqueued since the previous call. All zeros
+    // unless timing is enabled.
+    PhaseStats CollectPhaseStats();
+
+    // Opts in to computing each time step of `Run` with a single kernel that multiplies
+    // `R` by the previous hidden state in on-chip tiles and applies the pointwise
+    // operations to the product directly, instead of a cuBLAS GEMM whose [N,H*4] output
+    // makes a round trip through global memory before a separate pointwise kernel reads
+    // it. This mostly helps mid-sized problems (N of 32-64, H of 512-1024) where that
+    // traffic and the extra launch per step are a large part of the run time. The
+    // persistent kernel takes precedence when it's enabled. `Iterate`, `RunCheckpointed`
+    // and `RunCompact` are unaffected.
+    void EnableFusedRecurrence();
+
+    // Opts in to generating the zoneout mask inside the pointwise kernels instead of
+    // reading it from memory, so `zoneout_mask` may be null whenever `zoneout_prob` is
+    // nonzero. The mask is drawn from a counter-based generator (Philox4x32-10) keyed by
+    // `seed` and `offset`: the element at time step t, batch item n and hidden unit j of
+    // `Run` uses counter `(t*N + n)*H + j`, and `Iterate` always uses t=0, so callers
+    // should advance `offset` for every call that needs an independent mask.
+    // `zoneout_prob` must match the value given to `Run` or `Iterate`, and the same
+    // values must be given to `BackwardPass::SetZoneoutSeed`. A non-null `zoneout_mask`
+    // still takes precedence. Stacked and bidirectional passes ignore this setting.
+    void SetZoneoutSeed(
+        const float zoneout_prob,
+        const unsigned long long seed,
+        const unsigned long long offset);
+
+    // Applies DropConnect to `R` in `Run`, `RunCheckpointed` and `RunCompact`: like
+    // `tf.nn.dropout(R, rate)`, each element is kept with probability `1 - rate` and scaled by
+    // `1 / (1 - rate)`, or zeroed otherwise. The mask is drawn once per call from the same
+    // generator as `SetZoneoutSeed`, keyed by `seed` and `offset`, with element `k*H*4 + j` of
+    // `R` using counter `k*H*4 + j`. The masked matrix is written to `tmp_R` ([H,H*4]), which
+    // the caller must not touch until the call has completed. The same `rate`, `seed` and
+    // `offset` must be given to `BackwardPass::SetDropConnect`. A `rate` of 0 turns
+    // DropConnect off again. `Iterate` is unaffected.
+    void SetDropConnect(
+        const float rate,
+        const unsigned long long seed,
+        const unsigned long long offset,
+        T* tmp_R);
+
+    // Selects the order of the gate columns of `W`, `R`, `b` and `v` (e.g. as produced by
+    // `PackedWeights::Pack`). With `GateLayout::kInterleaved`, the pointwise kernel reads
+    // and writes all four gates of a hidden unit from one place instead of four blocks H
+    // elements apart, and the persistent kernel is not used. The `BackwardPass` must use
+    // the same layout. Stacked and bidirectional passes ignore this setting.
+    void SetGateLayout(const GateLayout layout);
+
+    // Selects how `Run` addresses `x` and `h` (see `SequenceLayout`), so that batch-major
+    // inputs, the reverse direction of a bidirectional layer, or one direction's slice
+    // of a concatenated output need no transposed, reversed or compacted copies. The
+    // input projection reads `x` through GEMM strides; `c`, `v` and `zoneout_mask` stay
+    // dense and time-major, indexed like `h` by time step. A layout other than the
+    // default disables the persistent kernel. The `BackwardPass` must use the same
+    // layout. `Iterate`, `RunSegment`, `RunCheckpointed`, `RunCompact` and
+    // `RunQuantized` ignore this setting.
+    void SetSequenceLayout(const SequenceLayout& layout);
+
+    // The next three setters select variants of the LSTM cell for `Run` and `Iterate`,
+    // which any combination of them may use. Each combination has its own instantiation
+    // of the pointwise kernel, so a variant cell costs about as much as the standard one.
+    // With any of them, `Run` uses neither the persistent nor the fused kernel, and
+    // `RunCheckpointed`, `RunCompact` and `RunQuantized` return false without enqueueing
+    // any work. The `BackwardPass` must select the same variants. The stacked,
+    // bidirectional and tensor-parallel passes, `InferenceSession` and `BatchScheduler`
+    // have no variants and always run the standard cell.
+    //
+    // Adds peephole connections: `P` ([3,H]) holds the weights of the input, forget and
+    // output gates, which add `P[0]*c_prev`, `P[1]*c_prev` and `P[2]*c` to their
+    // pre-activations, where `c` is the new cell state. A null `P` turns them off again.
+    void SetPeephole(const T* P);
+
+    // Couples the input gate to the forget gate as `i = 1 - f` (CIFG) if `coupled`. The
+    // input gate's columns of `W`, `R` and `b` are then unused.
+    void SetCoupledGates(const bool coupled);
+
+    // Layer-normalizes each gate's pre-activations (Wx + Rh + b) over the hidden units of
+    // a batch item, before the peephole terms and the nonlinearities, with the gains and
+    // biases in `layer_norm` ([2,H*4]: the gains, then the biases, in the same gate
+    // layout as `b`). The mean and variance are reduced inside the pointwise kernel,
+    // which runs one block per batch item. When training, `layer_norm_cache`
+    // ([T,N,2,H*4], or [N,2,H*4] for `Iterate`) receives what the backward pass needs and
+    // must be given to `BackwardPass::SetLayerNorm`. A null `layer_norm` turns layer
+    // normalization off again.
+    void SetLayerNorm(const T* layer_norm, T* layer_norm_cache);
+
+    // Selects the gate nonlinearities of the pointwise kernel of an inference pass (see
+    // `ActivationTier`) for `Run`, `Iterate` and `RunQuantized`. Each tier has its own
+    // instantiation of the kernel. Only the standard cell has the other tiers; the cell
+    // variants, the persistent and fused kernels and training passes always use
+    // `ActivationTier::kPrecise`, which is the default.
+    void SetActivationTier(const ActivationTier tier);
+
     // Performs one forward iteration of the LSTM cell.
     //
     // W: [C,H*4] the input weight matrix.
@@ -85,9 +433,9 @@ class ForwardPass {
         const T* b,
         const T* x,
         const T* h,
-        const T* c,
+        const accum_t<T>* c,
         T* h_out,
-        T* c_out,
+        accum_t<T>* c_out,
         T* v,
         T* tmp_Rh,
         const float zoneout_prob,
@@ -107,9 +455,9 @@ class ForwardPass {
     //      be set to the desired initial hidden state (typically zeros). The rest of the
     //      vectors will be set by this function. `h[1:,:,:]` forms the output of this LSTM
     //      layer.
-    // c: [T+1,N,H] the cell state vectors across all time steps. The t=0'th vector should be
-    //      set to the desired initial cell state (typically zeros). The rest of the vectors
-    //      will be set by this function.
+    // c: [T+1,N,H] the cell state vectors across all time steps, in FP32 for 16-bit `T`
+    //      (see `accum_t`). The t=0'th vector should be set to the desired initial cell
+    //      state (typically zeros). The rest of the vectors will be set by this function.
     // v: [T,N,H*4] if `training` is `false`, this is scratch space and should not be used by
     //     the caller. If `training` is `true`, this parameter will contain intermediate
     //     activations which must be provided as-is to `BackwardPass::Run` or manually urolled
@@ -123,6 +471,15 @@ class ForwardPass {
     // zoneout_mask: [T,N,H] may be null to disable zoneout. This is a random binary mask
     //     following a Bernoulli(1-zoneout_prob) distribution. A different mask is typically
     //     used for each iteration.
+    // sequence_lengths: [N] may be null if every sequence has `steps` time steps. The
+    //     number of valid time steps of each batch item, in device memory. Past the end of
+    //     its sequence, an item's state is carried through unchanged, so `h[T]` (and `c[T]`)
+    //     hold each item's final state. Only the pointwise work is skipped unless
+    //     `batch_sizes` is also provided.
+    // batch_sizes: [T] may be null. The number of batch items whose sequence includes each
+    //     time step, in host memory. Requires `sequence_lengths` and batch items sorted by
+    //     decreasing length; then the recurrent GEMM of each step only covers the active
+    //     batch items.
     void Run(
         const int steps,
         const T* W,
@@ -130,24 +487,242 @@ class ForwardPass {
         const T* b,
         const T* x,
         T* h,
-        T* c,
+        accum_t<T>* c,
         T* v,
         T* tmp_Rh,
         const float zoneout_prob,
-        const T* zoneout_mask);
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Same as `Run` above, with the weights of `weights`.
+    void Run(
+        const int steps,
+        const PackedWeights<T>& weights,
+        const T* x,
+        T* h,
+        accum_t<T>* c,
+        T* v,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // The size in bytes of the workspace that `Run` needs for `steps` time steps when it's
+    // given one in place of its temporary buffers: `tmp_Rh` and, unless the pass was
+    // constructed for training, `v`.
+    size_t GetWorkspaceSize(const int steps) const;
+
+    // Same as the first `Run` above, but carves `tmp_Rh` out of `workspace` so a caller
+    // can serve all of its temporary memory with a single allocation (e.g. from a caching
+    // arena). `workspace` must hold `GetWorkspaceSize(steps)` bytes, aligned to at least 16
+    // bytes, and needn't be initialized. Unless `training`, `v` may be null to carve it
+    // out of `workspace` as well.
+    void Run(
+        const int steps,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        T* h,
+        accum_t<T>* c,
+        T* v,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes,
+        void* workspace);
+
+    // Runs the LSTM over all time steps like `Run` but only keeps what
+    // `BackwardPass::RunCheckpointed` needs to recompute everything else: the hidden state
+    // of every step and the cell state of every `checkpoint_interval`'th step. `v` is not
+    // kept at all. This reduces the activations saved for training from [T,N,H*6] to about
+    // [T,N,H] + [T/K,N,H] at the cost of running the forward pass a second time during the
+    // backward pass. Larger intervals keep fewer cell states but need more temporary
+    // memory in both passes. The persistent kernel and graph capture are not used.
+    // Returns false without enqueueing any work if a cell variant is selected (see
+    // `SetPeephole`).
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // checkpoint_interval: the number of time steps between saved cell states (i.e. K).
+    //     Must be positive.
+    // W: [C,H*4] the input weight matrix.
+    // R: [H,H*4] the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // x: [T,N,C] the LSTM input for this iteration (N vectors, each with dimension C).
+    // h: [T+1,N,H] the hidden state vectors across all time steps, same as in `Run`.
+    // c: [ceil(T/K)+1,N,H] the cell state vectors at time steps 0, K, 2K, ... and T. The
+    //     t=0'th vector should be set to the desired initial cell state (typically zeros).
+    //     The rest of the vectors will be set by this function; the last one is the final
+    //     cell state.
+    // tmp_v: [K,N,H*4] additional temporary work space. The caller should not use the
+    //     contents of this vector.
+    // tmp_Rh: [N,H*4] additional temporary work space, same as in `Run`.
+    // zoneout_prob: same as in `Run`.
+    // zoneout_mask: [T,N,H] same as in `Run`.
+    // sequence_lengths: [N] same as in `Run`.
+    // batch_sizes: [T] same as in `Run`.
+    bool RunCheckpointed(
+        const int steps,
+        const int checkpoint_interval,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        T* h,
+        accum_t<T>* c,
+        T* tmp_v,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Runs the LSTM over all time steps like `Run` but saves the activations for
+    // `BackwardPass::RunCompact` in a reduced-precision `storage` format instead of `v`.
+    // That makes the saved activations 2x (`kHalf`) or 4x (`kFixed8`) smaller for FP32 and
+    // halves the traffic of reading them back in the backward pointwise kernel. The GEMMs
+    // are unchanged and the forward outputs match `Run` exactly; only the gradients see
+    // the rounding. Requires `training`. The persistent kernel and graph capture are not
+    // used. Returns false like `RunCheckpointed`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // storage: the format to save the activations in.
+    // W: [C,H*4] the input weight matrix.
+    // R: [H,H*4] the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // x: [T,N,C] the LSTM input for this iteration (N vectors, each with dimension C).
+    // h: [T+1,N,H] the hidden state vectors across all time steps, same as in `Run`.
+    // c: [T+1,N,H] the cell state vectors across all time steps, same as in `Run`.
+    // v: `CompactActivationsSize(T, N, H, storage)` bytes that will contain the
+    //     activations, which must be provided as-is to `BackwardPass::RunCompact`.
+    // tmp_Wx: [T,N,H*4] additional temporary work space for the input projections. The
+    //     caller should not use the contents of this vector.
+    // tmp_Rh: [N,H*4] additional temporary work space, same as in `Run`.
+    // zoneout_prob: same as in `Run`.
+    // zoneout_mask: [T,N,H] same as in `Run`.
+    // sequence_lengths: [N] same as in `Run`.
+    // batch_sizes: [T] same as in `Run`.
+    bool RunCompact(
+        const int steps,
+        const ActivationStorage storage,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        T* h,
+        accum_t<T>* c,
+        void* v,
+        T* tmp_Wx,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // The size in bytes of the workspace that `RunQuantized` needs for `steps` time steps.
+    size_t GetQuantizedWorkspaceSize(const int steps) const;
+
+    // Runs the LSTM over all time steps for inference with int8 weights. The inputs and
+    // every hidden state are quantized to int8 (the hidden state with a fixed scale of
+    // 1/127, since it's always in [-1, 1]) and both the input projection and the
+    // recurrent step are int8 GEMMs that accumulate in int32. The pointwise kernel
+    // dequantizes the products with the weights' per-column scales as it applies the
+    // gates, so no full-precision copy of `W`, `R` or their products is ever made. The
+    // cell state stays in `accum_t<T>` and the outputs in `T`. Requires C and H to be
+    // multiples of 4 and a GPU of compute capability 6.1 or later. Nothing is saved for a
+    // backward pass, whatever `training` is. The persistent kernel, the fused recurrence,
+    // DropConnect and graph capture are not used. Returns false like `RunCheckpointed`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // weights: the quantized weights (see `QuantizedWeights::Quantize`).
+    // x: [T,N,C] the LSTM input for this iteration (N vectors, each with dimension C).
+    // h: [T+1,N,H] the hidden state vectors across all time steps, same as in `Run`. The
+    //     initial hidden state must be in [-1, 1].
+    // c: [T+1,N,H] the cell state vectors across all time steps, same as in `Run`.
+    // zoneout_prob: same as in `Run`. Zoneout is applied as in inference.
+    // sequence_lengths: [N] same as in `Run`.
+    // batch_sizes: [T] same as in `Run`.
+    // workspace: `GetQuantizedWorkspaceSize(steps)` bytes of temporary work space, aligned
+    //     to at least 16 bytes. The caller should not use its contents.
+    bool RunQuantized(
+        const int steps,
+        const QuantizedWeights<T>& weights,
+        const T* x,
+        T* h,
+        accum_t<T>* c,
+        const float zoneout_prob,
+        const int* sequence_lengths,
+        const int* batch_sizes,
+        void* workspace);
 
   private:
+    friend class BackwardPass<T>;
+    friend class StackedForwardPass<T>;
+    friend class BidirectionalForwardPass<T>;
+
     void IterateInternal(
         const T* R,
         const T* b,
         const T* h,
-        const T* c,
+        const accum_t<T>* c,
         T* h_out,
-        T* c_out,
+        accum_t<T>* c_out,
         T* v,
         T* tmp_Rh,
         const float zoneout_prob,
-        const T* zoneout_mask);
+        const T* zoneout_mask,
+        const int step,
+        const int active_batch_size,
+        const int* sequence_lengths,
+        const int h_stride);
+
+    // Runs `steps` time steps starting at `first_step` of a sequence whose inputs, hidden
+    // states and zoneout masks start at `x`, `h` and `zoneout_mask`. The first step reads
+    // its cell state from `c`; step `i` writes its hidden state to `h_out + i * h_out_step`
+    // and its cell state to `c_out + i * c_out_step` and every later step reads its cell
+    // state from there. Either step may be 0 to update a single vector in place.
+    void RunSegment(
+        const int first_step,
+        const int steps,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        const T* h,
+        const accum_t<T>* c,
+        T* h_out,
+        const int h_out_step,
+        accum_t<T>* c_out,
+        const int c_out_step,
+        T* v,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Recomputes `v` and the cell states of a segment that was run by `RunCheckpointed`
+    // from its saved hidden states and the cell state `c` before its first step. The
+    // recomputed hidden states are discarded into `tmp_h`.
+    void Recompute(
+        const int first_step,
+        const int steps,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        const T* h,
+        const accum_t<T>* c,
+        accum_t<T>* c_out,
+        T* v,
+        T* tmp_h,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
 
     struct private_data;
     private_data* data_;
@@ -160,16 +735,111 @@ class BackwardPass {
     // input_size: the dimension of each input vector.
     // hidden_size: the expected dimension of each output vector.
     // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass. Each call waits for work already enqueued on `stream` before it starts, and
+    //     work enqueued on `stream` after a call returns will see its results. The host
+    //     thread is never blocked. Use `0` for the default stream.
     BackwardPass(
         const int batch_size,
         const int input_size,
         const int hidden_size,
-        const cublasHandle_t& blas_handle);
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
 
-    // Releases internal resources.
-    // Blocks until all iterations have completed executing on the GPU.
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
     ~BackwardPass();
 
+    // Opts in to capturing the work enqueued by `Run` into a CUDA graph and replaying it
+    // on subsequent calls with the same arguments (`steps`, pointers and scalars), which
+    // removes nearly all of the per-step host launch overhead. When the arguments change,
+    // the graph is recaptured and the executable graph is updated in place when possible.
+    // Callers that want replays should keep their buffers at stable addresses. Capture
+    // is silently abandoned in favor of regular launches if the CUDA runtime rejects it.
+    // `Iterate` is unaffected.
+    void EnableGraphCapture();
+
+    // Like `ForwardPass::EnablePhaseTiming` and `ForwardPass::CollectPhaseStats`.
+    void EnablePhaseTiming();
+    PhaseStats CollectPhaseStats();
+
+    // Opts in to folding each time step's `R_t·dv` GEMM of `Run` into the next step's
+    // pointwise kernel, like `ForwardPass::EnableFusedRecurrence`. Doesn't need to match
+    // the forward pass's setting. `Iterate`, `RunCheckpointed` and `RunCompact` are
+    // unaffected.
+    void EnableFusedRecurrence();
+
+    // Has `Run` issue the `dW`, `dR`, `db` and `dx` GEMMs for every `steps` time steps as
+    // soon as the recurrence has produced their `dv`, on streams of their own, instead of
+    // all at once after the last step. This overlaps most of the weight-gradient work with
+    // the latency-bound recurrence. The gradients are summed in a different order, so they
+    // may differ from the unchunked ones by rounding. 0 (the default) turns it off again.
+    void SetWeightGradientChunk(const int steps);
+
+    // Has `Run` call `callback(0, ready, user_data)` as soon as `dW`, `dR`, `db` (and `dP`
+    // and `dlayer_norm`, if set) are final, so that a data-parallel caller can start
+    // reducing them while the `dx` GEMM and the rest of its backward pass still run.
+    // With graph capture, a replay only signals once its graph has finished. A null
+    // `callback` turns it off again.
+    void SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data);
+
+#ifdef HASTE_WITH_NCCL
+    // Has `Run` sum the weight gradients across the ranks of `comm` in place, on a stream
+    // of its own, as soon as they're final (see `SetGradientReadyCallback`). Every rank
+    // must make the same calls. The sum isn't divided by the number of ranks. A callback
+    // is then only signaled once the sums are done. A null `comm` turns it off again.
+    // Returns false, and leaves the all-reduce off, for `__nv_bfloat16` with NCCL before
+    // 2.10, which has no bfloat16 type.
+    bool SetGradientAllReduce(const ncclComm_t& comm);
+#endif
+
+    // Regenerates the zoneout mask that a forward pass drew after
+    // `ForwardPass::SetZoneoutSeed(zoneout_prob, seed, offset)` instead of reading
+    // `zoneout_mask`, which may then be null. The arguments must match the forward pass.
+    void SetZoneoutSeed(
+        const float zoneout_prob,
+        const unsigned long long seed,
+        const unsigned long long offset);
+
+    // Applies the DropConnect mask that a forward pass drew after
+    // `ForwardPass::SetDropConnect(rate, seed, offset, ...)` to `R_t` in `Run`,
+    // `RunCheckpointed` and `RunCompact`, and to `dR` so that it holds the gradient with
+    // respect to the unmasked `R`. `dR` is masked in place once it has been accumulated, so it
+    // should be zero on entry. `tmp_R` is [H*4,H] workspace for the masked `R_t`, or [2,H*4,H]
+    // for `RunCheckpointed` which also needs the masked `R`. The caller must not touch it
+    // until the call has completed. A `rate` of 0 turns DropConnect off again.
+    void SetDropConnect(
+        const float rate,
+        const unsigned long long seed,
+        const unsigned long long offset,
+        T* tmp_R);
+
+    // Selects the order of the gate columns of `W`, `R`, `b`, `v` and their gradients. Must
+    // match `ForwardPass::SetGateLayout`.
+    void SetGateLayout(const GateLayout layout);
+
+    // Selects how `Run` addresses `x`, `h`, `dh_new` and `dx`. Must match
+    // `ForwardPass::SetSequenceLayout`. A batch-major layout needs the `PackedWeights`
+    // overload, which reads `x` itself; `x_t` is always [C,T,N]. Where the rows of `h` or
+    // `x` aren't evenly spaced, `dR` and `dW` are reduced in one GEMM per time step or per
+    // batch item, whichever is fewer. `Iterate`, `RunCheckpointed` and `RunCompact`
+    // ignore this setting.
+    void SetSequenceLayout(const SequenceLayout& layout);
+
+    // Select the cell variants of the forward pass (see `ForwardPass::SetPeephole`) for
+    // `Run` and `Iterate`, which then don't use the fused kernel. `dP` ([3,H]) and
+    // `dlayer_norm` ([2,H*4]) receive the gradients of the peephole weights and of the
+    // layer normalization's gains and biases like `db` does. `layer_norm_cache` is the
+    // forward pass's, which `Run` and `Iterate` overwrite.
+    void SetPeephole(const T* P, T* dP);
+    void SetCoupledGates(const bool coupled);
+    void SetLayerNorm(const T* layer_norm, T* layer_norm_cache, T* dlayer_norm);
+
+    // By default, `Run`, `RunCheckpointed` and `RunCompact` add their gradients to `dW`, `dR`
+    // and `db`, which must then be initialized. With `accumulate` false they overwrite them
+    // instead, so the caller needn't clear them first. `Iterate` always accumulates.
+    void SetAccumulateGradients(const bool accumulate);
+
     // Performs one backward iteration of the LSTM cell.
     //
     // Note that BackwardPass must be iterated in the reverse order as ForwardPass.
@@ -211,16 +881,16 @@ class BackwardPass {
         const T* b,
         const T* x_t,
         const T* h,
-        const T* c,
-        const T* c_new,
+        const accum_t<T>* c,
+        const accum_t<T>* c_new,
         const T* dh_new,
-        const T* dc_new,
+        const accum_t<T>* dc_new,
         T* dx,
         T* dW,
         T* dR,
         T* db,
         T* dh,
-        T* dc,
+        accum_t<T>* dc,
         T* v,
         const T* zoneout_mask);
 
@@ -251,6 +921,8 @@ class BackwardPass {
     // v: [T,N,H*4] the same tensor that was passed to `ForwardPass::Run`.
     // zoneout_mask: [T,N,H] may be null if zoneout was disabled in the forward pass. This
     //     vector must be the same as the one provided during the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
     void Run(
         const int steps,
         const T* W_t,
@@ -258,56 +930,1042 @@ class BackwardPass {
         const T* b,
         const T* x_t,
         const T* h,
-        const T* c,
+        const accum_t<T>* c,
         const T* dh_new,
-        const T* dc_new,
+        const accum_t<T>* dc_new,
         T* dx,
         T* dW,
         T* dR,
         T* db,
         T* dh,
-        T* dc,
+        accum_t<T>* dc,
         T* v,
-        const T* zoneout_mask);
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Same as `Run` above, but reads `W` and `R` from `weights` and takes the input `x`
+    // ([T,N,C], as given to the forward pass) in place of `W_t`, `R_t` and `x_t`; the
+    // GEMMs transpose them on the fly instead. `dW`, `dR` and `db` are in the packed
+    // layout (see `PackedWeights::UnpackGradients`).
+    void Run(
+        const int steps,
+        const PackedWeights<T>& weights,
+        const T* x,
+        const T* h,
+        const accum_t<T>* c,
+        const T* dh_new,
+        const accum_t<T>* dc_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* db,
+        T* dh,
+        accum_t<T>* dc,
+        T* v,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Runs the LSTM backward pass over all time steps after `ForwardPass::RunCheckpointed`.
+    // The time steps are processed in segments of `checkpoint_interval` steps from last to
+    // first; each segment's activations and cell states are recomputed from its saved cell
+    // state before its gradients are computed. Graph capture is not used. Returns false
+    // without enqueueing any work if a cell variant is selected (see `SetPeephole`).
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // checkpoint_interval: the same interval that was passed to the forward pass (i.e. K).
+    // W: [C,H*4] the input weight matrix (not transposed).
+    // R: [H,H*4] the recurrent weight matrix (not transposed).
+    // R_t: [H*4,H] the transpose of the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // x: [T,N,C] the LSTM input (not transposed).
+    // h: [T+1,N,H] the hidden state vectors after running `ForwardPass::RunCheckpointed`.
+    // c: [ceil(T/K)+1,N,H] the cell state vectors after running
+    //     `ForwardPass::RunCheckpointed`.
+    // dh_new: [T+1,N,H] the gradient of the loss with respect to `h`.
+    // dc_new: [ceil(T/K)+1,N,H] the gradient of the loss with respect to `c`.
+    // dx: [T,N,C] the gradient of the loss with respect to the input.
+    // dW: [C,H*4] the gradient of the loss with respect to the input weight matrix.
+    // dR: [H,H*4] the gradient of the loss with respect to the recurrent weight matrix.
+    // db: [H*4] the gradient of the loss with respect to the bias vector.
+    // dh: [N,H] NOTE: this is an input and output parameter, same as in `Run`.
+    // dc: [N,H] NOTE: this is an input and output parameter, same as in `Run`.
+    // tmp_c: [K,N,H] additional temporary work space. The caller should not use the
+    //     contents of this vector.
+    // tmp_v: [K,N,H*4] additional temporary work space.
+    // tmp_h: [N,H] additional temporary work space.
+    // tmp_Rh: [N,H*4] additional temporary work space.
+    // zoneout_prob: must match the value provided to the forward pass.
+    // zoneout_mask: [T,N,H] may be null if zoneout was disabled in the forward pass. This
+    //     vector must be the same as the one provided during the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    bool RunCheckpointed(
+        const int steps,
+        const int checkpoint_interval,
+        const T* W,
+        const T* R,
+        const T* R_t,
+        const T* b,
+        const T* x,
+        const T* h,
+        const accum_t<T>* c,
+        const T* dh_new,
+        const accum_t<T>* dc_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* db,
+        T* dh,
+        accum_t<T>* dc,
+        accum_t<T>* tmp_c,
+        T* tmp_v,
+        T* tmp_h,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Runs the LSTM backward pass over all time steps after `ForwardPass::RunCompact`. The
+    // saved activations are decompressed inside the pointwise kernel; the gate gradients
+    // and everything downstream of them are computed in `T` as in `Run`. Graph capture is
+    // not used. Returns false like `RunCheckpointed`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // storage: the same format that was passed to the forward pass.
+    // W_t: [H*4,C] the transpose of the input weight matrix.
+    // R_t: [H*4,H] the transpose of the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // x_t: [C,T,N] the transpose of the LSTM input for this iteration.
+    // h: [T+1,N,H] the hidden state vectors after running `ForwardPass::RunCompact`.
+    // c: [T+1,N,H] the cell state vectors after running `ForwardPass::RunCompact`.
+    // dh_new: [T+1,N,H] the gradient of the loss with respect to `h`.
+    // dc_new: [T+1,N,H] the gradient of the loss with respect to `c`.
+    // dx: [T,N,C] the gradient of the loss with respect to the input.
+    // dW: [C,H*4] the gradient of the loss with respect to the input weight matrix.
+    // dR: [H,H*4] the gradient of the loss with respect to the recurrent weight matrix.
+    // db: [H*4] the gradient of the loss with respect to the bias vector.
+    // dh: [N,H] NOTE: this is an input and output parameter, same as in `Run`.
+    // dc: [N,H] NOTE: this is an input and output parameter, same as in `Run`.
+    // v: the activations saved by `ForwardPass::RunCompact`.
+    // tmp_dv: [T,N,H*4] additional temporary work space for the gate gradients. The caller
+    //     should not use the contents of this vector.
+    // zoneout_mask: [T,N,H] may be null if zoneout was disabled in the forward pass. This
+    //     vector must be the same as the one provided during the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    bool RunCompact(
+        const int steps,
+        const ActivationStorage storage,
+        const T* W_t,
+        const T* R_t,
+        const T* b,
+        const T* x_t,
+        const T* h,
+        const accum_t<T>* c,
+        const T* dh_new,
+        const accum_t<T>* dc_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* db,
+        T* dh,
+        accum_t<T>* dc,
+        const void* v,
+        T* tmp_dv,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Same as `RunCompact` above, but reads `W` and `R` from `weights` and takes the input `x`
+    // ([T,N,C], as given to the forward pass) in place of `W_t`, `R_t` and `x_t`; the
+    // GEMMs transpose them on the fly instead. `dW`, `dR` and `db` are in the packed
+    // layout (see `PackedWeights::UnpackGradients`).
+    bool RunCompact(
+        const int steps,
+        const ActivationStorage storage,
+        const PackedWeights<T>& weights,
+        const T* x,
+        const T* h,
+        const accum_t<T>* c,
+        const T* dh_new,
+        const accum_t<T>* dc_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* db,
+        T* dh,
+        accum_t<T>* dc,
+        const void* v,
+        T* tmp_dv,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
 
   private:
+    friend class StackedBackwardPass<T>;
+    friend class BidirectionalBackwardPass<T>;
+
     void IterateInternal(
         const T* R_t,
-        const T* c,
-        const T* c_new,
+        const accum_t<T>* c,
+        const accum_t<T>* c_new,
         const T* dh_new,
-        const T* dc_new,
-        T* db,
+        const accum_t<T>* dc_new,
         T* dh,
-        T* dc,
+        accum_t<T>* dc,
         T* v,
-        const T* zoneout_mask);
+        const T* zoneout_mask,
+        const int step,
+        const int active_batch_size,
+        const int* sequence_lengths,
+        const int h_stride);
+
+    // Issues the weight-gradient and `dx` GEMMs of `steps` time steps from `first_step`
+    // of a `total_steps` call, once `stream[0]` has finished their `v`.
+    void WeightGradients(
+        const int first_step,
+        const int steps,
+        const int total_steps,
+        const bool accumulate,
+        const T* W_t,
+        const T* x_t,
+        const T* h,
+        const T* v,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* db);
+
+    // Signals the gradient hook on `stream` once it has finished the weight gradients.
+    void GradientsReady(const cudaStream_t& stream, T* dW, T* dR, T* db);
+
     struct private_data;
     private_data* data_;
 };
 
-}  // namespace lstm
-namespace gru {
 
 template<typename T>
-class ForwardPass {
+class StackedForwardPass {
   public:
     // training: `true` if the caller intends to perform a backward pass to compute gradients.
+    // layers: the number of stacked LSTM layers (L). The first layer consumes the input
+    //     sequence and each following layer consumes the hidden states of the layer below.
     // batch_size: the number of training/inference inputs provided in each tensor.
-    // input_size: the dimension of each input vector.
-    // hidden_size: the expected dimension of each output vector.
+    // input_size: the dimension of each input vector of the first layer.
+    // hidden_size: the expected dimension of each output vector of every layer.
     // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
-    ForwardPass(
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass, with the same semantics as for `ForwardPass`.
+    StackedForwardPass(
+        const bool training,
+        const int layers,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~StackedForwardPass();
+
+    // Runs all layers over all time steps as a diagonal wavefront: step t of layer l+1
+    // runs concurrently with step t+1 of layer l, so that the small per-step kernels of
+    // different layers occupy the GPU together. The result is the same as calling
+    // `ForwardPass::Run` for each layer in turn.
+    //
+    // Per-layer arguments are host arrays of L device pointers, each pointing to a tensor
+    // with the shape and meaning described for `ForwardPass::Run`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W: [L] layer 0's input weight matrix is [C,H*4]; the others are [H,H*4].
+    // R: [L] each [H,H*4].
+    // b: [L] each [H*4].
+    // x: [T,N,C] the input sequence of the first layer.
+    // h: [L] each [T+1,N,H]. `h[l][1:,:,:]` is the input of layer l+1 and `h[L-1][1:,:,:]`
+    //     forms the output of the stack.
+    // c: [L] each [T+1,N,H].
+    // v: [L] each [T,N,H*4].
+    // tmp_Rh: [L] each [N,H*4]. Layers run concurrently, so they may not share this buffer.
+    // zoneout_prob: applies to every layer.
+    // zoneout_mask: [L] each [T,N,H]. The array and any of its entries may be null.
+    // sequence_lengths: [N] may be null. Applies to every layer.
+    // batch_sizes: [T] may be null. Applies to every layer.
+    void Run(
+        const int steps,
+        const T* const* W,
+        const T* const* R,
+        const T* const* b,
+        const T* x,
+        T* const* h,
+        accum_t<T>* const* c,
+        T* const* v,
+        T* const* tmp_Rh,
+        const float zoneout_prob,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+template<typename T>
+class StackedBackwardPass {
+  public:
+    // layers: the number of stacked LSTM layers (L).
+    // Other parameters are as for `StackedForwardPass`.
+    StackedBackwardPass(
+        const int layers,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~StackedBackwardPass();
+
+    // Like `BackwardPass::SetGradientReadyCallback`, with `layer` set to each layer in
+    // turn. `Run` issues each layer's weight-gradient GEMMs as soon as its recurrence has
+    // reached the first time step, so the layers become ready from the last to the first
+    // and the gradients of the upper layers can be reduced while the lower layers are
+    // still running.
+    void SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data);
+
+#ifdef HASTE_WITH_NCCL
+    // Like `BackwardPass::SetGradientAllReduce`, for each layer as soon as its gradients
+    // are final (see `SetGradientReadyCallback`).
+    bool SetGradientAllReduce(const ncclComm_t& comm);
+#endif
+
+    // Runs the backward pass of all layers over all time steps as a diagonal wavefront
+    // starting from the last layer. The result is the same as calling `BackwardPass::Run`
+    // for each layer in turn, from the last to the first.
+    //
+    // Per-layer arguments are host arrays of L device pointers, each pointing to a tensor
+    // with the shape and meaning described for `BackwardPass::Run`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W_t: [L] layer 0's is [H*4,C]; the others are [H*4,H].
+    // R_t: [L] each [H*4,H].
+    // b: [L] each [H*4].
+    // x_t: [C,T,N] the transpose of the input sequence of the first layer.
+    // h: [L] each [T+1,N,H] after running `StackedForwardPass::Run`.
+    // c: [L] each [T+1,N,H] after running `StackedForwardPass::Run`.
+    // dh_new: [L] each [T+1,N,H]. NOTE: the entries of all but the last layer are input and
+    //     output parameters. They should hold the gradient of the loss with respect to that
+    //     layer's `h` from anything other than the layer above (typically zeros), and the
+    //     gradient flowing back from the layer above is added to them.
+    // dc_new: [L] each [T+1,N,H] (typically zeros for all but the last layer).
+    // dx: [T,N,C] the gradient of the loss with respect to the input of the first layer.
+    // dW: [L] layer 0's is [C,H*4]; the others are [H,H*4].
+    // dR: [L] each [H,H*4].
+    // db: [L] each [H*4].
+    // dh: [L] each [N,H]. Should be initialized to zeros.
+    // dc: [L] each [N,H]. Should be initialized to zeros.
+    // v: [L] each [T,N,H*4] the same tensors that were passed to `StackedForwardPass::Run`.
+    // zoneout_mask: [L] each [T,N,H]. Must match the value provided to the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    void Run(
+        const int steps,
+        const T* const* W_t,
+        const T* const* R_t,
+        const T* const* b,
+        const T* x_t,
+        const T* const* h,
+        const accum_t<T>* const* c,
+        T* const* dh_new,
+        const accum_t<T>* const* dc_new,
+        T* dx,
+        T* const* dW,
+        T* const* dR,
+        T* const* db,
+        T* const* dh,
+        accum_t<T>* const* dc,
+        T* const* v,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    // Issues the weight-gradient GEMMs of layer `l` (and `dx` for layer 0) once the
+    // recurrence of the layer has finished, and signals the gradient hook.
+    void LayerGradients(
+        const int l,
+        const int steps,
+        const T* const* W_t,
+        const T* x_t,
+        const T* const* h,
+        T* dx,
+        T* const* dW,
+        T* const* dR,
+        T* const* db,
+        const T* const* v);
+
+    struct private_data;
+    private_data* data_;
+};
+
+template<typename T>
+class BidirectionalForwardPass {
+  public:
+    // Parameters are as for `ForwardPass` and apply to both directions.
+    BidirectionalForwardPass(
         const bool training,
         const int batch_size,
         const int input_size,
         const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~BidirectionalForwardPass();
+
+    // Runs a forward and a reverse LSTM over the same input sequence. The two directions
+    // are independent, so their time steps are issued alternately on separate streams and
+    // the small per-step kernels of both directions occupy the GPU together. The result is
+    // the same as running `ForwardPass::Run` on the input and on its time reversal.
+    //
+    // Per-direction arguments are host arrays of 2 device pointers: index 0 is the forward
+    // direction and index 1 is the reverse direction. The reverse direction's state tensors
+    // are mirrored in time: its initial state is at index T and its state after visiting
+    // step t is at index t. It needs no reversed copy of `x` and, since padded steps are at
+    // the end of each sequence, each item starts from its own last valid step.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W: [2] each [C,H*4].
+    // R: [2] each [H,H*4].
+    // b: [2] each [H*4].
+    // x: [T,N,C] the input sequence shared by both directions.
+    // h: [2] each [T+1,N,H] with consecutive batch items `h_stride` elements apart. The
+    //     forward direction's output is `h[0][1:,:,:]` and the reverse direction's is
+    //     `h[1][:-1,:,:]`. To produce the concatenated [T,N,H*2] output directly, pass
+    //     `{y, y + N*H*2 + H}` for a [T+2,N,H*2] buffer `y` and `h_stride = H*2`; then
+    //     `y[1:T+1,:,:]` is the output, `y[0,:,:H]` must hold the forward direction's
+    //     initial state and `y[T+1,:,H:]` the reverse direction's.
+    // h_stride: at least H.
+    // c: [2] each [T+1,N,H], mirrored in time like `h` but always dense.
+    // v: [2] each [T,N,H*4]. Indexed by time step for both directions.
+    // tmp_Rh: [2] each [N,H*4].
+    // zoneout_prob: applies to both directions.
+    // zoneout_mask: [2] each [T,N,H]. The array and any of its entries may be null.
+    // sequence_lengths: [N] may be null. Applies to both directions.
+    // batch_sizes: [T] may be null. Applies to both directions.
+    void Run(
+        const int steps,
+        const T* const* W,
+        const T* const* R,
+        const T* const* b,
+        const T* x,
+        T* const* h,
+        const int h_stride,
+        accum_t<T>* const* c,
+        T* const* v,
+        T* const* tmp_Rh,
+        const float zoneout_prob,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+template<typename T>
+class BidirectionalBackwardPass {
+  public:
+    // Parameters are as for `BackwardPass` and apply to both directions.
+    BidirectionalBackwardPass(
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~BidirectionalBackwardPass();
+
+    // Runs the backward pass of both directions with their time steps interleaved. The
+    // result is the same as calling `BackwardPass::Run` for each direction, except that
+    // `dx` receives the sum of both directions' input gradients.
+    //
+    // Per-direction arguments are host arrays of 2 device pointers laid out as described
+    // for `BidirectionalForwardPass::Run`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W_t: [2] each [H*4,C].
+    // R_t: [2] each [H*4,H].
+    // b: [2] each [H*4].
+    // x_t: [C,T,N] the transpose of the input sequence.
+    // h: [2] after running `BidirectionalForwardPass::Run`.
+    // h_stride: the value provided to the forward pass. Also applies to `dh_new`.
+    // c: [2] each [T+1,N,H] after running `BidirectionalForwardPass::Run`.
+    // dh_new: [2] the gradient of the loss with respect to `h`, laid out like `h`.
+    // dc_new: [2] each [T+1,N,H] (typically zeros), mirrored in time like `c`.
+    // dx: [T,N,C] the gradient of the loss with respect to the input, summed over both
+    //     directions.
+    // dW: [2] each [C,H*4].
+    // dR: [2] each [H,H*4].
+    // db: [2] each [H*4].
+    // dh: [2] each [N,H]. Should be initialized to zeros.
+    // dc: [2] each [N,H]. Should be initialized to zeros.
+    // v: [2] each [T,N,H*4] the same tensors that were passed to the forward pass.
+    // zoneout_mask: [2] each [T,N,H]. Must match the value provided to the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    void Run(
+        const int steps,
+        const T* const* W_t,
+        const T* const* R_t,
+        const T* const* b,
+        const T* x_t,
+        const T* const* h,
+        const int h_stride,
+        const accum_t<T>* const* c,
+        const T* const* dh_new,
+        const accum_t<T>* const* dc_new,
+        T* dx,
+        T* const* dW,
+        T* const* dR,
+        T* const* db,
+        T* const* dh,
+        accum_t<T>* const* dc,
+        T* const* v,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+
+// Serves many independent sequences (e.g. one per user of an online speech service)
+// that each arrive a few frames at a time. The session owns the recurrent state of up
+// to `max_streams` sequences, addressed by stream ID in [0, max_streams), along with all
+// of the workspace that `ForwardPass::Iterate` makes callers manage. Calls run directly
+// on the session's CUDA stream without internal events, and each call sets the cuBLAS
+// stream once no matter how many frames it covers.
+template<typename T>
+class InferenceSession {
+  public:
+    // max_streams: the number of sequences whose state the session keeps (S).
+    // max_frames: the most frames that a single call to `Run` may cover (K).
+    // input_size: the dimension of each input vector.
+    // hidden_size: the expected dimension of each output vector.
+    // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that every call enqueues its work on. The host thread is
+    //     never blocked, except by the constructor and destructor which allocate and
+    //     free the session's device memory.
+    //
+    // All streams start out with zero state. If the session's device memory can't be
+    // allocated, every call that takes a stream returns false.
+    InferenceSession(
+        const int max_streams,
+        const int max_frames,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Frees the session's device memory.
+    ~InferenceSession();
+
+    // The number of elements in each of the two buffers that hold the state of one
+    // stream, as read and written by `SaveState` and `RestoreState`: [H] of `T` for h and
+    // [H] of `accum_t<T>` for c.
+    int StateSize() const;
+
+    // Zeroes the state of stream `id` so that it can start a new sequence. Returns false
+    // without doing anything if `id` isn't in [0, S).
+    bool Reset(const int id);
+
+    // Copies the state of stream `id` to `h` and `c` ([StateSize()] each in device memory),
+    // e.g. to move a sequence to another session or to branch a search. Returns false like
+    // `Reset`.
+    bool SaveState(const int id, T* h, accum_t<T>* c) const;
+
+    // Replaces the state of stream `id` with `h` and `c` ([StateSize()] each in device
+    // memory) as written by `SaveState`. Returns false like `Reset`.
+    bool RestoreState(const int id, const T* h, const accum_t<T>* c);
+
+    // Advances stream `id` by `frames` (1 <= frames <= K) consecutive frames. The input
+    // projection of all frames is a single GEMM, followed by one recurrent GEMM and one
+    // pointwise kernel per frame. Returns false without enqueueing any work if `id` isn't
+    // in [0, S) or `frames` isn't in [1, K].
+    //
+    // W: [C,H*4] the input weight matrix.
+    // R: [H,H*4] the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // x: [frames,C] the frames' input vectors.
+    // h_out: [frames,H] receives the hidden state after each frame.
+    // zoneout_prob: the zoneout probability the model was trained with, or 0.
+    bool Run(
+        const int id,
+        const int frames,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        T* h_out,
+        const float zoneout_prob);
+
+    // Advances `count` different streams (1 <= count <= S) by one frame each as a single
+    // N=count step: one gather of their states, one GEMM each for the input and
+    // recurrent projections, one pointwise kernel and one scatter of the new states.
+    // Returns false without enqueueing any work if `count` isn't in [1, S]. The IDs are
+    // in device memory, so they aren't checked.
+    //
+    // ids: [count] the distinct stream IDs to advance, in device memory.
+    // W: [C,H*4] the input weight matrix.
+    // R: [H,H*4] the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // x: [count,C] the input vector of each stream, in the order of `ids`.
+    // h_out: [count,H] receives the new hidden state of each stream.
+    // zoneout_prob: the zoneout probability the model was trained with, or 0.
+    bool Step(
+        const int count,
+        const int* ids,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        T* h_out,
+        const float zoneout_prob);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+// Serves independent inference requests that share the same weights but differ in
+// length and initial state, e.g. utterances arriving concurrently at a speech service.
+// Requests submitted from any thread are queued and, on a worker thread, packed into a
+// single `ForwardPass::Run` with N = max_batch_size and per-item `sequence_lengths`,
+// longest first, so that `batch_sizes` shrinks the recurrent GEMMs as the shorter items
+// finish. Each item's outputs are then copied back to the request's own buffers. A
+// batch starts as soon as `max_batch_size` requests are waiting or the oldest has waited
+// `max_wait_us`.
+template<typename T>
+class BatchScheduler {
+  public:
+    struct Request {
+      int steps;             // The length of the sequence, 1 <= steps <= max_steps.
+      const T* x;            // [steps,C] the input vectors.
+      const T* h0;           // [H] the initial hidden state, or null for zeros.
+      const accum_t<T>* c0;  // [H] the initial cell state, or null for zeros.
+      T* h;                  // [steps,H] receives the hidden state after each step.
+      accum_t<T>* c;         // [H] receives the final cell state, or null if not needed.
+    };
+
+    // max_batch_size: the most requests packed into one `Run` (N).
+    // max_steps: the longest request that may be submitted.
+    // max_wait_us: how long, in microseconds, the oldest waiting request may be held back
+    //     for a fuller batch.
+    // input_size: the dimension of each input vector.
+    // hidden_size: the expected dimension of each output vector.
+    // W: [C,H*4] the input weight matrix.
+    // R: [H,H*4] the recurrent weight matrix.
+    // b: [H*4] the bias vector.
+    // zoneout_prob: the zoneout probability the model was trained with, or 0.
+    // blas_handle: an initialized cuBLAS handle that only the scheduler's worker thread
+    //     uses for as long as the scheduler exists.
+    //
+    // The weights must stay valid and unchanged until the scheduler is destroyed. The
+    // constructor allocates the padded [max_steps,N,*] batch tensors in device memory and
+    // creates the CUDA stream that all batches run on.
+    BatchScheduler(
+        const int max_batch_size,
+        const int max_steps,
+        const int max_wait_us,
+        const int input_size,
+        const int hidden_size,
+        const T* W,
+        const T* R,
+        const T* b,
+        const float zoneout_prob,
         const cublasHandle_t& blas_handle);
 
-    // Releases internal resources.
-    // Blocks until all iterations have completed executing on the GPU.
+    // Runs the requests that are still queued, then frees the scheduler's resources.
+    ~BatchScheduler();
+
+    // Queues `request`. The returned future becomes ready once the request's outputs
+    // have been written, after which its input and output buffers may be reused. The
+    // buffers must be in device memory on the scheduler's device and, like the input
+    // work that produces them, complete before the call. A request with `steps` outside
+    // [1, max_steps] isn't queued; its future is ready at once and holds a
+    // `std::invalid_argument`. If the constructor couldn't allocate the batch tensors,
+    // every future holds a `std::runtime_error` instead.
+    std::future<void> Submit(const Request& request);
+
+    BatchSchedulerStats Stats() const;
+
+  private:
+    void RunBatch(const std::vector<Request>& requests);
+
+    struct private_data;
+    private_data* data_;
+};
+
+#ifdef HASTE_WITH_NCCL
+// Tensor-parallel LSTM layer for hidden sizes whose recurrent GEMM is too large or too
+// slow for one device. Each of the G ranks of an NCCL communicator owns Hs=H/G
+// consecutive hidden units, [rank*Hs, (rank+1)*Hs), along with the Hs*4 gate columns of
+// `W`, `R` and `b` that feed them (gate-major, [i,g,f,o], like the full matrices) and
+// its units' slices of `c` and `v`. Every step computes the recurrent GEMM of the rank's
+// gate columns from the full `h`, runs the pointwise operations on its own units and
+// all-gathers the new `h` through NCCL. The input projection of each step runs on a
+// separate stream so that it overlaps with the exchange. `x` and `h` are replicated:
+// every rank reads the full input and receives the full output, ready to feed the next
+// layer. All ranks must call `Run` with the same `steps`, each from a thread whose
+// current device is the rank's device. Only built with `make NCCL=1`.
+template<typename T>
+class TensorParallelForwardPass {
+  public:
+    // training: `true` if the caller intends to perform a backward pass to compute gradients.
+    // batch_size: the number of training/inference inputs provided in each tensor.
+    // input_size: the dimension of each input vector.
+    // hidden_size: the dimension of each (full) output vector, divisible by G.
+    // comm: the NCCL communicator of the G ranks.
+    // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass, as in `ForwardPass`.
+    TensorParallelForwardPass(
+        const bool training,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const ncclComm_t& comm,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block.
+    ~TensorParallelForwardPass();
+
+    // Runs the layer over `steps` time steps, which all sequences must have. Hs is the
+    // number of hidden units this rank owns.
+    //
+    // W: [C,Hs*4] this rank's columns of the input weight matrix.
+    // R: [H,Hs*4] this rank's columns of the recurrent weight matrix.
+    // b: [Hs*4] this rank's slice of the bias.
+    // x: [T,N,C] the input for all time steps, identical on every rank.
+    // h: [T+1,N,H] the full hidden state. `h[0]` must be initialized to the same initial
+    //     state on every rank; the remaining steps are written on every rank.
+    // c: [T+1,N,Hs] this rank's slice of the cell state. `c[0]` must be initialized.
+    // v: [T,N,Hs*4] this rank's slice of the activations, for the backward pass.
+    // tmp_Rh: [N,Hs*4] additional temporary work space.
+    // tmp_h: [N,H] additional temporary work space for the all-gather.
+    // zoneout_prob: 0.0f <= zoneout_prob <= 1.0f; as in `ForwardPass::Run`.
+    // zoneout_mask: [T,N,Hs] may be null to disable zoneout; this rank's slice of the mask.
+    void Run(
+        const int steps,
+        const T* W,
+        const T* R,
+        const T* b,
+        const T* x,
+        T* h,
+        accum_t<T>* c,
+        T* v,
+        T* tmp_Rh,
+        T* tmp_h,
+        const float zoneout_prob,
+        const T* zoneout_mask);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+// The backward pass of `TensorParallelForwardPass`. The gradient of each recurrent step's
+// `h` is the sum of every rank's contribution, so each step reduce-scatters it across the
+// ranks with NCCL before the rank's own units take their share. The weight gradients are
+// local to each rank; `dx` is all-reduced once at the end.
+template<typename T>
+class TensorParallelBackwardPass {
+  public:
+    // batch_size: the number of training inputs provided in each tensor.
+    // input_size: the dimension of each input vector.
+    // hidden_size: the dimension of each (full) output vector, divisible by G.
+    // comm: the NCCL communicator of the G ranks.
+    // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass, as in `BackwardPass`.
+    TensorParallelBackwardPass(
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const ncclComm_t& comm,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block.
+    ~TensorParallelBackwardPass();
+
+    // Runs the backward pass over `steps` time steps, the same as the forward pass.
+    //
+    // W_t: [Hs*4,C] the transpose of this rank's `W`.
+    // R_t: [Hs*4,H] the transpose of this rank's `R`.
+    // x_t: [C,T,N] the transpose of `x`.
+    // h: [T+1,N,H] the full hidden state from the forward pass.
+    // c: [T+1,N,Hs] this rank's cell state from the forward pass.
+    // dh_new: [T+1,N,H] the gradient of the loss with respect to `h`, identical on every
+    //     rank.
+    // dc_new: [T+1,N,Hs] this rank's slice of the gradient of the loss with respect to `c`.
+    // dx: [T,N,C] receives the gradient with respect to `x`, identical on every rank.
+    // dW: [C,Hs*4] accumulates the gradient of this rank's `W`. Must be initialized.
+    // dR: [H,Hs*4] accumulates the gradient of this rank's `R`. Must be initialized.
+    // db: [Hs*4] accumulates the gradient of this rank's `b`. Must be initialized.
+    // dh: [N,Hs] this rank's slice of the gradient with respect to `h[0]`. Must be
+    //     initialized to zeros.
+    // dc: [N,Hs] this rank's slice of the gradient with respect to `c[0]`. Must be
+    //     initialized to zeros.
+    // v: [T,N,Hs*4] the activations from the forward pass. Overwritten with the gate
+    //     gradients.
+    // tmp_dh: [N,H] additional temporary work space for the reduce-scatter.
+    // zoneout_mask: [T,N,Hs] the mask the forward pass used, or null.
+    void Run(
+        const int steps,
+        const T* W_t,
+        const T* R_t,
+        const T* x_t,
+        const T* h,
+        const accum_t<T>* c,
+        const T* dh_new,
+        const accum_t<T>* dc_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* db,
+        T* dh,
+        accum_t<T>* dc,
+        T* v,
+        T* tmp_dh,
+        const T* zoneout_mask);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+#endif  // HASTE_WITH_NCCL
+
+}  // namespace lstm
+namespace gru {
+
+template<typename T>
+class StackedForwardPass;
+
+template<typename T>
+class StackedBackwardPass;
+
+template<typename T>
+class BidirectionalForwardPass;
+
+template<typename T>
+class BidirectionalBackwardPass;
+
+// The number of bytes `ForwardPass::RunCompact` saves for `steps` time steps. With
+// `kHalf`, they're [T,N,H*4] FP16 activations laid out like `v`. The GRU's `q_g` isn't a
+// sigmoid or tanh output, so with `kFixed8` it's kept in FP16: the activations are
+// [T,N,H] FP16 `q_g` values followed by [T,N,H*3] 8-bit z, r, and g values.
+inline size_t CompactActivationsSize(
+    const int steps,
+    const int batch_size,
+    const int hidden_size,
+    const ActivationStorage storage) {
+  const size_t elements = size_t(steps) * batch_size * hidden_size;
+  return storage == ActivationStorage::kHalf
+      ? elements * 4 * sizeof(__half)
+      : elements * sizeof(__half) + elements * 3;
+}
+
+// A set of GRU weights in the layout that the passes read: `W` [C,H*3], `R` [H,H*3], `bx`
+// [H*3] and `br` [H*3], with gates in [z,r,h] order. The `PackedWeights` overloads of the
+// passes read `W` and `R` in this layout in both directions, with the backward GEMMs
+// transposing them on the fly, so callers don't keep transposed copies of `W`, `R` and
+// `x` for the backward pass. Weights in another format are converted once with `Pack`,
+// e.g. whenever they're loaded or updated, rather than on every call.
+template<typename T>
+struct PackedWeights {
+  const T* W;
+  const T* R;
+  const T* bx;
+  const T* br;
+
+  // The number of `T` elements that a layer's parameters take up in `format`.
+  static size_t Size(const WeightFormat format, const int input_size, const int hidden_size);
+
+  // Converts `weights` ([Size(format, ...)] in device memory) from `format` into `W`
+  // [C,H*3], `R` [H,H*3], `bx` [H*3] and `br` [H*3] on `stream` and returns a view of them.
+  static PackedWeights Pack(
+      const WeightFormat format,
+      const int input_size,
+      const int hidden_size,
+      const T* weights,
+      T* W,
+      T* R,
+      T* bx,
+      T* br,
+      const cudaStream_t& stream);
+
+  // Converts the gradients `dW`, `dR`, `dbx` and `dbr` that `BackwardPass` accumulates in
+  // the packed layout into `gradients` ([Size(format, ...)] in device memory) in `format`
+  // on `stream`, so they can be applied to the weights that were packed.
+  static void UnpackGradients(
+      const WeightFormat format,
+      const int input_size,
+      const int hidden_size,
+      const T* dW,
+      const T* dR,
+      const T* dbx,
+      const T* dbr,
+      T* gradients,
+      const cudaStream_t& stream);
+};
+
+// A set of GRU weights quantized to int8 for `ForwardPass::RunQuantized`: `W` [C,H*3]
+// and `R` [H,H*3] with a symmetric scale per gate column, `W_scale` [H*3] and `R_scale`
+// [H*3], as for `lstm::QuantizedWeights`. The inputs are quantized with the single scale
+// `x_scale` [1] and the biases `bx` [H*3] and `br` [H*3] stay in `T`. All pointers are to
+// device memory.
+template<typename T>
+struct QuantizedWeights {
+  const int8_t* W;
+  const int8_t* R;
+  const float* W_scale;
+  const float* R_scale;
+  const float* x_scale;
+  const T* bx;
+  const T* br;
+
+  // Same as `lstm::QuantizedWeights::Calibrate`.
+  static void Calibrate(
+      const size_t size,
+      const T* x,
+      float* x_absmax,
+      const cudaStream_t& stream);
+
+  // Quantizes the trained `W` [C,H*3] and `R` [H,H*3] into `W_q` and `R_q` with the
+  // per-column scales `W_scale` [H*3] and `R_scale` [H*3], and turns the calibrated
+  // `x_absmax` [1] into `x_scale` [1], on `stream`. Returns a view of them with `bx` and
+  // `br`.
+  static QuantizedWeights Quantize(
+      const int input_size,
+      const int hidden_size,
+      const T* W,
+      const T* R,
+      const T* bx,
+      const T* br,
+      const float* x_absmax,
+      int8_t* W_q,
+      int8_t* R_q,
+      float* W_scale,
+      float* R_scale,
+      float* x_scale,
+      const cudaStream_t& stream);
+};
+
+template<typename T>
+class ForwardPass {
+  public:
+    // training: `true` if the caller intends to perform a backward pass to compute gradients.
+    // batch_size: the number of training/inference inputs provided in each tensor.
+    // input_size: the dimension of each input vector.
+    // hidden_size: the expected dimension of each output vector.
+    // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass. Each call waits for work already enqueued on `stream` before it starts, and
+    //     work enqueued on `stream` after a call returns will see its results. The host
+    //     thread is never blocked. Use `0` for the default stream.
+    ForwardPass(
+        const bool training,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
     ~ForwardPass();
 
+    // Opts in to running the recurrence in `Run` as a single persistent kernel that keeps
+    // `R` in on-chip memory across all time steps instead of launching a GEMM and a
+    // pointwise kernel per step. This is typically a win for small batch sizes where the
+    // per-step GEMM is dominated by launch overhead and re-reading `R`. Returns `false`
+    // (and leaves `Run` unchanged) if `R` doesn't fit on-chip for this hidden size or if
+    // the device doesn't support cooperative launches. `Iterate` is unaffected.
+    bool EnablePersistentKernel();
+
+    // Opts in to capturing the work enqueued by `Run` into a CUDA graph and replaying it
+    // on subsequent calls with the same arguments (`steps`, pointers and scalars), which
+    // removes nearly all of the per-step host launch overhead. When the arguments change,
+    // the graph is recaptured and the executable graph is updated in place when possible.
+    // Callers that want replays should keep their buffers at stable addresses. Capture
+    // is silently abandoned in favor of regular launches if the CUDA runtime rejects it.
+    // `Iterate` is unaffected.
+    void EnableGraphCapture();
+
+    // Opts in to timing the phases of `Run` and `Iterate` (see `PhaseStats`) with CUDA
+    // events. Only builds with `make PROFILING=1` have the instrumentation, which also
+    // wraps each phase in an NVTX range whether or not timing is enabled; otherwise this
+    // has no effect. Calls replayed from a CUDA graph aren't timed.
+    void EnablePhaseTiming();
+
+    // Returns the time spent in each phase by the timed work that has finished since the
+    // previous call, without waiting for work that's still running, which a later call
+    // will count. `calls` counts the calls enqueued since the previous call. All zeros
+    // unless timing is enabled.
+    PhaseStats CollectPhaseStats();
+
+    // Opts in to generating the zoneout mask inside the pointwise kernels instead of
+    // reading it from memory, so `zoneout_mask` may be null whenever `zoneout_prob` is
+    // nonzero. The mask is drawn from a counter-based generator (Philox4x32-10) keyed by
+    // `seed` and `offset`: the element at time step t, batch item n and hidden unit j of
+    // `Run` uses counter `(t*N + n)*H + j`, and `Iterate` always uses t=0, so callers
+    // should advance `offset` for every call that needs an independent mask.
+    // `zoneout_prob` must match the value given to `Run` or `Iterate`, and the same
+    // values must be given to `BackwardPass::SetZoneoutSeed`. A non-null `zoneout_mask`
+    // still takes precedence. Stacked and bidirectional passes ignore this setting.
+    void SetZoneoutSeed(
+        const float zoneout_prob,
+        const unsigned long long seed,
+        const unsigned long long offset);
+
+    // Applies DropConnect to `R` in `Run` and `RunCompact`: like `tf.nn.dropout(R, rate)`,
+    // each element is kept with probability `1 - rate` and scaled by `1 / (1 - rate)`, or
+    // zeroed otherwise. The mask is drawn once per call from the same generator as
+    // `SetZoneoutSeed`, keyed by `seed` and `offset`, with element `k*H*3 + j` of `R` using
+    // counter `k*H*3 + j`. The masked matrix is written to `tmp_R` ([H,H*3]), which the caller
+    // must not touch until the call has completed. The same `rate`, `seed` and `offset` must
+    // be given to `BackwardPass::SetDropConnect`. A `rate` of 0 turns DropConnect off again.
+    // `Iterate` is unaffected.
+    void SetDropConnect(
+        const float rate,
+        const unsigned long long seed,
+        const unsigned long long offset,
+        T* tmp_R);
+
+    // Selects how `Run` addresses `x` and `h`, like `lstm::ForwardPass::SetSequenceLayout`.
+    // `v`, `tmp_Wx` and `zoneout_mask` stay dense and time-major. The `BackwardPass` must
+    // use the same layout. `Iterate`, `RunCompact` and `RunQuantized` ignore this setting.
+    void SetSequenceLayout(const SequenceLayout& layout);
+
+    // Selects the gate nonlinearities of an inference pass for `Run`, `Iterate` and
+    // `RunQuantized`, like `lstm::ForwardPass::SetActivationTier`. The persistent kernel
+    // and training passes always use `ActivationTier::kPrecise`, which is the default.
+    void SetActivationTier(const ActivationTier tier);
+
     // Performs one forward iteration of the GRU cell.
     //
     // W: [C,H*3] the input weight matrix.
@@ -349,8 +2007,187 @@ class ForwardPass {
         const float zoneout_prob,
         const T* zoneout_mask);
 
-  private:
-    struct private_data;
+    // Runs the GRU over all time steps. This method is faster than using a per-step
+    // `Iterate` but requires that the entire input sequence be available upfront. In some
+    // situations, this constraint may not be satisfiable (e.g. autoregressive models).
+    // Users should prefer calling `Run` over `Iterate` whenever possible.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W: [C,H*3] the input weight matrix.
+    // R: [H,H*3] the recurrent weight matrix.
+    // bx: [H*3] the bias for the input weight matrix.
+    // br: [H*3] the bias for the recurrent weight matrix.
+    // x: [T,N,C] the GRU input for this iteration (N vectors, each with dimension C).
+    // h: [T+1,N,H] the hidden state vectors across all time steps. The t=0'th vector should
+    //      be set to the desired initial hidden state (typically zeros). The rest of the
+    //      vectors will be set by this function. `h[1:,:,:]` forms the output of this GRU
+    //      layer.
+    // v: [T,N,H*4] if `training` is `false`, this can be a null pointer. If `training` is
+    //     `true`, this parameter will contain intermediate activations which must be provided
+    //     as-is to `BackwardPass::Run` or manually unrolled for `BackwardPass::Iterate`.
+    // tmp_Wx: [T,N,H*3] additional temporary work space required for this function. The
+    //     caller should not use the contents of this vector.
+    // tmp_Rh: [N,H*3] additional temporary work space required for this function. The caller
+    //     should not use the contents of this vector.
+    // zoneout_prob: 0.0 <= zoneout_prob <= 1.0; specifies the probability of a hidden
+    //     activation being randomly zoned out. If zoneout was used during training, this
+    //     parameter must also be specified during inference with the same value.
+    // zoneout_mask: [T,N,H] may be null to disable zoneout. This is a random binary mask
+    //     following a Bernoulli(1-zoneout_prob) distribution. A different mask is typically
+    //     used for each iteration.
+    // sequence_lengths: [N] may be null if every sequence has `steps` time steps. The
+    //     number of valid time steps of each batch item, in device memory. Past the end of
+    //     its sequence, an item's state is carried through unchanged, so `h[T]` (and `c[T]`)
+    //     hold each item's final state. Only the pointwise work is skipped unless
+    //     `batch_sizes` is also provided.
+    // batch_sizes: [T] may be null. The number of batch items whose sequence includes each
+    //     time step, in host memory. Requires `sequence_lengths` and batch items sorted by
+    //     decreasing length; then the recurrent GEMM of each step only covers the active
+    //     batch items.
+    void Run(
+        const int steps,
+        const T* W,
+        const T* R,
+        const T* bx,
+        const T* br,
+        const T* x,
+        T* h,
+        T* v,
+        T* tmp_Wx,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Same as `Run` above, with the weights of `weights`.
+    void Run(
+        const int steps,
+        const PackedWeights<T>& weights,
+        const T* x,
+        T* h,
+        T* v,
+        T* tmp_Wx,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // The size in bytes of the workspace that `Run` needs for `steps` time steps when it's
+    // given one in place of `tmp_Wx` and `tmp_Rh`.
+    size_t GetWorkspaceSize(const int steps) const;
+
+    // Same as the first `Run` above, but carves `tmp_Wx` and `tmp_Rh` out of `workspace` so
+    // a caller can serve all of its temporary memory with a single allocation (e.g. from a
+    // caching arena). `workspace` must hold `GetWorkspaceSize(steps)` bytes, aligned to at
+    // least 16 bytes, and needn't be initialized.
+    void Run(
+        const int steps,
+        const T* W,
+        const T* R,
+        const T* bx,
+        const T* br,
+        const T* x,
+        T* h,
+        T* v,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes,
+        void* workspace);
+
+    // Runs the GRU over all time steps like `Run` but saves the activations for
+    // `BackwardPass::RunCompact` in a reduced-precision `storage` format instead of `v`
+    // (see `CompactActivationsSize`). The GEMMs are unchanged and the forward outputs match
+    // `Run` exactly; only the gradients see the rounding. Requires `training`. The
+    // persistent kernel and graph capture are not used.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // storage: the format to save the activations in.
+    // W: [C,H*3] the input weight matrix.
+    // R: [H,H*3] the recurrent weight matrix.
+    // bx: [H*3] the bias for the input weight matrix.
+    // br: [H*3] the bias for the recurrent weight matrix.
+    // x: [T,N,C] the GRU input for this iteration (N vectors, each with dimension C).
+    // h: [T+1,N,H] the hidden state vectors across all time steps, same as in `Run`.
+    // v: `CompactActivationsSize(T, N, H, storage)` bytes that will contain the
+    //     activations, which must be provided as-is to `BackwardPass::RunCompact`.
+    // tmp_Wx: [T,N,H*3] additional temporary work space, same as in `Run`.
+    // tmp_Rh: [N,H*3] additional temporary work space, same as in `Run`.
+    // zoneout_prob: same as in `Run`.
+    // zoneout_mask: [T,N,H] same as in `Run`.
+    // sequence_lengths: [N] same as in `Run`.
+    // batch_sizes: [T] same as in `Run`.
+    void RunCompact(
+        const int steps,
+        const ActivationStorage storage,
+        const T* W,
+        const T* R,
+        const T* bx,
+        const T* br,
+        const T* x,
+        T* h,
+        void* v,
+        T* tmp_Wx,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // The size in bytes of the workspace that `RunQuantized` needs for `steps` time steps.
+    size_t GetQuantizedWorkspaceSize(const int steps) const;
+
+    // Runs the GRU over all time steps for inference with int8 weights, like
+    // `lstm::ForwardPass::RunQuantized`: the inputs and every hidden state are quantized
+    // to int8, both GEMMs accumulate in int32 and the pointwise kernel dequantizes their
+    // products as it applies the gates. The hidden state stays in `T`. Requires C and H
+    // to be multiples of 4 and a GPU of compute capability 6.1 or later. Nothing is saved
+    // for a backward pass, whatever `training` is. The persistent kernel, DropConnect and
+    // graph capture are not used.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // weights: the quantized weights (see `QuantizedWeights::Quantize`).
+    // x: [T,N,C] the GRU input for this iteration (N vectors, each with dimension C).
+    // h: [T+1,N,H] the hidden state vectors across all time steps, same as in `Run`. The
+    //     initial hidden state must be in [-1, 1].
+    // zoneout_prob: same as in `Run`. Zoneout is applied as in inference.
+    // sequence_lengths: [N] same as in `Run`.
+    // batch_sizes: [T] same as in `Run`.
+    // workspace: `GetQuantizedWorkspaceSize(steps)` bytes of temporary work space, aligned
+    //     to at least 16 bytes. The caller should not use its contents.
+    void RunQuantized(
+        const int steps,
+        const QuantizedWeights<T>& weights,
+        const T* x,
+        T* h,
+        const float zoneout_prob,
+        const int* sequence_lengths,
+        const int* batch_sizes,
+        void* workspace);
+
+  private:
+    friend class StackedForwardPass<T>;
+    friend class BidirectionalForwardPass<T>;
+
+    void IterateInternal(
+        const T* R,
+        const T* bx,
+        const T* br,
+        const T* h,
+        T* h_out,
+        T* v,
+        T* tmp_Wx,
+        T* tmp_Rh,
+        const float zoneout_prob,
+        const T* zoneout_mask,
+        const int step,
+        const int active_batch_size,
+        const int* sequence_lengths,
+        const int h_stride);
+
+    struct private_data;
     private_data* data_;
 };
 
@@ -361,16 +2198,78 @@ class BackwardPass {
     // input_size: the dimension of each input vector.
     // hidden_size: the expected dimension of each output vector.
     // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass. Each call waits for work already enqueued on `stream` before it starts, and
+    //     work enqueued on `stream` after a call returns will see its results. The host
+    //     thread is never blocked. Use `0` for the default stream.
     BackwardPass(
         const int batch_size,
         const int input_size,
         const int hidden_size,
-        const cublasHandle_t& blas_handle);
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
 
-    // Releases internal resources.
-    // Blocks until all iterations have completed executing on the GPU.
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
     ~BackwardPass();
 
+    // Opts in to capturing the work enqueued by `Run` into a CUDA graph and replaying it
+    // on subsequent calls with the same arguments (`steps`, pointers and scalars), which
+    // removes nearly all of the per-step host launch overhead. When the arguments change,
+    // the graph is recaptured and the executable graph is updated in place when possible.
+    // Callers that want replays should keep their buffers at stable addresses. Capture
+    // is silently abandoned in favor of regular launches if the CUDA runtime rejects it.
+    // `Iterate` is unaffected.
+    void EnableGraphCapture();
+
+    // Like `ForwardPass::EnablePhaseTiming` and `ForwardPass::CollectPhaseStats`.
+    void EnablePhaseTiming();
+    PhaseStats CollectPhaseStats();
+
+    // Regenerates the zoneout mask that a forward pass drew after
+    // `ForwardPass::SetZoneoutSeed(zoneout_prob, seed, offset)` instead of reading
+    // `zoneout_mask`, which may then be null. The arguments must match the forward pass.
+    void SetZoneoutSeed(
+        const float zoneout_prob,
+        const unsigned long long seed,
+        const unsigned long long offset);
+
+    // Applies the DropConnect mask that a forward pass drew after
+    // `ForwardPass::SetDropConnect(rate, seed, offset, ...)` to `R_t` in `Run` and
+    // `RunCompact`, and to `dR` so that it holds the gradient with respect to the unmasked
+    // `R`. `dR` is masked in place once it has been accumulated, so it should be zero on
+    // entry. `tmp_R` is [H*3,H] workspace for the masked `R_t`. The caller must not touch it
+    // until the call has completed. A `rate` of 0 turns DropConnect off again.
+    void SetDropConnect(
+        const float rate,
+        const unsigned long long seed,
+        const unsigned long long offset,
+        T* tmp_R);
+
+    // Selects how `Run` addresses `x`, `h`, `dh_new` and `dx`, like
+    // `lstm::BackwardPass::SetSequenceLayout`. Must match
+    // `ForwardPass::SetSequenceLayout`. A batch-major layout needs the `PackedWeights`
+    // overloads. `Iterate` and `RunCompact` ignore this setting.
+    void SetSequenceLayout(const SequenceLayout& layout);
+
+    // By default, `Run` and `RunCompact` add their gradients to `dW`, `dR`, `dbx` and `dbr`,
+    // which must then be initialized. With `accumulate` false they overwrite them instead,
+    // so the caller needn't clear them first. `Iterate` always accumulates.
+    void SetAccumulateGradients(const bool accumulate);
+
+    // Has `Run` issue the weight-gradient and `dx` GEMMs for every `steps` time steps as
+    // soon as the recurrence has produced them, like
+    // `lstm::BackwardPass::SetWeightGradientChunk`. 0 (the default) turns it off again.
+    void SetWeightGradientChunk(const int steps);
+
+    // Like `lstm::BackwardPass::SetGradientReadyCallback`, for `dW`, `dR`, `dbx` and `dbr`.
+    void SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data);
+
+#ifdef HASTE_WITH_NCCL
+    // Like `lstm::BackwardPass::SetGradientAllReduce`.
+    bool SetGradientAllReduce(const ncclComm_t& comm);
+#endif
+
     // Performs one backward iteration of the GRU cell.
     //
     // Note that BackwardPass must be iterated in the reverse order as ForwardPass.
@@ -384,8 +2283,8 @@ class BackwardPass {
     // bx: [H*3] the bias vector for the input weight matrix.
     // br: [H*3] the bias vector for the recurrent weight matrix.
     // x_t: [C,N] the transpose of the GRU input for this iteration.
-    // h_t: [H,N] the transpose of the t-1 iteration's `h_out` or the initial hidden state
-    //     if this is the t=0 iteration (typically zeros).
+    // h: [N,H] the t-1 iteration's `h_out` or the initial hidden state if this is the t=0
+    //     iteration (typically zeros).
     // v: [N,H*4] the same vector as returned by ForwardPass::Iterate on its corresponding
     //     iteration.
     // dh_new: [N,H] the gradient of `h_out` with respect to the loss at this iteration.
@@ -414,7 +2313,7 @@ class BackwardPass {
         const T* bx,
         const T* br,
         const T* x_t,
-        const T* h_t,
+        const T* h,
         const T* v,
         const T* dh_new,
         T* dx,
@@ -427,7 +2326,688 @@ class BackwardPass {
         T* dq,
         const T* zoneout_mask);
 
+    // Runs the GRU backward pass over all time steps. This method is faster than using a
+    // per-step `Iterate` but requires that the entire input sequence be available upfront.
+    // In some situations, this constraint may not be satisfiable (e.g. autoregressive models).
+    // Users should prefer calling `Run` over `Iterate` whenever possible.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W_t: [H*3,C] the transpose of the input weight matrix.
+    // R_t: [H*3,H] the transpose of the recurrent weight matrix.
+    // bx: [H*3] the bias vector for the input weight matrix.
+    // br: [H*3] the bias vector for the recurrent weight matrix.
+    // x_t: [C,T,N] the transpose of the GRU input for this iteration.
+    // h: [T+1,N,H] the hidden state vectors after running `ForwardPass::Run`.
+    // v: [T,N,H*4] the same tensor that was passed to `ForwardPass::Run`.
+    // dh_new: [T+1,N,H] the gradient of the loss with respect to `h`.
+    // dx: [T,N,C] the gradient of the loss with respect to the input.
+    // dW: [C,H*3] the gradient of the loss with respect to the input weight matrix.
+    // dR: [H,H*3] the gradient of the loss with respect to the recurrent weight matrix.
+    // dbx: [H*3] the gradient of the loss with respect to the bias vector for the input
+    //     weight matrix.
+    // dbr: [H*3] the gradient of the loss with respect to the bias vector for the recurrent
+    //     weight matrix.
+    // dh: [N,H] NOTE: this is an input and output parameter. Should be initialized to zeros.
+    //     When this function returns, `dh` will contain the gradient of the loss with respect
+    //     to the initial hidden state.
+    // dp: [T,N,H*3] additional temporary work space required for this function. The caller
+    //     should not use the contents of this vector.
+    // dq: [T,N,H*3] additional temporary work space required for this function. The caller
+    //     should not use the contents of this vector.
+    // zoneout_mask: [T,N,H] may be null if zoneout was disabled in the forward pass. This
+    //     vector must be the same as the one provided during the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    void Run(
+        const int steps,
+        const T* W_t,
+        const T* R_t,
+        const T* bx,
+        const T* br,
+        const T* x_t,
+        const T* h,
+        const T* v,
+        const T* dh_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* dbx,
+        T* dbr,
+        T* dh,
+        T* dp,
+        T* dq,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Same as `Run` above, but reads `W` and `R` from `weights` and takes the input `x`
+    // ([T,N,C], as given to the forward pass) in place of `W_t`, `R_t` and `x_t`; the
+    // GEMMs transpose them on the fly instead. `dW`, `dR`, `dbx` and `dbr` are in the
+    // packed layout (see `PackedWeights::UnpackGradients`).
+    void Run(
+        const int steps,
+        const PackedWeights<T>& weights,
+        const T* x,
+        const T* h,
+        const T* v,
+        const T* dh_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* dbx,
+        T* dbr,
+        T* dh,
+        T* dp,
+        T* dq,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // The size in bytes of the workspace that `Run` needs for `steps` time steps when it's
+    // given one in place of `dp` and `dq`.
+    size_t GetWorkspaceSize(const int steps) const;
+
+    // Same as the `PackedWeights` overload of `Run` above, but carves `dp` and `dq` out of
+    // `workspace`, which must hold `GetWorkspaceSize(steps)` bytes, aligned to at least 16
+    // bytes, and needn't be initialized.
+    void Run(
+        const int steps,
+        const PackedWeights<T>& weights,
+        const T* x,
+        const T* h,
+        const T* v,
+        const T* dh_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* dbx,
+        T* dbr,
+        T* dh,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes,
+        void* workspace);
+
+    // Runs the GRU backward pass over all time steps after `ForwardPass::RunCompact`. The
+    // saved activations are decompressed inside the pointwise kernel; the gate gradients
+    // and everything downstream of them are computed in `T` as in `Run`. Graph capture is
+    // not used.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // storage: the same format that was passed to the forward pass.
+    // v: the activations saved by `ForwardPass::RunCompact`.
+    // All other parameters are the same as in `Run`.
+    void RunCompact(
+        const int steps,
+        const ActivationStorage storage,
+        const T* W_t,
+        const T* R_t,
+        const T* bx,
+        const T* br,
+        const T* x_t,
+        const T* h,
+        const void* v,
+        const T* dh_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* dbx,
+        T* dbr,
+        T* dh,
+        T* dp,
+        T* dq,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+    // Same as `RunCompact` above, but reads `W` and `R` from `weights` and takes the input `x`
+    // ([T,N,C], as given to the forward pass) in place of `W_t`, `R_t` and `x_t`; the
+    // GEMMs transpose them on the fly instead. `dW`, `dR`, `dbx` and `dbr` are in the
+    // packed layout (see `PackedWeights::UnpackGradients`).
+    void RunCompact(
+        const int steps,
+        const ActivationStorage storage,
+        const PackedWeights<T>& weights,
+        const T* x,
+        const T* h,
+        const void* v,
+        const T* dh_new,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* dbx,
+        T* dbr,
+        T* dh,
+        T* dp,
+        T* dq,
+        const T* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    friend class StackedBackwardPass<T>;
+    friend class BidirectionalBackwardPass<T>;
+
+    void IterateInternal(
+        const T* R_t,
+        const T* h,
+        const T* v,
+        const T* dh_new,
+        T* dh,
+        T* dp,
+        T* dq,
+        const T* zoneout_mask,
+        const int step,
+        const int active_batch_size,
+        const int* sequence_lengths,
+        const int h_stride);
+
+    // Issues the weight-gradient and `dx` GEMMs of `steps` time steps from `first_step`
+    // of a `total_steps` call, once `stream[0]` has finished their `dp` and `dq`.
+    void WeightGradients(
+        const int first_step,
+        const int steps,
+        const int total_steps,
+        const bool accumulate,
+        const T* W_t,
+        const T* x_t,
+        const T* h,
+        const T* dp,
+        const T* dq,
+        T* dx,
+        T* dW,
+        T* dR,
+        T* dbx,
+        T* dbr);
+
+    // Signals the gradient hook on `stream` once it has finished the weight gradients.
+    void GradientsReady(const cudaStream_t& stream, T* dW, T* dR, T* dbx, T* dbr);
+
+    struct private_data;
+    private_data* data_;
+};
+
+
+template<typename T>
+class StackedForwardPass {
+  public:
+    // training: `true` if the caller intends to perform a backward pass to compute gradients.
+    // layers: the number of stacked GRU layers (L). The first layer consumes the input
+    //     sequence and each following layer consumes the hidden states of the layer below.
+    // batch_size: the number of training/inference inputs provided in each tensor.
+    // input_size: the dimension of each input vector of the first layer.
+    // hidden_size: the expected dimension of each output vector of every layer.
+    // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that produces the inputs and consumes the outputs of this
+    //     pass, with the same semantics as for `ForwardPass`.
+    StackedForwardPass(
+        const bool training,
+        const int layers,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~StackedForwardPass();
+
+    // Runs all layers over all time steps as a diagonal wavefront: step t of layer l+1
+    // runs concurrently with step t+1 of layer l, so that the small per-step kernels of
+    // different layers occupy the GPU together. The result is the same as calling
+    // `ForwardPass::Run` for each layer in turn.
+    //
+    // Per-layer arguments are host arrays of L device pointers, each pointing to a tensor
+    // with the shape and meaning described for `ForwardPass::Run`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W: [L] layer 0's input weight matrix is [C,H*3]; the others are [H,H*3].
+    // R: [L] each [H,H*3].
+    // bx: [L] each [H*3].
+    // br: [L] each [H*3].
+    // x: [T,N,C] the input sequence of the first layer.
+    // h: [L] each [T+1,N,H]. `h[l][1:,:,:]` is the input of layer l+1 and `h[L-1][1:,:,:]`
+    //     forms the output of the stack.
+    // v: [L] each [T,N,H*4].
+    // tmp_Wx: [L] each [T,N,H*3].
+    // tmp_Rh: [L] each [N,H*3]. Layers run concurrently, so they may not share this buffer.
+    // zoneout_prob: applies to every layer.
+    // zoneout_mask: [L] each [T,N,H]. The array and any of its entries may be null.
+    // sequence_lengths: [N] may be null. Applies to every layer.
+    // batch_sizes: [T] may be null. Applies to every layer.
+    void Run(
+        const int steps,
+        const T* const* W,
+        const T* const* R,
+        const T* const* bx,
+        const T* const* br,
+        const T* x,
+        T* const* h,
+        T* const* v,
+        T* const* tmp_Wx,
+        T* const* tmp_Rh,
+        const float zoneout_prob,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+template<typename T>
+class StackedBackwardPass {
+  public:
+    // layers: the number of stacked GRU layers (L).
+    // Other parameters are as for `StackedForwardPass`.
+    StackedBackwardPass(
+        const int layers,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~StackedBackwardPass();
+
+    // Like `BackwardPass::SetGradientReadyCallback`, with `layer` set to each layer in
+    // turn. `Run` issues each layer's weight-gradient GEMMs as soon as its recurrence has
+    // reached the first time step, so the layers become ready from the last to the first
+    // and the gradients of the upper layers can be reduced while the lower layers are
+    // still running.
+    void SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data);
+
+#ifdef HASTE_WITH_NCCL
+    // Like `BackwardPass::SetGradientAllReduce`, for each layer as soon as its gradients
+    // are final (see `SetGradientReadyCallback`).
+    bool SetGradientAllReduce(const ncclComm_t& comm);
+#endif
+
+    // Runs the backward pass of all layers over all time steps as a diagonal wavefront
+    // starting from the last layer. The result is the same as calling `BackwardPass::Run`
+    // for each layer in turn, from the last to the first.
+    //
+    // Per-layer arguments are host arrays of L device pointers, each pointing to a tensor
+    // with the shape and meaning described for `BackwardPass::Run`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W_t: [L] layer 0's is [H*3,C]; the others are [H*3,H].
+    // R_t: [L] each [H*3,H].
+    // bx: [L] each [H*3].
+    // br: [L] each [H*3].
+    // x_t: [C,T,N] the transpose of the input sequence of the first layer.
+    // h: [L] each [T+1,N,H] after running `StackedForwardPass::Run`.
+    // v: [L] each [T,N,H*4] the same tensors that were passed to `StackedForwardPass::Run`.
+    // dh_new: [L] each [T+1,N,H]. NOTE: the entries of all but the last layer are input and
+    //     output parameters. They should hold the gradient of the loss with respect to that
+    //     layer's `h` from anything other than the layer above (typically zeros), and the
+    //     gradient flowing back from the layer above is added to them.
+    // dx: [T,N,C] the gradient of the loss with respect to the input of the first layer.
+    // dW: [L] layer 0's is [C,H*3]; the others are [H,H*3].
+    // dR: [L] each [H,H*3].
+    // dbx: [L] each [H*3].
+    // dbr: [L] each [H*3].
+    // dh: [L] each [N,H]. Should be initialized to zeros.
+    // dp: [L] each [T,N,H*3].
+    // dq: [L] each [T,N,H*3].
+    // zoneout_mask: [L] each [T,N,H]. Must match the value provided to the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    void Run(
+        const int steps,
+        const T* const* W_t,
+        const T* const* R_t,
+        const T* const* bx,
+        const T* const* br,
+        const T* x_t,
+        const T* const* h,
+        const T* const* v,
+        T* const* dh_new,
+        T* dx,
+        T* const* dW,
+        T* const* dR,
+        T* const* dbx,
+        T* const* dbr,
+        T* const* dh,
+        T* const* dp,
+        T* const* dq,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    // Issues the weight-gradient GEMMs of layer `l` (and `dx` for layer 0) once the
+    // recurrence of the layer has finished, and signals the gradient hook.
+    void LayerGradients(
+        const int l,
+        const int steps,
+        const T* const* W_t,
+        const T* x_t,
+        const T* const* h,
+        T* dx,
+        T* const* dW,
+        T* const* dR,
+        T* const* dbx,
+        T* const* dbr,
+        const T* const* dp,
+        const T* const* dq);
+
+    struct private_data;
+    private_data* data_;
+};
+
+template<typename T>
+class BidirectionalForwardPass {
+  public:
+    // Parameters are as for `ForwardPass` and apply to both directions.
+    BidirectionalForwardPass(
+        const bool training,
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~BidirectionalForwardPass();
+
+    // Runs a forward and a reverse GRU over the same input sequence. The two directions
+    // are independent, so their time steps are issued alternately on separate streams and
+    // the small per-step kernels of both directions occupy the GPU together. The result is
+    // the same as running `ForwardPass::Run` on the input and on its time reversal.
+    //
+    // Per-direction arguments are host arrays of 2 device pointers: index 0 is the forward
+    // direction and index 1 is the reverse direction. The reverse direction's `h` is
+    // mirrored in time: its initial state is at index T and its state after visiting step
+    // t is at index t. It needs no reversed copy of `x` and, since padded steps are at the
+    // end of each sequence, each item starts from its own last valid step.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W: [2] each [C,H*3].
+    // R: [2] each [H,H*3].
+    // bx: [2] each [H*3].
+    // br: [2] each [H*3].
+    // x: [T,N,C] the input sequence shared by both directions.
+    // h: [2] each [T+1,N,H] with consecutive batch items `h_stride` elements apart. The
+    //     forward direction's output is `h[0][1:,:,:]` and the reverse direction's is
+    //     `h[1][:-1,:,:]`. To produce the concatenated [T,N,H*2] output directly, pass
+    //     `{y, y + N*H*2 + H}` for a [T+2,N,H*2] buffer `y` and `h_stride = H*2`; then
+    //     `y[1:T+1,:,:]` is the output, `y[0,:,:H]` must hold the forward direction's
+    //     initial state and `y[T+1,:,H:]` the reverse direction's.
+    // h_stride: at least H.
+    // v: [2] each [T,N,H*4]. Indexed by time step for both directions.
+    // tmp_Wx: [2] each [T,N,H*3].
+    // tmp_Rh: [2] each [N,H*3].
+    // zoneout_prob: applies to both directions.
+    // zoneout_mask: [2] each [T,N,H]. The array and any of its entries may be null.
+    // sequence_lengths: [N] may be null. Applies to both directions.
+    // batch_sizes: [T] may be null. Applies to both directions.
+    void Run(
+        const int steps,
+        const T* const* W,
+        const T* const* R,
+        const T* const* bx,
+        const T* const* br,
+        const T* x,
+        T* const* h,
+        const int h_stride,
+        T* const* v,
+        T* const* tmp_Wx,
+        T* const* tmp_Rh,
+        const float zoneout_prob,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+template<typename T>
+class BidirectionalBackwardPass {
+  public:
+    // Parameters are as for `BackwardPass` and apply to both directions.
+    BidirectionalBackwardPass(
+        const int batch_size,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Releases internal resources. Does not block: work that has already been enqueued
+    // continues to run on the GPU.
+    ~BidirectionalBackwardPass();
+
+    // Runs the backward pass of both directions with their time steps interleaved. The
+    // result is the same as calling `BackwardPass::Run` for each direction, except that
+    // `dx` receives the sum of both directions' input gradients.
+    //
+    // Per-direction arguments are host arrays of 2 device pointers laid out as described
+    // for `BidirectionalForwardPass::Run`.
+    //
+    // steps: the number of iterations to run (i.e. T).
+    // W_t: [2] each [H*3,C].
+    // R_t: [2] each [H*3,H].
+    // bx: [2] each [H*3].
+    // br: [2] each [H*3].
+    // x_t: [C,T,N] the transpose of the input sequence.
+    // h: [2] after running `BidirectionalForwardPass::Run`.
+    // h_stride: the value provided to the forward pass. Also applies to `dh_new`.
+    // v: [2] each [T,N,H*4] the same tensors that were passed to the forward pass.
+    // dh_new: [2] the gradient of the loss with respect to `h`, laid out like `h`.
+    // dx: [T,N,C] the gradient of the loss with respect to the input, summed over both
+    //     directions.
+    // dW: [2] each [C,H*3].
+    // dR: [2] each [H,H*3].
+    // dbx: [2] each [H*3].
+    // dbr: [2] each [H*3].
+    // dh: [2] each [N,H]. Should be initialized to zeros.
+    // dp: [2] each [T,N,H*3].
+    // dq: [2] each [T,N,H*3].
+    // zoneout_mask: [2] each [T,N,H]. Must match the value provided to the forward pass.
+    // sequence_lengths: [N] may be null. Must match the value provided to the forward pass.
+    // batch_sizes: [T] may be null. Must match the value provided to the forward pass.
+    void Run(
+        const int steps,
+        const T* const* W_t,
+        const T* const* R_t,
+        const T* const* bx,
+        const T* const* br,
+        const T* x_t,
+        const T* const* h,
+        const int h_stride,
+        const T* const* v,
+        const T* const* dh_new,
+        T* dx,
+        T* const* dW,
+        T* const* dR,
+        T* const* dbx,
+        T* const* dbr,
+        T* const* dh,
+        T* const* dp,
+        T* const* dq,
+        const T* const* zoneout_mask,
+        const int* sequence_lengths,
+        const int* batch_sizes);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+
+// Serves many independent sequences (e.g. one per user of an online speech service)
+// that each arrive a few frames at a time. The session owns the recurrent state of up
+// to `max_streams` sequences, addressed by stream ID in [0, max_streams), along with all
+// of the workspace that `ForwardPass::Iterate` makes callers manage. Calls run directly
+// on the session's CUDA stream without internal events, and each call sets the cuBLAS
+// stream once no matter how many frames it covers.
+template<typename T>
+class InferenceSession {
+  public:
+    // max_streams: the number of sequences whose state the session keeps (S).
+    // max_frames: the most frames that a single call to `Run` may cover (K).
+    // input_size: the dimension of each input vector.
+    // hidden_size: the expected dimension of each output vector.
+    // blas_handle: an initialized cuBLAS handle (see `cublasCreate`).
+    // stream: the CUDA stream that every call enqueues its work on. The host thread is
+    //     never blocked, except by the constructor and destructor which allocate and
+    //     free the session's device memory.
+    //
+    // All streams start out with zero state. If the session's device memory can't be
+    // allocated, every call that takes a stream returns false.
+    InferenceSession(
+        const int max_streams,
+        const int max_frames,
+        const int input_size,
+        const int hidden_size,
+        const cublasHandle_t& blas_handle,
+        const cudaStream_t& stream);
+
+    // Frees the session's device memory.
+    ~InferenceSession();
+
+    // The number of `T` elements in the state of one stream, as read and written by
+    // `SaveState` and `RestoreState`: [H] holding h.
+    int StateSize() const;
+
+    // Zeroes the state of stream `id` so that it can start a new sequence. Returns false
+    // without doing anything if `id` isn't in [0, S).
+    bool Reset(const int id);
+
+    // Copies the state of stream `id` to `state` ([StateSize()] in device memory), e.g. to
+    // move a sequence to another session or to branch a search. Returns false like
+    // `Reset`.
+    bool SaveState(const int id, T* state) const;
+
+    // Replaces the state of stream `id` with `state` ([StateSize()] in device memory) as
+    // written by `SaveState`. Returns false like `Reset`.
+    bool RestoreState(const int id, const T* state);
+
+    // Advances stream `id` by `frames` (1 <= frames <= K) consecutive frames. The input
+    // projection of all frames is a single GEMM, followed by one recurrent GEMM and one
+    // pointwise kernel per frame. Returns false without enqueueing any work if `id` isn't
+    // in [0, S) or `frames` isn't in [1, K].
+    //
+    // W: [C,H*3] the input weight matrix.
+    // R: [H,H*3] the recurrent weight matrix.
+    // bx: [H*3] the bias for the input weight matrix.
+    // br: [H*3] the bias for the recurrent weight matrix.
+    // x: [frames,C] the frames' input vectors.
+    // h_out: [frames,H] receives the hidden state after each frame.
+    // zoneout_prob: the zoneout probability the model was trained with, or 0.
+    bool Run(
+        const int id,
+        const int frames,
+        const T* W,
+        const T* R,
+        const T* bx,
+        const T* br,
+        const T* x,
+        T* h_out,
+        const float zoneout_prob);
+
+    // Advances `count` different streams (1 <= count <= S) by one frame each as a single
+    // N=count step: one gather of their states, one GEMM each for the input and
+    // recurrent projections, one pointwise kernel and one scatter of the new states.
+    // Returns false without enqueueing any work if `count` isn't in [1, S]. The IDs are
+    // in device memory, so they aren't checked.
+    //
+    // ids: [count] the distinct stream IDs to advance, in device memory.
+    // W: [C,H*3] the input weight matrix.
+    // R: [H,H*3] the recurrent weight matrix.
+    // bx: [H*3] the bias for the input weight matrix.
+    // br: [H*3] the bias for the recurrent weight matrix.
+    // x: [count,C] the input vector of each stream, in the order of `ids`.
+    // h_out: [count,H] receives the new hidden state of each stream.
+    // zoneout_prob: the zoneout probability the model was trained with, or 0.
+    bool Step(
+        const int count,
+        const int* ids,
+        const T* W,
+        const T* R,
+        const T* bx,
+        const T* br,
+        const T* x,
+        T* h_out,
+        const float zoneout_prob);
+
+  private:
+    struct private_data;
+    private_data* data_;
+};
+
+// Serves independent inference requests that share the same weights but differ in
+// length and initial state, e.g. utterances arriving concurrently at a speech service.
+// Requests submitted from any thread are queued and, on a worker thread, packed into a
+// single `ForwardPass::Run` with N = max_batch_size and per-item `sequence_lengths`,
+// longest first, so that `batch_sizes` shrinks the recurrent GEMMs as the shorter items
+// finish. Each item's outputs are then copied back to the request's own buffers. A
+// batch starts as soon as `max_batch_size` requests are waiting or the oldest has waited
+// `max_wait_us`.
+template<typename T>
+class BatchScheduler {
+  public:
+    struct Request {
+      int steps;    // The length of the sequence, 1 <= steps <= max_steps.
+      const T* x;   // [steps,C] the input vectors.
+      const T* h0;  // [H] the initial hidden state, or null for zeros.
+      T* h;         // [steps,H] receives the hidden state after each step.
+    };
+
+    // max_batch_size: the most requests packed into one `Run` (N).
+    // max_steps: the longest request that may be submitted.
+    // max_wait_us: how long, in microseconds, the oldest waiting request may be held back
+    //     for a fuller batch.
+    // input_size: the dimension of each input vector.
+    // hidden_size: the expected dimension of each output vector.
+    // W: [C,H*3] the input weight matrix.
+    // R: [H,H*3] the recurrent weight matrix.
+    // bx: [H*3] the bias vector for the input weight matrix.
+    // br: [H*3] the bias vector for the recurrent weight matrix.
+    // zoneout_prob: the zoneout probability the model was trained with, or 0.
+    // blas_handle: an initialized cuBLAS handle that only the scheduler's worker thread
+    //     uses for as long as the scheduler exists.
+    //
+    // The weights must stay valid and unchanged until the scheduler is destroyed. The
+    // constructor allocates the padded [max_steps,N,*] batch tensors in device memory and
+    // creates the CUDA stream that all batches run on.
+    BatchScheduler(
+        const int max_batch_size,
+        const int max_steps,
+        const int max_wait_us,
+        const int input_size,
+        const int hidden_size,
+        const T* W,
+        const T* R,
+        const T* bx,
+        const T* br,
+        const float zoneout_prob,
+        const cublasHandle_t& blas_handle);
+
+    // Runs the requests that are still queued, then frees the scheduler's resources.
+    ~BatchScheduler();
+
+    // Queues `request`. The returned future becomes ready once the request's outputs
+    // have been written, after which its input and output buffers may be reused. The
+    // buffers must be in device memory on the scheduler's device and, like the input
+    // work that produces them, complete before the call. A request with `steps` outside
+    // [1, max_steps] isn't queued; its future is ready at once and holds a
+    // `std::invalid_argument`. If the constructor couldn't allocate the batch tensors,
+    // every future holds a `std::runtime_error` instead.
+    std::future<void> Submit(const Request& request);
+
+    BatchSchedulerStats Stats() const;
+
   private:
+    void RunBatch(const std::vector<Request>& requests);
+
     struct private_data;
     private_data* data_;
 };
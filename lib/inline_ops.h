@@ -15,6 +15,16 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+
+#include "haste.h"
+
+// 16-bit types are widened to `accum_type<T>::type` on load and narrowed on store.
+using haste::v0::accum_type;
+using haste::v0::accum_t;
+
 template<typename T>
 __device__ __forceinline__
 T sigmoid(const T x) {
@@ -32,3 +42,273 @@ __device__ __forceinline__
 T d_tanh(const T tanh_output) {
   return (static_cast<T>(1.0) - tanh_output * tanh_output);
 }
+
+// log2(e), for computing e^x as 2^(x*log2(e)).
+constexpr float kLog2e = 1.4426950408889634f;
+
+// 2^x with the `ex2.approx` instruction: within 2 ulps, with denormal results flushed
+// to zero.
+__device__ __forceinline__
+float exp2_approx(const float x) {
+  float y;
+  asm("ex2.approx.ftz.f32 %0, %1;" : "=f"(y) : "f"(x));
+  return y;
+}
+
+// `sigmoid` from `exp2_approx`, within a few ulps. Saturates to exactly 0 and 1.
+__device__ __forceinline__
+float sigmoid_ex2(const float x) {
+  return __frcp_rn(1.0f + exp2_approx(-kLog2e * x));
+}
+
+// `tanh` from `exp2_approx` as `1 - 2/(e^(2|x|)+1)` with the sign of `x`, which
+// saturates to exactly 1 for large |x|, and from its Taylor series below |x| = 1/4 where
+// that difference would cancel. Within a few ulps.
+__device__ __forceinline__
+float tanh_ex2(const float x) {
+  const float a = fabsf(x);
+  if (a < 0.25f) {
+    const float x2 = x * x;
+    return x * fmaf(x2, fmaf(x2, fmaf(x2, -17.0f / 315.0f, 2.0f / 15.0f), -1.0f / 3.0f), 1.0f);
+  }
+  return copysignf(1.0f - 2.0f * __frcp_rn(1.0f + exp2_approx(2.0f * kLog2e * a)), x);
+}
+
+// `tanh` with the `tanh.approx` instruction of sm_75 and newer, within a relative error
+// of about 2^-11. `tanh_ex2` on older architectures.
+__device__ __forceinline__
+float tanh_approx(const float x) {
+#if __CUDA_ARCH__ >= 750
+  float y;
+  asm("tanh.approx.f32 %0, %1;" : "=f"(y) : "f"(x));
+  return y;
+#else
+  return tanh_ex2(x);
+#endif
+}
+
+// `sigmoid` as `tanh_approx(x/2)/2 + 1/2`, within about 2^-12 of the exact value.
+__device__ __forceinline__
+float sigmoid_approx(const float x) {
+  return fmaf(0.5f, tanh_approx(0.5f * x), 0.5f);
+}
+
+// `tanh_approx` of a pair of values at once, in FP16 with the `tanh.approx.f16x2`
+// instruction of sm_75 and newer, within about 1e-3. Separate `tanh_approx` calls on
+// older architectures.
+__device__ __forceinline__
+void tanh2_approx(const float x0, const float x1, float* y0, float* y1) {
+#if __CUDA_ARCH__ >= 750 && __CUDACC_VER_MAJOR__ >= 11
+  const __half2 x = __floats2half2_rn(x0, x1);
+  __half2 y;
+  asm("tanh.approx.f16x2 %0, %1;"
+      : "=r"(*reinterpret_cast<unsigned int*>(&y))
+      : "r"(*reinterpret_cast<const unsigned int*>(&x)));
+  *y0 = __low2float(y);
+  *y1 = __high2float(y);
+#else
+  *y0 = tanh_approx(x0);
+  *y1 = tanh_approx(x1);
+#endif
+}
+
+// The gate nonlinearities of the pointwise kernels, as a template argument, one policy
+// per `ActivationTier`. `sigmoid2` computes two independent sigmoids, which
+// `Half2Activations` packs into one instruction. Only `float` has approximations; other
+// types always get the precise functions.
+struct PreciseActivations {
+  template<typename T>
+  static __device__ __forceinline__ T sigmoid(const T x) {
+    return ::sigmoid(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ T tanh(const T x) {
+    return ::tanh(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ void sigmoid2(const T x0, const T x1, T* y0, T* y1) {
+    *y0 = ::sigmoid(x0);
+    *y1 = ::sigmoid(x1);
+  }
+};
+
+struct FastActivations {
+  template<typename T>
+  static __device__ __forceinline__ T sigmoid(const T x) {
+    return ::sigmoid(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ T tanh(const T x) {
+    return ::tanh(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ void sigmoid2(const T x0, const T x1, T* y0, T* y1) {
+    *y0 = sigmoid(x0);
+    *y1 = sigmoid(x1);
+  }
+
+  static __device__ __forceinline__ float sigmoid(const float x) {
+    return sigmoid_ex2(x);
+  }
+
+  static __device__ __forceinline__ float tanh(const float x) {
+    return tanh_ex2(x);
+  }
+};
+
+struct ApproxActivations {
+  template<typename T>
+  static __device__ __forceinline__ T sigmoid(const T x) {
+    return ::sigmoid(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ T tanh(const T x) {
+    return ::tanh(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ void sigmoid2(const T x0, const T x1, T* y0, T* y1) {
+    *y0 = sigmoid(x0);
+    *y1 = sigmoid(x1);
+  }
+
+  static __device__ __forceinline__ float sigmoid(const float x) {
+    return sigmoid_approx(x);
+  }
+
+  static __device__ __forceinline__ float tanh(const float x) {
+    return tanh_approx(x);
+  }
+};
+
+struct Half2Activations {
+  template<typename T>
+  static __device__ __forceinline__ T sigmoid(const T x) {
+    return ::sigmoid(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ T tanh(const T x) {
+    return ::tanh(x);
+  }
+
+  template<typename T>
+  static __device__ __forceinline__ void sigmoid2(const T x0, const T x1, T* y0, T* y1) {
+    *y0 = ::sigmoid(x0);
+    *y1 = ::sigmoid(x1);
+  }
+
+  static __device__ __forceinline__ float sigmoid(const float x) {
+    return sigmoid_approx(x);
+  }
+
+  static __device__ __forceinline__ float tanh(const float x) {
+    return tanh_approx(x);
+  }
+
+  static __device__ __forceinline__ void sigmoid2(const float x0, const float x1, float* y0, float* y1) {
+    tanh2_approx(0.5f * x0, 0.5f * x1, y0, y1);
+    *y0 = fmaf(0.5f, *y0, 0.5f);
+    *y1 = fmaf(0.5f, *y1, 0.5f);
+  }
+};
+
+// Converts an activation to and from the element type `V` it's saved as between the
+// forward and backward passes. `int8_t` is 8-bit fixed point with a scale of 1/127, which
+// covers the [-1, 1] range of sigmoid and tanh outputs; larger values are clamped.
+template<typename V>
+struct activation_storage {
+  template<typename Acc>
+  static __device__ __forceinline__ V pack(const Acc x) {
+    return V(x);
+  }
+
+  template<typename Acc>
+  static __device__ __forceinline__ Acc unpack(const V x) {
+    return Acc(x);
+  }
+};
+
+template<>
+struct activation_storage<int8_t> {
+  template<typename Acc>
+  static __device__ __forceinline__ int8_t pack(const Acc x) {
+    return static_cast<int8_t>(__float2int_rn(fminf(fmaxf(float(x), -1.0f), 1.0f) * 127.0f));
+  }
+
+  template<typename Acc>
+  static __device__ __forceinline__ Acc unpack(const int8_t x) {
+    return Acc(x) * static_cast<Acc>(1.0 / 127.0);
+  }
+};
+
+template<typename V, typename Acc>
+__device__ __forceinline__
+V pack_activation(const Acc x) {
+  return activation_storage<V>::pack(x);
+}
+
+template<typename Acc, typename V>
+__device__ __forceinline__
+Acc unpack_activation(const V x) {
+  return activation_storage<V>::template unpack<Acc>(x);
+}
+
+// Parameters of a zoneout mask that's generated on the fly instead of read from memory.
+// Element `i` of the mask only depends on `seed`, `offset` and `i`, so the backward pass
+// regenerates exactly the mask the forward pass applied.
+struct ZoneoutRng {
+  bool enabled;
+  float prob;
+  unsigned long long seed;
+  unsigned long long offset;
+};
+
+// One block of the Philox4x32-10 counter-based generator (Salmon et al., 2011).
+__device__ __forceinline__
+uint4 philox4x32_10(uint4 counter, uint2 key) {
+  for (int round = 0; round < 10; ++round) {
+    const unsigned int hi0 = __umulhi(0xD2511F53u, counter.x);
+    const unsigned int lo0 = 0xD2511F53u * counter.x;
+    const unsigned int hi1 = __umulhi(0xCD9E8D57u, counter.z);
+    const unsigned int lo1 = 0xCD9E8D57u * counter.z;
+    counter = make_uint4(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+    key.x += 0x9E3779B9u;
+    key.y += 0xBB67AE85u;
+  }
+  return counter;
+}
+
+// A uniform float in [0, 1) for element `index` of the random stream named by `seed`
+// and `offset`.
+__device__ __forceinline__
+float philox_uniform(
+    const unsigned long long seed,
+    const unsigned long long offset,
+    const unsigned long long index) {
+  const uint4 bits = philox4x32_10(
+      make_uint4(
+          static_cast<unsigned int>(index),
+          static_cast<unsigned int>(index >> 32),
+          static_cast<unsigned int>(offset),
+          static_cast<unsigned int>(offset >> 32)),
+      make_uint2(
+          static_cast<unsigned int>(seed),
+          static_cast<unsigned int>(seed >> 32)));
+  // 24 bits convert to a float in [0, 1) exactly.
+  return (bits.x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Element `index` of the zoneout mask described by `rng`: 1 with probability
+// `1 - rng.prob`, 0 otherwise.
+template<typename T>
+__device__ __forceinline__
+T zoneout_keep(const ZoneoutRng& rng, const unsigned long long index) {
+  const float uniform = philox_uniform(rng.seed, rng.offset, index);
+  return uniform >= rng.prob ? static_cast<T>(1.0) : static_cast<T>(0.0);
+}
@@ -19,80 +19,832 @@
 #include <vector>
 
 #include "blas.h"
+#include "cell.h"
+#include "dropconnect.h"
+#include "gradient_hook.h"
+#include "graph.h"
 #include "haste.h"
 #include "inline_ops.h"
+#include "pointwise.h"
+#include "profiling.h"
+#include "reduce.h"
+#include "sequence.h"
+
+#ifdef HASTE_WITH_NCCL
+#include "tensor_parallel.h"
+#endif
 
 namespace {
 
-template<typename T, bool ApplyZoneout>
+// The gradients of one hidden unit's gate pre-activations `dv` ([i,g,f,o]) and previous
+// cell state given the gradients `dh_total` and `dc_total` flowing into its outputs, in
+// (at least) FP32 for 16-bit types, for the cell variant `Cell` with the unit's [i,f,o]
+// peephole weights `peephole` (only used if `Cell::kPeephole`). Also splits `dh_total`
+// into the part that reaches the previous `h` directly through zoneout, `dh_prev`, using
+// the keep mask `mask`.
+template<typename Acc, typename Cell, bool ApplyZoneout>
+__device__ __forceinline__
+void LstmCellGrad(const Acc gates[4],
+                  const Acc peephole[3],
+                  const Acc c_prev,
+                  const Acc c_new,
+                  Acc dh_total,
+                  Acc dc_total,
+                  const Acc mask,
+                  Acc* dh_prev,
+                  Acc* dc_prev,
+                  Acc dv[4]) {
+  const Acc i = gates[0];
+  const Acc g = gates[1];
+  const Acc f = gates[2];
+  const Acc o = gates[3];
+  const Acc c_tanh = tanh(c_new);
+
+  if (ApplyZoneout) {
+    *dh_prev = (static_cast<Acc>(1.0) - mask) * dh_total;
+    dh_total = mask * dh_total;
+  } else {
+    *dh_prev = static_cast<Acc>(0.0);
+  }
+
+  const Acc do_ = c_tanh * dh_total;
+  const Acc dc_tanh = o * dh_total;
+  dv[3] = d_sigmoid(o) * do_;
+  dc_total += d_tanh(c_tanh) * dc_tanh;
+  if (Cell::kPeephole)
+    dc_total += peephole[2] * dv[3];
+  const Acc df = c_prev * dc_total;
+  Acc dc = f * dc_total;
+  const Acc di = g * dc_total;
+  const Acc dg = i * dc_total;
+  dv[1] = d_tanh(g) * dg;
+  if (Cell::kCoupled) {
+    // `i = 1 - f`, so the input gate's gradient flows to the forget gate.
+    dv[0] = static_cast<Acc>(0.0);
+    dv[2] = d_sigmoid(f) * (df - di);
+  } else {
+    dv[0] = d_sigmoid(i) * di;
+    dv[2] = d_sigmoid(f) * df;
+  }
+  if (Cell::kPeephole)
+    dc += peephole[0] * dv[0] + peephole[1] * dv[2];
+  *dc_prev = dc;
+}
+
+// `v` holds the activations as `V`, which is `T` except for `RunCompact`. `v` and
+// `dv_out` may be aliased if they have the same type.
+// Each thread handles `U` consecutive hidden units of one batch item with vector loads
+// and stores. `Interleaved` selects `GateLayout::kInterleaved` for `v` and `dv_out`, and
+// `Cell` the gate math.
+template<typename T, typename V, int U, bool Interleaved, typename Cell, bool ApplyZoneout>
 __global__
 void PointwiseOperations(const int batch_dim,
                          const int hidden_dim,
-                         const T* c,
-                         const T* v,
-                         const T* c_new,
+                         const int h_stride,  // Distance between batch items in `dh_new`
+                         const T* peephole,  // Peephole weights [3,H] (only used if Cell::kPeephole)
+                         const accum_t<T>* c,
+                         const V* v,
+                         const accum_t<T>* c_new,
                          const T* dh_new,
-                         const T* dc_new,
-                         T* db_out,
+                         const accum_t<T>* dc_new,  // May be null if there's no gradient for `c_new`
                          T* dh_inout,
-                         T* dc_inout,
+                         accum_t<T>* dc_inout,
                          T* dv_out,
-                         const T* zoneout_mask) {  // Zoneout mask (only used if ApplyZoneout==true)
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+                         const T* zoneout_mask,  // Zoneout mask (only used if ApplyZoneout==true), may be null
+                         const ZoneoutRng zoneout_rng,  // Regenerates the mask if `zoneout_mask` is null
+                         const int step,
+                         const int* sequence_lengths) {  // May be null
+  const int row = (blockDim.x * blockIdx.x + threadIdx.x) * U;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
+  // Gradients are computed in (at least) FP32 for 16-bit types.
+  typedef typename accum_type<T>::type Acc;
+
   const int base_idx = col * hidden_dim + row;
+  const int dh_new_idx = col * h_stride + row;
+  const int stride4_base_idx = col * (hidden_dim * 4);
 
-        T dc_total = dc_new[base_idx] + dc_inout[base_idx];
-        T dh_total = dh_new[base_idx] + dh_inout[base_idx];
-  const T c_tanh = tanh(c_new[base_idx]);
+  const AlignedVector<T, U> dh_new_in = LoadVector<U>(dh_new + dh_new_idx);
+  const AlignedVector<T, U> dh_in = LoadVector<U>(dh_inout + base_idx);
+  const AlignedVector<Acc, U> dc_in = LoadVector<U>(dc_inout + base_idx);
+  AlignedVector<Acc, U> dc_new_in;
+  #pragma unroll
+  for (int j = 0; j < U; ++j)
+    dc_new_in.x[j] = static_cast<Acc>(0.0);
+  if (dc_new)
+    dc_new_in = LoadVector<U>(dc_new + base_idx);
 
-  const int stride4_base_idx = col * (hidden_dim * 4) + row;
-  const int i_idx = stride4_base_idx + 0 * hidden_dim;
-  const int g_idx = stride4_base_idx + 1 * hidden_dim;
-  const int f_idx = stride4_base_idx + 2 * hidden_dim;
-  const int o_idx = stride4_base_idx + 3 * hidden_dim;
+  AlignedVector<T, U> dh_out;
+  AlignedVector<Acc, U> dc_out;
+  T dv[4][U];
 
-  const T i = v[i_idx];
-  const T g = v[g_idx];
-  const T f = v[f_idx];
-  const T o = v[o_idx];
+  // The forward pass copied the state through for items past the end of their sequence,
+  // so the whole gradient flows to the previous step and none of it reaches the gates.
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    #pragma unroll
+    for (int j = 0; j < U; ++j) {
+      dh_out.x[j] = T(Acc(dh_new_in.x[j]) + Acc(dh_in.x[j]));
+      dc_out.x[j] = dc_new_in.x[j] + dc_in.x[j];
+      dv[0][j] = static_cast<T>(0.0);
+      dv[1][j] = static_cast<T>(0.0);
+      dv[2][j] = static_cast<T>(0.0);
+      dv[3][j] = static_cast<T>(0.0);
+    }
+    StoreVector<U>(dh_inout + base_idx, dh_out);
+    StoreVector<U>(dc_inout + base_idx, dc_out);
+    StoreGates<U, 4, Interleaved>(dv_out + stride4_base_idx, hidden_dim, row, dv);
+    return;
+  }
 
-  if (ApplyZoneout) {
-    const T mask = zoneout_mask[base_idx];
-    dh_inout[base_idx] = (static_cast<T>(1.0) - mask) * dh_total;
-    dh_total = mask * dh_total;
+  V v_in[4][U];
+  LoadGates<U, 4, Interleaved>(v + stride4_base_idx, hidden_dim, row, v_in);
+  const AlignedVector<Acc, U> c_in = LoadVector<U>(c + base_idx);
+  const AlignedVector<Acc, U> c_new_in = LoadVector<U>(c_new + base_idx);
+  AlignedVector<T, U> mask_in;
+  if (ApplyZoneout && zoneout_mask)
+    mask_in = LoadVector<U>(zoneout_mask + base_idx);
+  AlignedVector<T, U> peephole_in[3];
+  if (Cell::kPeephole) {
+    #pragma unroll
+    for (int k = 0; k < 3; ++k)
+      peephole_in[k] = LoadVector<U>(peephole + k * hidden_dim + row);
+  }
+
+  #pragma unroll
+  for (int j = 0; j < U; ++j) {
+    Acc gates[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      gates[k] = unpack_activation<Acc>(v_in[k][j]);
+
+    Acc mask = static_cast<Acc>(0.0);
+    if (ApplyZoneout) {
+      mask = zoneout_mask
+          ? Acc(mask_in.x[j])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + base_idx + j);
+    }
+
+    Acc peep[3];
+    #pragma unroll
+    for (int k = 0; k < 3; ++k)
+      peep[k] = Cell::kPeephole ? Acc(peephole_in[k].x[j]) : static_cast<Acc>(0.0);
+
+    Acc dh_prev;
+    Acc dc_prev;
+    Acc dv_value[4];
+    LstmCellGrad<Acc, Cell, ApplyZoneout>(
+        gates,
+        peep,
+        c_in.x[j],
+        c_new_in.x[j],
+        Acc(dh_new_in.x[j]) + Acc(dh_in.x[j]),
+        dc_new_in.x[j] + dc_in.x[j],
+        mask,
+        &dh_prev,
+        &dc_prev,
+        dv_value);
+
+    dh_out.x[j] = T(dh_prev);
+    dc_out.x[j] = dc_prev;
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      dv[k][j] = T(dv_value[k]);
+  }
+
+  StoreVector<U>(dh_inout + base_idx, dh_out);
+  StoreVector<U>(dc_inout + base_idx, dc_out);
+  StoreGates<U, 4, Interleaved>(dv_out + stride4_base_idx, hidden_dim, row, dv);
+}
+
+// Launches the `PointwiseOperations` instantiation for `U`, `Interleaved` and `Cell`.
+template<typename T, typename V, int U, bool Interleaved, typename Cell>
+void LaunchPointwiseKernel(
+    const bool apply_zoneout,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* peephole,
+    const accum_t<T>* c,
+    const V* v,
+    const accum_t<T>* c_new,
+    const T* dh_new,
+    const accum_t<T>* dc_new,
+    T* dh,
+    accum_t<T>* dc,
+    T* dv,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  dim3 gridDim;
+  dim3 blockDim;
+  PointwiseLaunchShape(batch_size, hidden_size / U, &gridDim, &blockDim);
+
+  if (apply_zoneout) {
+    PointwiseOperations<T, V, U, Interleaved, Cell, true><<<gridDim, blockDim, 0, stream>>>(
+        batch_size,
+        hidden_size,
+        h_stride,
+        peephole,
+        c,
+        v,
+        c_new,
+        dh_new,
+        dc_new,
+        dh,
+        dc,
+        dv,
+        zoneout_mask,
+        zoneout_rng,
+        step,
+        sequence_lengths
+    );
   } else {
-    dh_inout[base_idx] = static_cast<T>(0.0);
+    PointwiseOperations<T, V, U, Interleaved, Cell, false><<<gridDim, blockDim, 0, stream>>>(
+        batch_size,
+        hidden_size,
+        h_stride,
+        peephole,
+        c,
+        v,
+        c_new,
+        dh_new,
+        dc_new,
+        dh,
+        dc,
+        dv,
+        nullptr,
+        ZoneoutRng(),
+        step,
+        sequence_lengths
+    );
+  }
+}
+
+// Launches `PointwiseOperations` for one time step of the whole batch, with the widest
+// vector accesses that the sizes and pointers allow.
+template<typename T, typename V>
+void LaunchPointwiseOperations(
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const accum_t<T>* c,
+    const V* v,
+    const accum_t<T>* c_new,
+    const T* dh_new,
+    const accum_t<T>* dc_new,
+    T* dh,
+    accum_t<T>* dc,
+    T* dv,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const bool apply_zoneout = zoneout_mask || (zoneout_rng.enabled && zoneout_rng.prob);
+
+  const int units = PointwiseVectorWidth<T>(
+      hidden_size,
+      h_stride,
+      { v, dh_new, dh, dv, zoneout_mask },
+      { c, c_new, dc_new, dc });
+  const auto launch = interleaved
+      ? (units == 4 ? LaunchPointwiseKernel<T, V, 4, true, StandardCell>
+       : units == 2 ? LaunchPointwiseKernel<T, V, 2, true, StandardCell>
+       :              LaunchPointwiseKernel<T, V, 1, true, StandardCell>)
+      : (units == 4 ? LaunchPointwiseKernel<T, V, 4, false, StandardCell>
+       : units == 2 ? LaunchPointwiseKernel<T, V, 2, false, StandardCell>
+       :              LaunchPointwiseKernel<T, V, 1, false, StandardCell>);
+  launch(
+      apply_zoneout,
+      batch_size,
+      hidden_size,
+      h_stride,
+      nullptr,
+      c,
+      v,
+      c_new,
+      dh_new,
+      dc_new,
+      dh,
+      dc,
+      dv,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths,
+      stream);
+}
+
+// The backward pass of `LayerNormPointwiseOperations`, with V=T and U=1: the gradients
+// `da` of the normalized pre-activations come from the gate math, and the block of each
+// batch item reduces their sums with and without the normalized pre-activations `xhat`
+// to turn them into the gradients `dv_out` of the pre-activations (Wx + Rh + b). Each
+// row of `ln_cache` holds the forward pass's `xhat` and reciprocal standard deviations
+// on entry and `da*xhat` and `da` on exit, whose column sums are the gradients of the
+// gains and biases. `v` and `dv_out` may be aliased.
+template<typename T, typename Cell, bool Interleaved, bool ApplyZoneout>
+__global__
+void LayerNormPointwiseOperations(const int batch_dim,
+                                  const int hidden_dim,
+                                  const int h_stride,  // Distance between batch items in `dh_new`
+                                  const T* peephole,    // [3,H] (only used if Cell::kPeephole)
+                                  const T* layer_norm,  // [2,H*4]
+                                  const accum_t<T>* c,
+                                  const T* v,
+                                  const accum_t<T>* c_new,
+                                  const T* dh_new,
+                                  const accum_t<T>* dc_new,  // May be null if there's no gradient for `c_new`
+                                  T* dh_inout,
+                                  accum_t<T>* dc_inout,
+                                  T* dv_out,
+                                  T* ln_cache,  // [N,2,H*4]
+                                  const T* zoneout_mask,
+                                  const ZoneoutRng zoneout_rng,
+                                  const int step,
+                                  const int* sequence_lengths) {
+  typedef typename accum_type<T>::type Acc;
+
+  __shared__ Acc partial[4][kLayerNormThreads / 32];
+
+  const int col = blockIdx.x;
+  const int stride4_base_idx = col * (hidden_dim * 4);
+  T* cache = ln_cache + col * (hidden_dim * 8);
+
+  // Like `PointwiseOperations`, but none of the gradient reaches the gains and biases
+  // either.
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+      const int base_idx = col * hidden_dim + row;
+      const Acc dc_new_value = dc_new ? dc_new[base_idx] : static_cast<Acc>(0.0);
+      dh_inout[base_idx] = T(Acc(dh_new[col * h_stride + row]) + Acc(dh_inout[base_idx]));
+      dc_inout[base_idx] = dc_new_value + dc_inout[base_idx];
+      #pragma unroll
+      for (int k = 0; k < 4; ++k) {
+        const int idx = PackedGateColumn(k, row, hidden_dim, 4, Interleaved);
+        dv_out[stride4_base_idx + idx] = static_cast<T>(0.0);
+        cache[idx] = static_cast<T>(0.0);
+        cache[hidden_dim * 4 + idx] = static_cast<T>(0.0);
+      }
+    }
+    return;
+  }
+
+  // The reciprocal standard deviations are overwritten below.
+  Acc rstd[4];
+  #pragma unroll
+  for (int k = 0; k < 4; ++k)
+    rstd[k] = Acc(cache[hidden_dim * 4 + k]);
+  __syncthreads();
+
+  // Each thread revisits the same units in both passes, so it only ever reads back the
+  // `da` that it wrote to `dv_out` itself.
+  const T* gamma = layer_norm;
+  Acc sum[4];
+  Acc sum_xhat[4];
+  #pragma unroll
+  for (int k = 0; k < 4; ++k) {
+    sum[k] = static_cast<Acc>(0.0);
+    sum_xhat[k] = static_cast<Acc>(0.0);
+  }
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    const int base_idx = col * hidden_dim + row;
+
+    Acc gates[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      gates[k] = Acc(v[stride4_base_idx + PackedGateColumn(k, row, hidden_dim, 4, Interleaved)]);
+
+    Acc peep[3];
+    #pragma unroll
+    for (int k = 0; k < 3; ++k)
+      peep[k] = Cell::kPeephole ? Acc(peephole[k * hidden_dim + row]) : static_cast<Acc>(0.0);
+
+    Acc mask = static_cast<Acc>(0.0);
+    if (ApplyZoneout) {
+      mask = zoneout_mask
+          ? Acc(zoneout_mask[base_idx])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + base_idx);
+    }
+
+    const Acc dh_total = Acc(dh_new[col * h_stride + row]) + Acc(dh_inout[base_idx]);
+    const Acc dc_total = (dc_new ? dc_new[base_idx] : static_cast<Acc>(0.0)) + dc_inout[base_idx];
+
+    Acc dh_prev;
+    Acc dc_prev;
+    Acc da[4];
+    LstmCellGrad<Acc, Cell, ApplyZoneout>(
+        gates, peep, c[base_idx], c_new[base_idx], dh_total, dc_total, mask, &dh_prev, &dc_prev, da);
+
+    dh_inout[base_idx] = T(dh_prev);
+    dc_inout[base_idx] = dc_prev;
+    #pragma unroll
+    for (int k = 0; k < 4; ++k) {
+      const int idx = PackedGateColumn(k, row, hidden_dim, 4, Interleaved);
+      const Acc dxhat = da[k] * Acc(gamma[idx]);
+      dv_out[stride4_base_idx + idx] = T(da[k]);
+      sum[k] += dxhat;
+      sum_xhat[k] += dxhat * Acc(cache[idx]);
+    }
+  }
+  BlockSum<4>(sum, partial);
+  BlockSum<4>(sum_xhat, partial);
+
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    #pragma unroll
+    for (int k = 0; k < 4; ++k) {
+      const int idx = PackedGateColumn(k, row, hidden_dim, 4, Interleaved);
+      const Acc da = Acc(dv_out[stride4_base_idx + idx]);
+      const Acc xhat = Acc(cache[idx]);
+      const Acc dxhat = da * Acc(gamma[idx]);
+      dv_out[stride4_base_idx + idx] = T(rstd[k] * (dxhat - (sum[k] + xhat * sum_xhat[k]) / hidden_dim));
+      cache[idx] = T(da * xhat);
+      cache[hidden_dim * 4 + idx] = T(da);
+    }
+  }
+}
+
+// Launches the `LayerNormPointwiseOperations` instantiation for `Cell` and `Interleaved`.
+template<typename T, typename Cell, bool Interleaved>
+void LaunchLayerNormKernel(
+    const bool apply_zoneout,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* peephole,
+    const T* layer_norm,
+    const accum_t<T>* c,
+    const T* v,
+    const accum_t<T>* c_new,
+    const T* dh_new,
+    const accum_t<T>* dc_new,
+    T* dh,
+    accum_t<T>* dc,
+    T* dv,
+    T* ln_cache,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const auto kernel = apply_zoneout
+      ? LayerNormPointwiseOperations<T, Cell, Interleaved, true>
+      : LayerNormPointwiseOperations<T, Cell, Interleaved, false>;
+  kernel<<<batch_size, LayerNormBlockSize(hidden_size), 0, stream>>>(
+      batch_size,
+      hidden_size,
+      h_stride,
+      peephole,
+      layer_norm,
+      c,
+      v,
+      c_new,
+      dh_new,
+      dc_new,
+      dh,
+      dc,
+      dv,
+      ln_cache,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths);
+}
+
+// Launches the pointwise operations of the cell variant `Cell` for one time step of the
+// whole batch like `LaunchPointwiseOperations`, with layer normalization if `cell` has
+// it. `cell.layer_norm_cache` is indexed by `step`.
+template<typename T, typename Cell>
+void LaunchCellOperations(
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const accum_t<T>* c,
+    const T* v,
+    const accum_t<T>* c_new,
+    const T* dh_new,
+    const accum_t<T>* dc_new,
+    T* dh,
+    accum_t<T>* dc,
+    T* dv,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const CellConfig<T>& cell,
+    const cudaStream_t& stream) {
+  const bool apply_zoneout = zoneout_mask || (zoneout_rng.enabled && zoneout_rng.prob);
+
+  if (cell.layer_norm) {
+    const auto launch = interleaved
+        ? LaunchLayerNormKernel<T, Cell, true>
+        : LaunchLayerNormKernel<T, Cell, false>;
+    launch(
+        apply_zoneout,
+        batch_size,
+        hidden_size,
+        h_stride,
+        cell.peephole,
+        cell.layer_norm,
+        c,
+        v,
+        c_new,
+        dh_new,
+        dc_new,
+        dh,
+        dc,
+        dv,
+        cell.layer_norm_cache + static_cast<size_t>(step) * batch_size * hidden_size * 8,
+        zoneout_mask,
+        zoneout_rng,
+        step,
+        sequence_lengths,
+        stream);
+    return;
+  }
+
+  const int units = PointwiseVectorWidth<T>(
+      hidden_size,
+      h_stride,
+      { cell.peephole, v, dh_new, dh, dv, zoneout_mask },
+      { c, c_new, dc_new, dc });
+  const auto launch = interleaved
+      ? (units == 4 ? LaunchPointwiseKernel<T, T, 4, true, Cell>
+       : units == 2 ? LaunchPointwiseKernel<T, T, 2, true, Cell>
+       :              LaunchPointwiseKernel<T, T, 1, true, Cell>)
+      : (units == 4 ? LaunchPointwiseKernel<T, T, 4, false, Cell>
+       : units == 2 ? LaunchPointwiseKernel<T, T, 2, false, Cell>
+       :              LaunchPointwiseKernel<T, T, 1, false, Cell>);
+  launch(
+      apply_zoneout,
+      batch_size,
+      hidden_size,
+      h_stride,
+      cell.peephole,
+      c,
+      v,
+      c_new,
+      dh_new,
+      dc_new,
+      dh,
+      dc,
+      dv,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths,
+      stream);
+}
+
+// `LaunchPointwiseOperations` for the cell variant `cell`.
+template<typename T>
+void LaunchPointwiseOperations(
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const accum_t<T>* c,
+    const T* v,
+    const accum_t<T>* c_new,
+    const T* dh_new,
+    const accum_t<T>* dc_new,
+    T* dh,
+    accum_t<T>* dc,
+    T* dv,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const CellConfig<T>& cell,
+    const cudaStream_t& stream) {
+  const auto launch = cell.peephole
+      ? (cell.coupled ? LaunchCellOperations<T, CellPolicy<true, true>> : LaunchCellOperations<T, CellPolicy<true, false>>)
+      : (cell.coupled ? LaunchCellOperations<T, CellPolicy<false, true>> : LaunchCellOperations<T, StandardCell>);
+  launch(
+      batch_size,
+      hidden_size,
+      h_stride,
+      interleaved,
+      c,
+      v,
+      c_new,
+      dh_new,
+      dc_new,
+      dh,
+      dc,
+      dv,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths,
+      cell,
+      stream);
+}
+
+// Tile of `FusedRecurrenceGrad`: each block computes the recurrent GEMM for
+// `kFusedUnits` hidden units of `kFusedRows` batch items, `kFusedK` gate columns at a
+// time, and applies the pointwise operations to the result in registers.
+constexpr int kFusedUnits = 32;
+constexpr int kFusedRowThreads = 8;
+constexpr int kFusedRowsPerThread = 2;
+constexpr int kFusedRows = kFusedRowThreads * kFusedRowsPerThread;
+constexpr int kFusedK = 16;
+
+// One time step of the backward recurrence that folds the previous iteration's
+// `dh += R_t·dv` GEMM into the pointwise operations: same as that GEMM followed by
+// `PointwiseOperations` with V=T, U=1. `dv_prev` is the gradient of the later time
+// step's gate pre-activations (null for the last time step) and must not be aliased
+// with `dv_out`; its rows from `active_batch` onwards are zero and skipped. `v` and
+// `dv_out` may be aliased.
+template<typename T, bool Packed, bool Interleaved, bool ApplyZoneout>
+__global__
+void FusedRecurrenceGrad(const int batch_dim,
+                         const int active_batch,
+                         const int hidden_dim,
+                         const int h_stride,  // Distance between batch items in `dh_new`
+                         const T* R_t,  // [H*4,H], or R [H,H*4] if `Packed`
+                         const T* dv_prev,  // [N,H*4]
+                         const accum_t<T>* c,
+                         const T* v,
+                         const accum_t<T>* c_new,
+                         const T* dh_new,
+                         const accum_t<T>* dc_new,  // May be null if there's no gradient for `c_new`
+                         T* dh_inout,
+                         accum_t<T>* dc_inout,
+                         T* dv_out,
+                         const T* zoneout_mask,  // Zoneout mask (only used if ApplyZoneout==true), may be null
+                         const ZoneoutRng zoneout_rng,  // Regenerates the mask if `zoneout_mask` is null
+                         const int step,
+                         const int* sequence_lengths) {  // May be null
+  typedef typename accum_type<T>::type Acc;
+
+  __shared__ T R_tile[kFusedK][kFusedUnits];
+  __shared__ T dv_tile[kFusedRows][kFusedK + 1];
+
+  const int threads = kFusedUnits * kFusedRowThreads;
+  const int tid = threadIdx.y * kFusedUnits + threadIdx.x;
+  const int unit_base = blockIdx.x * kFusedUnits;
+  const int row_base = blockIdx.y * kFusedRows;
+  const int unit = unit_base + threadIdx.x;
+  const int cols = hidden_dim * 4;
+
+  Acc dh_recurrent[kFusedRowsPerThread];
+  #pragma unroll
+  for (int r = 0; r < kFusedRowsPerThread; ++r)
+    dh_recurrent[r] = static_cast<Acc>(0.0);
+
+  // `row_base` is the same for the whole block, so the barriers are safe.
+  if (dv_prev && row_base < active_batch) {
+    for (int k_base = 0; k_base < cols; k_base += kFusedK) {
+      // Consecutive threads read consecutive elements of `R_t` or `R`.
+      for (int e = tid; e < kFusedK * kFusedUnits; e += threads) {
+        const int kk = Packed ? e % kFusedK : e / kFusedUnits;
+        const int u = Packed ? e / kFusedK : e % kFusedUnits;
+        const bool valid = k_base + kk < cols && unit_base + u < hidden_dim;
+        const size_t idx = Packed
+            ? static_cast<size_t>(unit_base + u) * cols + k_base + kk
+            : static_cast<size_t>(k_base + kk) * hidden_dim + unit_base + u;
+        R_tile[kk][u] = valid ? R_t[idx] : static_cast<T>(0.0);
+      }
+      for (int e = tid; e < kFusedRows * kFusedK; e += threads) {
+        const int r = e / kFusedK;
+        const int kk = e - r * kFusedK;
+        const int n = row_base + r;
+        const bool valid = n < active_batch && k_base + kk < cols;
+        dv_tile[r][kk] = valid ? dv_prev[static_cast<size_t>(n) * cols + k_base + kk] : static_cast<T>(0.0);
+      }
+      __syncthreads();
+
+      #pragma unroll
+      for (int kk = 0; kk < kFusedK; ++kk) {
+        const Acc R_value = Acc(R_tile[kk][threadIdx.x]);
+        #pragma unroll
+        for (int r = 0; r < kFusedRowsPerThread; ++r)
+          dh_recurrent[r] += Acc(dv_tile[threadIdx.y + r * kFusedRowThreads][kk]) * R_value;
+      }
+      __syncthreads();
+    }
   }
 
-  const T do_ = c_tanh * dh_total;
-  const T dc_tanh = o * dh_total;
-          dc_total += d_tanh(c_tanh) * dc_tanh;
-  const T df = c[base_idx] * dc_total;
-  const T dc = f * dc_total;
-  const T di = g * dc_total;
-  const T dg = i * dc_total;
-  const T dv_g = d_tanh(g) * dg;
-  const T dv_o = d_sigmoid(o) * do_;
-  const T dv_i = d_sigmoid(i) * di;
-  const T dv_f = d_sigmoid(f) * df;
+  if (unit >= hidden_dim)
+    return;
+
+  #pragma unroll
+  for (int r = 0; r < kFusedRowsPerThread; ++r) {
+    const int n = row_base + threadIdx.y + r * kFusedRowThreads;
+    if (n >= batch_dim)
+      break;
+
+    const int base_idx = n * hidden_dim + unit;
+    const int dh_new_idx = n * h_stride + unit;
+    const Acc dh_total = Acc(dh_new[dh_new_idx]) + Acc(dh_inout[base_idx]) + dh_recurrent[r];
+    const Acc dc_total = (dc_new ? dc_new[base_idx] : static_cast<Acc>(0.0)) + dc_inout[base_idx];
+
+    int gate_idx[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      gate_idx[k] = n * cols + (Interleaved ? unit * 4 + k : k * hidden_dim + unit);
+
+    // The forward pass copied the state through for items past the end of their
+    // sequence, so the whole gradient flows to the previous step.
+    if (sequence_lengths && step >= sequence_lengths[n]) {
+      dh_inout[base_idx] = T(dh_total);
+      dc_inout[base_idx] = dc_total;
+      #pragma unroll
+      for (int k = 0; k < 4; ++k)
+        dv_out[gate_idx[k]] = static_cast<T>(0.0);
+      continue;
+    }
+
+    Acc gates[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      gates[k] = Acc(v[gate_idx[k]]);
+
+    Acc mask = static_cast<Acc>(0.0);
+    if (ApplyZoneout) {
+      mask = zoneout_mask
+          ? Acc(zoneout_mask[base_idx])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + base_idx);
+    }
+
+    Acc dh_prev;
+    Acc dc_prev;
+    Acc dv[4];
+    LstmCellGrad<Acc, StandardCell, ApplyZoneout>(
+        gates, nullptr, c[base_idx], c_new[base_idx], dh_total, dc_total, mask, &dh_prev, &dc_prev, dv);
 
-  // TODO: performance optimization opportunity on this reduce operation.
-  atomicAdd(&db_out[row + 0 * hidden_dim], dv_i);
-  atomicAdd(&db_out[row + 1 * hidden_dim], dv_g);
-  atomicAdd(&db_out[row + 2 * hidden_dim], dv_f);
-  atomicAdd(&db_out[row + 3 * hidden_dim], dv_o);
+    dh_inout[base_idx] = T(dh_prev);
+    dc_inout[base_idx] = dc_prev;
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      dv_out[gate_idx[k]] = T(dv[k]);
+  }
+}
+
+// Launches `FusedRecurrenceGrad` for one time step of the whole batch.
+template<typename T>
+void LaunchFusedRecurrenceGrad(
+    const int batch_size,
+    const int active_batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool packed,
+    const bool interleaved,
+    const T* R_t,
+    const T* dv_prev,
+    const accum_t<T>* c,
+    const T* v,
+    const accum_t<T>* c_new,
+    const T* dh_new,
+    const accum_t<T>* dc_new,
+    T* dh,
+    accum_t<T>* dc,
+    T* dv,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const bool apply_zoneout = zoneout_mask || (zoneout_rng.enabled && zoneout_rng.prob);
 
-  dc_inout[base_idx] = dc;
+  const auto kernel = packed
+      ? (interleaved
+          ? (apply_zoneout ? FusedRecurrenceGrad<T, true, true, true> : FusedRecurrenceGrad<T, true, true, false>)
+          : (apply_zoneout ? FusedRecurrenceGrad<T, true, false, true> : FusedRecurrenceGrad<T, true, false, false>))
+      : (interleaved
+          ? (apply_zoneout ? FusedRecurrenceGrad<T, false, true, true> : FusedRecurrenceGrad<T, false, true, false>)
+          : (apply_zoneout ? FusedRecurrenceGrad<T, false, false, true> : FusedRecurrenceGrad<T, false, false, false>));
 
-  dv_out[i_idx] = dv_i;
-  dv_out[g_idx] = dv_g;
-  dv_out[f_idx] = dv_f;
-  dv_out[o_idx] = dv_o;
+  const dim3 blockDim(kFusedUnits, kFusedRowThreads);
+  const dim3 gridDim(
+      (hidden_size + kFusedUnits - 1) / kFusedUnits,
+      (batch_size + kFusedRows - 1) / kFusedRows);
+  kernel<<<gridDim, blockDim, 0, stream>>>(
+      batch_size,
+      active_batch_size,
+      hidden_size,
+      h_stride,
+      R_t,
+      dv_prev,
+      c,
+      v,
+      c_new,
+      dh_new,
+      dc_new,
+      dh,
+      dc,
+      dv,
+      apply_zoneout ? zoneout_mask : nullptr,
+      zoneout_rng,
+      step,
+      sequence_lengths);
 }
 
 }  // anonymous namespace
@@ -107,8 +859,24 @@ struct BackwardPass<T>::private_data {
   int input_size;
   int hidden_size;
   cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
   cudaStream_t stream[3];
   cudaEvent_t event;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+  GraphCache graph;
+  ZoneoutRng zoneout_rng;
+  bool packed;  // Set by the `PackedWeights` overloads for the duration of a call.
+  DropConnectConfig<T> dropconnect;
+  GateLayout gate_layout;
+  SequenceLayout sequence_layout;
+  bool fused;
+  bool accumulate;
+  int gradient_chunk;
+  GradientHook gradient_hook;
+  CellConfig<T> cell;
+  PhaseProfiler profiler;
+  ForwardPass<T>* recompute;  // Created by the first call to `RunCheckpointed`.
 };
 
 template<typename T>
@@ -116,22 +884,37 @@ BackwardPass<T>::BackwardPass(
     const int batch_size,
     const int input_size,
     const int hidden_size,
-    const cublasHandle_t& blas_handle) : data_(new private_data) {
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
   data_->batch_size = batch_size;
   data_->input_size = input_size;
   data_->hidden_size = hidden_size;
   data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  data_->zoneout_rng = ZoneoutRng();
+  data_->packed = false;
+  data_->dropconnect = DropConnectConfig<T>();
+  data_->gate_layout = GateLayout::kBlocked;
+  data_->sequence_layout = SequenceLayout();
+  data_->fused = false;
+  data_->accumulate = true;
+  data_->gradient_chunk = 0;
+  data_->cell = CellConfig<T>();
+  data_->recompute = nullptr;
+  data_->profiler.SetName("lstm::BackwardPass");
   cudaStreamCreate(&data_->stream[0]);
   cudaStreamCreate(&data_->stream[1]);
   cudaStreamCreate(&data_->stream[2]);
   cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
 }
 
 template<typename T>
 BackwardPass<T>::~BackwardPass() {
-  cudaStreamSynchronize(data_->stream[2]);
-  cudaStreamSynchronize(data_->stream[1]);
-  cudaStreamSynchronize(data_->stream[0]);
+  delete data_->recompute;
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
   cudaEventDestroy(data_->event);
   cudaStreamDestroy(data_->stream[2]);
   cudaStreamDestroy(data_->stream[1]);
@@ -139,6 +922,99 @@ BackwardPass<T>::~BackwardPass() {
   delete data_;
 }
 
+template<typename T>
+void BackwardPass<T>::EnableGraphCapture() {
+  data_->graph.Enable();
+}
+
+template<typename T>
+void BackwardPass<T>::EnableFusedRecurrence() {
+  data_->fused = true;
+}
+
+template<typename T>
+void BackwardPass<T>::EnablePhaseTiming() {
+  data_->profiler.EnableTiming();
+}
+
+template<typename T>
+PhaseStats BackwardPass<T>::CollectPhaseStats() {
+  return data_->profiler.Collect();
+}
+
+template<typename T>
+void BackwardPass<T>::SetZoneoutSeed(
+    const float zoneout_prob,
+    const unsigned long long seed,
+    const unsigned long long offset) {
+  data_->zoneout_rng.enabled = true;
+  data_->zoneout_rng.prob = zoneout_prob;
+  data_->zoneout_rng.seed = seed;
+  data_->zoneout_rng.offset = offset;
+}
+
+template<typename T>
+void BackwardPass<T>::SetDropConnect(
+    const float rate,
+    const unsigned long long seed,
+    const unsigned long long offset,
+    T* tmp_R) {
+  data_->dropconnect.rate = rate;
+  data_->dropconnect.seed = seed;
+  data_->dropconnect.offset = offset;
+  data_->dropconnect.tmp_R = tmp_R;
+}
+
+template<typename T>
+void BackwardPass<T>::SetGateLayout(const GateLayout layout) {
+  data_->gate_layout = layout;
+}
+
+template<typename T>
+void BackwardPass<T>::SetSequenceLayout(const SequenceLayout& layout) {
+  data_->sequence_layout = layout;
+}
+
+template<typename T>
+void BackwardPass<T>::SetPeephole(const T* P, T* dP) {
+  data_->cell.peephole = P;
+  data_->cell.dpeephole = dP;
+}
+
+template<typename T>
+void BackwardPass<T>::SetCoupledGates(const bool coupled) {
+  data_->cell.coupled = coupled;
+}
+
+template<typename T>
+void BackwardPass<T>::SetLayerNorm(const T* layer_norm, T* layer_norm_cache, T* dlayer_norm) {
+  data_->cell.layer_norm = layer_norm;
+  data_->cell.layer_norm_cache = layer_norm_cache;
+  data_->cell.dlayer_norm = dlayer_norm;
+}
+
+template<typename T>
+void BackwardPass<T>::SetAccumulateGradients(const bool accumulate) {
+  data_->accumulate = accumulate;
+}
+
+template<typename T>
+void BackwardPass<T>::SetWeightGradientChunk(const int steps) {
+  data_->gradient_chunk = steps;
+}
+
+template<typename T>
+void BackwardPass<T>::SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data) {
+  data_->gradient_hook.SetCallback(callback, user_data);
+}
+
+#ifdef HASTE_WITH_NCCL
+template<typename T>
+bool BackwardPass<T>::SetGradientAllReduce(const ncclComm_t& comm) {
+  return data_->gradient_hook.template SetAllReduce<T>(comm);
+}
+#endif
+
 template<typename T>
 void BackwardPass<T>::Iterate(
     const T* W_t,     // [H*4,C]
@@ -146,16 +1022,16 @@ void BackwardPass<T>::Iterate(
     const T* b,       // [H*4]
     const T* x_t,     // [C,N]
     const T* h,       // [N,H]
-    const T* c,       // [N,H]
-    const T* c_new,   // [N,H]
+    const accum_t<T>* c,  // [N,H]
+    const accum_t<T>* c_new,  // [N,H]
     const T* dh_new,  // [N,H]
-    const T* dc_new,  // [N,H]
+    const accum_t<T>* dc_new,  // [N,H]
     T* dx,            // [N,C]
     T* dW,            // [C,H*4]
     T* dR,            // [H,H*4]
     T* db,            // [H*4]
     T* dh,            // [N,H]
-    T* dc,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
     T* v,             // [N,H*4]
     const T* zoneout_mask) {
   const T alpha = static_cast<T>(1.0);
@@ -166,6 +1042,7 @@ void BackwardPass<T>::Iterate(
   const int input_size = data_->input_size;
   const int hidden_size = data_->hidden_size;
   const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
   const cudaStream_t stream2 = data_->stream[1];
   const cudaStream_t stream3 = data_->stream[2];
   const cudaEvent_t event = data_->event;
@@ -173,23 +1050,36 @@ void BackwardPass<T>::Iterate(
   cudaStream_t save_stream;
   cublasGetStream(blas_handle, &save_stream);
 
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kRecurrence, stream1);
   IterateInternal(
       R_t,
       c,
       c_new,
       dh_new,
       dc_new,
-      db,
       dh,
       dc,
       v,
-      zoneout_mask);
+      zoneout_mask,
+      0,
+      data_->batch_size,
+      nullptr,
+      data_->hidden_size);
+  profiler.End(Phase::kRecurrence, stream1);
 
   // Wait for pointwise operations to complete since there's a
   // data dependency between its output (`v`) and the following matmuls.
   cudaStreamWaitEvent(stream2, event, 0);
   cudaStreamWaitEvent(stream3, event, 0);
 
+  profiler.Begin(Phase::kInputProjection, stream2);
   cublasSetStream(blas_handle, stream2);
   blas<T>::gemm(blas_handle,
       CUBLAS_OP_N, CUBLAS_OP_N,
@@ -199,6 +1089,16 @@ void BackwardPass<T>::Iterate(
       v, hidden_size * 4,
       &beta_assign,
       dx, input_size);
+  profiler.End(Phase::kInputProjection, stream2);
+
+  // The bias gradient is the column sum of `dv`. Reducing it here instead of with
+  // atomics in the pointwise kernel makes it deterministic.
+  profiler.Begin(Phase::kWeightGradient, stream3);
+  AddColumnSums(batch_size, hidden_size * 4, v, db, stream3);
+  if (data_->cell.enabled()) {
+    LaunchCellGradients(batch_size, hidden_size, data_->gate_layout == GateLayout::kInterleaved,
+        true, data_->cell, c, c_new, v, stream3);
+  }
 
   cublasSetStream(blas_handle, stream3);
   blas<T>::gemm(blas_handle,
@@ -219,6 +1119,15 @@ void BackwardPass<T>::Iterate(
       x_t, batch_size,
       &beta_sum,
       dW, hidden_size * 4);
+  profiler.End(Phase::kWeightGradient, stream3);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream3);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
 
   cublasSetStream(blas_handle, save_stream);
 }
@@ -226,15 +1135,18 @@ void BackwardPass<T>::Iterate(
 template<typename T>
 void BackwardPass<T>::IterateInternal(
     const T* R_t,     // [H*4,H]
-    const T* c,       // [N,H]
-    const T* c_new,   // [N,H]
+    const accum_t<T>* c,  // [N,H]
+    const accum_t<T>* c_new,  // [N,H]
     const T* dh_new,  // [N,H]
-    const T* dc_new,  // [N,H]
-    T* db,            // [H*4]
+    const accum_t<T>* dc_new,  // [N,H]
     T* dh,            // [N,H]
-    T* dc,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
     T* v,             // [N,H*4]
-    const T* zoneout_mask) {
+    const T* zoneout_mask,
+    const int step,
+    const int active_batch_size,
+    const int* sequence_lengths,  // [N]
+    const int h_stride) {
   const T alpha = static_cast<T>(1.0);
   const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
 
@@ -243,59 +1155,158 @@ void BackwardPass<T>::IterateInternal(
   const cublasHandle_t blas_handle = data_->blas_handle;
   const cudaStream_t stream1 = data_->stream[0];
   const cudaEvent_t event = data_->event;
+  const bool packed = data_->packed;  // `R_t` is `R` for the `PackedWeights` overloads.
+  const bool interleaved = data_->gate_layout == GateLayout::kInterleaved;
 
-  // Compute launch configuration for pointwise operations kernel.
-  const dim3 blockDim(64, 16);
-  const dim3 gridDim(
-      (hidden_size + blockDim.x - 1) / blockDim.x,
-      (batch_size + blockDim.y - 1) / blockDim.y);
-
-  if (zoneout_mask) {
-    PointwiseOperations<T, true><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size,
-        hidden_size,
-        c,
-        v,
-        c_new,
-        dh_new,
-        dc_new,
-        db,
-        dh,
-        dc,
-        v,
-        zoneout_mask
-    );
-  } else {
-    PointwiseOperations<T, false><<<gridDim, blockDim, 0, stream1>>>(
-        batch_size,
-        hidden_size,
-        c,
-        v,
-        c_new,
-        dh_new,
-        dc_new,
-        db,
-        dh,
-        dc,
-        v,
-        nullptr
-    );
-  }
+  data_->profiler.Begin(Phase::kPointwise, stream1);
+  LaunchPointwiseOperations(
+      batch_size,
+      hidden_size,
+      h_stride,
+      interleaved,
+      c,
+      v,
+      c_new,
+      dh_new,
+      dc_new,
+      dh,
+      dc,
+      v,
+      zoneout_mask,
+      data_->zoneout_rng,
+      step,
+      sequence_lengths,
+      data_->cell,
+      stream1);
+  data_->profiler.End(Phase::kPointwise, stream1);
 
   // Signal completion of pointwise operations for data-dependent streams.
   cudaEventRecord(event, stream1);
 
   cublasSetStream(blas_handle, stream1);
   blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size, batch_size, hidden_size * 4,
+      packed ? CUBLAS_OP_T : CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size, active_batch_size, hidden_size * 4,
       &alpha,
-      R_t, hidden_size,
+      R_t, packed ? hidden_size * 4 : hidden_size,
       v, hidden_size * 4,
       &beta_sum,
       dh, hidden_size);
 }
 
+template<typename T>
+void BackwardPass<T>::WeightGradients(
+    const int first_step,
+    const int steps,
+    const int total_steps,
+    const bool accumulate,
+    const T* W_t,     // [H*4,C]
+    const T* x_t,     // [C,T,N]
+    const T* h,       // [T+1,N,H]
+    const T* v,       // [T,N,H*4]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*4]
+    T* dR,            // [H,H*4]
+    T* db) {          // [H*4]
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+  const T* beta_weights = accumulate ? &beta_sum : &beta_assign;
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaStream_t stream3 = data_->stream[2];
+  const cudaEvent_t event = data_->event;
+  const bool packed = data_->packed;
+  const cublasOperation_t op_t = packed ? CUBLAS_OP_T : CUBLAS_OP_N;
+  const SequenceStrides strides(data_->sequence_layout, total_steps, batch_size, input_size, hidden_size);
+
+  // `x_t` is [C,T,N] unless `packed`, when it's `x` as laid out by `strides`.
+  const int rows = batch_size * steps;
+  const T* v_chunk = v + first_step * batch_size * hidden_size * 4;
+  const T* x_chunk = packed
+      ? x_t + first_step * strides.x_step
+      : x_t + first_step * batch_size;
+
+  cudaEventRecord(event, stream1);
+  cudaStreamWaitEvent(stream2, event, 0);
+  cudaStreamWaitEvent(stream3, event, 0);
+
+  data_->profiler.Begin(Phase::kWeightGradient, stream3);
+  StoreColumnSums(rows, hidden_size * 4, accumulate, v_chunk, db, stream3);
+  data_->profiler.End(Phase::kWeightGradient, stream3);
+
+  data_->profiler.Begin(Phase::kWeightGradient, stream2);
+  cublasSetStream(blas_handle, stream2);
+  if (packed) {
+    StepwiseSumGemm(blas_handle,
+        hidden_size * 4, input_size,
+        steps, batch_size,
+        &alpha,
+        v_chunk,
+        x_chunk, strides.x_ld, strides.x_step,
+        beta_weights,
+        dW, hidden_size * 4);
+  } else {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, op_t,
+        hidden_size * 4, input_size, rows,
+        &alpha,
+        v_chunk, hidden_size * 4,
+        x_chunk, batch_size * total_steps,
+        beta_weights,
+        dW, hidden_size * 4);
+  }
+
+  StepwiseSumGemm(blas_handle,
+      hidden_size * 4, hidden_size,
+      steps, batch_size,
+      &alpha,
+      v_chunk,
+      h + strides.In(first_step) * strides.h_step, strides.h_ld, strides.h_step,
+      beta_weights,
+      dR, hidden_size * 4);
+  data_->profiler.End(Phase::kWeightGradient, stream2);
+
+  data_->profiler.Begin(Phase::kInputProjection, stream2);
+  StepwiseGemm(blas_handle,
+      op_t,
+      input_size, hidden_size * 4,
+      steps, batch_size,
+      &alpha,
+      W_t, packed ? hidden_size * 4 : input_size,
+      v_chunk, hidden_size * 4, static_cast<size_t>(batch_size) * hidden_size * 4,
+      &beta_assign,
+      dx + first_step * strides.x_step, strides.x_ld, strides.x_step);
+  data_->profiler.End(Phase::kInputProjection, stream2);
+}
+
+template<typename T>
+void BackwardPass<T>::GradientsReady(const cudaStream_t& stream, T* dW, T* dR, T* db) {
+  const size_t input_size = data_->input_size;
+  const size_t hidden_size = data_->hidden_size;
+  const CellConfig<T>& cell = data_->cell;
+  T* const gradients[] = {
+    dW,
+    dR,
+    db,
+    cell.peephole ? cell.dpeephole : nullptr,
+    cell.layer_norm ? cell.dlayer_norm : nullptr,
+  };
+  const size_t sizes[] = {
+    input_size * hidden_size * 4,
+    hidden_size * hidden_size * 4,
+    hidden_size * 4,
+    hidden_size * 3,
+    hidden_size * 8,
+  };
+  data_->gradient_hook.Signal(0, stream, gradients, sizes, 5);
+}
+
 template<typename T>
 void BackwardPass<T>::Run(
     const int steps,
@@ -304,20 +1315,590 @@ void BackwardPass<T>::Run(
     const T* b,       // [H*4]
     const T* x_t,     // [C,T,N]
     const T* h,       // [T+1,N,H]
-    const T* c,       // [T+1,N,H]
+    const accum_t<T>* c,  // [T+1,N,H]
     const T* dh_new,  // [T+1,N,H]
-    const T* dc_new,  // [T+1,N,H]
+    const accum_t<T>* dc_new,  // [T+1,N,H]
     T* dx,            // [T,N,C]
     T* dW,            // [C,H*4]
     T* dR,            // [H,H*4]
     T* db,            // [H*4]
     T* dh,            // [N,H]
-    T* dc,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
     T* v,            // [T,N,H*4]
-    const T* zoneout_mask) {
+    const T* zoneout_mask,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // Replay the work captured on a previous call with the same arguments, capturing it
+  // first if there's no such call. The capture re-enters `Run` with the graph's stream
+  // standing in for the caller's stream.
+  GraphCache& graph = data_->graph;
+  if (graph.enabled() && !graph.capturing()) {
+    bool captured = graph.Lookup(
+        steps,
+        W_t,
+        R_t,
+        b,
+        x_t,
+        h,
+        c,
+        dh_new,
+        dc_new,
+        dx,
+        dW,
+        dR,
+        db,
+        dh,
+        dc,
+        v,
+        zoneout_mask,
+        data_->zoneout_rng.enabled,
+        data_->zoneout_rng.prob,
+        data_->zoneout_rng.seed,
+        data_->zoneout_rng.offset,
+        data_->dropconnect.rate,
+        data_->dropconnect.seed,
+        data_->dropconnect.offset,
+        data_->dropconnect.tmp_R,
+        data_->packed,
+        data_->gate_layout,
+        data_->sequence_layout.batch_major,
+        data_->sequence_layout.reverse,
+        data_->sequence_layout.h_stride,
+        data_->fused,
+        data_->accumulate,
+        data_->gradient_chunk,
+        data_->cell.peephole,
+        data_->cell.dpeephole,
+        data_->cell.coupled,
+        data_->cell.layer_norm,
+        data_->cell.layer_norm_cache,
+        data_->cell.dlayer_norm,
+        sequence_lengths,
+        GraphKeyArray(batch_sizes, batch_sizes ? steps : 0));
+    if (!captured) {
+      const cudaStream_t sync_stream = data_->sync_stream;
+      data_->sync_stream = graph.BeginCapture();
+      Run(
+          steps,
+          W_t,
+          R_t,
+          b,
+          x_t,
+          h,
+          c,
+          dh_new,
+          dc_new,
+          dx,
+          dW,
+          dR,
+          db,
+          dh,
+          dc,
+          v,
+          zoneout_mask,
+          sequence_lengths,
+          batch_sizes);
+      data_->sync_stream = sync_stream;
+      captured = graph.EndCapture();
+    }
+    if (captured) {
+      // The hook can't be part of the graph, so a replay only signals at the end.
+      graph.Launch(data_->sync_stream);
+      if (data_->gradient_hook.enabled()) {
+        GradientsReady(data_->sync_stream, dW, dR, db);
+        data_->gradient_hook.Join(data_->sync_stream);
+      }
+      return;
+    }
+  }
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+  const T* beta_weights = data_->accumulate ? &beta_sum : &beta_assign;
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaStream_t stream3 = data_->stream[2];
+  const cudaEvent_t event = data_->event;
+  const bool signal_gradients = data_->gradient_hook.enabled() && !data_->graph.capturing();
+
+  // The `PackedWeights` overloads pass `W`, `R` and `x` in place of `W_t`, `R_t` and
+  // `x_t`, and the GEMMs transpose them instead.
+  const bool packed = data_->packed;
+  const cublasOperation_t op_t = packed ? CUBLAS_OP_T : CUBLAS_OP_N;
+  const SequenceStrides strides(data_->sequence_layout, steps, batch_size, input_size, hidden_size);
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // The recurrence runs on the masked `R_t` that the forward pass used.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  const bool apply_dropconnect = dropconnect.rate > 0.0f && dropconnect.tmp_R;
+  if (apply_dropconnect) {
+    LaunchDropConnect(hidden_size, hidden_size * 4, !packed, dropconnect, R_t, dropconnect.tmp_R, stream1);
+    R_t = dropconnect.tmp_R;
+  }
+
+  // With chunking, the GEMMs of the iterations [i, i+chunk) are issued once the
+  // recurrence reaches iteration i. Iteration i computes time step `strides.Step(i)`, so
+  // a chunk's time steps are contiguous either way. The first chunk to be issued is the
+  // only one that may overwrite.
+  const int chunk = data_->gradient_chunk;
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kRecurrence, stream1);
+  const int NH = batch_size * hidden_size;
+  // The fused kernel only knows the standard cell.
+  if (data_->fused && !data_->cell.enabled()) {
+    for (int i = steps - 1; i >= 0; --i) {
+      const bool last = i == steps - 1;
+      const int t = strides.Step(i, steps);
+      const int t_prev = last ? t : strides.Step(i + 1, steps);
+      LaunchFusedRecurrenceGrad(
+          batch_size,
+          last ? 0 : (batch_sizes ? batch_sizes[t_prev] : batch_size),
+          hidden_size,
+          strides.h_ld,
+          packed,
+          data_->gate_layout == GateLayout::kInterleaved,
+          R_t,
+          last ? nullptr : v + t_prev * NH * 4,
+          c + strides.In(t) * NH,
+          v + t * NH * 4,
+          c + strides.Out(t) * NH,
+          dh_new + strides.Out(t) * strides.h_step,
+          dc_new + strides.Out(t) * NH,
+          dh,
+          dc,
+          v + t * NH * 4,
+          zoneout_mask ? zoneout_mask + t * NH : nullptr,
+          data_->zoneout_rng,
+          t,
+          sequence_lengths,
+          stream1);
+      if (chunk && i % chunk == 0) {
+        const int count = std::min(chunk, steps - i);
+        WeightGradients(strides.reverse ? steps - i - count : i, count, steps,
+            data_->accumulate || i + chunk < steps, W_t, x_t, h, v, dx, dW, dR, db);
+      }
+    }
+
+    // The first time step's recurrent gradient still has to reach `dh`.
+    const int t_first = strides.Step(0, steps);
+    cublasSetStream(blas_handle, stream1);
+    blas<T>::gemm(blas_handle,
+        op_t, CUBLAS_OP_N,
+        hidden_size, batch_sizes ? batch_sizes[t_first] : batch_size, hidden_size * 4,
+        &alpha,
+        R_t, packed ? hidden_size * 4 : hidden_size,
+        v + t_first * NH * 4, hidden_size * 4,
+        &beta_sum,
+        dh, hidden_size);
+  } else {
+    for (int i = steps - 1; i >= 0; --i) {
+      const int t = strides.Step(i, steps);
+      IterateInternal(
+          R_t,
+          c + strides.In(t) * NH,
+          c + strides.Out(t) * NH,
+          dh_new + strides.Out(t) * strides.h_step,
+          dc_new + strides.Out(t) * NH,
+          dh,
+          dc,
+          v + t * NH * 4,
+          zoneout_mask ? zoneout_mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          strides.h_ld);
+      if (chunk && i % chunk == 0) {
+        const int count = std::min(chunk, steps - i);
+        WeightGradients(strides.reverse ? steps - i - count : i, count, steps,
+            data_->accumulate || i + chunk < steps, W_t, x_t, h, v, dx, dW, dR, db);
+      }
+    }
+  }
+  profiler.End(Phase::kRecurrence, stream1);
+
+  if (data_->cell.enabled()) {
+    cudaEventRecord(event, stream1);
+    cudaStreamWaitEvent(stream3, event, 0);
+    profiler.Begin(Phase::kWeightGradient, stream3);
+    LaunchCellGradients(batch_size * steps, hidden_size, data_->gate_layout == GateLayout::kInterleaved,
+        data_->accumulate, data_->cell, c + strides.In(0) * NH, c + strides.Out(0) * NH, v, stream3);
+    profiler.End(Phase::kWeightGradient, stream3);
+  }
+
+  if (chunk) {
+    // Only the kept elements of `R` took part in the recurrence. `dR` is complete once
+    // the last chunk's GEMMs on `stream2` are.
+    if (apply_dropconnect)
+      LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, dR, dR, stream2);
+
+    // The last chunk's `db` and the cell gradients are on `stream3`.
+    if (signal_gradients) {
+      cudaEventRecord(event, stream2);
+      cudaStreamWaitEvent(stream3, event, 0);
+      GradientsReady(stream3, dW, dR, db);
+    }
+  } else {
+    cudaEventRecord(event, stream1);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    profiler.Begin(Phase::kWeightGradient, stream2);
+    cublasSetStream(blas_handle, stream2);
+    if (packed) {
+      StepwiseSumGemm(blas_handle,
+          hidden_size * 4, input_size,
+          steps, batch_size,
+          &alpha,
+          v,
+          x_t, strides.x_ld, strides.x_step,
+          beta_weights,
+          dW, hidden_size * 4);
+    } else {
+      blas<T>::gemm(blas_handle,
+          CUBLAS_OP_N, op_t,
+          hidden_size * 4, input_size, batch_size * steps,
+          &alpha,
+          v, hidden_size * 4,
+          x_t, batch_size * steps,
+          beta_weights,
+          dW, hidden_size * 4);
+    }
+    profiler.End(Phase::kWeightGradient, stream2);
+
+    cudaStreamWaitEvent(stream3, event, 0);
+    profiler.Begin(Phase::kWeightGradient, stream3);
+    StoreColumnSums(batch_size * steps, hidden_size * 4, data_->accumulate, v, db, stream3);
+    profiler.End(Phase::kWeightGradient, stream3);
+
+    profiler.Begin(Phase::kWeightGradient, stream1);
+    cublasSetStream(blas_handle, stream1);
+    StepwiseSumGemm(blas_handle,
+        hidden_size * 4, hidden_size,
+        steps, batch_size,
+        &alpha,
+        v,
+        h + strides.In(0) * strides.h_step, strides.h_ld, strides.h_step,
+        beta_weights,
+        dR, hidden_size * 4);
+    profiler.End(Phase::kWeightGradient, stream1);
+
+    // Only the kept elements of `R` took part in the recurrence.
+    if (apply_dropconnect)
+      LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, dR, dR, stream1);
+
+    // Signal the weight gradients before `dx` is enqueued behind them on `stream1`.
+    if (signal_gradients) {
+      cudaEventRecord(event, stream1);
+      cudaStreamWaitEvent(stream3, event, 0);
+      cudaEventRecord(event, stream2);
+      cudaStreamWaitEvent(stream3, event, 0);
+      GradientsReady(stream3, dW, dR, db);
+    }
+
+    profiler.Begin(Phase::kInputProjection, stream1);
+    cublasSetStream(blas_handle, stream1);
+    StepwiseGemm(blas_handle,
+        op_t,
+        input_size, hidden_size * 4,
+        steps, batch_size,
+        &alpha,
+        W_t, packed ? hidden_size * 4 : input_size,
+        v, hidden_size * 4, static_cast<size_t>(NH) * 4,
+        &beta_assign,
+        dx, strides.x_ld, strides.x_step);
+    profiler.End(Phase::kInputProjection, stream1);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream3);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  if (signal_gradients)
+    data_->gradient_hook.Join(data_->sync_stream);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void BackwardPass<T>::Run(
+    const int steps,
+    const PackedWeights<T>& weights,
+    const T* x,       // [T,N,C]
+    const T* h,       // [T+1,N,H]
+    const accum_t<T>* c,  // [T+1,N,H]
+    const T* dh_new,  // [T+1,N,H]
+    const accum_t<T>* dc_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*4]
+    T* dR,            // [H,H*4]
+    T* db,            // [H*4]
+    T* dh,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
+    T* v,             // [T,N,H*4]
+    const T* zoneout_mask,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  data_->packed = true;
+  Run(
+      steps,
+      weights.W,
+      weights.R,
+      weights.b,
+      x,
+      h,
+      c,
+      dh_new,
+      dc_new,
+      dx,
+      dW,
+      dR,
+      db,
+      dh,
+      dc,
+      v,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+  data_->packed = false;
+}
+
+template<typename T>
+bool BackwardPass<T>::RunCheckpointed(
+    const int steps,
+    const int checkpoint_interval,
+    const T* W,       // [C,H*4]
+    const T* R,       // [H,H*4]
+    const T* R_t,     // [H*4,H]
+    const T* b,       // [H*4]
+    const T* x,       // [T,N,C]
+    const T* h,       // [T+1,N,H]
+    const accum_t<T>* c,  // [ceil(T/K)+1,N,H]
+    const T* dh_new,  // [T+1,N,H]
+    const accum_t<T>* dc_new,  // [ceil(T/K)+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*4]
+    T* dR,            // [H,H*4]
+    T* db,            // [H*4]
+    T* dh,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
+    accum_t<T>* tmp_c,  // [K,N,H]
+    T* tmp_v,         // [K,N,H*4]
+    T* tmp_h,         // [N,H]
+    T* tmp_Rh,        // [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // The cell variants only have `Run` and `Iterate` kernels.
+  if (data_->cell.enabled())
+    return false;
+
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaStream_t stream3 = data_->stream[2];
+  const cudaEvent_t event = data_->event;
+
+  // The recomputation is ordered against `stream1` just like this pass is ordered
+  // against the caller's stream.
+  if (!data_->recompute) {
+    data_->recompute = new ForwardPass<T>(
+        true,
+        batch_size,
+        input_size,
+        hidden_size,
+        blas_handle,
+        stream1);
+  }
+  // The recomputed segments must zone out the same units as the original forward pass
+  // and lay out their activations the same way.
+  data_->recompute->SetGateLayout(data_->gate_layout);
+  if (data_->zoneout_rng.enabled)
+    data_->recompute->SetZoneoutSeed(
+        data_->zoneout_rng.prob,
+        data_->zoneout_rng.seed,
+        data_->zoneout_rng.offset);
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // The recurrence runs on the masked `R_t` that the forward pass used, and the
+  // recomputation on the matching masked `R`, which follows it in `tmp_R`.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  const bool apply_dropconnect = dropconnect.rate > 0.0f && dropconnect.tmp_R;
+  if (apply_dropconnect) {
+    T* tmp_R = dropconnect.tmp_R + hidden_size * hidden_size * 4;
+    LaunchDropConnect(hidden_size, hidden_size * 4, true, dropconnect, R_t, dropconnect.tmp_R, stream1);
+    LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, R, tmp_R, stream1);
+    R_t = dropconnect.tmp_R;
+    R = tmp_R;
+  }
+
+  const int NH = batch_size * hidden_size;
+  const int segments = (steps + checkpoint_interval - 1) / checkpoint_interval;
+  for (int j = segments - 1; j >= 0; --j) {
+    const int first_step = j * checkpoint_interval;
+    const int segment_steps = std::min(checkpoint_interval, steps - first_step);
+    // The last segment runs first, so it's the one that may overwrite the gradients.
+    const bool accumulate = data_->accumulate || j != segments - 1;
+    const T* beta_weights = accumulate ? &beta_sum : &beta_assign;
+
+    // The previous segment's weight gradients read `tmp_v` on the other streams.
+    cudaEventRecord(event, stream2);
+    cudaStreamWaitEvent(stream1, event, 0);
+    cudaEventRecord(event, stream3);
+    cudaStreamWaitEvent(stream1, event, 0);
+
+    data_->recompute->Recompute(
+        first_step,
+        segment_steps,
+        W,
+        R,
+        b,
+        x,
+        h,
+        c + j * NH,
+        tmp_c,
+        tmp_v,
+        tmp_h,
+        tmp_Rh,
+        zoneout_prob,
+        zoneout_mask,
+        sequence_lengths,
+        batch_sizes);
+
+    // Only the cell states at checkpoints were outputs of the forward pass.
+    for (int i = segment_steps - 1; i >= 0; --i) {
+      const int t = first_step + i;
+      const bool checkpoint = (t + 1) % checkpoint_interval == 0 || t + 1 == steps;
+      IterateInternal(
+          R_t,
+          i ? tmp_c + (i - 1) * NH : c + j * NH,
+          tmp_c + i * NH,
+          dh_new + (t + 1) * NH,
+          checkpoint ? dc_new + (j + 1) * NH : nullptr,
+          dh,
+          dc,
+          tmp_v + i * NH * 4,
+          zoneout_mask ? zoneout_mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          hidden_size);
+    }
+    cudaEventRecord(event, stream1);
+
+    // `x` and `W` aren't transposed here, so the GEMMs transpose them instead.
+    cudaStreamWaitEvent(stream2, event, 0);
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        hidden_size * 4, input_size, batch_size * segment_steps,
+        &alpha,
+        tmp_v, hidden_size * 4,
+        x + first_step * batch_size * input_size, input_size,
+        beta_weights,
+        dW, hidden_size * 4);
+
+    cudaStreamWaitEvent(stream3, event, 0);
+    StoreColumnSums(batch_size * segment_steps, hidden_size * 4, accumulate, tmp_v, db, stream3);
+
+    cublasSetStream(blas_handle, stream1);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        hidden_size * 4, hidden_size, batch_size * segment_steps,
+        &alpha,
+        tmp_v, hidden_size * 4,
+        h + first_step * NH, hidden_size,
+        beta_weights,
+        dR, hidden_size * 4);
+
+    cublasSetStream(blas_handle, stream1);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_T, CUBLAS_OP_N,
+        input_size, batch_size * segment_steps, hidden_size * 4,
+        &alpha,
+        W, hidden_size * 4,
+        tmp_v, hidden_size * 4,
+        &beta_assign,
+        dx + first_step * batch_size * input_size, input_size);
+  }
+
+  // Only the kept elements of `R` took part in the recurrence.
+  if (apply_dropconnect)
+    LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, dR, dR, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream3);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+bool BackwardPass<T>::RunCompact(
+    const int steps,
+    const ActivationStorage storage,
+    const T* W_t,     // [H*4,C]
+    const T* R_t,     // [H*4,H]
+    const T* b,       // [H*4]
+    const T* x_t,     // [C,T,N]
+    const T* h,       // [T+1,N,H]
+    const accum_t<T>* c,  // [T+1,N,H]
+    const T* dh_new,  // [T+1,N,H]
+    const accum_t<T>* dc_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*4]
+    T* dR,            // [H,H*4]
+    T* db,            // [H*4]
+    T* dh,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
+    const void* v,    // [T,N,H*4] in the `storage` format
+    T* tmp_dv,        // [T,N,H*4]
+    const T* zoneout_mask,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // The cell variants only have `Run` and `Iterate` kernels.
+  if (data_->cell.enabled())
+    return false;
+
   const T alpha = static_cast<T>(1.0);
   const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
   const T beta_assign = static_cast<T>(0.0);
+  const T* beta_weights = data_->accumulate ? &beta_sum : &beta_assign;
 
   const int batch_size = data_->batch_size;
   const int input_size = data_->input_size;
@@ -328,62 +1909,833 @@ void BackwardPass<T>::Run(
   const cudaStream_t stream3 = data_->stream[2];
   const cudaEvent_t event = data_->event;
 
+  // The `PackedWeights` overloads pass `W`, `R` and `x` in place of `W_t`, `R_t` and
+  // `x_t`, and the GEMMs transpose them instead.
+  const bool packed = data_->packed;
+  const cublasOperation_t op_t = packed ? CUBLAS_OP_T : CUBLAS_OP_N;
+  const bool interleaved = data_->gate_layout == GateLayout::kInterleaved;
+
   cudaStream_t save_stream;
   cublasGetStream(blas_handle, &save_stream);
 
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // The recurrence runs on the masked `R_t` that the forward pass used.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  const bool apply_dropconnect = dropconnect.rate > 0.0f && dropconnect.tmp_R;
+  if (apply_dropconnect) {
+    LaunchDropConnect(hidden_size, hidden_size * 4, !packed, dropconnect, R_t, dropconnect.tmp_R, stream1);
+    R_t = dropconnect.tmp_R;
+  }
+
+  // The pointwise kernel reads the compact activations and writes full-precision gate
+  // gradients to `tmp_dv`, so the GEMMs below are the same as in `Run`.
+  cublasSetStream(blas_handle, stream1);
   const int NH = batch_size * hidden_size;
   for (int i = steps - 1; i >= 0; --i) {
-    IterateInternal(
-        R_t,
-        c + i * NH,
-        c + (i + 1) * NH,
-        dh_new + (i + 1) * NH,
-        dc_new + (i + 1) * NH,
-        db,
-        dh,
-        dc,
-        v + i * NH * 4,
-        zoneout_mask ? zoneout_mask + i * NH : nullptr);
+    switch (storage) {
+      case ActivationStorage::kHalf:
+        LaunchPointwiseOperations(
+            batch_size,
+            hidden_size,
+            hidden_size,
+            interleaved,
+            c + i * NH,
+            reinterpret_cast<const __half*>(v) + i * NH * 4,
+            c + (i + 1) * NH,
+            dh_new + (i + 1) * NH,
+            dc_new + (i + 1) * NH,
+            dh,
+            dc,
+            tmp_dv + i * NH * 4,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+      case ActivationStorage::kFixed8:
+        LaunchPointwiseOperations(
+            batch_size,
+            hidden_size,
+            hidden_size,
+            interleaved,
+            c + i * NH,
+            reinterpret_cast<const int8_t*>(v) + i * NH * 4,
+            c + (i + 1) * NH,
+            dh_new + (i + 1) * NH,
+            dc_new + (i + 1) * NH,
+            dh,
+            dc,
+            tmp_dv + i * NH * 4,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+    }
+
+    blas<T>::gemm(blas_handle,
+        op_t, CUBLAS_OP_N,
+        hidden_size, batch_sizes ? batch_sizes[i] : batch_size, hidden_size * 4,
+        &alpha,
+        R_t, packed ? hidden_size * 4 : hidden_size,
+        tmp_dv + i * NH * 4, hidden_size * 4,
+        &beta_sum,
+        dh, hidden_size);
   }
   cudaEventRecord(event, stream1);
 
   cudaStreamWaitEvent(stream2, event, 0);
   cublasSetStream(blas_handle, stream2);
   blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
+      CUBLAS_OP_N, op_t,
       hidden_size * 4, input_size, batch_size * steps,
       &alpha,
-      v, hidden_size * 4,
-      x_t, batch_size * steps,
-      &beta_sum,
+      tmp_dv, hidden_size * 4,
+      x_t, packed ? input_size : batch_size * steps,
+      beta_weights,
       dW, hidden_size * 4);
 
   cudaStreamWaitEvent(stream3, event, 0);
+  StoreColumnSums(batch_size * steps, hidden_size * 4, data_->accumulate, tmp_dv, db, stream3);
+
   cublasSetStream(blas_handle, stream1);
   blas<T>::gemm(blas_handle,
       CUBLAS_OP_N, CUBLAS_OP_T,
       hidden_size * 4, hidden_size, batch_size * steps,
       &alpha,
-      v, hidden_size * 4,
+      tmp_dv, hidden_size * 4,
       h, hidden_size,
-      &beta_sum,
+      beta_weights,
       dR, hidden_size * 4);
 
   cublasSetStream(blas_handle, stream1);
   blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
+      op_t, CUBLAS_OP_N,
       input_size, steps * batch_size, hidden_size * 4,
       &alpha,
+      W_t, packed ? hidden_size * 4 : input_size,
+      tmp_dv, hidden_size * 4,
+      &beta_assign,
+      dx, input_size);
+
+  // Only the kept elements of `R` took part in the recurrence.
+  if (apply_dropconnect)
+    LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, dR, dR, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream3);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+bool BackwardPass<T>::RunCompact(
+    const int steps,
+    const ActivationStorage storage,
+    const PackedWeights<T>& weights,
+    const T* x,       // [T,N,C]
+    const T* h,       // [T+1,N,H]
+    const accum_t<T>* c,  // [T+1,N,H]
+    const T* dh_new,  // [T+1,N,H]
+    const accum_t<T>* dc_new,  // [T+1,N,H]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,H*4]
+    T* dR,            // [H,H*4]
+    T* db,            // [H*4]
+    T* dh,            // [N,H]
+    accum_t<T>* dc,   // [N,H]
+    const void* v,    // [T,N,H*4] in the `storage` format
+    T* tmp_dv,        // [T,N,H*4]
+    const T* zoneout_mask,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  data_->packed = true;
+  const bool ok = RunCompact(
+      steps,
+      storage,
+      weights.W,
+      weights.R,
+      weights.b,
+      x,
+      h,
+      c,
+      dh_new,
+      dc_new,
+      dx,
+      dW,
+      dR,
+      db,
+      dh,
+      dc,
+      v,
+      tmp_dv,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+  data_->packed = false;
+  return ok;
+}
+
+template<typename T>
+struct StackedBackwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  std::vector<BackwardPass<T>*> layers;
+  std::vector<cudaEvent_t> layer_events;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+  GradientHook gradient_hook;
+};
+
+template<typename T>
+StackedBackwardPass<T>::StackedBackwardPass(
+    const int layers,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < layers; ++i) {
+    data_->layers.push_back(new BackwardPass<T>(
+        batch_size,
+        i ? hidden_size : input_size,
+        hidden_size,
+        blas_handle,
+        stream));
+    cudaEvent_t event;
+    cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+    data_->layer_events.push_back(event);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+StackedBackwardPass<T>::~StackedBackwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  for (int i = data_->layers.size() - 1; i >= 0; --i) {
+    cudaEventDestroy(data_->layer_events[i]);
+    delete data_->layers[i];
+  }
+  delete data_;
+}
+
+template<typename T>
+void StackedBackwardPass<T>::SetGradientReadyCallback(const GradientReadyCallback callback, void* user_data) {
+  data_->gradient_hook.SetCallback(callback, user_data);
+}
+
+#ifdef HASTE_WITH_NCCL
+template<typename T>
+bool StackedBackwardPass<T>::SetGradientAllReduce(const ncclComm_t& comm) {
+  return data_->gradient_hook.template SetAllReduce<T>(comm);
+}
+#endif
+
+template<typename T>
+void StackedBackwardPass<T>::LayerGradients(
+    const int l,
+    const int steps,
+    const T* const* W_t,  // [L] [H*4,C] or [H*4,H]
+    const T* x_t,         // [C,T,N]
+    const T* const* h,    // [L] [T+1,N,H]
+    T* dx,                // [T,N,C]
+    T* const* dW,         // [L] [C,H*4] or [H,H*4]
+    T* const* dR,         // [L] [H,H*4]
+    T* const* db,         // [L] [H*4]
+    const T* const* v) {  // [L] [T,N,H*4]
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const int NH = batch_size * hidden_size;
+
+  auto layer = data_->layers[l]->data_;
+  const cudaStream_t stream1 = layer->stream[0];
+  const cudaStream_t stream2 = layer->stream[1];
+  const cudaStream_t stream3 = layer->stream[2];
+  const cudaEvent_t event = layer->event;
+  cudaEventRecord(event, stream1);
+
+  cudaStreamWaitEvent(stream2, event, 0);
+  cublasSetStream(blas_handle, stream2);
+  if (l == 0) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 4, input_size, batch_size * steps,
+        &alpha,
+        v[0], hidden_size * 4,
+        x_t, batch_size * steps,
+        &beta_sum,
+        dW[0], hidden_size * 4);
+  } else {
+    // The input of every other layer is the untransposed `h` of the layer below.
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        hidden_size * 4, hidden_size, batch_size * steps,
+        &alpha,
+        v[l], hidden_size * 4,
+        h[l - 1] + NH, hidden_size,
+        &beta_sum,
+        dW[l], hidden_size * 4);
+  }
+
+  cudaStreamWaitEvent(stream3, event, 0);
+  AddColumnSums(batch_size * steps, hidden_size * 4, v[l], db[l], stream3);
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_T,
+      hidden_size * 4, hidden_size, batch_size * steps,
+      &alpha,
+      v[l], hidden_size * 4,
+      h[l], hidden_size,
+      &beta_sum,
+      dR[l], hidden_size * 4);
+
+  // Signal the weight gradients before layer 0's `dx` is enqueued behind them.
+  if (data_->gradient_hook.enabled()) {
+    cudaEventRecord(event, stream1);
+    cudaStreamWaitEvent(stream3, event, 0);
+    cudaEventRecord(event, stream2);
+    cudaStreamWaitEvent(stream3, event, 0);
+    const size_t layer_input_size = l ? hidden_size : input_size;
+    T* const gradients[] = { dW[l], dR[l], db[l] };
+    const size_t sizes[] = {
+      layer_input_size * hidden_size * 4,
+      static_cast<size_t>(hidden_size) * hidden_size * 4,
+      static_cast<size_t>(hidden_size) * 4,
+    };
+    data_->gradient_hook.Signal(l, stream3, gradients, sizes, 3);
+  }
+
+  if (l == 0) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        input_size, steps * batch_size, hidden_size * 4,
+        &alpha,
+        W_t[0], input_size,
+        v[0], hidden_size * 4,
+        &beta_assign,
+        dx, input_size);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream3);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+}
+
+template<typename T>
+void StackedBackwardPass<T>::Run(
+    const int steps,
+    const T* const* W_t,     // [L] [H*4,C] or [H*4,H]
+    const T* const* R_t,     // [L] [H*4,H]
+    const T* const* b,       // [L] [H*4]
+    const T* x_t,            // [C,T,N]
+    const T* const* h,       // [L] [T+1,N,H]
+    const accum_t<T>* const* c,  // [L] [T+1,N,H]
+    T* const* dh_new,        // [L] [T+1,N,H]
+    const accum_t<T>* const* dc_new,  // [L] [T+1,N,H]
+    T* dx,                   // [T,N,C]
+    T* const* dW,            // [L] [C,H*4] or [H,H*4]
+    T* const* dR,            // [L] [H,H*4]
+    T* const* db,            // [L] [H*4]
+    T* const* dh,            // [L] [N,H]
+    accum_t<T>* const* dc,   // [L] [N,H]
+    T* const* v,             // [L] [T,N,H*4]
+    const T* const* zoneout_mask,  // [L] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+
+  const int layers = data_->layers.size();
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (BackwardPass<T>* layer : data_->layers)
+    cudaStreamWaitEvent(layer->data_->stream[0], data_->ready_event, 0);
+
+  // Step `t` of layer `l` is issued on diagonal `(T - 1 - t) + (L - 1 - l)`, after step `t`
+  // of layer `l + 1` has added its input gradient to `dh_new[l]` on the previous diagonal.
+  // Each diagonal is issued from the bottom layer up so that `layer_events[l + 1]` still
+  // marks step `t` when layer `l` waits on it.
+  const int NH = batch_size * hidden_size;
+  for (int d = 0; d < steps + layers - 1; ++d) {
+    for (int l = std::max(0, layers - 1 - d); l < layers && d - (layers - 1 - l) < steps; ++l) {
+      const int t = steps - 1 - (d - (layers - 1 - l));
+      const int active_batch_size = batch_sizes ? batch_sizes[t] : batch_size;
+      BackwardPass<T>* layer = data_->layers[l];
+
+      if (l < layers - 1)
+        cudaStreamWaitEvent(layer->data_->stream[0], data_->layer_events[l + 1], 0);
+
+      const T* mask = zoneout_mask ? zoneout_mask[l] : nullptr;
+      layer->IterateInternal(
+          R_t[l],
+          c[l] + t * NH,
+          c[l] + (t + 1) * NH,
+          dh_new[l] + (t + 1) * NH,
+          dc_new[l] + (t + 1) * NH,
+          dh[l],
+          dc[l],
+          v[l] + t * NH * 4,
+          mask ? mask + t * NH : nullptr,
+          t,
+          active_batch_size,
+          sequence_lengths,
+          hidden_size);
+
+      // The first layer's input gradient isn't needed until the end, so it's computed
+      // for all time steps at once by `LayerGradients`.
+      if (l > 0) {
+        const cudaStream_t stream2 = layer->data_->stream[1];
+        cudaStreamWaitEvent(stream2, layer->data_->event, 0);
+        cublasSetStream(blas_handle, stream2);
+        blas<T>::gemm(blas_handle,
+            CUBLAS_OP_N, CUBLAS_OP_N,
+            hidden_size, active_batch_size, hidden_size * 4,
+            &alpha,
+            W_t[l], hidden_size,
+            v[l] + t * NH * 4, hidden_size * 4,
+            &beta_sum,
+            dh_new[l - 1] + (t + 1) * NH, hidden_size);
+        cudaEventRecord(data_->layer_events[l], stream2);
+      }
+
+      // The layer's weight gradients are final once its recurrence has reached the first
+      // time step, while the layers below still have `l` diagonals to go.
+      if (t == 0)
+        LayerGradients(l, steps, W_t, x_t, h, dx, dW, dR, db, v);
+    }
+  }
+
+  data_->gradient_hook.Join(data_->sync_stream);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct BidirectionalBackwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  BackwardPass<T>* directions[2];
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+BidirectionalBackwardPass<T>::BidirectionalBackwardPass(
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < 2; ++i) {
+    data_->directions[i] = new BackwardPass<T>(
+        batch_size,
+        input_size,
+        hidden_size,
+        blas_handle,
+        stream);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+BidirectionalBackwardPass<T>::~BidirectionalBackwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  delete data_->directions[1];
+  delete data_->directions[0];
+  delete data_;
+}
+
+template<typename T>
+void BidirectionalBackwardPass<T>::Run(
+    const int steps,
+    const T* const* W_t,     // [2] [H*4,C]
+    const T* const* R_t,     // [2] [H*4,H]
+    const T* const* b,       // [2] [H*4]
+    const T* x_t,            // [C,T,N]
+    const T* const* h,       // [2] [T+1,N,H] with a stride of `h_stride`
+    const int h_stride,
+    const accum_t<T>* const* c,  // [2] [T+1,N,H]
+    const T* const* dh_new,  // [2] [T+1,N,H] with a stride of `h_stride`
+    const accum_t<T>* const* dc_new,  // [2] [T+1,N,H]
+    T* dx,                   // [T,N,C]
+    T* const* dW,            // [2] [C,H*4]
+    T* const* dR,            // [2] [H,H*4]
+    T* const* db,            // [2] [H*4]
+    T* const* dh,            // [2] [N,H]
+    accum_t<T>* const* dc,   // [2] [N,H]
+    T* const* v,             // [2] [T,N,H*4]
+    const T* const* zoneout_mask,  // [2] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (BackwardPass<T>* direction : data_->directions)
+    cudaStreamWaitEvent(direction->data_->stream[0], data_->ready_event, 0);
+
+  // Each direction visits its steps in the opposite order of its forward pass: the
+  // forward direction goes from step `T - 1` down to 0 while the reverse direction goes
+  // from step 0 up to `T - 1`. See `BidirectionalForwardPass::Run` for the layout.
+  const int NH = batch_size * hidden_size;
+  const int h_step = batch_size * h_stride;
+  for (int s = 0; s < steps; ++s) {
+    for (int i = 0; i < 2; ++i) {
+      const int t = i ? s : steps - 1 - s;
+      const int in = i ? t + 1 : t;
+      const int out = i ? t : t + 1;
+      const T* mask = zoneout_mask ? zoneout_mask[i] : nullptr;
+      data_->directions[i]->IterateInternal(
+          R_t[i],
+          c[i] + in * NH,
+          c[i] + out * NH,
+          dh_new[i] + out * h_step,
+          dc_new[i] + out * NH,
+          dh[i],
+          dc[i],
+          v[i] + t * NH * 4,
+          mask ? mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          h_stride);
+    }
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    auto direction = data_->directions[i]->data_;
+    const cudaStream_t stream1 = direction->stream[0];
+    const cudaStream_t stream2 = direction->stream[1];
+    const cudaStream_t stream3 = direction->stream[2];
+    const cudaEvent_t event = direction->event;
+    cudaEventRecord(event, stream1);
+
+    cudaStreamWaitEvent(stream2, event, 0);
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 4, input_size, batch_size * steps,
+        &alpha,
+        v[i], hidden_size * 4,
+        x_t, batch_size * steps,
+        &beta_sum,
+        dW[i], hidden_size * 4);
+
+    cudaStreamWaitEvent(stream3, event, 0);
+    AddColumnSums(batch_size * steps, hidden_size * 4, v[i], db[i], stream3);
+
+    // The inputs of the reverse direction's steps start at index 1.
+    cublasSetStream(blas_handle, stream1);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        hidden_size * 4, hidden_size, batch_size * steps,
+        &alpha,
+        v[i], hidden_size * 4,
+        i ? h[i] + h_step : h[i], h_stride,
+        &beta_sum,
+        dR[i], hidden_size * 4);
+  }
+
+  // Both directions' input gradients are summed into `dx` on a single stream so that
+  // the accumulation is ordered.
+  const cudaStream_t stream1 = data_->directions[0]->data_->stream[0];
+  cudaStreamWaitEvent(stream1, data_->directions[1]->data_->event, 0);
+  cublasSetStream(blas_handle, stream1);
+  for (int i = 0; i < 2; ++i) {
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        input_size, steps * batch_size, hidden_size * 4,
+        &alpha,
+        W_t[i], input_size,
+        v[i], hidden_size * 4,
+        i ? &beta_sum : &beta_assign,
+        dx, input_size);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  for (BackwardPass<T>* direction : data_->directions) {
+    for (int i = 2; i >= 0; --i) {
+      cudaEventRecord(data_->finished_event, direction->data_->stream[i]);
+      cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+    }
+  }
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+#ifdef HASTE_WITH_NCCL
+template<typename T>
+struct TensorParallelBackwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  int rank;
+  int ranks;
+  ncclComm_t comm;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  cudaStream_t stream[3];
+  cudaEvent_t event;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+TensorParallelBackwardPass<T>::TensorParallelBackwardPass(
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const ncclComm_t& comm,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->comm = comm;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  ncclCommUserRank(comm, &data_->rank);
+  ncclCommCount(comm, &data_->ranks);
+  cudaStreamCreate(&data_->stream[0]);
+  cudaStreamCreate(&data_->stream[1]);
+  cudaStreamCreate(&data_->stream[2]);
+  cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+TensorParallelBackwardPass<T>::~TensorParallelBackwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  cudaEventDestroy(data_->event);
+  cudaStreamDestroy(data_->stream[2]);
+  cudaStreamDestroy(data_->stream[1]);
+  cudaStreamDestroy(data_->stream[0]);
+  delete data_;
+}
+
+template<typename T>
+void TensorParallelBackwardPass<T>::Run(
+    const int steps,
+    const T* W_t,     // [Hs*4,C]
+    const T* R_t,     // [Hs*4,H]
+    const T* x_t,     // [C,T,N]
+    const T* h,       // [T+1,N,H]
+    const accum_t<T>* c,  // [T+1,N,Hs]
+    const T* dh_new,  // [T+1,N,H]
+    const accum_t<T>* dc_new,  // [T+1,N,Hs]
+    T* dx,            // [T,N,C]
+    T* dW,            // [C,Hs*4]
+    T* dR,            // [H,Hs*4]
+    T* db,            // [Hs*4]
+    T* dh,            // [N,Hs]
+    accum_t<T>* dc,   // [N,Hs]
+    T* v,             // [T,N,Hs*4]
+    T* tmp_dh,        // Per-rank contributions to the recurrent gradient [G,N,Hs]
+    const T* zoneout_mask) {  // [T,N,Hs]
+  const T alpha = static_cast<T>(1.0);
+  const T beta_sum = static_cast<T>(1.0);  // Accumulate into output matrix!
+  const T beta_assign = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const int rank = data_->rank;
+  const int ranks = data_->ranks;
+  const int local_size = hidden_size / ranks;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaStream_t stream3 = data_->stream[2];
+  const cudaEvent_t event = data_->event;
+
+  const int NH = batch_size * hidden_size;
+  const int NHs = batch_size * local_size;
+
+  // This rank's shard of `tmp_dh` stands in for `dh` during the recurrence: it's where
+  // the reduce-scatter delivers the summed gradient of our units.
+  T* dh_local = tmp_dh + rank * NHs;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. The other streams
+  // only ever run work that's ordered after `stream1` through `event`.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  cudaMemcpyAsync(dh_local, dh, NHs * sizeof(T), cudaMemcpyDeviceToDevice, stream1);
+
+  cublasSetStream(blas_handle, stream1);
+  for (int i = steps - 1; i >= 0; --i) {
+    LaunchPointwiseOperations<T, T>(
+        batch_size,
+        local_size,
+        hidden_size,
+        false,
+        c + i * NHs,
+        v + i * NHs * 4,
+        c + (i + 1) * NHs,
+        dh_new + (i + 1) * NH + rank * local_size,
+        dc_new + (i + 1) * NHs,
+        dh_local,
+        dc,
+        v + i * NHs * 4,
+        zoneout_mask ? zoneout_mask + i * NHs : nullptr,
+        ZoneoutRng(),
+        i,
+        nullptr,
+        stream1);
+
+    // Our gate gradients contribute to every rank's units. Write the contribution to
+    // rank g's units into shard g, adding our own to the zoneout carry that the pointwise
+    // kernel left in place, and sum the shards across ranks.
+    for (int g = 0; g < ranks; ++g) {
+      blas<T>::gemm(blas_handle,
+          CUBLAS_OP_N, CUBLAS_OP_N,
+          local_size, batch_size, local_size * 4,
+          &alpha,
+          R_t + g * local_size, hidden_size,
+          v + i * NHs * 4, local_size * 4,
+          g == rank ? &beta_sum : &beta_assign,
+          tmp_dh + g * NHs, local_size);
+    }
+    ncclReduceScatter(tmp_dh, dh_local, NHs, nccl_type<T>::value, ncclSum, data_->comm, stream1);
+  }
+
+  cudaMemcpyAsync(dh, dh_local, NHs * sizeof(T), cudaMemcpyDeviceToDevice, stream1);
+  cudaEventRecord(event, stream1);
+
+  cudaStreamWaitEvent(stream2, event, 0);
+  cublasSetStream(blas_handle, stream2);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      local_size * 4, input_size, batch_size * steps,
+      &alpha,
+      v, local_size * 4,
+      x_t, batch_size * steps,
+      &beta_sum,
+      dW, local_size * 4);
+
+  cudaStreamWaitEvent(stream3, event, 0);
+  AddColumnSums(batch_size * steps, local_size * 4, v, db, stream3);
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_T,
+      local_size * 4, hidden_size, batch_size * steps,
+      &alpha,
+      v, local_size * 4,
+      h, hidden_size,
+      &beta_sum,
+      dR, local_size * 4);
+
+  // Each rank's gates only see part of `x`'s gradient, so sum it over the ranks.
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      input_size, steps * batch_size, local_size * 4,
+      &alpha,
       W_t, input_size,
-      v, hidden_size * 4,
+      v, local_size * 4,
       &beta_assign,
       dx, input_size);
+  ncclAllReduce(dx, dx, steps * batch_size * input_size, nccl_type<T>::value, ncclSum, data_->comm, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream3);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream2);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
 
   cublasSetStream(blas_handle, save_stream);
 }
+#endif  // HASTE_WITH_NCCL
 
+template struct BackwardPass<__half>;
+template struct BackwardPass<__nv_bfloat16>;
 template struct BackwardPass<float>;
 template struct BackwardPass<double>;
+template struct StackedBackwardPass<__half>;
+template struct StackedBackwardPass<__nv_bfloat16>;
+template struct StackedBackwardPass<float>;
+template struct StackedBackwardPass<double>;
+template struct BidirectionalBackwardPass<__half>;
+template struct BidirectionalBackwardPass<__nv_bfloat16>;
+template struct BidirectionalBackwardPass<float>;
+template struct BidirectionalBackwardPass<double>;
+#ifdef HASTE_WITH_NCCL
+template struct TensorParallelBackwardPass<__half>;
+#if HASTE_NCCL_HAS_BF16
+template struct TensorParallelBackwardPass<__nv_bfloat16>;
+#endif
+template struct TensorParallelBackwardPass<float>;
+template struct TensorParallelBackwardPass<double>;
+#endif
 
 }  // namespace lstm
 }  // namespace v0
@@ -13,341 +13,3325 @@
 // limitations under the License.
 // ==============================================================================
 
+#include <algorithm>
+#include <chrono>
+#include <cooperative_groups.h>
 #include <cublas_v2.h>
 #include <cuda_runtime_api.h>
+#include <vector>
 
+#include "batching.h"
 #include "blas.h"
+#include "cell.h"
+#include "dropconnect.h"
+#include "graph.h"
 #include "haste.h"
 #include "inline_ops.h"
+#include "packing.h"
+#include "persistent.h"
+#include "pointwise.h"
+#include "profiling.h"
+#include "quantize.h"
+#include "sequence.h"
+#include "state_pool.h"
+#include "workspace.h"
+
+#ifdef HASTE_WITH_NCCL
+#include "tensor_parallel.h"
+#endif
 
 namespace {
 
+// Applies the gate nonlinearities of the cell variant `Cell` (see `CellPolicy`) to the
+// pre-activations `pre` ([i,g,f,o]) of one hidden unit and updates its state, in (at
+// least) FP32 for 16-bit types, with the activations of `Cell::Activations`. `peephole`
+// holds the unit's [i,f,o] peephole weights, only used if `Cell::kPeephole`. `mask` is
+// the unit's zoneout keep mask, only used if `ApplyZoneout` and `Training`.
+template<typename Acc, typename Cell, bool Training, bool ApplyZoneout>
+__device__ __forceinline__
+void LstmCell(const Acc pre[4],
+              const Acc peephole[3],
+              const Acc h_prev,
+              const Acc c_prev,
+              const float zoneout_prob,
+              const Acc mask,
+              Acc gates[4],
+              Acc* h_new,
+              Acc* c_new) {
+  typedef typename Cell::Activations Act;
+  gates[1] = Act::tanh(pre[1]);
+  if (Cell::kCoupled) {
+    gates[2] = Act::sigmoid(Cell::kPeephole ? pre[2] + peephole[1] * c_prev : pre[2]);
+    gates[0] = static_cast<Acc>(1.0) - gates[2];
+  } else {
+    Act::sigmoid2(
+        Cell::kPeephole ? pre[0] + peephole[0] * c_prev : pre[0],
+        Cell::kPeephole ? pre[2] + peephole[1] * c_prev : pre[2],
+        &gates[0],
+        &gates[2]);
+  }
+
+  const Acc cur_c_value = (gates[2] * c_prev) + (gates[0] * gates[1]);
+  gates[3] = Act::sigmoid(Cell::kPeephole ? pre[3] + peephole[2] * cur_c_value : pre[3]);
+  Acc cur_h_value = gates[3] * Act::tanh(cur_c_value);
+
+  if (ApplyZoneout) {
+    if (Training) {
+      cur_h_value = (cur_h_value - h_prev) * mask + h_prev;
+    } else {
+      cur_h_value = (zoneout_prob * h_prev) + ((1.0f - zoneout_prob) * cur_h_value);
+    }
+  }
+
+  *c_new = cur_c_value;
+  *h_new = cur_h_value;
+}
+
 // `h` and `h_out` may be aliased.
 // `c` and `c_out` may be aliased.
-template<typename T, bool Training, bool ApplyZoneout>
+// `v_out` holds the activations as `V`, which is `T` except for `RunCompact`.
+// Each thread handles `U` consecutive hidden units of one batch item with vector loads
+// and stores. `Interleaved` selects `GateLayout::kInterleaved` for `Wx`, `Rh`, `b` and
+// `v_out`, and `Cell` the gate math.
+template<typename T, typename V, int U, bool Interleaved, typename Cell, bool Training, bool ApplyZoneout>
 __global__
 void PointwiseOperations(const int batch_dim,
                          const int hidden_dim,
+                         const int h_stride,  // Distance between batch items in `h` and `h_out`
                          const T* Wx,  // Precomputed (Wx) vector
                          const T* Rh,  // Precomputed (Rh) vector
                          const T* b,   // Bias for gates
+                         const T* peephole,  // Peephole weights [3,H] (only used if Cell::kPeephole)
                          const T* h,   // Input recurrent state
-                         const T* c,   // Input cell state
+                         const accum_t<T>* c,  // Input cell state
                          T* h_out,     // Output recurrent state
-                         T* c_out,     // Output cell state
-                         T* v_out,     // Output vector v (Wx + Rh + b) (only used if Training==true)
+                         accum_t<T>* c_out,  // Output cell state
+                         V* v_out,     // Output vector v (Wx + Rh + b) (only used if Training==true)
                          const float zoneout_prob,
-                         const T* zoneout_mask) {  // Zoneout mask (only used if ApplyZoneout==true)
+                         const T* zoneout_mask,  // Zoneout mask (only used if ApplyZoneout==true), may be null
+                         const ZoneoutRng zoneout_rng,  // Generates the mask if `zoneout_mask` is null
+                         const int step,
+                         const int* sequence_lengths) {  // May be null
   // We're in column-major order here, so increase x => increase row.
-  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+  const int row = (blockDim.x * blockIdx.x + threadIdx.x) * U;
   const int col = blockDim.y * blockIdx.y + threadIdx.y;
 
   if (row >= hidden_dim || col >= batch_dim)
     return;
 
-  // Base index into the Wx and Rh matrices.
-  const int weight_idx = col * (hidden_dim * 4) + row;
+  // Items past the end of their sequence carry their state through unchanged. Their
+  // `v` and `Rh` are never read (and may not have been computed).
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    const int h_idx = col * h_stride + row;
+    const int idx = col * hidden_dim + row;
+    StoreVector<U>(h_out + h_idx, LoadVector<U>(h + h_idx));
+    StoreVector<U>(c_out + idx, LoadVector<U>(c + idx));
+    return;
+  }
+
+  // Base index of this batch item's row in the Wx and Rh matrices.
+  const int weight_idx = col * (hidden_dim * 4);
 
   // Base index into the output matrix. This is different from `weight_idx` because
   // the number of rows are different between the two sets of matrices.
   const int output_idx = col * hidden_dim + row;
+  const int h_idx = col * h_stride + row;
 
-  const int i_idx = weight_idx + 0 * hidden_dim;
-  const int g_idx = weight_idx + 1 * hidden_dim;
-  const int f_idx = weight_idx + 2 * hidden_dim;
-  const int o_idx = weight_idx + 3 * hidden_dim;
+  // Gate math is done in (at least) FP32 for 16-bit types, the type of the cell state.
+  typedef typename accum_type<T>::type Acc;
 
-  const T i = sigmoid(Wx[i_idx] + Rh[i_idx] + b[row + 0 * hidden_dim]);
-  const T g = tanh   (Wx[g_idx] + Rh[g_idx] + b[row + 1 * hidden_dim]);
-  const T f = sigmoid(Wx[f_idx] + Rh[f_idx] + b[row + 2 * hidden_dim]);
-  const T o = sigmoid(Wx[o_idx] + Rh[o_idx] + b[row + 3 * hidden_dim]);
-
-  // Compile-time constant branch should be eliminated by compiler so we have
-  // straight-through code.
-  if (Training) {
-    v_out[i_idx] = i;
-    v_out[g_idx] = g;
-    v_out[f_idx] = f;
-    v_out[o_idx] = o;
+  T Wx_in[4][U];
+  T Rh_in[4][U];
+  T b_in[4][U];
+  LoadGates<U, 4, Interleaved>(Wx + weight_idx, hidden_dim, row, Wx_in);
+  LoadGates<U, 4, Interleaved>(Rh + weight_idx, hidden_dim, row, Rh_in);
+  LoadGates<U, 4, Interleaved>(b, hidden_dim, row, b_in);
+  const AlignedVector<T, U> h_in = LoadVector<U>(h + h_idx);
+  const AlignedVector<Acc, U> c_in = LoadVector<U>(c + output_idx);
+  AlignedVector<T, U> mask_in;
+  if (ApplyZoneout && Training && zoneout_mask)
+    mask_in = LoadVector<U>(zoneout_mask + output_idx);
+  AlignedVector<T, U> peephole_in[3];
+  if (Cell::kPeephole) {
+    #pragma unroll
+    for (int k = 0; k < 3; ++k)
+      peephole_in[k] = LoadVector<U>(peephole + k * hidden_dim + row);
   }
 
-  T cur_c_value = (f * c[output_idx]) + (i * g);
-  T cur_h_value = o * tanh(cur_c_value);
+  V v[4][U];
+  AlignedVector<T, U> h_new;
+  AlignedVector<Acc, U> c_new;
 
-  if (ApplyZoneout) {
-    if (Training) {
-      cur_h_value = (cur_h_value - h[output_idx]) * zoneout_mask[output_idx] + h[output_idx];
-    } else {
-      cur_h_value = (zoneout_prob * h[output_idx]) + ((1.0f - zoneout_prob) * cur_h_value);
+  #pragma unroll
+  for (int j = 0; j < U; ++j) {
+    Acc pre[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      pre[k] = Acc(Wx_in[k][j]) + Acc(Rh_in[k][j]) + Acc(b_in[k][j]);
+
+    Acc mask = static_cast<Acc>(0.0);
+    if (ApplyZoneout && Training) {
+      mask = zoneout_mask
+          ? Acc(mask_in.x[j])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + output_idx + j);
     }
-  }
 
-  c_out[output_idx] = cur_c_value;
-  h_out[output_idx] = cur_h_value;
-}
+    Acc peep[3];
+    #pragma unroll
+    for (int k = 0; k < 3; ++k)
+      peep[k] = Cell::kPeephole ? Acc(peephole_in[k].x[j]) : static_cast<Acc>(0.0);
 
-}  // anonymous namespace
+    Acc gates[4];
+    Acc cur_h_value;
+    Acc cur_c_value;
+    LstmCell<Acc, Cell, Training, ApplyZoneout>(
+        pre, peep, Acc(h_in.x[j]), c_in.x[j], zoneout_prob, mask, gates, &cur_h_value, &cur_c_value);
 
-namespace haste {
-namespace v0 {
-namespace lstm {
+    // Compile-time constant branch should be eliminated by compiler so we have
+    // straight-through code.
+    if (Training) {
+      #pragma unroll
+      for (int k = 0; k < 4; ++k)
+        v[k][j] = pack_activation<V>(gates[k]);
+    }
 
-template<typename T>
-struct ForwardPass<T>::private_data {
-  bool training;
-  int batch_size;
-  int input_size;
-  int hidden_size;
-  cublasHandle_t blas_handle;
-  cudaStream_t stream[2];
-  cudaEvent_t event;
-  cudaEvent_t ready_event;
-  cudaEvent_t finished_event;
-};
+    c_new.x[j] = cur_c_value;
+    h_new.x[j] = T(cur_h_value);
+  }
 
-template<typename T>
-ForwardPass<T>::ForwardPass(
+  if (Training)
+    StoreGates<U, 4, Interleaved>(v_out + weight_idx, hidden_dim, row, v);
+  StoreVector<U>(c_out + output_idx, c_new);
+  StoreVector<U>(h_out + h_idx, h_new);
+}
+
+// Launches the `PointwiseOperations` instantiation for `U`, `Interleaved` and `Cell`.
+template<typename T, typename V, int U, bool Interleaved, typename Cell>
+void LaunchPointwiseKernel(
     const bool training,
+    const bool apply_zoneout,
     const int batch_size,
-    const int input_size,
     const int hidden_size,
-    const cublasHandle_t& blas_handle) : data_(new private_data) {
-  data_->training = training;
-  data_->batch_size = batch_size;
-  data_->input_size = input_size;
-  data_->hidden_size = hidden_size;
-  data_->blas_handle = blas_handle;
-  cudaStreamCreate(&data_->stream[0]);
-  cudaStreamCreate(&data_->stream[1]);
-  cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
-  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
-  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
-}
-
-template<typename T>
-ForwardPass<T>::~ForwardPass() {
-  cudaStreamSynchronize(data_->stream[1]);
-  cudaStreamSynchronize(data_->stream[0]);
-  cudaEventDestroy(data_->finished_event);
-  cudaEventDestroy(data_->ready_event);
-  cudaEventDestroy(data_->event);
-  cudaStreamDestroy(data_->stream[1]);
-  cudaStreamDestroy(data_->stream[0]);
-  delete data_;
-}
-
-template<typename T>
-void ForwardPass<T>::Iterate(
-    const T* W,  // Weight matrix for input (Wx) [C,H*4]
-    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
-    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
-    const T* x,  // Input vector [N,C]
-    const T* h,  // Recurrent state [N,H]
-    const T* c,  // Cell state [N,H]
-    T* h_out,    // Output recurrent state [N,H]
-    T* c_out,    // Output cell state [N,H]
-    T* v,        // Output vector (Wx + Rh + b) [N,H*4]
-    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
-    const float zoneout_prob,
-    const T* zoneout_mask) { // Zoneout mask [N,H]
-  // Constants for GEMM
-  static const T alpha = static_cast<T>(1.0);
-  static const T beta = static_cast<T>(0.0);
-
-  const int batch_size = data_->batch_size;
-  const int input_size = data_->input_size;
-  const int hidden_size = data_->hidden_size;
-  const cublasHandle_t blas_handle = data_->blas_handle;
-  const cudaStream_t stream2 = data_->stream[1];
-  const cudaEvent_t event = data_->event;
-
-  cudaStream_t save_stream;
-  cublasGetStream(blas_handle, &save_stream);
-
-  cublasSetStream(blas_handle, stream2);
-  blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size * 4, batch_size, input_size,
-      &alpha,
-      W, hidden_size * 4,
-      x, input_size,
-      &beta,
-      v, hidden_size * 4);
-  cudaEventRecord(event, stream2);
-
-  IterateInternal(
-      R,
-      b,
-      h,
-      c,
-      h_out,
-      c_out,
-      v,
-      tmp_Rh,
-      zoneout_prob,
-      zoneout_mask);
-
-  cublasSetStream(blas_handle, save_stream);
-}
-
-template<typename T>
-void ForwardPass<T>::IterateInternal(
-    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
-    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
-    const T* h,  // Recurrent state [N,H]
-    const T* c,  // Cell state [N,H]
-    T* h_out,    // Output recurrent state [N,H]
-    T* c_out,    // Output cell state [N,H]
-    T* v,        // Output vector (Wx + Rh + b) [N,H*4]
-    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const int h_stride,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* peephole,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    V* v_out,
     const float zoneout_prob,
-    const T* zoneout_mask) { // Zoneout mask [N,H]
-  static const T alpha = static_cast<T>(1.0);
-  static const T beta = static_cast<T>(0.0);
-
-  const bool training = data_->training;
-  const int batch_size = data_->batch_size;
-  const int hidden_size = data_->hidden_size;
-  const cublasHandle_t blas_handle = data_->blas_handle;
-  const cudaStream_t stream1 = data_->stream[0];
-  const cudaEvent_t event = data_->event;
-
-  cublasSetStream(blas_handle, stream1);
-  blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size * 4, batch_size, hidden_size,
-      &alpha,
-      R, hidden_size * 4,
-      h, hidden_size,
-      &beta,
-      tmp_Rh, hidden_size * 4);
-
-  cudaStreamWaitEvent(stream1, event, 0);
-
-  // Compute launch configuration for pointwise operations kernel.
-  const dim3 blockDim(64, 16);
-  const dim3 gridDim(
-      (hidden_size + blockDim.x - 1) / blockDim.x,
-      (batch_size + blockDim.y - 1) / blockDim.y);
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  dim3 gridDim;
+  dim3 blockDim;
+  PointwiseLaunchShape(batch_size, hidden_size / U, &gridDim, &blockDim);
 
   if (training) {
-    if (zoneout_prob && zoneout_mask) {
-      PointwiseOperations<T, true, true><<<gridDim, blockDim, 0, stream1>>>(
+    if (apply_zoneout) {
+      PointwiseOperations<T, V, U, Interleaved, Cell, true, true><<<gridDim, blockDim, 0, stream>>>(
           batch_size,
           hidden_size,
-          v,
-          tmp_Rh,
+          h_stride,
+          Wx,
+          Rh,
           b,
+          peephole,
           h,
           c,
           h_out,
           c_out,
-          v,
+          v_out,
           zoneout_prob,
-          zoneout_mask);
+          zoneout_mask,
+          zoneout_rng,
+          step,
+          sequence_lengths);
     } else {
-      PointwiseOperations<T, true, false><<<gridDim, blockDim, 0, stream1>>>(
+      PointwiseOperations<T, V, U, Interleaved, Cell, true, false><<<gridDim, blockDim, 0, stream>>>(
           batch_size,
           hidden_size,
-          v,
-          tmp_Rh,
+          h_stride,
+          Wx,
+          Rh,
           b,
+          peephole,
           h,
           c,
           h_out,
           c_out,
-          v,
+          v_out,
           0.0f,
-          nullptr);
+          nullptr,
+          ZoneoutRng(),
+          step,
+          sequence_lengths);
     }
   } else {
-    if (zoneout_prob && zoneout_mask) {
-      PointwiseOperations<T, false, true><<<gridDim, blockDim, 0, stream1>>>(
+    if (apply_zoneout) {
+      PointwiseOperations<T, V, U, Interleaved, Cell, false, true><<<gridDim, blockDim, 0, stream>>>(
           batch_size,
           hidden_size,
-          v,
-          tmp_Rh,
+          h_stride,
+          Wx,
+          Rh,
           b,
+          peephole,
           h,
           c,
           h_out,
           c_out,
           nullptr,
           zoneout_prob,
-          zoneout_mask);
+          zoneout_mask,
+          zoneout_rng,
+          step,
+          sequence_lengths);
     } else {
-      PointwiseOperations<T, false, false><<<gridDim, blockDim, 0, stream1>>>(
+      PointwiseOperations<T, V, U, Interleaved, Cell, false, false><<<gridDim, blockDim, 0, stream>>>(
           batch_size,
           hidden_size,
-          v,
-          tmp_Rh,
+          h_stride,
+          Wx,
+          Rh,
           b,
+          peephole,
           h,
           c,
           h_out,
           c_out,
           nullptr,
           0.0f,
-          nullptr);
+          nullptr,
+          ZoneoutRng(),
+          step,
+          sequence_lengths);
     }
   }
 }
 
+// Launches `PointwiseOperations` for one time step of the whole batch, with the widest
+// vector accesses that the sizes and pointers allow.
+template<typename T, typename V>
+void LaunchPointwiseOperations(
+    const bool training,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    V* v_out,
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  // Inference blends in the expectation of zoneout, so it needs no mask source.
+  const bool apply_zoneout = zoneout_prob && (!training || zoneout_mask || zoneout_rng.enabled);
+
+  const int units = PointwiseVectorWidth<T>(
+      hidden_size,
+      h_stride,
+      { Wx, Rh, b, h, h_out, training ? v_out : nullptr, apply_zoneout ? zoneout_mask : nullptr },
+      { c, c_out });
+  const auto launch = interleaved
+      ? (units == 4 ? LaunchPointwiseKernel<T, V, 4, true, StandardCell>
+       : units == 2 ? LaunchPointwiseKernel<T, V, 2, true, StandardCell>
+       :              LaunchPointwiseKernel<T, V, 1, true, StandardCell>)
+      : (units == 4 ? LaunchPointwiseKernel<T, V, 4, false, StandardCell>
+       : units == 2 ? LaunchPointwiseKernel<T, V, 2, false, StandardCell>
+       :              LaunchPointwiseKernel<T, V, 1, false, StandardCell>);
+  launch(
+      training,
+      apply_zoneout,
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      b,
+      nullptr,
+      h,
+      c,
+      h_out,
+      c_out,
+      v_out,
+      zoneout_prob,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths,
+      stream);
+}
+
+// Launches the inference instantiation of `PointwiseOperations` for `U`, `Interleaved`
+// and `Cell`. Unlike `LaunchPointwiseKernel` it leaves out the training kernels, which
+// the activation tiers don't have.
+template<typename T, int U, bool Interleaved, typename Cell>
+void LaunchInferenceKernel(
+    const bool apply_zoneout,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    const float zoneout_prob,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  dim3 gridDim;
+  dim3 blockDim;
+  PointwiseLaunchShape(batch_size, hidden_size / U, &gridDim, &blockDim);
+
+  const auto kernel = apply_zoneout
+      ? PointwiseOperations<T, T, U, Interleaved, Cell, false, true>
+      : PointwiseOperations<T, T, U, Interleaved, Cell, false, false>;
+  kernel<<<gridDim, blockDim, 0, stream>>>(
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      b,
+      nullptr,
+      h,
+      c,
+      h_out,
+      c_out,
+      nullptr,
+      apply_zoneout ? zoneout_prob : 0.0f,
+      nullptr,
+      ZoneoutRng(),
+      step,
+      sequence_lengths);
+}
+
+// `LaunchPointwiseOperations` for an inference pass of the standard cell with the gate
+// nonlinearities of `Act` (see `ActivationTier`).
+template<typename T, typename Act>
+void LaunchInferenceOperations(
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    const float zoneout_prob,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  typedef CellPolicy<false, false, Act> Cell;
+  const bool apply_zoneout = zoneout_prob != 0.0f;
+
+  const int units = PointwiseVectorWidth<T>(hidden_size, h_stride, { Wx, Rh, b, h, h_out }, { c, c_out });
+  const auto launch = interleaved
+      ? (units == 4 ? LaunchInferenceKernel<T, 4, true, Cell>
+       : units == 2 ? LaunchInferenceKernel<T, 2, true, Cell>
+       :              LaunchInferenceKernel<T, 1, true, Cell>)
+      : (units == 4 ? LaunchInferenceKernel<T, 4, false, Cell>
+       : units == 2 ? LaunchInferenceKernel<T, 2, false, Cell>
+       :              LaunchInferenceKernel<T, 1, false, Cell>);
+  launch(
+      apply_zoneout,
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      b,
+      h,
+      c,
+      h_out,
+      c_out,
+      zoneout_prob,
+      step,
+      sequence_lengths,
+      stream);
+}
+
+// `LaunchInferenceOperations` for `tier`, which isn't `ActivationTier::kPrecise`: the
+// precise inference kernels are `LaunchPointwiseOperations`'s own.
 template<typename T>
-void ForwardPass<T>::Run(
-    const int steps,
-    const T* W,  // Weight matrix for input (Wx) [C,H*4]
-    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
-    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
-    const T* x,  // Input vector [T,N,C]
-    T* h,        // Recurrent state [T+1,N,H]
-    T* c,        // Cell state [T+1,N,H]
-    T* v,        // Output vector (Wx + Rh + b) [T,N,H*4]
-    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+void LaunchTierOperations(
+    const haste::v0::ActivationTier tier,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
     const float zoneout_prob,
-    const T* zoneout_mask) { // Zoneout mask [T,N,H]
-  static const T alpha = static_cast<T>(1.0);
-  static const T beta = static_cast<T>(0.0);
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  typedef haste::v0::ActivationTier Tier;
+  const auto launch = tier == Tier::kHalf2 ? LaunchInferenceOperations<T, Half2Activations>
+      : tier == Tier::kApprox ? LaunchInferenceOperations<T, ApproxActivations>
+      :                         LaunchInferenceOperations<T, FastActivations>;
+  launch(
+      batch_size,
+      hidden_size,
+      h_stride,
+      interleaved,
+      Wx,
+      Rh,
+      b,
+      h,
+      c,
+      h_out,
+      c_out,
+      zoneout_prob,
+      step,
+      sequence_lengths,
+      stream);
+}
 
-  const int batch_size = data_->batch_size;
-  const int input_size = data_->input_size;
-  const int hidden_size = data_->hidden_size;
-  const cublasHandle_t blas_handle = data_->blas_handle;
-  const cudaStream_t stream1 = data_->stream[0];
+// `PointwiseOperations` with V=T and U=1 that layer-normalizes each gate's
+// pre-activations (Wx + Rh + b) before the gate math: gate k's pre-activation `x` of
+// unit j becomes `(x - mean) / sqrt(var + eps) * gamma[k,j] + beta[k,j]`, with the mean
+// and variance over the H units of the gate and batch item, and the gains `gamma` and
+// biases `beta` given as `layer_norm` ([2,H*4], in the gate layout). Each block handles
+// one batch item, so that it reduces the means and variances itself instead of in
+// separate kernels, in passes over the pre-activations that it keeps in `v_out`
+// meanwhile (which is therefore needed even if !Training). When training, each row of
+// `ln_cache` receives the normalized pre-activations followed by the gates' reciprocal
+// standard deviations for the backward pass.
+template<typename T, typename Cell, bool Interleaved, bool Training, bool ApplyZoneout>
+__global__
+void LayerNormPointwiseOperations(const int batch_dim,
+                                  const int hidden_dim,
+                                  const int h_stride,  // Distance between batch items in `h` and `h_out`
+                                  const T* Wx,
+                                  const T* Rh,
+                                  const T* b,
+                                  const T* peephole,    // [3,H] (only used if Cell::kPeephole)
+                                  const T* layer_norm,  // [2,H*4]
+                                  const T* h,
+                                  const accum_t<T>* c,
+                                  T* h_out,
+                                  accum_t<T>* c_out,
+                                  T* v_out,
+                                  T* ln_cache,  // [N,2,H*4] (only used if Training==true)
+                                  const float zoneout_prob,
+                                  const T* zoneout_mask,
+                                  const ZoneoutRng zoneout_rng,
+                                  const int step,
+                                  const int* sequence_lengths) {
+  typedef typename accum_type<T>::type Acc;
 
-  cudaStream_t save_stream;
-  cublasGetStream(blas_handle, &save_stream);
+  __shared__ Acc partial[4][kLayerNormThreads / 32];
 
-  cublasSetStream(blas_handle, stream1);
-  blas<T>::gemm(blas_handle,
-      CUBLAS_OP_N, CUBLAS_OP_N,
-      hidden_size * 4, steps * batch_size, input_size,
-      &alpha,
-      W, hidden_size * 4,
-      x, input_size,
-      &beta,
-      v, hidden_size * 4);
+  const int col = blockIdx.x;
 
-  for (int i = 0; i < steps; ++i) {
-    const int NH = batch_size * hidden_size;
-    IterateInternal(
-        R,
-        b,
-        h + i * NH,
-        c + i * NH,
-        h + (i + 1) * NH,
-        c + (i + 1) * NH,
-        v + i * NH * 4,
-        tmp_Rh,
-        zoneout_prob,
-        zoneout_mask ? zoneout_mask + i * NH : nullptr);
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+      h_out[col * h_stride + row] = h[col * h_stride + row];
+      c_out[col * hidden_dim + row] = c[col * hidden_dim + row];
+    }
+    return;
+  }
+
+  T* v_row = v_out + col * (hidden_dim * 4);
+  const T* Wx_row = Wx + col * (hidden_dim * 4);
+  const T* Rh_row = Rh + col * (hidden_dim * 4);
+
+  // Each thread revisits the same units in every pass, so it only ever reads back the
+  // pre-activations that it wrote itself.
+  Acc mean[4];
+  Acc var[4];
+  #pragma unroll
+  for (int k = 0; k < 4; ++k) {
+    mean[k] = static_cast<Acc>(0.0);
+    var[k] = static_cast<Acc>(0.0);
+  }
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    #pragma unroll
+    for (int k = 0; k < 4; ++k) {
+      const int idx = PackedGateColumn(k, row, hidden_dim, 4, Interleaved);
+      const Acc pre = Acc(Wx_row[idx]) + Acc(Rh_row[idx]) + Acc(b[idx]);
+      v_row[idx] = T(pre);
+      mean[k] += pre;
+    }
   }
+  BlockSum<4>(mean, partial);
+  #pragma unroll
+  for (int k = 0; k < 4; ++k)
+    mean[k] /= hidden_dim;
+
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    #pragma unroll
+    for (int k = 0; k < 4; ++k) {
+      const Acc d = Acc(v_row[PackedGateColumn(k, row, hidden_dim, 4, Interleaved)]) - mean[k];
+      var[k] += d * d;
+    }
+  }
+  BlockSum<4>(var, partial);
+
+  Acc rstd[4];
+  #pragma unroll
+  for (int k = 0; k < 4; ++k)
+    rstd[k] = static_cast<Acc>(1.0) / sqrt(var[k] / hidden_dim + static_cast<Acc>(kLayerNormEpsilon));
+
+  T* cache = Training ? ln_cache + col * (hidden_dim * 8) : nullptr;
+  if (Training && threadIdx.x == 0) {
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      cache[hidden_dim * 4 + k] = T(rstd[k]);
+  }
+
+  const T* gamma = layer_norm;
+  const T* beta = layer_norm + hidden_dim * 4;
+  for (int row = threadIdx.x; row < hidden_dim; row += blockDim.x) {
+    const int output_idx = col * hidden_dim + row;
+    const int h_idx = col * h_stride + row;
+
+    Acc pre[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k) {
+      const int idx = PackedGateColumn(k, row, hidden_dim, 4, Interleaved);
+      const Acc xhat = (Acc(v_row[idx]) - mean[k]) * rstd[k];
+      pre[k] = xhat * Acc(gamma[idx]) + Acc(beta[idx]);
+      if (Training)
+        cache[idx] = T(xhat);
+    }
+
+    Acc peep[3];
+    #pragma unroll
+    for (int k = 0; k < 3; ++k)
+      peep[k] = Cell::kPeephole ? Acc(peephole[k * hidden_dim + row]) : static_cast<Acc>(0.0);
+
+    Acc mask = static_cast<Acc>(0.0);
+    if (ApplyZoneout && Training) {
+      mask = zoneout_mask
+          ? Acc(zoneout_mask[output_idx])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + output_idx);
+    }
+
+    Acc gates[4];
+    Acc cur_h_value;
+    Acc cur_c_value;
+    LstmCell<Acc, Cell, Training, ApplyZoneout>(
+        pre, peep, Acc(h[h_idx]), c[output_idx], zoneout_prob, mask, gates, &cur_h_value, &cur_c_value);
+
+    if (Training) {
+      #pragma unroll
+      for (int k = 0; k < 4; ++k)
+        v_row[PackedGateColumn(k, row, hidden_dim, 4, Interleaved)] = T(gates[k]);
+    }
+    c_out[output_idx] = cur_c_value;
+    h_out[h_idx] = T(cur_h_value);
+  }
+}
+
+// Launches the `LayerNormPointwiseOperations` instantiation for `Cell` and `Interleaved`.
+template<typename T, typename Cell, bool Interleaved>
+void LaunchLayerNormKernel(
+    const bool training,
+    const bool apply_zoneout,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* peephole,
+    const T* layer_norm,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    T* v_out,
+    T* ln_cache,
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const auto kernel = training
+      ? (apply_zoneout ? LayerNormPointwiseOperations<T, Cell, Interleaved, true, true>
+                       : LayerNormPointwiseOperations<T, Cell, Interleaved, true, false>)
+      : (apply_zoneout ? LayerNormPointwiseOperations<T, Cell, Interleaved, false, true>
+                       : LayerNormPointwiseOperations<T, Cell, Interleaved, false, false>);
+  kernel<<<batch_size, LayerNormBlockSize(hidden_size), 0, stream>>>(
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      b,
+      peephole,
+      layer_norm,
+      h,
+      c,
+      h_out,
+      c_out,
+      v_out,
+      ln_cache,
+      zoneout_prob,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths);
+}
+
+// Launches the pointwise operations of the cell variant `Cell` for one time step of the
+// whole batch like `LaunchPointwiseOperations`, with layer normalization if `cell` has
+// it. `cell.layer_norm_cache` is indexed by `step`.
+template<typename T, typename Cell>
+void LaunchCellOperations(
+    const bool training,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    T* v_out,
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const CellConfig<T>& cell,
+    const cudaStream_t& stream) {
+  const bool apply_zoneout = zoneout_prob && (!training || zoneout_mask || zoneout_rng.enabled);
+
+  if (cell.layer_norm) {
+    T* ln_cache = training
+        ? cell.layer_norm_cache + static_cast<size_t>(step) * batch_size * hidden_size * 8
+        : nullptr;
+    const auto launch = interleaved
+        ? LaunchLayerNormKernel<T, Cell, true>
+        : LaunchLayerNormKernel<T, Cell, false>;
+    launch(
+        training,
+        apply_zoneout,
+        batch_size,
+        hidden_size,
+        h_stride,
+        Wx,
+        Rh,
+        b,
+        cell.peephole,
+        cell.layer_norm,
+        h,
+        c,
+        h_out,
+        c_out,
+        v_out,
+        ln_cache,
+        zoneout_prob,
+        zoneout_mask,
+        zoneout_rng,
+        step,
+        sequence_lengths,
+        stream);
+    return;
+  }
+
+  const int units = PointwiseVectorWidth<T>(
+      hidden_size,
+      h_stride,
+      { Wx, Rh, b, cell.peephole, h, h_out, training ? v_out : nullptr, apply_zoneout ? zoneout_mask : nullptr },
+      { c, c_out });
+  const auto launch = interleaved
+      ? (units == 4 ? LaunchPointwiseKernel<T, T, 4, true, Cell>
+       : units == 2 ? LaunchPointwiseKernel<T, T, 2, true, Cell>
+       :              LaunchPointwiseKernel<T, T, 1, true, Cell>)
+      : (units == 4 ? LaunchPointwiseKernel<T, T, 4, false, Cell>
+       : units == 2 ? LaunchPointwiseKernel<T, T, 2, false, Cell>
+       :              LaunchPointwiseKernel<T, T, 1, false, Cell>);
+  launch(
+      training,
+      apply_zoneout,
+      batch_size,
+      hidden_size,
+      h_stride,
+      Wx,
+      Rh,
+      b,
+      cell.peephole,
+      h,
+      c,
+      h_out,
+      c_out,
+      v_out,
+      zoneout_prob,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths,
+      stream);
+}
+
+// `LaunchPointwiseOperations` for the cell variant `cell`.
+template<typename T>
+void LaunchPointwiseOperations(
+    const bool training,
+    const int batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const T* Wx,
+    const T* Rh,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    T* v_out,
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const CellConfig<T>& cell,
+    const cudaStream_t& stream) {
+  const auto launch = cell.peephole
+      ? (cell.coupled ? LaunchCellOperations<T, CellPolicy<true, true>> : LaunchCellOperations<T, CellPolicy<true, false>>)
+      : (cell.coupled ? LaunchCellOperations<T, CellPolicy<false, true>> : LaunchCellOperations<T, StandardCell>);
+  launch(
+      training,
+      batch_size,
+      hidden_size,
+      h_stride,
+      interleaved,
+      Wx,
+      Rh,
+      b,
+      h,
+      c,
+      h_out,
+      c_out,
+      v_out,
+      zoneout_prob,
+      zoneout_mask,
+      zoneout_rng,
+      step,
+      sequence_lengths,
+      cell,
+      stream);
+}
+
+// The pointwise operations of `RunQuantized`: dequantizes the int32 products `Wx` and
+// `Rh` with the per-column weight scales and the scales of the quantized inputs and
+// hidden state, applies the gates in (at least) FP32 and writes the new hidden state
+// both in `T` and quantized, as `h_q`, for the next step's recurrent GEMM. Each thread
+// handles one hidden unit of one batch item. `h` and `h_out` may be aliased, as may `c`
+// and `c_out`. `Act` implements the gate nonlinearities (see `ActivationTier`).
+template<typename T, typename Act, bool ApplyZoneout>
+__global__
+void QuantizedPointwiseOperations(const int batch_dim,
+                                  const int hidden_dim,
+                                  const bool interleaved,
+                                  const int32_t* Wx,       // [N,H*4] int8 products
+                                  const int32_t* Rh,       // [N,H*4] int8 products
+                                  const float* W_scale,    // [H*4]
+                                  const float* R_scale,    // [H*4]
+                                  const float* x_scale,    // [1]
+                                  const T* b,
+                                  const T* h,
+                                  const accum_t<T>* c,
+                                  T* h_out,
+                                  accum_t<T>* c_out,
+                                  int8_t* h_q,             // [N,H]
+                                  const float zoneout_prob,
+                                  const int step,
+                                  const int* sequence_lengths) {  // May be null
+  const int row = blockDim.x * blockIdx.x + threadIdx.x;
+  const int col = blockDim.y * blockIdx.y + threadIdx.y;
+
+  if (row >= hidden_dim || col >= batch_dim)
+    return;
+
+  typedef typename accum_type<T>::type Acc;
+
+  const int idx = col * hidden_dim + row;
+  if (sequence_lengths && step >= sequence_lengths[col]) {
+    h_out[idx] = h[idx];
+    c_out[idx] = c[idx];
+    h_q[idx] = pack_activation<int8_t>(Acc(h[idx]));
+    return;
+  }
+
+  const float Wx_scale = *x_scale;
+  const float Rh_scale = 1.0f / 127.0f;
+  Acc pre[4];
+  #pragma unroll
+  for (int k = 0; k < 4; ++k) {
+    const int gate_col = PackedGateColumn(k, row, hidden_dim, 4, interleaved);
+    const int weight_idx = col * (hidden_dim * 4) + gate_col;
+    const float product = W_scale[gate_col] * Wx_scale * static_cast<float>(Wx[weight_idx])
+        + R_scale[gate_col] * Rh_scale * static_cast<float>(Rh[weight_idx]);
+    pre[k] = Acc(product) + Acc(b[gate_col]);
+  }
+
+  Acc gates[4];
+  Acc cur_h_value;
+  Acc cur_c_value;
+  LstmCell<Acc, CellPolicy<false, false, Act>, false, ApplyZoneout>(
+      pre, nullptr, Acc(h[idx]), c[idx], zoneout_prob, static_cast<Acc>(0.0), gates, &cur_h_value, &cur_c_value);
+
+  c_out[idx] = cur_c_value;
+  h_out[idx] = T(cur_h_value);
+  h_q[idx] = pack_activation<int8_t>(cur_h_value);
+}
+
+// Launches `QuantizedPointwiseOperations` for one time step of the whole batch, with
+// the gate nonlinearities of `tier`.
+template<typename T>
+void LaunchQuantizedPointwiseOperations(
+    const haste::v0::ActivationTier tier,
+    const int batch_size,
+    const int hidden_size,
+    const bool interleaved,
+    const int32_t* Wx,
+    const int32_t* Rh,
+    const float* W_scale,
+    const float* R_scale,
+    const float* x_scale,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    int8_t* h_q,
+    const float zoneout_prob,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  dim3 gridDim;
+  dim3 blockDim;
+  PointwiseLaunchShape(batch_size, hidden_size, &gridDim, &blockDim);
+  typedef haste::v0::ActivationTier Tier;
+  const auto kernel = zoneout_prob
+      ? (tier == Tier::kHalf2 ? QuantizedPointwiseOperations<T, Half2Activations, true>
+       : tier == Tier::kApprox ? QuantizedPointwiseOperations<T, ApproxActivations, true>
+       : tier == Tier::kFast ? QuantizedPointwiseOperations<T, FastActivations, true>
+       :                       QuantizedPointwiseOperations<T, PreciseActivations, true>)
+      : (tier == Tier::kHalf2 ? QuantizedPointwiseOperations<T, Half2Activations, false>
+       : tier == Tier::kApprox ? QuantizedPointwiseOperations<T, ApproxActivations, false>
+       : tier == Tier::kFast ? QuantizedPointwiseOperations<T, FastActivations, false>
+       :                       QuantizedPointwiseOperations<T, PreciseActivations, false>);
+  kernel<<<gridDim, blockDim, 0, stream>>>(
+      batch_size,
+      hidden_size,
+      interleaved,
+      Wx,
+      Rh,
+      W_scale,
+      R_scale,
+      x_scale,
+      b,
+      h,
+      c,
+      h_out,
+      c_out,
+      h_q,
+      zoneout_prob,
+      step,
+      sequence_lengths);
+}
+
+// Tile of `FusedRecurrence`: each block computes the recurrent GEMM for all four gate
+// columns of `kFusedUnits` hidden units and `kFusedRows` batch items, `kFusedK` rows of
+// R at a time, and applies the pointwise operations to the result in registers.
+constexpr int kFusedUnits = 32;
+constexpr int kFusedRowThreads = 8;
+constexpr int kFusedRowsPerThread = 2;
+constexpr int kFusedRows = kFusedRowThreads * kFusedRowsPerThread;
+constexpr int kFusedK = 16;
+
+// One time step of the recurrence that never materializes Rh: same as the Rh GEMM
+// followed by `PointwiseOperations` with V=T, U=1. `h` and `h_out` must not be aliased
+// since every block reads all of `h`; `Wx` and `v_out` may be. Batch items from
+// `active_batch` onwards are past the end of their sequence, so their GEMM rows are
+// skipped.
+template<typename T, bool Interleaved, bool Training, bool ApplyZoneout>
+__global__
+void FusedRecurrence(const int batch_dim,
+                     const int active_batch,
+                     const int hidden_dim,
+                     const int h_stride,  // Distance between batch items in `h` and `h_out`
+                     const T* R,   // Recurrent weight matrix [H,H*4]
+                     const T* Wx,  // Precomputed (Wx) vector
+                     const T* b,   // Bias for gates
+                     const T* h,   // Input recurrent state
+                     const accum_t<T>* c,  // Input cell state
+                     T* h_out,     // Output recurrent state
+                     accum_t<T>* c_out,  // Output cell state
+                     T* v_out,     // Output vector v (Wx + Rh + b) (only used if Training==true)
+                     const float zoneout_prob,
+                     const T* zoneout_mask,  // Zoneout mask (only used if ApplyZoneout==true), may be null
+                     const ZoneoutRng zoneout_rng,  // Generates the mask if `zoneout_mask` is null
+                     const int step,
+                     const int* sequence_lengths) {  // May be null
+  typedef typename accum_type<T>::type Acc;
+
+  __shared__ T R_tile[kFusedK][4 * kFusedUnits];
+  __shared__ T h_tile[kFusedRows][kFusedK + 1];
+
+  const int threads = kFusedUnits * kFusedRowThreads;
+  const int tid = threadIdx.y * kFusedUnits + threadIdx.x;
+  const int unit_base = blockIdx.x * kFusedUnits;
+  const int row_base = blockIdx.y * kFusedRows;
+  const int unit = unit_base + threadIdx.x;
+  const int cols = hidden_dim * 4;
+
+  Acc Rh[kFusedRowsPerThread][4];
+  #pragma unroll
+  for (int r = 0; r < kFusedRowsPerThread; ++r) {
+    #pragma unroll
+    for (int k = 0; k < 4; ++k)
+      Rh[r][k] = static_cast<Acc>(0.0);
+  }
+
+  // `row_base` is the same for the whole block, so the barriers are safe.
+  if (row_base < active_batch) {
+    for (int k_base = 0; k_base < hidden_dim; k_base += kFusedK) {
+      // Consecutive threads read consecutive columns of R in either gate layout.
+      for (int e = tid; e < kFusedK * 4 * kFusedUnits; e += threads) {
+        const int kk = e / (4 * kFusedUnits);
+        const int idx = e - kk * 4 * kFusedUnits;
+        const int gate = Interleaved ? idx % 4 : idx / kFusedUnits;
+        const int u = Interleaved ? idx / 4 : idx % kFusedUnits;
+        const int col = Interleaved ? (unit_base + u) * 4 + gate : gate * hidden_dim + unit_base + u;
+        const bool valid = k_base + kk < hidden_dim && unit_base + u < hidden_dim;
+        R_tile[kk][gate * kFusedUnits + u] = valid
+            ? R[static_cast<size_t>(k_base + kk) * cols + col]
+            : static_cast<T>(0.0);
+      }
+      for (int e = tid; e < kFusedRows * kFusedK; e += threads) {
+        const int r = e / kFusedK;
+        const int kk = e - r * kFusedK;
+        const int n = row_base + r;
+        const bool valid = n < active_batch && k_base + kk < hidden_dim;
+        h_tile[r][kk] = valid ? h[n * h_stride + k_base + kk] : static_cast<T>(0.0);
+      }
+      __syncthreads();
+
+      #pragma unroll
+      for (int kk = 0; kk < kFusedK; ++kk) {
+        Acc R_value[4];
+        #pragma unroll
+        for (int k = 0; k < 4; ++k)
+          R_value[k] = Acc(R_tile[kk][k * kFusedUnits + threadIdx.x]);
+        #pragma unroll
+        for (int r = 0; r < kFusedRowsPerThread; ++r) {
+          const Acc h_value = Acc(h_tile[threadIdx.y + r * kFusedRowThreads][kk]);
+          #pragma unroll
+          for (int k = 0; k < 4; ++k)
+            Rh[r][k] += h_value * R_value[k];
+        }
+      }
+      __syncthreads();
+    }
+  }
+
+  if (unit >= hidden_dim)
+    return;
+
+  #pragma unroll
+  for (int r = 0; r < kFusedRowsPerThread; ++r) {
+    const int n = row_base + threadIdx.y + r * kFusedRowThreads;
+    if (n >= batch_dim)
+      break;
+
+    const int output_idx = n * hidden_dim + unit;
+    const int h_idx = n * h_stride + unit;
+
+    // Items past the end of their sequence carry their state through unchanged.
+    if (sequence_lengths && step >= sequence_lengths[n]) {
+      h_out[h_idx] = h[h_idx];
+      c_out[output_idx] = c[output_idx];
+      continue;
+    }
+
+    int gate_idx[4];
+    Acc pre[4];
+    #pragma unroll
+    for (int k = 0; k < 4; ++k) {
+      const int col = Interleaved ? unit * 4 + k : k * hidden_dim + unit;
+      gate_idx[k] = n * cols + col;
+      pre[k] = Acc(Wx[gate_idx[k]]) + Rh[r][k] + Acc(b[col]);
+    }
+
+    Acc mask = static_cast<Acc>(0.0);
+    if (ApplyZoneout && Training) {
+      mask = zoneout_mask
+          ? Acc(zoneout_mask[output_idx])
+          : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(step) * batch_dim * hidden_dim + output_idx);
+    }
+
+    Acc gates[4];
+    Acc cur_h_value;
+    Acc cur_c_value;
+    LstmCell<Acc, StandardCell, Training, ApplyZoneout>(
+        pre, nullptr, Acc(h[h_idx]), c[output_idx], zoneout_prob, mask, gates, &cur_h_value, &cur_c_value);
+
+    if (Training) {
+      #pragma unroll
+      for (int k = 0; k < 4; ++k)
+        v_out[gate_idx[k]] = T(gates[k]);
+    }
+    c_out[output_idx] = cur_c_value;
+    h_out[h_idx] = T(cur_h_value);
+  }
+}
+
+// Launches `FusedRecurrence` for one time step of the whole batch.
+template<typename T>
+void LaunchFusedRecurrence(
+    const bool training,
+    const int batch_size,
+    const int active_batch_size,
+    const int hidden_size,
+    const int h_stride,
+    const bool interleaved,
+    const T* R,
+    const T* Wx,
+    const T* b,
+    const T* h,
+    const accum_t<T>* c,
+    T* h_out,
+    accum_t<T>* c_out,
+    T* v_out,
+    const float zoneout_prob,
+    const T* zoneout_mask,
+    const ZoneoutRng& zoneout_rng,
+    const int step,
+    const int* sequence_lengths,
+    const cudaStream_t& stream) {
+  const bool apply_zoneout = zoneout_prob && (!training || zoneout_mask || zoneout_rng.enabled);
+
+  const auto kernel = interleaved
+      ? (training
+          ? (apply_zoneout ? FusedRecurrence<T, true, true, true> : FusedRecurrence<T, true, true, false>)
+          : (apply_zoneout ? FusedRecurrence<T, true, false, true> : FusedRecurrence<T, true, false, false>))
+      : (training
+          ? (apply_zoneout ? FusedRecurrence<T, false, true, true> : FusedRecurrence<T, false, true, false>)
+          : (apply_zoneout ? FusedRecurrence<T, false, false, true> : FusedRecurrence<T, false, false, false>));
+
+  const dim3 blockDim(kFusedUnits, kFusedRowThreads);
+  const dim3 gridDim(
+      (hidden_size + kFusedUnits - 1) / kFusedUnits,
+      (batch_size + kFusedRows - 1) / kFusedRows);
+  kernel<<<gridDim, blockDim, 0, stream>>>(
+      batch_size,
+      active_batch_size,
+      hidden_size,
+      h_stride,
+      R,
+      Wx,
+      b,
+      h,
+      c,
+      h_out,
+      c_out,
+      v_out,
+      apply_zoneout ? zoneout_prob : 0.0f,
+      apply_zoneout ? zoneout_mask : nullptr,
+      zoneout_rng,
+      step,
+      sequence_lengths);
+}
+
+// Runs the recurrence for all time steps in a single cooperative launch. Each block owns
+// `units` consecutive hidden units and keeps the matching columns of R for all four gates
+// in shared memory, so R is read from DRAM once per call instead of once per step. The
+// block's threads are laid out as [splits, units*4]: each thread accumulates a partial
+// dot product over a strided subset of `h` for one gate column. A grid-wide barrier
+// separates time steps since every block reads all of the previous step's `h`.
+//
+// `v` must hold the precomputed Wx vectors on entry, same as `PointwiseOperations`.
+template<typename T, bool Training, bool ApplyZoneout>
+__global__
+void PersistentRecurrence(const int steps,
+                          const int batch_dim,
+                          const int hidden_dim,
+                          const int units,
+                          const T* R,   // [H,H*4]
+                          const T* b,   // [H*4]
+                          T* h,         // [T+1,N,H]
+                          accum_t<T>* c,  // [T+1,N,H]
+                          T* v,         // [T,N,H*4]
+                          const float zoneout_prob,
+                          const T* zoneout_mask,    // [T,N,H], may be null
+                          const ZoneoutRng zoneout_rng,  // Generates the mask if `zoneout_mask` is null
+                          const int* sequence_lengths) {  // [N], may be null
+  typedef typename accum_type<T>::type Acc;
+  extern __shared__ __align__(16) unsigned char shared_storage[];
+
+  const int cols = units * 4;
+  const int splits = blockDim.y;
+  T* R_s = reinterpret_cast<T*>(shared_storage);  // [H,units*4]
+  Acc* Rh_s = reinterpret_cast<Acc*>(             // [splits,N,units*4]
+      shared_storage + PersistentAccumOffset(hidden_dim, cols, sizeof(T)));
+
+  const int base_row = blockIdx.x * units;
+  const int block_units = min(units, hidden_dim - base_row);
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  const int num_threads = blockDim.x * blockDim.y;
+
+  // Column `gate * units + u` of the slice is column `gate * H + base_row + u` of R.
+  for (int i = tid; i < hidden_dim * cols; i += num_threads) {
+    const int k = i / cols;
+    const int gate = (i - k * cols) / units;
+    const int u = i - k * cols - gate * units;
+    R_s[i] = u < block_units
+        ? R[k * hidden_dim * 4 + gate * hidden_dim + base_row + u]
+        : static_cast<T>(0.0);
+  }
+  __syncthreads();
+
+  cooperative_groups::grid_group grid = cooperative_groups::this_grid();
+  const int NH = batch_dim * hidden_dim;
+
+  for (int t = 0; t < steps; ++t) {
+    // `h` is written by other blocks during the kernel, so always load it from L2.
+    const T* h_cur = h + t * NH;
+    for (int n = 0; n < batch_dim; ++n) {
+      Acc sum = static_cast<Acc>(0.0);
+      for (int k = threadIdx.y; k < hidden_dim; k += splits)
+        sum += Acc(R_s[k * cols + threadIdx.x]) * Acc(__ldcg(h_cur + n * hidden_dim + k));
+      Rh_s[(threadIdx.y * batch_dim + n) * cols + threadIdx.x] = sum;
+    }
+    __syncthreads();
+
+    for (int i = tid; i < block_units * batch_dim; i += num_threads) {
+      const int n = i / block_units;
+      const int u = i - n * block_units;
+      const int row = base_row + u;
+      const int output_idx = n * hidden_dim + row;
+
+      if (sequence_lengths && t >= sequence_lengths[n]) {
+        h[(t + 1) * NH + output_idx] = __ldcg(h_cur + output_idx);
+        c[(t + 1) * NH + output_idx] = c[t * NH + output_idx];
+        continue;
+      }
+
+      Acc Rh[4];
+      for (int gate = 0; gate < 4; ++gate) {
+        Rh[gate] = static_cast<Acc>(0.0);
+        for (int split = 0; split < splits; ++split)
+          Rh[gate] += Rh_s[(split * batch_dim + n) * cols + gate * units + u];
+      }
+
+      const int weight_idx = t * NH * 4 + n * (hidden_dim * 4) + row;
+
+      const int i_idx = weight_idx + 0 * hidden_dim;
+      const int g_idx = weight_idx + 1 * hidden_dim;
+      const int f_idx = weight_idx + 2 * hidden_dim;
+      const int o_idx = weight_idx + 3 * hidden_dim;
+
+      const Acc ig = sigmoid(Acc(v[i_idx]) + Rh[0] + Acc(b[row + 0 * hidden_dim]));
+      const Acc g  = tanh   (Acc(v[g_idx]) + Rh[1] + Acc(b[row + 1 * hidden_dim]));
+      const Acc f  = sigmoid(Acc(v[f_idx]) + Rh[2] + Acc(b[row + 2 * hidden_dim]));
+      const Acc o  = sigmoid(Acc(v[o_idx]) + Rh[3] + Acc(b[row + 3 * hidden_dim]));
+
+      if (Training) {
+        v[i_idx] = T(ig);
+        v[g_idx] = T(g);
+        v[f_idx] = T(f);
+        v[o_idx] = T(o);
+      }
+
+      const Acc h_prev = Acc(__ldcg(h_cur + output_idx));
+      Acc cur_c_value = (f * c[t * NH + output_idx]) + (ig * g);
+      Acc cur_h_value = o * tanh(cur_c_value);
+
+      if (ApplyZoneout) {
+        if (Training) {
+          const Acc mask = zoneout_mask
+              ? Acc(zoneout_mask[t * NH + output_idx])
+              : zoneout_keep<Acc>(zoneout_rng, static_cast<unsigned long long>(t) * NH + output_idx);
+          cur_h_value = (cur_h_value - h_prev) * mask + h_prev;
+        } else {
+          cur_h_value = (zoneout_prob * h_prev) + ((1.0f - zoneout_prob) * cur_h_value);
+        }
+      }
+
+      c[(t + 1) * NH + output_idx] = cur_c_value;
+      h[(t + 1) * NH + output_idx] = T(cur_h_value);
+    }
+
+    // Also stops this block from overwriting `Rh_s` while it's still being read.
+    grid.sync();
+  }
+}
+
+}  // anonymous namespace
+
+namespace haste {
+namespace v0 {
+namespace lstm {
+
+template<typename T>
+struct ForwardPass<T>::private_data {
+  bool training;
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  cudaStream_t stream[2];
+  cudaEvent_t event;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+  PersistentConfig persistent;
+  GraphCache graph;
+  ZoneoutRng zoneout_rng;
+  DropConnectConfig<T> dropconnect;
+  GateLayout gate_layout;
+  SequenceLayout sequence_layout;
+  bool fused;
+  CellConfig<T> cell;
+  ActivationTier activations;
+  PhaseProfiler profiler;
+};
+
+template<typename T>
+ForwardPass<T>::ForwardPass(
+    const bool training,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->training = training;
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  data_->zoneout_rng = ZoneoutRng();
+  data_->dropconnect = DropConnectConfig<T>();
+  data_->gate_layout = GateLayout::kBlocked;
+  data_->sequence_layout = SequenceLayout();
+  data_->fused = false;
+  data_->cell = CellConfig<T>();
+  data_->activations = ActivationTier::kPrecise;
+  data_->profiler.SetName("lstm::ForwardPass");
+  cudaStreamCreate(&data_->stream[0]);
+  cudaStreamCreate(&data_->stream[1]);
+  cudaEventCreateWithFlags(&data_->event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+ForwardPass<T>::~ForwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  cudaEventDestroy(data_->event);
+  cudaStreamDestroy(data_->stream[1]);
+  cudaStreamDestroy(data_->stream[0]);
+  delete data_;
+}
+
+template<typename T>
+bool ForwardPass<T>::EnablePersistentKernel() {
+  const decltype(&PersistentRecurrence<T, true, true>) kernels[] = {
+    PersistentRecurrence<T, true, true>,
+    PersistentRecurrence<T, true, false>,
+    PersistentRecurrence<T, false, true>,
+    PersistentRecurrence<T, false, false>,
+  };
+  data_->persistent = ConfigurePersistentKernel(
+      kernels,
+      sizeof(kernels) / sizeof(kernels[0]),
+      4,
+      data_->batch_size,
+      data_->hidden_size,
+      sizeof(T),
+      sizeof(typename accum_type<T>::type));
+  return data_->persistent.enabled;
+}
+
+template<typename T>
+void ForwardPass<T>::EnableGraphCapture() {
+  data_->graph.Enable();
+}
+
+template<typename T>
+void ForwardPass<T>::EnableFusedRecurrence() {
+  data_->fused = true;
+}
+
+template<typename T>
+void ForwardPass<T>::EnablePhaseTiming() {
+  data_->profiler.EnableTiming();
+}
+
+template<typename T>
+PhaseStats ForwardPass<T>::CollectPhaseStats() {
+  return data_->profiler.Collect();
+}
+
+template<typename T>
+void ForwardPass<T>::SetZoneoutSeed(
+    const float zoneout_prob,
+    const unsigned long long seed,
+    const unsigned long long offset) {
+  data_->zoneout_rng.enabled = true;
+  data_->zoneout_rng.prob = zoneout_prob;
+  data_->zoneout_rng.seed = seed;
+  data_->zoneout_rng.offset = offset;
+}
+
+template<typename T>
+void ForwardPass<T>::SetDropConnect(
+    const float rate,
+    const unsigned long long seed,
+    const unsigned long long offset,
+    T* tmp_R) {
+  data_->dropconnect.rate = rate;
+  data_->dropconnect.seed = seed;
+  data_->dropconnect.offset = offset;
+  data_->dropconnect.tmp_R = tmp_R;
+}
+
+template<typename T>
+void ForwardPass<T>::SetGateLayout(const GateLayout layout) {
+  data_->gate_layout = layout;
+}
+
+template<typename T>
+void ForwardPass<T>::SetSequenceLayout(const SequenceLayout& layout) {
+  data_->sequence_layout = layout;
+}
+
+template<typename T>
+void ForwardPass<T>::SetPeephole(const T* P) {
+  data_->cell.peephole = P;
+}
+
+template<typename T>
+void ForwardPass<T>::SetCoupledGates(const bool coupled) {
+  data_->cell.coupled = coupled;
+}
+
+template<typename T>
+void ForwardPass<T>::SetLayerNorm(const T* layer_norm, T* layer_norm_cache) {
+  data_->cell.layer_norm = layer_norm;
+  data_->cell.layer_norm_cache = layer_norm_cache;
+}
+
+template<typename T>
+void ForwardPass<T>::SetActivationTier(const ActivationTier tier) {
+  data_->activations = tier;
+}
+
+template<typename T>
+void ForwardPass<T>::Iterate(
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [N,C]
+    const T* h,  // Recurrent state [N,H]
+    const accum_t<T>* c,  // Cell state [N,H]
+    T* h_out,    // Output recurrent state [N,H]
+    accum_t<T>* c_out,  // Output cell state [N,H]
+    T* v,        // Output vector (Wx + Rh + b) [N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask) { // Zoneout mask [N,H]
+  // Constants for GEMM
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+  const cudaEvent_t event = data_->event;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+  cudaStreamWaitEvent(stream2, data_->ready_event, 0);
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kInputProjection, stream2);
+  cublasSetStream(blas_handle, stream2);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, batch_size, input_size,
+      &alpha,
+      W, hidden_size * 4,
+      x, input_size,
+      &beta,
+      v, hidden_size * 4);
+  profiler.End(Phase::kInputProjection, stream2);
+  cudaEventRecord(event, stream2);
+
+  profiler.Begin(Phase::kRecurrence, stream1);
+  IterateInternal(
+      R,
+      b,
+      h,
+      c,
+      h_out,
+      c_out,
+      v,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      0,
+      data_->batch_size,
+      nullptr,
+      data_->hidden_size);
+  profiler.End(Phase::kRecurrence, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void ForwardPass<T>::IterateInternal(
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* h,  // Recurrent state [N,H]
+    const accum_t<T>* c,  // Cell state [N,H]
+    T* h_out,    // Output recurrent state [N,H]
+    accum_t<T>* c_out,  // Output cell state [N,H]
+    T* v,        // Output vector (Wx + Rh + b) [N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [N,H]
+    const int step,
+    const int active_batch_size,
+    const int* sequence_lengths,  // [N]
+    const int h_stride) {
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const bool training = data_->training;
+  const int batch_size = data_->batch_size;
+  const int hidden_size = data_->hidden_size;
+  const bool interleaved = data_->gate_layout == GateLayout::kInterleaved;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaEvent_t event = data_->event;
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, active_batch_size, hidden_size,
+      &alpha,
+      R, hidden_size * 4,
+      h, h_stride,
+      &beta,
+      tmp_Rh, hidden_size * 4);
+
+  cudaStreamWaitEvent(stream1, event, 0);
+
+  data_->profiler.Begin(Phase::kPointwise, stream1);
+  if (!training && !data_->cell.enabled() && data_->activations != ActivationTier::kPrecise) {
+    LaunchTierOperations(
+        data_->activations,
+        batch_size,
+        hidden_size,
+        h_stride,
+        interleaved,
+        v,
+        tmp_Rh,
+        b,
+        h,
+        c,
+        h_out,
+        c_out,
+        zoneout_prob,
+        step,
+        sequence_lengths,
+        stream1);
+  } else {
+    LaunchPointwiseOperations(
+        training,
+        batch_size,
+        hidden_size,
+        h_stride,
+        interleaved,
+        v,
+        tmp_Rh,
+        b,
+        h,
+        c,
+        h_out,
+        c_out,
+        v,
+        zoneout_prob,
+        zoneout_mask,
+        data_->zoneout_rng,
+        step,
+        sequence_lengths,
+        data_->cell,
+        stream1);
+  }
+  data_->profiler.End(Phase::kPointwise, stream1);
+}
+
+template<typename T>
+void ForwardPass<T>::Run(
+    const int steps,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state [T+1,N,H]
+    T* v,        // Output vector (Wx + Rh + b) [T,N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // Replay the work captured on a previous call with the same arguments, capturing it
+  // first if there's no such call. The capture re-enters `Run` with the graph's stream
+  // standing in for the caller's stream.
+  GraphCache& graph = data_->graph;
+  if (graph.enabled() && !graph.capturing()) {
+    bool captured = graph.Lookup(
+        steps,
+        W,
+        R,
+        b,
+        x,
+        h,
+        c,
+        v,
+        tmp_Rh,
+        zoneout_prob,
+        zoneout_mask,
+        data_->zoneout_rng.enabled,
+        data_->zoneout_rng.seed,
+        data_->zoneout_rng.offset,
+        data_->dropconnect.rate,
+        data_->dropconnect.seed,
+        data_->dropconnect.offset,
+        data_->dropconnect.tmp_R,
+        data_->gate_layout,
+        data_->sequence_layout.batch_major,
+        data_->sequence_layout.reverse,
+        data_->sequence_layout.h_stride,
+        data_->fused,
+        data_->cell.peephole,
+        data_->cell.coupled,
+        data_->cell.layer_norm,
+        data_->cell.layer_norm_cache,
+        data_->activations,
+        sequence_lengths,
+        GraphKeyArray(batch_sizes, batch_sizes ? steps : 0));
+    if (!captured) {
+      const cudaStream_t sync_stream = data_->sync_stream;
+      data_->sync_stream = graph.BeginCapture();
+      Run(
+          steps,
+          W,
+          R,
+          b,
+          x,
+          h,
+          c,
+          v,
+          tmp_Rh,
+          zoneout_prob,
+          zoneout_mask,
+          sequence_lengths,
+          batch_sizes);
+      data_->sync_stream = sync_stream;
+      captured = graph.EndCapture();
+    }
+    if (captured) {
+      graph.Launch(data_->sync_stream);
+      return;
+    }
+  }
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const SequenceStrides strides(data_->sequence_layout, steps, batch_size, input_size, hidden_size);
+  const int NH = batch_size * hidden_size;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // Every step reads the same masked copy of `R`, so draw the mask once up front.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  if (dropconnect.rate > 0.0f && dropconnect.tmp_R) {
+    LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, R, dropconnect.tmp_R, stream1);
+    R = dropconnect.tmp_R;
+  }
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kInputProjection, stream1);
+  cublasSetStream(blas_handle, stream1);
+  StepwiseGemm(blas_handle,
+      CUBLAS_OP_N,
+      hidden_size * 4, input_size,
+      steps, batch_size,
+      &alpha,
+      W, hidden_size * 4,
+      x, strides.x_ld, strides.x_step,
+      &beta,
+      v, hidden_size * 4, static_cast<size_t>(NH) * 4);
+  profiler.End(Phase::kInputProjection, stream1);
+
+  // `IterateInternal` waits on `event` for the Wx GEMM, which we've already ordered on
+  // `stream1`. Record it here so that the wait never refers to work outside this call
+  // (which would also break graph capture).
+  cudaEventRecord(data_->event, stream1);
+
+  profiler.Begin(Phase::kRecurrence, stream1);
+  // The persistent kernel reads R's gate columns in the blocked layout and walks dense
+  // time-major states. Neither it nor the fused kernel knows the cell variants.
+  const bool standard_cell = !data_->cell.enabled();
+  if (data_->persistent.enabled && data_->gate_layout == GateLayout::kBlocked && standard_cell &&
+      strides.dense) {
+    const bool training = data_->training;
+    const bool apply_zoneout =
+        zoneout_prob && (!training || zoneout_mask || data_->zoneout_rng.enabled);
+    auto kernel = training
+        ? (apply_zoneout ? PersistentRecurrence<T, true, true> : PersistentRecurrence<T, true, false>)
+        : (apply_zoneout ? PersistentRecurrence<T, false, true> : PersistentRecurrence<T, false, false>);
+
+    int steps_arg = steps;
+    int batch_size_arg = batch_size;
+    int hidden_size_arg = hidden_size;
+    int units_arg = data_->persistent.units;
+    float zoneout_prob_arg = apply_zoneout ? zoneout_prob : 0.0f;
+    const T* zoneout_mask_arg = apply_zoneout ? zoneout_mask : nullptr;
+    ZoneoutRng zoneout_rng_arg = data_->zoneout_rng;
+    void* args[] = {
+      &steps_arg,
+      &batch_size_arg,
+      &hidden_size_arg,
+      &units_arg,
+      &R,
+      &b,
+      &h,
+      &c,
+      &v,
+      &zoneout_prob_arg,
+      &zoneout_mask_arg,
+      &zoneout_rng_arg,
+      &sequence_lengths,
+    };
+    cudaLaunchCooperativeKernel(
+        kernel,
+        data_->persistent.grid,
+        data_->persistent.block,
+        args,
+        data_->persistent.shared_bytes,
+        stream1);
+  } else if (data_->fused && standard_cell) {
+    for (int i = 0; i < steps; ++i) {
+      const int t = strides.Step(i, steps);
+      LaunchFusedRecurrence(
+          data_->training,
+          batch_size,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          hidden_size,
+          strides.h_ld,
+          data_->gate_layout == GateLayout::kInterleaved,
+          R,
+          v + t * NH * 4,
+          b,
+          h + strides.In(t) * strides.h_step,
+          c + strides.In(t) * NH,
+          h + strides.Out(t) * strides.h_step,
+          c + strides.Out(t) * NH,
+          v + t * NH * 4,
+          zoneout_prob,
+          zoneout_mask ? zoneout_mask + t * NH : nullptr,
+          data_->zoneout_rng,
+          t,
+          sequence_lengths,
+          stream1);
+    }
+  } else {
+    for (int i = 0; i < steps; ++i) {
+      const int t = strides.Step(i, steps);
+      IterateInternal(
+          R,
+          b,
+          h + strides.In(t) * strides.h_step,
+          c + strides.In(t) * NH,
+          h + strides.Out(t) * strides.h_step,
+          c + strides.Out(t) * NH,
+          v + t * NH * 4,
+          tmp_Rh,
+          zoneout_prob,
+          zoneout_mask ? zoneout_mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          strides.h_ld);
+    }
+  }
+  profiler.End(Phase::kRecurrence, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+void ForwardPass<T>::Run(
+    const int steps,
+    const PackedWeights<T>& weights,
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state [T+1,N,H]
+    T* v,        // Output vector (Wx + Rh + b) [T,N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  Run(
+      steps,
+      weights.W,
+      weights.R,
+      weights.b,
+      x,
+      h,
+      c,
+      v,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+}
+
+template<typename T>
+size_t ForwardPass<T>::GetWorkspaceSize(const int steps) const {
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  size_t size = WorkspaceBytes<T>(NH * 4);  // tmp_Rh
+  if (!data_->training)
+    size += WorkspaceBytes<T>(steps * NH * 4);  // v
+  return size;
+}
+
+template<typename T>
+void ForwardPass<T>::Run(
+    const int steps,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state [T+1,N,H]
+    T* v,        // Output vector (Wx + Rh + b) [T,N,H*4], may be null unless training
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes,       // [T] host
+    void* workspace) {            // `GetWorkspaceSize(steps)` bytes
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  Workspace buffers(workspace);
+  T* tmp_Rh = buffers.Take<T>(NH * 4);
+  T* tmp_v = data_->training ? nullptr : buffers.Take<T>(steps * NH * 4);
+  Run(
+      steps,
+      W,
+      R,
+      b,
+      x,
+      h,
+      c,
+      v ? v : tmp_v,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+}
+
+template<typename T>
+void ForwardPass<T>::RunSegment(
+    const int first_step,
+    const int steps,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [T,N,C]
+    const T* h,  // Recurrent state [T+1,N,H]
+    const accum_t<T>* c,  // Cell state before `first_step` [N,H]
+    T* h_out,    // Output recurrent state [steps,N,H] or [N,H]
+    const int h_out_step,
+    accum_t<T>* c_out,  // Output cell state [steps,N,H] or [N,H]
+    const int c_out_step,
+    T* v,        // Output vector (Wx + Rh + b) [steps,N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, steps * batch_size, input_size,
+      &alpha,
+      W, hidden_size * 4,
+      x + first_step * batch_size * input_size, input_size,
+      &beta,
+      v, hidden_size * 4);
+  cudaEventRecord(data_->event, stream1);
+
+  const int NH = batch_size * hidden_size;
+  for (int i = 0; i < steps; ++i) {
+    const int t = first_step + i;
+    IterateInternal(
+        R,
+        b,
+        h + t * NH,
+        i ? c_out + (i - 1) * c_out_step : c,
+        h_out + i * h_out_step,
+        c_out + i * c_out_step,
+        v + i * NH * 4,
+        tmp_Rh,
+        zoneout_prob,
+        zoneout_mask ? zoneout_mask + t * NH : nullptr,
+        t,
+        batch_sizes ? batch_sizes[t] : batch_size,
+        sequence_lengths,
+        hidden_size);
+  }
+}
+
+template<typename T>
+bool ForwardPass<T>::RunCheckpointed(
+    const int steps,
+    const int checkpoint_interval,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state checkpoints [ceil(T/K)+1,N,H]
+    T* tmp_v,    // Temporary storage for one segment's v [K,N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // The cell variants only have `Run` and `Iterate` kernels.
+  if (data_->cell.enabled())
+    return false;
+
+  const int NH = data_->batch_size * data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // Every step reads the same masked copy of `R`, so draw the mask once up front.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  if (dropconnect.rate > 0.0f && dropconnect.tmp_R) {
+    const int hidden_size = data_->hidden_size;
+    LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, R, dropconnect.tmp_R, stream1);
+    R = dropconnect.tmp_R;
+  }
+
+  // Each segment advances its checkpoint's cell state in place, which leaves the state
+  // at the start of the next segment behind.
+  for (int first_step = 0, j = 0; first_step < steps; first_step += checkpoint_interval, ++j) {
+    RunSegment(
+        first_step,
+        std::min(checkpoint_interval, steps - first_step),
+        W,
+        R,
+        b,
+        x,
+        h,
+        c + j * NH,
+        h + (first_step + 1) * NH,
+        NH,
+        c + (j + 1) * NH,
+        0,
+        tmp_v,
+        tmp_Rh,
+        zoneout_prob,
+        zoneout_mask,
+        sequence_lengths,
+        batch_sizes);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+void ForwardPass<T>::Recompute(
+    const int first_step,
+    const int steps,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [T,N,C]
+    const T* h,  // Recurrent state [T+1,N,H]
+    const accum_t<T>* c,  // Cell state before `first_step` [N,H]
+    accum_t<T>* c_out,  // Output cell state [steps,N,H]
+    T* v,        // Output vector (Wx + Rh + b) [steps,N,H*4]
+    T* tmp_h,    // Temporary storage for the discarded recurrent state [N,H]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  RunSegment(
+      first_step,
+      steps,
+      W,
+      R,
+      b,
+      x,
+      h,
+      c,
+      tmp_h,
+      0,
+      c_out,
+      data_->batch_size * data_->hidden_size,
+      v,
+      tmp_Rh,
+      zoneout_prob,
+      zoneout_mask,
+      sequence_lengths,
+      batch_sizes);
+
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+bool ForwardPass<T>::RunCompact(
+    const int steps,
+    const ActivationStorage storage,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state [T+1,N,H]
+    void* v,     // Output activations [T,N,H*4] in the `storage` format
+    T* tmp_Wx,   // Temporary storage for Wx vectors [T,N,H*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,H*4]
+    const float zoneout_prob,
+    const T* zoneout_mask,  // Zoneout mask [T,N,H]
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes) {     // [T] host
+  // The cell variants only have `Run` and `Iterate` kernels.
+  if (data_->cell.enabled())
+    return false;
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const bool interleaved = data_->gate_layout == GateLayout::kInterleaved;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  // Every step reads the same masked copy of `R`, so draw the mask once up front.
+  const DropConnectConfig<T>& dropconnect = data_->dropconnect;
+  if (dropconnect.rate > 0.0f && dropconnect.tmp_R) {
+    LaunchDropConnect(hidden_size, hidden_size * 4, false, dropconnect, R, dropconnect.tmp_R, stream1);
+    R = dropconnect.tmp_R;
+  }
+
+  cublasSetStream(blas_handle, stream1);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, steps * batch_size, input_size,
+      &alpha,
+      W, hidden_size * 4,
+      x, input_size,
+      &beta,
+      tmp_Wx, hidden_size * 4);
+
+  const int NH = batch_size * hidden_size;
+  for (int i = 0; i < steps; ++i) {
+    const int step_batch_size = batch_sizes ? batch_sizes[i] : batch_size;
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 4, step_batch_size, hidden_size,
+        &alpha,
+        R, hidden_size * 4,
+        h + i * NH, hidden_size,
+        &beta,
+        tmp_Rh, hidden_size * 4);
+
+    // The activations are only rounded on their way out, so the recurrence itself runs
+    // at full precision.
+    switch (storage) {
+      case ActivationStorage::kHalf:
+        LaunchPointwiseOperations(
+            true,
+            batch_size,
+            hidden_size,
+            hidden_size,
+            interleaved,
+            tmp_Wx + i * NH * 4,
+            tmp_Rh,
+            b,
+            h + i * NH,
+            c + i * NH,
+            h + (i + 1) * NH,
+            c + (i + 1) * NH,
+            reinterpret_cast<__half*>(v) + i * NH * 4,
+            zoneout_prob,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+      case ActivationStorage::kFixed8:
+        LaunchPointwiseOperations(
+            true,
+            batch_size,
+            hidden_size,
+            hidden_size,
+            interleaved,
+            tmp_Wx + i * NH * 4,
+            tmp_Rh,
+            b,
+            h + i * NH,
+            c + i * NH,
+            h + (i + 1) * NH,
+            c + (i + 1) * NH,
+            reinterpret_cast<int8_t*>(v) + i * NH * 4,
+            zoneout_prob,
+            zoneout_mask ? zoneout_mask + i * NH : nullptr,
+            data_->zoneout_rng,
+            i,
+            sequence_lengths,
+            stream1);
+        break;
+    }
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+size_t ForwardPass<T>::GetQuantizedWorkspaceSize(const int steps) const {
+  const size_t NH = static_cast<size_t>(data_->batch_size) * data_->hidden_size;
+  const size_t NC = static_cast<size_t>(data_->batch_size) * data_->input_size;
+  return WorkspaceBytes<int32_t>(steps * NH * 4)  // tmp_Wx
+      + WorkspaceBytes<int32_t>(NH * 4)            // tmp_Rh
+      + WorkspaceBytes<int8_t>(steps * NC)         // x_q
+      + WorkspaceBytes<int8_t>(NH);                // h_q
+}
+
+template<typename T>
+bool ForwardPass<T>::RunQuantized(
+    const int steps,
+    const QuantizedWeights<T>& weights,
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state [T+1,N,H]
+    const float zoneout_prob,
+    const int* sequence_lengths,  // [N] device
+    const int* batch_sizes,       // [T] host
+    void* workspace) {            // `GetQuantizedWorkspaceSize(steps)` bytes
+  // The cell variants only have `Run` and `Iterate` kernels.
+  if (data_->cell.enabled())
+    return false;
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const bool interleaved = data_->gate_layout == GateLayout::kInterleaved;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+
+  const int NH = batch_size * hidden_size;
+  const size_t NC = static_cast<size_t>(batch_size) * input_size;
+  Workspace buffers(workspace);
+  int32_t* tmp_Wx = buffers.Take<int32_t>(steps * static_cast<size_t>(NH) * 4);
+  int32_t* tmp_Rh = buffers.Take<int32_t>(static_cast<size_t>(NH) * 4);
+  int8_t* x_q = buffers.Take<int8_t>(steps * NC);
+  int8_t* h_q = buffers.Take<int8_t>(NH);
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+
+  PhaseProfiler& profiler = data_->profiler;
+  profiler.CountCall();
+  profiler.Begin(Phase::kInputProjection, stream1);
+  LaunchQuantizeValues(steps * NC, x, weights.x_scale, x_q, stream1);
+  LaunchQuantizeValues(NH, h, nullptr, h_q, stream1);
+  cublasSetStream(blas_handle, stream1);
+  blas_int8::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, steps * batch_size, input_size,
+      weights.W, hidden_size * 4,
+      x_q, input_size,
+      tmp_Wx, hidden_size * 4);
+  profiler.End(Phase::kInputProjection, stream1);
+
+  profiler.Begin(Phase::kRecurrence, stream1);
+  for (int i = 0; i < steps; ++i) {
+    const int step_batch_size = batch_sizes ? batch_sizes[i] : batch_size;
+    blas_int8::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 4, step_batch_size, hidden_size,
+        weights.R, hidden_size * 4,
+        h_q, hidden_size,
+        tmp_Rh, hidden_size * 4);
+
+    LaunchQuantizedPointwiseOperations(
+        data_->activations,
+        batch_size,
+        hidden_size,
+        interleaved,
+        tmp_Wx + i * NH * 4,
+        tmp_Rh,
+        weights.W_scale,
+        weights.R_scale,
+        weights.x_scale,
+        weights.b,
+        h + i * NH,
+        c + i * NH,
+        h + (i + 1) * NH,
+        c + (i + 1) * NH,
+        h_q,
+        zoneout_prob,
+        i,
+        sequence_lengths,
+        stream1);
+  }
+  profiler.End(Phase::kRecurrence, stream1);
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+struct StackedForwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  std::vector<ForwardPass<T>*> layers;
+  std::vector<cudaEvent_t> layer_events;
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+StackedForwardPass<T>::StackedForwardPass(
+    const bool training,
+    const int layers,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < layers; ++i) {
+    data_->layers.push_back(new ForwardPass<T>(
+        training,
+        batch_size,
+        i ? hidden_size : input_size,
+        hidden_size,
+        blas_handle,
+        stream));
+    cudaEvent_t event;
+    cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+    data_->layer_events.push_back(event);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+StackedForwardPass<T>::~StackedForwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  for (int i = data_->layers.size() - 1; i >= 0; --i) {
+    cudaEventDestroy(data_->layer_events[i]);
+    delete data_->layers[i];
+  }
+  delete data_;
+}
+
+template<typename T>
+void StackedForwardPass<T>::Run(
+    const int steps,
+    const T* const* W,       // [L] [C,H*4] or [H,H*4]
+    const T* const* R,       // [L] [H,H*4]
+    const T* const* b,       // [L] [H*4]
+    const T* x,              // [T,N,C]
+    T* const* h,             // [L] [T+1,N,H]
+    accum_t<T>* const* c,    // [L] [T+1,N,H]
+    T* const* v,             // [L] [T,N,H*4]
+    T* const* tmp_Rh,        // [L] [N,H*4]
+    const float zoneout_prob,
+    const T* const* zoneout_mask,  // [L] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int layers = data_->layers.size();
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (ForwardPass<T>* layer : data_->layers) {
+    cudaStreamWaitEvent(layer->data_->stream[0], data_->ready_event, 0);
+    cudaStreamWaitEvent(layer->data_->stream[1], data_->ready_event, 0);
+  }
+
+  // The input sequence of the first layer is available upfront, so its Wx GEMM covers
+  // all time steps just like in `ForwardPass::Run`.
+  auto first = data_->layers[0]->data_;
+  cublasSetStream(blas_handle, first->stream[0]);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, steps * batch_size, input_size,
+      &alpha,
+      W[0], hidden_size * 4,
+      x, input_size,
+      &beta,
+      v[0], hidden_size * 4);
+  cudaEventRecord(first->event, first->stream[0]);
+
+  // Step `t` of layer `l` is issued on diagonal `t + l`, after step `t` of layer `l - 1`
+  // which was issued on the previous diagonal. Each diagonal is issued from the top layer
+  // down so that `layer_events[l - 1]` still marks step `t` when layer `l` waits on it.
+  const int NH = batch_size * hidden_size;
+  for (int d = 0; d < steps + layers - 1; ++d) {
+    for (int l = std::min(d, layers - 1); l >= 0 && d - l < steps; --l) {
+      const int t = d - l;
+      const int active_batch_size = batch_sizes ? batch_sizes[t] : batch_size;
+      ForwardPass<T>* layer = data_->layers[l];
+
+      if (l > 0) {
+        const cudaStream_t stream2 = layer->data_->stream[1];
+        cudaStreamWaitEvent(stream2, data_->layer_events[l - 1], 0);
+        cublasSetStream(blas_handle, stream2);
+        blas<T>::gemm(blas_handle,
+            CUBLAS_OP_N, CUBLAS_OP_N,
+            hidden_size * 4, active_batch_size, hidden_size,
+            &alpha,
+            W[l], hidden_size * 4,
+            h[l - 1] + (t + 1) * NH, hidden_size,
+            &beta,
+            v[l] + t * NH * 4, hidden_size * 4);
+        cudaEventRecord(layer->data_->event, stream2);
+      }
+
+      const T* mask = zoneout_mask ? zoneout_mask[l] : nullptr;
+      layer->IterateInternal(
+          R[l],
+          b[l],
+          h[l] + t * NH,
+          c[l] + t * NH,
+          h[l] + (t + 1) * NH,
+          c[l] + (t + 1) * NH,
+          v[l] + t * NH * 4,
+          tmp_Rh[l],
+          zoneout_prob,
+          mask ? mask + t * NH : nullptr,
+          t,
+          active_batch_size,
+          sequence_lengths,
+          hidden_size);
+      cudaEventRecord(data_->layer_events[l], layer->data_->stream[0]);
+    }
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  for (ForwardPass<T>* layer : data_->layers) {
+    cudaEventRecord(data_->finished_event, layer->data_->stream[0]);
+    cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  }
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct BidirectionalForwardPass<T>::private_data {
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  ForwardPass<T>* directions[2];
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+BidirectionalForwardPass<T>::BidirectionalForwardPass(
+    const bool training,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  for (int i = 0; i < 2; ++i) {
+    data_->directions[i] = new ForwardPass<T>(
+        training,
+        batch_size,
+        input_size,
+        hidden_size,
+        blas_handle,
+        stream);
+  }
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+BidirectionalForwardPass<T>::~BidirectionalForwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  delete data_->directions[1];
+  delete data_->directions[0];
+  delete data_;
+}
+
+template<typename T>
+void BidirectionalForwardPass<T>::Run(
+    const int steps,
+    const T* const* W,       // [2] [C,H*4]
+    const T* const* R,       // [2] [H,H*4]
+    const T* const* b,       // [2] [H*4]
+    const T* x,              // [T,N,C]
+    T* const* h,             // [2] [T+1,N,H] with a stride of `h_stride`
+    const int h_stride,
+    accum_t<T>* const* c,    // [2] [T+1,N,H]
+    T* const* v,             // [2] [T,N,H*4]
+    T* const* tmp_Rh,        // [2] [N,H*4]
+    const float zoneout_prob,
+    const T* const* zoneout_mask,  // [2] [T,N,H]
+    const int* sequence_lengths,   // [N] device
+    const int* batch_sizes) {      // [T] host
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs. Both directions
+  // consume the whole input sequence, so each one's Wx GEMM covers all time steps.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  for (int i = 0; i < 2; ++i) {
+    auto direction = data_->directions[i]->data_;
+    cudaStreamWaitEvent(direction->stream[0], data_->ready_event, 0);
+    cublasSetStream(blas_handle, direction->stream[0]);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 4, steps * batch_size, input_size,
+        &alpha,
+        W[i], hidden_size * 4,
+        x, input_size,
+        &beta,
+        v[i], hidden_size * 4);
+    cudaEventRecord(direction->event, direction->stream[0]);
+  }
+
+  // The reverse direction visits step `T - 1 - s` while the forward direction visits
+  // step `s`. Its state after step `t` is at index `t`, so it reads index `t + 1`.
+  const int NH = batch_size * hidden_size;
+  const int h_step = batch_size * h_stride;
+  for (int s = 0; s < steps; ++s) {
+    for (int i = 0; i < 2; ++i) {
+      const int t = i ? steps - 1 - s : s;
+      const int in = i ? t + 1 : t;
+      const int out = i ? t : t + 1;
+      const T* mask = zoneout_mask ? zoneout_mask[i] : nullptr;
+      data_->directions[i]->IterateInternal(
+          R[i],
+          b[i],
+          h[i] + in * h_step,
+          c[i] + in * NH,
+          h[i] + out * h_step,
+          c[i] + out * NH,
+          v[i] + t * NH * 4,
+          tmp_Rh[i],
+          zoneout_prob,
+          mask ? mask + t * NH : nullptr,
+          t,
+          batch_sizes ? batch_sizes[t] : batch_size,
+          sequence_lengths,
+          h_stride);
+    }
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  for (int i = 0; i < 2; ++i) {
+    cudaEventRecord(data_->finished_event, data_->directions[i]->data_->stream[0]);
+    cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
+  }
+
+  cublasSetStream(blas_handle, save_stream);
+}
+
+template<typename T>
+struct InferenceSession<T>::private_data {
+  int max_streams;
+  int max_frames;
+  int input_size;
+  int hidden_size;
+  cublasHandle_t blas_handle;
+  cudaStream_t stream;
+  void* buffer;  // Backs all of the tensors below.
+  T* h;          // Per-stream hidden state [S,H]
+  accum_t<T>* c;       // Per-stream cell state [S,H]
+  T* step_h;     // Gathered hidden state of a `Step` [S,H]
+  accum_t<T>* step_c;  // Gathered cell state of a `Step` [S,H]
+  T* tmp_Wx;     // Input projections [max(K,S),H*4]
+  T* tmp_Rh;     // Recurrent projection [S,H*4]
+};
+
+template<typename T>
+InferenceSession<T>::InferenceSession(
+    const int max_streams,
+    const int max_frames,
+    const int input_size,
+    const int hidden_size,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->max_streams = max_streams;
+  data_->max_frames = max_frames;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->blas_handle = blas_handle;
+  data_->stream = stream;
+
+  const size_t NH = static_cast<size_t>(max_streams) * hidden_size;
+  const size_t wx_rows = std::max(max_frames, max_streams);
+  const size_t bytes = WorkspaceBytes<T>(NH) * 2
+      + WorkspaceBytes<accum_t<T>>(NH) * 2
+      + WorkspaceBytes<T>(wx_rows * hidden_size * 4)
+      + WorkspaceBytes<T>(NH * 4);
+  if (cudaMalloc(&data_->buffer, bytes) != cudaSuccess) {
+    // Every other call checks for this and returns false.
+    data_->buffer = nullptr;
+    return;
+  }
+  Workspace buffers(data_->buffer);
+  data_->h = buffers.Take<T>(NH);
+  data_->c = buffers.Take<accum_t<T>>(NH);
+  data_->step_h = buffers.Take<T>(NH);
+  data_->step_c = buffers.Take<accum_t<T>>(NH);
+  data_->tmp_Wx = buffers.Take<T>(wx_rows * hidden_size * 4);
+  data_->tmp_Rh = buffers.Take<T>(NH * 4);
+  cudaMemset(data_->h, 0, NH * sizeof(T));
+  cudaMemset(data_->c, 0, NH * sizeof(accum_t<T>));
+}
+
+template<typename T>
+InferenceSession<T>::~InferenceSession() {
+  cudaFree(data_->buffer);
+  delete data_;
+}
+
+template<typename T>
+int InferenceSession<T>::StateSize() const {
+  return data_->hidden_size;
+}
+
+template<typename T>
+bool InferenceSession<T>::Reset(const int id) {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams)
+    return false;
+
+  const int hidden_size = data_->hidden_size;
+  cudaMemsetAsync(data_->h + id * hidden_size, 0, hidden_size * sizeof(T), data_->stream);
+  cudaMemsetAsync(data_->c + id * hidden_size, 0, hidden_size * sizeof(accum_t<T>), data_->stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::SaveState(const int id, T* h, accum_t<T>* c) const {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams)
+    return false;
+
+  const int hidden_size = data_->hidden_size;
+  cudaMemcpyAsync(h, data_->h + id * hidden_size, hidden_size * sizeof(T), cudaMemcpyDeviceToDevice, data_->stream);
+  cudaMemcpyAsync(c, data_->c + id * hidden_size, hidden_size * sizeof(accum_t<T>), cudaMemcpyDeviceToDevice, data_->stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::RestoreState(const int id, const T* h, const accum_t<T>* c) {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams)
+    return false;
+
+  const int hidden_size = data_->hidden_size;
+  cudaMemcpyAsync(data_->h + id * hidden_size, h, hidden_size * sizeof(T), cudaMemcpyDeviceToDevice, data_->stream);
+  cudaMemcpyAsync(data_->c + id * hidden_size, c, hidden_size * sizeof(accum_t<T>), cudaMemcpyDeviceToDevice, data_->stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::Run(
+    const int id,
+    const int frames,
+    const T* W,  // Weight matrix for input (Wx) [C,H*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,  // Input vectors [K,C]
+    T* h_out,    // Output recurrent states [K,H]
+    const float zoneout_prob) {
+  if (!data_->buffer || id < 0 || id >= data_->max_streams || frames < 1 ||
+      frames > data_->max_frames)
+    return false;
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream = data_->stream;
+  T* h = data_->h + id * hidden_size;
+  accum_t<T>* c = data_->c + id * hidden_size;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  cublasSetStream(blas_handle, stream);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, frames, input_size,
+      &alpha,
+      W, hidden_size * 4,
+      x, input_size,
+      &beta,
+      data_->tmp_Wx, hidden_size * 4);
+
+  // Each frame reads the previous frame's output, so only the cell state is updated in
+  // place and the final hidden state is copied back once at the end.
+  for (int i = 0; i < frames; ++i) {
+    const T* h_in = i ? h_out + (i - 1) * hidden_size : h;
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        hidden_size * 4, 1, hidden_size,
+        &alpha,
+        R, hidden_size * 4,
+        h_in, hidden_size,
+        &beta,
+        data_->tmp_Rh, hidden_size * 4);
+
+    LaunchPointwiseOperations<T, T>(
+        false,
+        1,
+        hidden_size,
+        hidden_size,
+        false,
+        data_->tmp_Wx + i * hidden_size * 4,
+        data_->tmp_Rh,
+        b,
+        h_in,
+        c,
+        h_out + i * hidden_size,
+        c,
+        nullptr,
+        zoneout_prob,
+        nullptr,
+        ZoneoutRng(),
+        i,
+        nullptr,
+        stream);
+  }
+  cudaMemcpyAsync(
+      h,
+      h_out + (frames - 1) * hidden_size,
+      hidden_size * sizeof(T),
+      cudaMemcpyDeviceToDevice,
+      stream);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+bool InferenceSession<T>::Step(
+    const int count,
+    const int* ids,  // Stream IDs [count] device
+    const T* W,      // Weight matrix for input (Wx) [C,H*4]
+    const T* R,      // Weight matrix for recurrent state (Rh) [H,H*4]
+    const T* b,      // Bias for gates (Wx + Rh + b) [H*4]
+    const T* x,      // Input vectors [count,C]
+    T* h_out,        // Output recurrent states [count,H]
+    const float zoneout_prob) {
+  if (!data_->buffer || count < 1 || count > data_->max_streams)
+    return false;
+
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream = data_->stream;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  GatherPoolRows(count, hidden_size, ids, data_->h, data_->step_h, stream);
+  GatherPoolRows(count, hidden_size, ids, data_->c, data_->step_c, stream);
+
+  cublasSetStream(blas_handle, stream);
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, count, input_size,
+      &alpha,
+      W, hidden_size * 4,
+      x, input_size,
+      &beta,
+      data_->tmp_Wx, hidden_size * 4);
+
+  blas<T>::gemm(blas_handle,
+      CUBLAS_OP_N, CUBLAS_OP_N,
+      hidden_size * 4, count, hidden_size,
+      &alpha,
+      R, hidden_size * 4,
+      data_->step_h, hidden_size,
+      &beta,
+      data_->tmp_Rh, hidden_size * 4);
+
+  LaunchPointwiseOperations<T, T>(
+      false,
+      count,
+      hidden_size,
+      hidden_size,
+      false,
+      data_->tmp_Wx,
+      data_->tmp_Rh,
+      b,
+      data_->step_h,
+      data_->step_c,
+      h_out,
+      data_->step_c,
+      nullptr,
+      zoneout_prob,
+      nullptr,
+      ZoneoutRng(),
+      0,
+      nullptr,
+      stream);
+
+  ScatterPoolRows(count, hidden_size, ids, h_out, data_->h, stream);
+  ScatterPoolRows(count, hidden_size, ids, data_->step_c, data_->c, stream);
+
+  cublasSetStream(blas_handle, save_stream);
+  return true;
+}
+
+template<typename T>
+struct BatchScheduler<T>::private_data {
+  int max_batch_size;
+  int max_steps;
+  int input_size;
+  int hidden_size;
+  int device;
+  const T* W;
+  const T* R;
+  const T* b;
+  float zoneout_prob;
+  cudaStream_t stream;
+  ForwardPass<T>* forward;
+  void* buffer;        // Backs all of the tensors below.
+  T* x;                // Packed inputs [max_steps,N,C]
+  T* h;                // Packed hidden states [max_steps+1,N,H]
+  accum_t<T>* c;       // Packed cell states [max_steps+1,N,H]
+  T* v;                // Activations [max_steps,N,H*4]
+  T* tmp_Rh;           // Recurrent projection [N,H*4]
+  int* lengths;        // Per-item lengths [N] device
+  int* host_lengths;   // Staging for `lengths` [N] pinned host
+  bool allocated;      // Whether all of the above could be allocated.
+  std::vector<int> batch_sizes;
+  BatchQueue<Request>* queue;
+};
+
+template<typename T>
+BatchScheduler<T>::BatchScheduler(
+    const int max_batch_size,
+    const int max_steps,
+    const int max_wait_us,
+    const int input_size,
+    const int hidden_size,
+    const T* W,
+    const T* R,
+    const T* b,
+    const float zoneout_prob,
+    const cublasHandle_t& blas_handle) : data_(new private_data) {
+  data_->max_batch_size = max_batch_size;
+  data_->max_steps = max_steps;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->W = W;
+  data_->R = R;
+  data_->b = b;
+  data_->zoneout_prob = zoneout_prob;
+  cudaGetDevice(&data_->device);
+  cudaStreamCreateWithFlags(&data_->stream, cudaStreamNonBlocking);
+  data_->forward = new ForwardPass<T>(false, max_batch_size, input_size, hidden_size, blas_handle, data_->stream);
+
+  const size_t NC = static_cast<size_t>(max_batch_size) * input_size;
+  const size_t NH = static_cast<size_t>(max_batch_size) * hidden_size;
+  const size_t bytes = WorkspaceBytes<T>(max_steps * NC)
+      + WorkspaceBytes<T>((max_steps + 1) * NH)
+      + WorkspaceBytes<accum_t<T>>((max_steps + 1) * NH)
+      + WorkspaceBytes<T>(max_steps * NH * 4)
+      + WorkspaceBytes<T>(NH * 4);
+  // Each pointer is null if its allocation failed, in which case `Submit` refuses every
+  // request.
+  if (cudaMalloc(&data_->buffer, bytes) != cudaSuccess)
+    data_->buffer = nullptr;
+  if (cudaMalloc(reinterpret_cast<void**>(&data_->lengths), max_batch_size * sizeof(int)) != cudaSuccess)
+    data_->lengths = nullptr;
+  if (cudaMallocHost(reinterpret_cast<void**>(&data_->host_lengths), max_batch_size * sizeof(int)) != cudaSuccess)
+    data_->host_lengths = nullptr;
+  data_->allocated = data_->buffer && data_->lengths && data_->host_lengths;
+  Workspace buffers(data_->buffer);
+  data_->x = buffers.Take<T>(max_steps * NC);
+  data_->h = buffers.Take<T>((max_steps + 1) * NH);
+  data_->c = buffers.Take<accum_t<T>>((max_steps + 1) * NH);
+  data_->v = buffers.Take<T>(max_steps * NH * 4);
+  data_->tmp_Rh = buffers.Take<T>(NH * 4);
+
+  data_->queue = new BatchQueue<Request>(
+      max_batch_size,
+      std::chrono::microseconds(max_wait_us),
+      [this](const std::vector<Request>& requests) { RunBatch(requests); });
+}
+
+template<typename T>
+BatchScheduler<T>::~BatchScheduler() {
+  delete data_->queue;
+  delete data_->forward;
+  cudaFree(data_->buffer);
+  cudaFree(data_->lengths);
+  cudaFreeHost(data_->host_lengths);
+  cudaStreamDestroy(data_->stream);
+  delete data_;
+}
+
+template<typename T>
+std::future<void> BatchScheduler<T>::Submit(const Request& request) {
+  if (!data_->allocated)
+    return RefusedRequest<std::runtime_error>("BatchScheduler: out of memory");
+  if (request.steps < 1 || request.steps > data_->max_steps)
+    return RefusedRequest<std::invalid_argument>("BatchScheduler: steps not in [1, max_steps]");
+  return data_->queue->Push(request);
+}
+
+template<typename T>
+BatchSchedulerStats BatchScheduler<T>::Stats() const {
+  return data_->queue->Stats();
+}
+
+template<typename T>
+void BatchScheduler<T>::RunBatch(const std::vector<Request>& requests) {
+  const int batch_size = data_->max_batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const int count = requests.size();
+  const size_t NC = static_cast<size_t>(batch_size) * input_size;
+  const size_t NH = static_cast<size_t>(batch_size) * hidden_size;
+  const cudaStream_t stream = data_->stream;
+
+  cudaSetDevice(data_->device);
+
+  // `batch_sizes` requires the items to be sorted by decreasing length. The unused
+  // slots get a length of 0 so the pointwise kernels only carry their state forward.
+  std::vector<int> order(count);
+  for (int i = 0; i < count; ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&requests](const int a, const int b) {
+    return requests[a].steps > requests[b].steps;
+  });
+  const int steps = requests[order[0]].steps;
+
+  data_->batch_sizes.assign(steps, 0);
+  for (int n = 0; n < batch_size; ++n) {
+    const int length = n < count ? requests[order[n]].steps : 0;
+    data_->host_lengths[n] = length;
+    for (int t = 0; t < length; ++t)
+      ++data_->batch_sizes[t];
+  }
+  cudaMemcpyAsync(data_->lengths, data_->host_lengths, batch_size * sizeof(int), cudaMemcpyHostToDevice, stream);
+
+  for (int n = 0; n < count; ++n) {
+    const Request& request = requests[order[n]];
+    cudaMemcpy2DAsync(
+        data_->x + n * input_size, NC * sizeof(T),
+        request.x, input_size * sizeof(T),
+        input_size * sizeof(T), request.steps,
+        cudaMemcpyDeviceToDevice, stream);
+    if (request.h0)
+      cudaMemcpyAsync(data_->h + n * hidden_size, request.h0, hidden_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    else
+      cudaMemsetAsync(data_->h + n * hidden_size, 0, hidden_size * sizeof(T), stream);
+    if (request.c0)
+      cudaMemcpyAsync(data_->c + n * hidden_size, request.c0, hidden_size * sizeof(accum_t<T>), cudaMemcpyDeviceToDevice, stream);
+    else
+      cudaMemsetAsync(data_->c + n * hidden_size, 0, hidden_size * sizeof(accum_t<T>), stream);
+  }
+
+  data_->forward->Run(
+      steps,
+      data_->W,
+      data_->R,
+      data_->b,
+      data_->x,
+      data_->h,
+      data_->c,
+      data_->v,
+      data_->tmp_Rh,
+      data_->zoneout_prob,
+      nullptr,
+      data_->lengths,
+      data_->batch_sizes.data());
+
+  // Items that finish early carry their state through the remaining steps, so the
+  // final cell state of every item is at step `steps`.
+  for (int n = 0; n < count; ++n) {
+    const Request& request = requests[order[n]];
+    cudaMemcpy2DAsync(
+        request.h, hidden_size * sizeof(T),
+        data_->h + NH + n * hidden_size, NH * sizeof(T),
+        hidden_size * sizeof(T), request.steps,
+        cudaMemcpyDeviceToDevice, stream);
+    if (request.c)
+      cudaMemcpyAsync(request.c, data_->c + steps * NH + n * hidden_size, hidden_size * sizeof(accum_t<T>), cudaMemcpyDeviceToDevice, stream);
+  }
+
+  cudaStreamSynchronize(stream);
+}
+
+template<typename T>
+size_t PackedWeights<T>::Size(
+    const WeightFormat format,
+    const int input_size,
+    const int hidden_size) {
+  const size_t matrices = static_cast<size_t>(input_size + hidden_size) * hidden_size * 4;
+  return matrices + hidden_size * (format == WeightFormat::kCudnn ? 8 : 4);
+}
+
+template<typename T>
+PackedWeights<T> PackedWeights<T>::Pack(
+    const WeightFormat format,
+    const GateLayout layout,
+    const int input_size,
+    const int hidden_size,
+    const T* weights,
+    T* W,  // [C,H*4]
+    T* R,  // [H,H*4]
+    T* b,  // [H*4]
+    const cudaStream_t& stream) {
+  const size_t W_size = static_cast<size_t>(input_size) * hidden_size * 4;
+  const size_t R_size = static_cast<size_t>(hidden_size) * hidden_size * 4;
+  const bool interleaved = layout == GateLayout::kInterleaved;
+  if (format == WeightFormat::kCudnn) {
+    // cuDNN orders the gates [i,f,g,o] and has separate input and recurrent biases.
+    const GateMap map = {{0, 2, 1, 3}};
+    PackCudnnWeights<T>(input_size, hidden_size, 4, map, interleaved, weights, W, R, b, nullptr, stream);
+  } else if (interleaved) {
+    LaunchConvertGateLayout(input_size, hidden_size, 4, false, weights, W, stream);
+    LaunchConvertGateLayout(hidden_size, hidden_size, 4, false, weights + W_size, R, stream);
+    LaunchConvertGateLayout(1, hidden_size, 4, false, weights + W_size + R_size, b, stream);
+  } else {
+    cudaMemcpyAsync(W, weights, W_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(R, weights + W_size, R_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(b, weights + W_size + R_size, hidden_size * 4 * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+  }
+  PackedWeights<T> packed = { W, R, b };
+  return packed;
+}
+
+template<typename T>
+void PackedWeights<T>::UnpackGradients(
+    const WeightFormat format,
+    const GateLayout layout,
+    const int input_size,
+    const int hidden_size,
+    const T* dW,  // [C,H*4]
+    const T* dR,  // [H,H*4]
+    const T* db,  // [H*4]
+    T* gradients,
+    const cudaStream_t& stream) {
+  const size_t W_size = static_cast<size_t>(input_size) * hidden_size * 4;
+  const size_t R_size = static_cast<size_t>(hidden_size) * hidden_size * 4;
+  const bool interleaved = layout == GateLayout::kInterleaved;
+  if (format == WeightFormat::kCudnn) {
+    const GateMap map = {{0, 2, 1, 3}};
+    UnpackCudnnGradients<T>(input_size, hidden_size, 4, map, interleaved, dW, dR, db, nullptr, gradients, stream);
+  } else if (interleaved) {
+    LaunchConvertGateLayout(input_size, hidden_size, 4, true, dW, gradients, stream);
+    LaunchConvertGateLayout(hidden_size, hidden_size, 4, true, dR, gradients + W_size, stream);
+    LaunchConvertGateLayout(1, hidden_size, 4, true, db, gradients + W_size + R_size, stream);
+  } else {
+    cudaMemcpyAsync(gradients, dW, W_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(gradients + W_size, dR, R_size * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+    cudaMemcpyAsync(gradients + W_size + R_size, db, hidden_size * 4 * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+  }
+}
+
+template<typename T>
+void QuantizedWeights<T>::Calibrate(
+    const size_t size,
+    const T* x,
+    float* x_absmax,  // [1]
+    const cudaStream_t& stream) {
+  LaunchAbsMax(size, x, x_absmax, stream);
+}
+
+template<typename T>
+QuantizedWeights<T> QuantizedWeights<T>::Quantize(
+    const int input_size,
+    const int hidden_size,
+    const T* W,  // [C,H*4]
+    const T* R,  // [H,H*4]
+    const T* b,  // [H*4]
+    const float* x_absmax,  // [1]
+    int8_t* W_q,      // [C,H*4]
+    int8_t* R_q,      // [H,H*4]
+    float* W_scale,   // [H*4]
+    float* R_scale,   // [H*4]
+    float* x_scale,   // [1]
+    const cudaStream_t& stream) {
+  LaunchQuantizeColumns(input_size, hidden_size * 4, W, W_q, W_scale, stream);
+  LaunchQuantizeColumns(hidden_size, hidden_size * 4, R, R_q, R_scale, stream);
+  CalibratedScale<<<1, 1, 0, stream>>>(x_absmax, x_scale);
+  QuantizedWeights<T> quantized = { W_q, R_q, W_scale, R_scale, x_scale, b };
+  return quantized;
+}
+
+#ifdef HASTE_WITH_NCCL
+template<typename T>
+struct TensorParallelForwardPass<T>::private_data {
+  bool training;
+  int batch_size;
+  int input_size;
+  int hidden_size;
+  int rank;
+  int ranks;
+  ncclComm_t comm;
+  cublasHandle_t blas_handle;
+  cudaStream_t sync_stream;
+  cudaStream_t stream[2];
+  cudaEvent_t wx_event[2];
+  cudaEvent_t ready_event;
+  cudaEvent_t finished_event;
+};
+
+template<typename T>
+TensorParallelForwardPass<T>::TensorParallelForwardPass(
+    const bool training,
+    const int batch_size,
+    const int input_size,
+    const int hidden_size,
+    const ncclComm_t& comm,
+    const cublasHandle_t& blas_handle,
+    const cudaStream_t& stream) : data_(new private_data) {
+  data_->training = training;
+  data_->batch_size = batch_size;
+  data_->input_size = input_size;
+  data_->hidden_size = hidden_size;
+  data_->comm = comm;
+  data_->blas_handle = blas_handle;
+  data_->sync_stream = stream;
+  ncclCommUserRank(comm, &data_->rank);
+  ncclCommCount(comm, &data_->ranks);
+  cudaStreamCreate(&data_->stream[0]);
+  cudaStreamCreate(&data_->stream[1]);
+  cudaEventCreateWithFlags(&data_->wx_event[0], cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->wx_event[1], cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->ready_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&data_->finished_event, cudaEventDisableTiming);
+}
+
+template<typename T>
+TensorParallelForwardPass<T>::~TensorParallelForwardPass() {
+  cudaEventDestroy(data_->finished_event);
+  cudaEventDestroy(data_->ready_event);
+  cudaEventDestroy(data_->wx_event[1]);
+  cudaEventDestroy(data_->wx_event[0]);
+  cudaStreamDestroy(data_->stream[1]);
+  cudaStreamDestroy(data_->stream[0]);
+  delete data_;
+}
+
+template<typename T>
+void TensorParallelForwardPass<T>::Run(
+    const int steps,
+    const T* W,  // Weight matrix for input (Wx) [C,Hs*4]
+    const T* R,  // Weight matrix for recurrent state (Rh) [H,Hs*4]
+    const T* b,  // Bias for gates (Wx + Rh + b) [Hs*4]
+    const T* x,  // Input vector [T,N,C]
+    T* h,        // Recurrent state [T+1,N,H]
+    accum_t<T>* c,  // Cell state [T+1,N,Hs]
+    T* v,        // Output vector (Wx + Rh + b) [T,N,Hs*4]
+    T* tmp_Rh,   // Temporary storage for Rh vector [N,Hs*4]
+    T* tmp_h,    // Gathered shards of the new recurrent state [G,N,Hs]
+    const float zoneout_prob,
+    const T* zoneout_mask) {  // Zoneout mask [T,N,Hs]
+  static const T alpha = static_cast<T>(1.0);
+  static const T beta = static_cast<T>(0.0);
+
+  const int batch_size = data_->batch_size;
+  const int input_size = data_->input_size;
+  const int hidden_size = data_->hidden_size;
+  const int rank = data_->rank;
+  const int ranks = data_->ranks;
+  const int local_size = hidden_size / ranks;
+  const cublasHandle_t blas_handle = data_->blas_handle;
+  const cudaStream_t stream1 = data_->stream[0];
+  const cudaStream_t stream2 = data_->stream[1];
+
+  const int NC = batch_size * input_size;
+  const int NH = batch_size * hidden_size;
+  const int NHs = batch_size * local_size;
+
+  cudaStream_t save_stream;
+  cublasGetStream(blas_handle, &save_stream);
+
+  // Don't start until the caller's stream has produced our inputs.
+  cudaEventRecord(data_->ready_event, data_->sync_stream);
+  cudaStreamWaitEvent(stream1, data_->ready_event, 0);
+  cudaStreamWaitEvent(stream2, data_->ready_event, 0);
+
+  for (int i = 0; i < steps; ++i) {
+    // The input projections only depend on `x`, so `stream2` runs ahead of the
+    // recurrence and hides them behind the all-gathers. The events alternate: each wait
+    // is enqueued before its event is recorded again.
+    cublasSetStream(blas_handle, stream2);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        local_size * 4, batch_size, input_size,
+        &alpha,
+        W, local_size * 4,
+        x + i * NC, input_size,
+        &beta,
+        v + i * NHs * 4, local_size * 4);
+    cudaEventRecord(data_->wx_event[i % 2], stream2);
+
+    cublasSetStream(blas_handle, stream1);
+    blas<T>::gemm(blas_handle,
+        CUBLAS_OP_N, CUBLAS_OP_N,
+        local_size * 4, batch_size, hidden_size,
+        &alpha,
+        R, local_size * 4,
+        h + i * NH, hidden_size,
+        &beta,
+        tmp_Rh, local_size * 4);
+
+    cudaStreamWaitEvent(stream1, data_->wx_event[i % 2], 0);
+    LaunchPointwiseOperations<T, T>(
+        data_->training,
+        batch_size,
+        local_size,
+        hidden_size,
+        false,
+        v + i * NHs * 4,
+        tmp_Rh,
+        b,
+        h + i * NH + rank * local_size,
+        c + i * NHs,
+        h + (i + 1) * NH + rank * local_size,
+        c + (i + 1) * NHs,
+        v + i * NHs * 4,
+        zoneout_prob,
+        zoneout_mask ? zoneout_mask + i * NHs : nullptr,
+        ZoneoutRng(),
+        i,
+        nullptr,
+        stream1);
+
+    // Exchange the new state: stage our units as this rank's shard, gather everyone's in
+    // place, and spread the other shards into their columns of `h`.
+    cudaMemcpy2DAsync(
+        tmp_h + rank * NHs, local_size * sizeof(T),
+        h + (i + 1) * NH + rank * local_size, hidden_size * sizeof(T),
+        local_size * sizeof(T), batch_size,
+        cudaMemcpyDeviceToDevice, stream1);
+    ncclAllGather(tmp_h + rank * NHs, tmp_h, NHs, nccl_type<T>::value, data_->comm, stream1);
+    LaunchInterleaveShards(ranks, batch_size, local_size, rank, tmp_h, h + (i + 1) * NH, stream1);
+  }
+
+  // Make the caller's stream wait for our outputs without blocking the host.
+  cudaEventRecord(data_->finished_event, stream1);
+  cudaStreamWaitEvent(data_->sync_stream, data_->finished_event, 0);
 
   cublasSetStream(blas_handle, save_stream);
 }
+#endif  // HASTE_WITH_NCCL
 
+template struct PackedWeights<__half>;
+template struct PackedWeights<__nv_bfloat16>;
+template struct PackedWeights<float>;
+template struct PackedWeights<double>;
+template struct QuantizedWeights<__half>;
+template struct QuantizedWeights<__nv_bfloat16>;
+template struct QuantizedWeights<float>;
+template struct QuantizedWeights<double>;
+template struct ForwardPass<__half>;
+template struct ForwardPass<__nv_bfloat16>;
 template struct ForwardPass<float>;
 template struct ForwardPass<double>;
+template struct StackedForwardPass<__half>;
+template struct StackedForwardPass<__nv_bfloat16>;
+template struct StackedForwardPass<float>;
+template struct StackedForwardPass<double>;
+template struct BidirectionalForwardPass<__half>;
+template struct BidirectionalForwardPass<__nv_bfloat16>;
+template struct BidirectionalForwardPass<float>;
+template struct BidirectionalForwardPass<double>;
+template struct InferenceSession<__half>;
+template struct InferenceSession<__nv_bfloat16>;
+template struct InferenceSession<float>;
+template struct InferenceSession<double>;
+template struct BatchScheduler<__half>;
+template struct BatchScheduler<__nv_bfloat16>;
+template struct BatchScheduler<float>;
+template struct BatchScheduler<double>;
+#ifdef HASTE_WITH_NCCL
+template struct TensorParallelForwardPass<__half>;
+#if HASTE_NCCL_HAS_BF16
+template struct TensorParallelForwardPass<__nv_bfloat16>;
+#endif
+template struct TensorParallelForwardPass<float>;
+template struct TensorParallelForwardPass<double>;
+#endif
 
 }  // namespace lstm
 }  // namespace v0
@@ -0,0 +1,227 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+#include "inline_ops.h"
+
+// `gate[k]` is cuDNN's index of gate k of the passes (see `WeightFormat::kCudnn`).
+struct GateMap {
+  int gate[4];
+};
+
+// The column of gate `gate` of hidden unit `unit` in a packed matrix with the given
+// gate layout (see `GateLayout`).
+__device__ __forceinline__
+int PackedGateColumn(const int gate, const int unit, const int hidden_size, const int gates, const bool interleaved) {
+  return interleaved ? unit * gates + gate : gate * hidden_size + unit;
+}
+
+// Converts between cuDNN's per-gate [G][H,K] matrices, `cudnn`, and the row-major
+// [K,G*H] matrix the passes read, `packed`, in the direction given by `unpack`.
+template<typename T>
+__global__
+void ConvertGateMatrix(const int rows,  // K
+                       const int hidden_size,
+                       const int gates,
+                       const GateMap map,
+                       const bool interleaved,
+                       const bool unpack,
+                       const T* __restrict__ x,
+                       T* __restrict__ y) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  const int row = blockIdx.y * blockDim.y + threadIdx.y;
+  if (col >= gates * hidden_size || row >= rows)
+    return;
+
+  const int gate = col / hidden_size;
+  const int unit = col - gate * hidden_size;
+  const size_t packed_idx = static_cast<size_t>(row) * gates * hidden_size
+      + PackedGateColumn(gate, unit, hidden_size, gates, interleaved);
+  const size_t cudnn_idx = (static_cast<size_t>(map.gate[gate]) * hidden_size + unit) * rows + row;
+  if (unpack)
+    y[cudnn_idx] = x[packed_idx];
+  else
+    y[packed_idx] = x[cudnn_idx];
+}
+
+// Converts cuDNN's input and recurrent biases, [2][G][H], into the passes' gate order.
+// The LSTM passes take a single bias, so `br` may be null to write their sum to `bx`.
+template<typename T>
+__global__
+void PackGateBiases(const int hidden_size,
+                    const int gates,
+                    const GateMap map,
+                    const bool interleaved,
+                    const T* __restrict__ cudnn,
+                    T* __restrict__ bx,
+                    T* __restrict__ br) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  if (col >= gates * hidden_size)
+    return;
+
+  typedef typename accum_type<T>::type Acc;
+
+  const int gate = col / hidden_size;
+  const int unit = col - gate * hidden_size;
+  const int input_idx = map.gate[gate] * hidden_size + unit;
+  const int recurrent_idx = input_idx + gates * hidden_size;
+  const int packed_idx = PackedGateColumn(gate, unit, hidden_size, gates, interleaved);
+  if (br) {
+    bx[packed_idx] = cudnn[input_idx];
+    br[packed_idx] = cudnn[recurrent_idx];
+  } else {
+    bx[packed_idx] = T(Acc(cudnn[input_idx]) + Acc(cudnn[recurrent_idx]));
+  }
+}
+
+// The reverse of `PackGateBiases` for gradients: both of cuDNN's biases receive `dbx`
+// when `dbr` is null, since the LSTM passes only see their sum.
+template<typename T>
+__global__
+void UnpackGateBiases(const int hidden_size,
+                      const int gates,
+                      const GateMap map,
+                      const bool interleaved,
+                      const T* __restrict__ dbx,
+                      const T* __restrict__ dbr,
+                      T* __restrict__ cudnn) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  if (col >= gates * hidden_size)
+    return;
+
+  const int gate = col / hidden_size;
+  const int unit = col - gate * hidden_size;
+  const int input_idx = map.gate[gate] * hidden_size + unit;
+  const int packed_idx = PackedGateColumn(gate, unit, hidden_size, gates, interleaved);
+  cudnn[input_idx] = dbx[packed_idx];
+  cudnn[input_idx + gates * hidden_size] = dbr ? dbr[packed_idx] : dbx[packed_idx];
+}
+
+// Converts the row-major [K,G*H] matrix `x` between the blocked and interleaved gate
+// layouts: to interleaved unless `unpack`, when `x` is interleaved and `y` blocked.
+template<typename T>
+__global__
+void ConvertGateLayout(const int rows,  // K
+                       const int hidden_size,
+                       const int gates,
+                       const bool unpack,
+                       const T* __restrict__ x,
+                       T* __restrict__ y) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  const int row = blockIdx.y * blockDim.y + threadIdx.y;
+  if (col >= gates * hidden_size || row >= rows)
+    return;
+
+  const int gate = col / hidden_size;
+  const int unit = col - gate * hidden_size;
+  const size_t blocked_idx = static_cast<size_t>(row) * gates * hidden_size + col;
+  const size_t interleaved_idx = static_cast<size_t>(row) * gates * hidden_size + unit * gates + gate;
+  if (unpack)
+    y[blocked_idx] = x[interleaved_idx];
+  else
+    y[interleaved_idx] = x[blocked_idx];
+}
+
+// Launches `ConvertGateMatrix` on `stream`.
+template<typename T>
+void LaunchConvertGateMatrix(
+    const int rows,
+    const int hidden_size,
+    const int gates,
+    const GateMap& map,
+    const bool interleaved,
+    const bool unpack,
+    const T* x,
+    T* y,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(64, 4);
+  const dim3 gridDim(
+      (gates * hidden_size + blockDim.x - 1) / blockDim.x,
+      (rows + blockDim.y - 1) / blockDim.y);
+  ConvertGateMatrix<T><<<gridDim, blockDim, 0, stream>>>(
+      rows, hidden_size, gates, map, interleaved, unpack, x, y);
+}
+
+// Launches `ConvertGateLayout` on `stream`.
+template<typename T>
+void LaunchConvertGateLayout(
+    const int rows,
+    const int hidden_size,
+    const int gates,
+    const bool unpack,
+    const T* x,
+    T* y,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(64, 4);
+  const dim3 gridDim(
+      (gates * hidden_size + blockDim.x - 1) / blockDim.x,
+      (rows + blockDim.y - 1) / blockDim.y);
+  ConvertGateLayout<T><<<gridDim, blockDim, 0, stream>>>(rows, hidden_size, gates, unpack, x, y);
+}
+
+// Converts the cuDNN canonical parameters `cudnn` ([G*H*C + G*H*H + 2*G*H]) into `W`
+// [C,G*H], `R` [H,G*H] and the biases on `stream`, with their gate columns interleaved
+// if `interleaved`.
+template<typename T>
+void PackCudnnWeights(
+    const int input_size,
+    const int hidden_size,
+    const int gates,
+    const GateMap& map,
+    const bool interleaved,
+    const T* cudnn,
+    T* W,
+    T* R,
+    T* bx,
+    T* br,
+    const cudaStream_t& stream) {
+  const size_t W_size = static_cast<size_t>(gates) * hidden_size * input_size;
+  const size_t R_size = static_cast<size_t>(gates) * hidden_size * hidden_size;
+  LaunchConvertGateMatrix(input_size, hidden_size, gates, map, interleaved, false, cudnn, W, stream);
+  LaunchConvertGateMatrix(hidden_size, hidden_size, gates, map, interleaved, false, cudnn + W_size, R, stream);
+
+  const int threads = 256;
+  const int blocks = (gates * hidden_size + threads - 1) / threads;
+  PackGateBiases<T><<<blocks, threads, 0, stream>>>(
+      hidden_size, gates, map, interleaved, cudnn + W_size + R_size, bx, br);
+}
+
+// The reverse of `PackCudnnWeights` for gradients.
+template<typename T>
+void UnpackCudnnGradients(
+    const int input_size,
+    const int hidden_size,
+    const int gates,
+    const GateMap& map,
+    const bool interleaved,
+    const T* dW,
+    const T* dR,
+    const T* dbx,
+    const T* dbr,
+    T* cudnn,
+    const cudaStream_t& stream) {
+  const size_t W_size = static_cast<size_t>(gates) * hidden_size * input_size;
+  const size_t R_size = static_cast<size_t>(gates) * hidden_size * hidden_size;
+  LaunchConvertGateMatrix(input_size, hidden_size, gates, map, interleaved, true, dW, cudnn, stream);
+  LaunchConvertGateMatrix(hidden_size, hidden_size, gates, map, interleaved, true, dR, cudnn + W_size, stream);
+
+  const int threads = 256;
+  const int blocks = (gates * hidden_size + threads - 1) / threads;
+  UnpackGateBiases<T><<<blocks, threads, 0, stream>>>(
+      hidden_size, gates, map, interleaved, dbx, dbr, cudnn + W_size + R_size);
+}
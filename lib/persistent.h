@@ -0,0 +1,96 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cuda_runtime_api.h>
+
+// Byte offset of the per-split partial sums in shared memory, which follow the R slice.
+__host__ __device__ __forceinline__
+size_t PersistentAccumOffset(const int hidden_size, const int cols, const size_t weight_size) {
+  return (static_cast<size_t>(hidden_size) * cols * weight_size + 15) & ~static_cast<size_t>(15);
+}
+
+// Launch configuration for a persistent recurrent kernel. Each block owns `units`
+// consecutive hidden units and keeps the `units * gates` matching columns of R in
+// shared memory for the lifetime of the kernel.
+struct PersistentConfig {
+  bool enabled = false;
+  int units = 0;
+  dim3 grid;
+  dim3 block;
+  size_t shared_bytes = 0;
+};
+
+// Picks the smallest number of hidden units per block (i.e. the most blocks) for which
+// the whole grid can be co-resident on the current device, which is a requirement for
+// the grid-wide barrier between time steps. `kernels` are all the instantiations that
+// may be launched with the resulting configuration. R is stored with `weight_size` bytes
+// per element and the partial sums with `accum_size` bytes per element. Returns a
+// disabled configuration if R doesn't fit on-chip or the device can't do cooperative
+// launches.
+template<typename Kernel>
+PersistentConfig ConfigurePersistentKernel(
+    const Kernel* kernels,
+    const int kernel_count,
+    const int gates,
+    const int batch_size,
+    const int hidden_size,
+    const size_t weight_size,
+    const size_t accum_size) {
+  static constexpr int kTargetThreads = 256;
+
+  PersistentConfig config;
+
+  int device;
+  int cooperative;
+  int sm_count;
+  int max_shared_bytes;
+  cudaGetDevice(&device);
+  cudaDeviceGetAttribute(&cooperative, cudaDevAttrCooperativeLaunch, device);
+  cudaDeviceGetAttribute(&sm_count, cudaDevAttrMultiProcessorCount, device);
+  cudaDeviceGetAttribute(&max_shared_bytes, cudaDevAttrMaxSharedMemoryPerBlockOptin, device);
+  if (!cooperative)
+    return config;
+
+  for (int units = 1; units <= hidden_size && units * gates <= 1024; ++units) {
+    const int cols = units * gates;
+    const int splits = std::max(1, std::min(kTargetThreads / cols, hidden_size));
+
+    // R slice plus the per-split partial sums of R·h for every batch item.
+    const size_t shared_bytes = PersistentAccumOffset(hidden_size, cols, weight_size) +
+        static_cast<size_t>(splits) * batch_size * cols * accum_size;
+    if (shared_bytes > static_cast<size_t>(max_shared_bytes))
+      break;
+
+    for (int i = 0; i < kernel_count; ++i)
+      cudaFuncSetAttribute(kernels[i], cudaFuncAttributeMaxDynamicSharedMemorySize, shared_bytes);
+
+    int blocks_per_sm = 0;
+    cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocks_per_sm, kernels[0], cols * splits, shared_bytes);
+
+    const int blocks = (hidden_size + units - 1) / units;
+    if (blocks <= blocks_per_sm * sm_count) {
+      config.enabled = true;
+      config.units = units;
+      config.grid = dim3(blocks);
+      config.block = dim3(cols, splits);
+      config.shared_bytes = shared_bytes;
+      return config;
+    }
+  }
+  return config;
+}
@@ -0,0 +1,129 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cuda_runtime_api.h>
+#include <initializer_list>
+
+#include "haste.h"
+
+// `U` consecutive elements that are loaded and stored with a single instruction (two
+// for 32 bytes). Pointers must be aligned to `sizeof(T) * U`.
+template<typename T, int U>
+struct alignas(sizeof(T) * U) AlignedVector {
+  T x[U];
+};
+
+template<int U, typename T>
+__device__ __forceinline__
+AlignedVector<T, U> LoadVector(const T* x) {
+  return *reinterpret_cast<const AlignedVector<T, U>*>(x);
+}
+
+template<int U, typename T>
+__device__ __forceinline__
+void StoreVector(T* x, const AlignedVector<T, U>& y) {
+  *reinterpret_cast<AlignedVector<T, U>*>(x) = y;
+}
+
+// Reads the `gates` gate values of hidden units [unit, unit+U) from the [G*H] row `x`
+// into `y[gate][j]`. With `Interleaved`, the G values of each unit are adjacent
+// ([H,G]); otherwise each gate is a contiguous block of H units ([G,H]). Either way
+// the thread issues G vector loads.
+template<int U, int G, bool Interleaved, typename T>
+__device__ __forceinline__
+void LoadGates(const T* x, const int hidden_dim, const int unit, T y[G][U]) {
+  #pragma unroll
+  for (int k = 0; k < G; ++k) {
+    const AlignedVector<T, U> chunk = Interleaved
+        ? LoadVector<U>(x + unit * G + k * U)
+        : LoadVector<U>(x + k * hidden_dim + unit);
+    #pragma unroll
+    for (int j = 0; j < U; ++j) {
+      if (Interleaved)
+        y[(k * U + j) % G][(k * U + j) / G] = chunk.x[j];
+      else
+        y[k][j] = chunk.x[j];
+    }
+  }
+}
+
+// The reverse of `LoadGates`.
+template<int U, int G, bool Interleaved, typename T>
+__device__ __forceinline__
+void StoreGates(T* x, const int hidden_dim, const int unit, const T y[G][U]) {
+  #pragma unroll
+  for (int k = 0; k < G; ++k) {
+    AlignedVector<T, U> chunk;
+    #pragma unroll
+    for (int j = 0; j < U; ++j) {
+      if (Interleaved)
+        chunk.x[j] = y[(k * U + j) % G][(k * U + j) / G];
+      else
+        chunk.x[j] = y[k][j];
+    }
+    if (Interleaved)
+      StoreVector<U>(x + unit * G + k * U, chunk);
+    else
+      StoreVector<U>(x + k * hidden_dim + unit, chunk);
+  }
+}
+
+// The number of consecutive hidden units (1, 2 or 4) that each thread of a pointwise
+// kernel can handle with vector accesses of at most 16 bytes of `T`. `hidden_size` and
+// `h_stride` must be multiples of it and every non-null pointer in `ptrs`, which all
+// have elements of at most `sizeof(T)` bytes, must be aligned to it, as must those in
+// `accum_ptrs` (such as the LSTM cell state) with elements of `accum_t<T>`.
+template<typename T>
+int PointwiseVectorWidth(
+    const int hidden_size,
+    const int h_stride,
+    const std::initializer_list<const void*> ptrs,
+    const std::initializer_list<const void*> accum_ptrs = {}) {
+  int units = std::min(4, static_cast<int>(16 / sizeof(T)));
+  while (units > 1) {
+    bool aligned = hidden_size % units == 0 && h_stride % units == 0;
+    for (const void* ptr : ptrs)
+      aligned = aligned && (!ptr || reinterpret_cast<uintptr_t>(ptr) % (sizeof(T) * units) == 0);
+    for (const void* ptr : accum_ptrs)
+      aligned = aligned && (!ptr || reinterpret_cast<uintptr_t>(ptr) % (sizeof(haste::v0::accum_t<T>) * units) == 0);
+    if (aligned)
+      break;
+    units /= 2;
+  }
+  return units;
+}
+
+// Sizes a pointwise kernel's blocks from the problem instead of using a fixed shape, so
+// a small batch or a narrow layer doesn't leave most of each block idle: `threads` per
+// batch item along x (rounded up to a power of two in [32, 256]) and as many batch items
+// along y as fit in 256 threads.
+inline void PointwiseLaunchShape(
+    const int batch_size,
+    const int threads,
+    dim3* grid,
+    dim3* block) {
+  int x = 32;
+  while (x < threads && x < 256)
+    x *= 2;
+  int y = 1;
+  while (x * y < 256 && y < batch_size)
+    y *= 2;
+  *block = dim3(x, y);
+  *grid = dim3((threads + x - 1) / x, (batch_size + y - 1) / y);
+}
@@ -0,0 +1,177 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+#include <string>
+#include <vector>
+
+#ifdef HASTE_WITH_PROFILING
+#include <nvtx3/nvToolsExt.h>
+#endif
+
+#include "haste.h"
+
+// The phases of a pass that `PhaseProfiler` tells apart (see `haste::v0::PhaseStats`).
+enum class Phase {
+  kInputProjection,
+  kRecurrence,
+  kPointwise,
+  kWeightGradient,
+};
+
+#ifdef HASTE_WITH_PROFILING
+
+// Wraps the phases of a pass's calls in NVTX ranges named "<name> <phase>" and, once
+// timing is enabled, brackets them with timing events on the stream that runs them.
+// `Begin` and `End` calls must nest, since NVTX ranges are a per-thread stack. Work
+// enqueued during stream capture only gets the NVTX range: events recorded into a CUDA
+// graph can't be timed from outside it.
+class PhaseProfiler {
+  public:
+    PhaseProfiler() : enabled_(false), calls_(0), open_(), totals_() {}
+
+    ~PhaseProfiler() {
+      for (const Interval& interval : pending_) {
+        cudaEventDestroy(interval.start);
+        cudaEventDestroy(interval.end);
+      }
+      for (cudaEvent_t event : free_)
+        cudaEventDestroy(event);
+    }
+
+    void SetName(const char* name) {
+      const char* phases[] = { "input projection", "recurrence", "pointwise", "weight gradient" };
+      for (int i = 0; i < kPhases; ++i)
+        names_[i] = std::string(name) + " " + phases[i];
+    }
+
+    void EnableTiming() { enabled_ = true; }
+
+    // Counts a call of `Run`, `Iterate` etc. towards `PhaseStats::calls`.
+    void CountCall() {
+      if (enabled_)
+        ++calls_;
+    }
+
+    void Begin(const Phase phase, const cudaStream_t& stream) {
+      nvtxRangePushA(names_[Index(phase)].c_str());
+      open_[Index(phase)] = nullptr;
+      if (!enabled_ || Capturing(stream))
+        return;
+      open_[Index(phase)] = Acquire();
+      cudaEventRecord(open_[Index(phase)], stream);
+    }
+
+    void End(const Phase phase, const cudaStream_t& stream) {
+      cudaEvent_t& start = open_[Index(phase)];
+      if (start) {
+        Interval interval = { phase, start, Acquire() };
+        cudaEventRecord(interval.end, stream);
+        pending_.push_back(interval);
+        start = nullptr;
+        // Bound the number of outstanding events if the caller never collects.
+        if (pending_.size() >= kMaxPending)
+          Accumulate(true);
+      }
+      nvtxRangePop();
+    }
+
+    // Returns the totals of the intervals that have finished since the last call. Ones
+    // that are still running are left for a later call.
+    haste::v0::PhaseStats Collect() {
+      Accumulate(false);
+      haste::v0::PhaseStats stats = totals_;
+      stats.calls = calls_;
+      totals_ = haste::v0::PhaseStats();
+      calls_ = 0;
+      return stats;
+    }
+
+  private:
+    struct Interval {
+      Phase phase;
+      cudaEvent_t start;
+      cudaEvent_t end;
+    };
+
+    static constexpr int kPhases = 4;
+    static constexpr size_t kMaxPending = 4096;
+
+    static int Index(const Phase phase) { return static_cast<int>(phase); }
+
+    static bool Capturing(const cudaStream_t& stream) {
+      cudaStreamCaptureStatus status = cudaStreamCaptureStatusNone;
+      cudaStreamIsCapturing(stream, &status);
+      return status != cudaStreamCaptureStatusNone;
+    }
+
+    cudaEvent_t Acquire() {
+      cudaEvent_t event;
+      if (free_.empty()) {
+        cudaEventCreate(&event);
+      } else {
+        event = free_.back();
+        free_.pop_back();
+      }
+      return event;
+    }
+
+    void Accumulate(const bool wait) {
+      size_t running = 0;
+      for (const Interval& interval : pending_) {
+        if (!wait && cudaEventQuery(interval.end) != cudaSuccess) {
+          pending_[running++] = interval;
+          continue;
+        }
+        cudaEventSynchronize(interval.end);
+        float ms = 0.0f;
+        cudaEventElapsedTime(&ms, interval.start, interval.end);
+        switch (interval.phase) {
+          case Phase::kInputProjection: totals_.input_projection_ms += ms; break;
+          case Phase::kRecurrence: totals_.recurrence_ms += ms; break;
+          case Phase::kPointwise: totals_.pointwise_ms += ms; break;
+          case Phase::kWeightGradient: totals_.weight_gradient_ms += ms; break;
+        }
+        free_.push_back(interval.start);
+        free_.push_back(interval.end);
+      }
+      pending_.resize(running);
+    }
+
+    bool enabled_;
+    unsigned long long calls_;
+    std::string names_[kPhases];
+    cudaEvent_t open_[kPhases];
+    std::vector<Interval> pending_;
+    std::vector<cudaEvent_t> free_;
+    haste::v0::PhaseStats totals_;
+};
+
+#else  // HASTE_WITH_PROFILING
+
+// Compiled out: every call is a no-op and `Collect` always returns zeros.
+class PhaseProfiler {
+  public:
+    void SetName(const char*) {}
+    void EnableTiming() {}
+    void CountCall() {}
+    void Begin(const Phase, const cudaStream_t&) {}
+    void End(const Phase, const cudaStream_t&) {}
+    haste::v0::PhaseStats Collect() { return haste::v0::PhaseStats(); }
+};
+
+#endif  // HASTE_WITH_PROFILING
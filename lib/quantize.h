@@ -0,0 +1,133 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cuda_runtime_api.h>
+
+// Symmetric int8 quantization for `RunQuantized`: a value `x` with scale `s` is stored as
+// `round(x / s)` clamped to [-127, 127]. The hidden state is always in [-1, 1], so it's
+// quantized with the fixed scale 1/127 of `activation_storage<int8_t>`; the inputs and
+// each gate column of the weights have their own scales.
+
+__device__ __forceinline__
+int8_t QuantizeInt8(const float x) {
+  return static_cast<int8_t>(__float2int_rn(fminf(fmaxf(x, -127.0f), 127.0f)));
+}
+
+// The scale that maps magnitudes up to `absmax` onto [-127, 127]. All-zero data gets a
+// scale of 1 so that dequantizing never divides by zero.
+__device__ __forceinline__
+float Int8Scale(const float absmax) {
+  return absmax > 0.0f ? absmax / 127.0f : 1.0f;
+}
+
+// Folds the largest magnitude of `x` into `*absmax`. Non-negative floats order the same
+// way as their bit patterns do as ints, so `atomicMax` on the bits keeps the maximum.
+template<typename T>
+__global__
+void AbsMax(const size_t size, const T* __restrict__ x, float* absmax) {
+  float value = 0.0f;
+  for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < size; i += blockDim.x * gridDim.x)
+    value = fmaxf(value, fabsf(static_cast<float>(x[i])));
+
+  for (int offset = 16; offset > 0; offset /= 2)
+    value = fmaxf(value, __shfl_down_sync(0xffffffff, value, offset));
+  if (threadIdx.x % 32 == 0)
+    atomicMax(reinterpret_cast<int*>(absmax), __float_as_int(value));
+}
+
+// Quantizes each column `col` of the row-major [rows,cols] matrix `x` into `y` with its
+// own scale, `scale[col]`, chosen from the column's largest magnitude.
+template<typename T>
+__global__
+void QuantizeColumns(const int rows,
+                     const int cols,
+                     const T* __restrict__ x,
+                     int8_t* __restrict__ y,
+                     float* __restrict__ scale) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  if (col >= cols)
+    return;
+
+  float absmax = 0.0f;
+  for (int row = 0; row < rows; ++row)
+    absmax = fmaxf(absmax, fabsf(static_cast<float>(x[static_cast<size_t>(row) * cols + col])));
+
+  const float col_scale = Int8Scale(absmax);
+  for (int row = 0; row < rows; ++row) {
+    const size_t idx = static_cast<size_t>(row) * cols + col;
+    y[idx] = QuantizeInt8(static_cast<float>(x[idx]) / col_scale);
+  }
+  scale[col] = col_scale;
+}
+
+// Turns the calibrated magnitude `*absmax` into the scale of the inputs.
+static __global__
+void CalibratedScale(const float* absmax, float* scale) {
+  *scale = Int8Scale(*absmax);
+}
+
+// Quantizes `size` elements of `x` into `y` with the scale `*scale`, or with the fixed
+// scale of the hidden state if `scale` is null.
+template<typename T>
+__global__
+void QuantizeValues(const size_t size,
+                    const T* __restrict__ x,
+                    const float* __restrict__ scale,
+                    int8_t* __restrict__ y) {
+  const float inv_scale = scale ? 1.0f / *scale : 127.0f;
+  for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < size; i += blockDim.x * gridDim.x)
+    y[i] = QuantizeInt8(static_cast<float>(x[i]) * inv_scale);
+}
+
+// Launches `AbsMax` on `stream`.
+template<typename T>
+void LaunchAbsMax(const size_t size, const T* x, float* absmax, const cudaStream_t& stream) {
+  const int threads = 256;
+  const int blocks = static_cast<int>(std::min<size_t>((size + threads - 1) / threads, 1024));
+  if (blocks)
+    AbsMax<T><<<blocks, threads, 0, stream>>>(size, x, absmax);
+}
+
+// Launches `QuantizeColumns` on `stream`.
+template<typename T>
+void LaunchQuantizeColumns(
+    const int rows,
+    const int cols,
+    const T* x,
+    int8_t* y,
+    float* scale,
+    const cudaStream_t& stream) {
+  const int threads = 256;
+  const int blocks = (cols + threads - 1) / threads;
+  QuantizeColumns<T><<<blocks, threads, 0, stream>>>(rows, cols, x, y, scale);
+}
+
+// Launches `QuantizeValues` on `stream`.
+template<typename T>
+void LaunchQuantizeValues(
+    const size_t size,
+    const T* x,
+    const float* scale,
+    int8_t* y,
+    const cudaStream_t& stream) {
+  const int threads = 256;
+  const int blocks = static_cast<int>(std::min<size_t>((size + threads - 1) / threads, 4096));
+  if (blocks)
+    QuantizeValues<T><<<blocks, threads, 0, stream>>>(size, x, scale, y);
+}
@@ -0,0 +1,81 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+#include "inline_ops.h"
+
+static constexpr int kColumnSumWidth = 32;
+static constexpr int kColumnSumLanes = 32;
+
+// Adds the column sums of the row-major [rows,cols] matrix `x` to `sum`, or stores them if
+// `accumulate` is false. Each block owns `kColumnSumWidth` columns so that loads are
+// coalesced, and each column is reduced in the same order on every launch, which makes
+// the result bit-for-bit reproducible.
+template<typename T>
+__global__
+void ColumnSum(const int rows,
+               const int cols,
+               const bool accumulate,
+               const T* __restrict__ x,
+               T* __restrict__ sum) {
+  typedef typename accum_type<T>::type Acc;
+
+  __shared__ Acc partial[kColumnSumLanes][kColumnSumWidth + 1];
+
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+
+  Acc total = static_cast<Acc>(0.0);
+  if (col < cols) {
+    for (int row = threadIdx.y; row < rows; row += blockDim.y)
+      total += Acc(x[static_cast<size_t>(row) * cols + col]);
+  }
+  partial[threadIdx.y][threadIdx.x] = total;
+  __syncthreads();
+
+  if (threadIdx.y != 0 || col >= cols)
+    return;
+
+  for (int i = 1; i < blockDim.y; ++i)
+    total += partial[i][threadIdx.x];
+  sum[col] = accumulate ? T(Acc(sum[col]) + total) : T(total);
+}
+
+// Launches `ColumnSum` on `stream`.
+template<typename T>
+void StoreColumnSums(
+    const int rows,
+    const int cols,
+    const bool accumulate,
+    const T* x,
+    T* sum,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(kColumnSumWidth, kColumnSumLanes);
+  const dim3 gridDim((cols + blockDim.x - 1) / blockDim.x);
+  ColumnSum<T><<<gridDim, blockDim, 0, stream>>>(rows, cols, accumulate, x, sum);
+}
+
+// Launches `ColumnSum` on `stream`, adding to `sum`.
+template<typename T>
+void AddColumnSums(
+    const int rows,
+    const int cols,
+    const T* x,
+    T* sum,
+    const cudaStream_t& stream) {
+  StoreColumnSums(rows, cols, true, x, sum, stream);
+}
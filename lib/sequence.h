@@ -0,0 +1,158 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cstddef>
+#include <cublas_v2.h>
+
+#include "blas.h"
+#include "haste.h"
+
+// Where `Run` finds the time steps and rows of `x`, `h` and their gradients under a
+// `SequenceLayout`. `c`, `v` and the other per-step tensors are always dense and
+// time-major.
+struct SequenceStrides {
+  SequenceStrides(
+      const haste::v0::SequenceLayout& layout,
+      const int steps,
+      const int batch_size,
+      const int input_size,
+      const int hidden_size) {
+    const int h_stride = layout.h_stride ? layout.h_stride : hidden_size;
+    dense = !layout.batch_major && !layout.reverse && h_stride == hidden_size;
+    reverse = layout.reverse;
+    x_ld = layout.batch_major ? steps * input_size : input_size;
+    x_step = layout.batch_major ? input_size : static_cast<size_t>(batch_size) * input_size;
+    h_ld = layout.batch_major ? (steps + 1) * h_stride : h_stride;
+    h_step = layout.batch_major ? h_stride : static_cast<size_t>(batch_size) * h_stride;
+  }
+
+  // The time step that the `i`th iteration of a `Run` over `steps` steps computes.
+  int Step(const int i, const int steps) const { return reverse ? steps - 1 - i : i; }
+
+  // The indices of the states that time step `t` reads and writes.
+  int In(const int t) const { return reverse ? t + 1 : t; }
+  int Out(const int t) const { return reverse ? t : t + 1; }
+
+  bool dense;     // The default layout, which the persistent kernels require.
+  bool reverse;
+  int x_ld;       // Elements between the rows of `x` within a time step.
+  size_t x_step;  // Elements between the time steps of `x`.
+  int h_ld;       // Elements between the rows of `h` within a time step.
+  size_t h_step;  // Elements between the time steps of `h`.
+};
+
+// Computes `C_t = alpha * op(A) * B_t + beta * C_t` for each of `steps` time steps, where
+// `B_t` ([batch,k], rows `ldb` apart) starts `step_b` elements after `B_{t-1}` and
+// likewise for `C_t` ([batch,m]). Runs as one GEMM over all steps when both are dense,
+// otherwise as one strided-batched GEMM with a batch per time step.
+template<typename T>
+void StepwiseGemm(
+    const cublasHandle_t handle,
+    const cublasOperation_t transa,
+    const int m,
+    const int k,
+    const int steps,
+    const int batch,
+    const T* alpha,
+    const T* A,
+    const int lda,
+    const T* B,
+    const int ldb,
+    const size_t step_b,
+    const T* beta,
+    T* C,
+    const int ldc,
+    const size_t step_c) {
+  if (step_b == static_cast<size_t>(batch) * ldb && step_c == static_cast<size_t>(batch) * ldc) {
+    blas<T>::gemm(handle,
+        transa, CUBLAS_OP_N,
+        m, steps * batch, k,
+        alpha,
+        A, lda,
+        B, ldb,
+        beta,
+        C, ldc);
+  } else {
+    blas<T>::gemmStridedBatched(handle,
+        transa, CUBLAS_OP_N,
+        m, batch, k,
+        alpha,
+        A, lda, 0,
+        B, ldb, step_b,
+        beta,
+        C, ldc, step_c,
+        steps);
+  }
+}
+
+// Computes `C = alpha * sum_t A_t * B_t^T + beta * C` over `steps` time steps, where `A_t`
+// is the t'th dense [batch,m] block of `A` and `B_t` ([batch,n], rows `ldb` apart)
+// starts `step_b` elements after `B_{t-1}`. Reduces in one GEMM when the rows of `B` are
+// evenly spaced, otherwise in one GEMM per time step or one per batch row, whichever
+// takes fewer.
+template<typename T>
+void StepwiseSumGemm(
+    const cublasHandle_t handle,
+    const int m,
+    const int n,
+    const int steps,
+    const int batch,
+    const T* alpha,
+    const T* A,
+    const T* B,
+    const int ldb,
+    const size_t step_b,
+    const T* beta,
+    T* C,
+    const int ldc) {
+  static const T one = static_cast<T>(1.0);
+  const size_t block = static_cast<size_t>(batch) * m;
+  if (step_b == static_cast<size_t>(batch) * ldb) {
+    blas<T>::gemm(handle,
+        CUBLAS_OP_N, CUBLAS_OP_T,
+        m, n, steps * batch,
+        alpha,
+        A, m,
+        B, ldb,
+        beta,
+        C, ldc);
+  } else if (steps <= batch) {
+    for (int t = 0; t < steps; ++t) {
+      blas<T>::gemm(handle,
+          CUBLAS_OP_N, CUBLAS_OP_T,
+          m, n, batch,
+          alpha,
+          A + t * block, m,
+          B + t * step_b, ldb,
+          t ? &one : beta,
+          C, ldc);
+    }
+  } else {
+    // Row `r` of every time step: its columns of `A` are `batch*m` apart and its rows
+    // of `B` `step_b` apart.
+    for (int r = 0; r < batch; ++r) {
+      blas<T>::gemm(handle,
+          CUBLAS_OP_N, CUBLAS_OP_T,
+          m, n, steps,
+          alpha,
+          A + static_cast<size_t>(r) * m, static_cast<int>(block),
+          B + static_cast<size_t>(r) * ldb, static_cast<int>(step_b),
+          r ? &one : beta,
+          C, ldc);
+    }
+  }
+}
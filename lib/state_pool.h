@@ -0,0 +1,70 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_runtime_api.h>
+
+// Copies rows `ids[0..rows)` of the row-major [*,cols] pool `x` to consecutive rows of
+// `y` if `gather` is `true`, and consecutive rows of `x` to rows `ids` of the pool `y`
+// otherwise. `ids` must not repeat when scattering.
+template<typename T>
+__global__
+void CopyPoolRows(const int rows,
+                  const int cols,
+                  const bool gather,
+                  const int* __restrict__ ids,
+                  const T* __restrict__ x,
+                  T* __restrict__ y) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  const int row = blockIdx.y * blockDim.y + threadIdx.y;
+  if (col >= cols || row >= rows)
+    return;
+
+  const size_t pool_idx = static_cast<size_t>(ids[row]) * cols + col;
+  const size_t idx = static_cast<size_t>(row) * cols + col;
+  if (gather)
+    y[idx] = x[pool_idx];
+  else
+    y[pool_idx] = x[idx];
+}
+
+// Launches `CopyPoolRows` on `stream` to read rows `ids` of `pool` into `rows_out`.
+template<typename T>
+void GatherPoolRows(
+    const int rows,
+    const int cols,
+    const int* ids,
+    const T* pool,
+    T* rows_out,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(64, 4);
+  const dim3 gridDim((cols + blockDim.x - 1) / blockDim.x, (rows + blockDim.y - 1) / blockDim.y);
+  CopyPoolRows<T><<<gridDim, blockDim, 0, stream>>>(rows, cols, true, ids, pool, rows_out);
+}
+
+// Launches `CopyPoolRows` on `stream` to write `rows_in` back to rows `ids` of `pool`.
+template<typename T>
+void ScatterPoolRows(
+    const int rows,
+    const int cols,
+    const int* ids,
+    const T* rows_in,
+    T* pool,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(64, 4);
+  const dim3 gridDim((cols + blockDim.x - 1) / blockDim.x, (rows + blockDim.y - 1) / blockDim.y);
+  CopyPoolRows<T><<<gridDim, blockDim, 0, stream>>>(rows, cols, false, ids, rows_in, pool);
+}
@@ -0,0 +1,89 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cuda_bf16.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+#include <nccl.h>
+
+// `ncclBfloat16` first appeared in NCCL 2.10.
+#define HASTE_NCCL_HAS_BF16 (NCCL_VERSION_CODE >= NCCL_VERSION(2, 10, 0))
+
+template<typename T>
+struct nccl_type {};
+
+template<>
+struct nccl_type<__half> {
+  static constexpr ncclDataType_t value = ncclHalf;
+};
+
+#if HASTE_NCCL_HAS_BF16
+template<>
+struct nccl_type<__nv_bfloat16> {
+  static constexpr ncclDataType_t value = ncclBfloat16;
+};
+#endif
+
+template<>
+struct nccl_type<float> {
+  static constexpr ncclDataType_t value = ncclFloat;
+};
+
+template<>
+struct nccl_type<double> {
+  static constexpr ncclDataType_t value = ncclDouble;
+};
+
+// Copies the rank-major [G,N,Hs] shards that `ncclAllGather` produces into the columns
+// of the batch-major [N,G*Hs] matrix `y`. The shard of rank `skip` is left alone since
+// the caller's own units are already in place.
+template<typename T>
+__global__
+void InterleaveShards(const int ranks,
+                      const int rows,
+                      const int cols,
+                      const int skip,
+                      const T* __restrict__ x,
+                      T* __restrict__ y) {
+  const int col = blockIdx.x * blockDim.x + threadIdx.x;
+  const int row = blockIdx.y * blockDim.y + threadIdx.y;
+  const int rank = blockIdx.z;
+  if (col >= cols || row >= rows || rank == skip)
+    return;
+
+  const size_t shard_idx = (static_cast<size_t>(rank) * rows + row) * cols + col;
+  const size_t idx = static_cast<size_t>(row) * ranks * cols + rank * cols + col;
+  y[idx] = x[shard_idx];
+}
+
+// Launches `InterleaveShards` on `stream`.
+template<typename T>
+void LaunchInterleaveShards(
+    const int ranks,
+    const int rows,
+    const int cols,
+    const int skip,
+    const T* shards,
+    T* y,
+    const cudaStream_t& stream) {
+  const dim3 blockDim(64, 4);
+  const dim3 gridDim(
+      (cols + blockDim.x - 1) / blockDim.x,
+      (rows + blockDim.y - 1) / blockDim.y,
+      ranks);
+  InterleaveShards<T><<<gridDim, blockDim, 0, stream>>>(ranks, rows, cols, skip, shards, y);
+}
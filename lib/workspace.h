@@ -0,0 +1,45 @@
+// Copyright 2020 LMNT, Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#pragma once
+
+#include <cstddef>
+
+// The sub-buffers of a caller's workspace start at multiples of this many bytes from its
+// base, the same alignment as `cudaMalloc`, so each keeps the base's alignment.
+constexpr size_t kWorkspaceAlignment = 256;
+
+// The bytes that `count` elements of `T` take up in a workspace, including padding.
+template<typename T>
+size_t WorkspaceBytes(const size_t count) {
+  return (count * sizeof(T) + kWorkspaceAlignment - 1) / kWorkspaceAlignment * kWorkspaceAlignment;
+}
+
+// Hands out consecutive sub-buffers of the workspace at `base`, which the caller sized
+// with the matching sum of `WorkspaceBytes`.
+class Workspace {
+  public:
+    explicit Workspace(void* base) : next_(static_cast<unsigned char*>(base)) {}
+
+    template<typename T>
+    T* Take(const size_t count) {
+      T* buffer = reinterpret_cast<T*>(next_);
+      next_ += WorkspaceBytes<T>(count);
+      return buffer;
+    }
+
+  private:
+    unsigned char* next_;
+};
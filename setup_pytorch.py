@@ -0,0 +1,69 @@
+# Copyright 2020 LMNT, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import os
+
+from setuptools import setup
+from torch.utils import cpp_extension
+
+
+# `make haste_pytorch` runs this from a staging directory that holds `pytorch/`,
+# `lib/haste.h` and `libhaste.a`, and passes the Makefile's build options along.
+define_macros = []
+libraries = ['cublas']
+if os.environ.get('HASTE_WITH_NCCL') == '1':
+  define_macros.append(('HASTE_WITH_NCCL', None))
+  libraries.append('nccl')
+if os.environ.get('HASTE_WITH_PROFILING') == '1':
+  define_macros.append(('HASTE_WITH_PROFILING', None))
+  libraries.append('dl')
+
+extension = cpp_extension.CUDAExtension(
+    'haste_pytorch_lib',
+    sources = [
+        'pytorch/lstm.cc',
+        'pytorch/gru.cc',
+        'pytorch/support.cc',
+    ],
+    include_dirs = ['lib'],
+    define_macros = define_macros,
+    extra_objects = ['libhaste.a'],
+    libraries = libraries)
+
+setup(name = 'haste_pytorch',
+    version = '0.2.0',
+    description = 'Haste: a fast, simple, and open RNN library.',
+    author = 'LMNT, Inc.',
+    author_email = 'haste@lmnt.com',
+    url = 'https://www.lmnt.com',
+    license = 'Apache 2.0',
+    keywords = 'pytorch machine learning rnn lstm gru custom op',
+    packages = ['haste_pytorch'],
+    package_dir = { 'haste_pytorch': 'pytorch' },
+    install_requires = [],
+    zip_safe = False,
+    ext_modules = [extension],
+    cmdclass = { 'build_ext': cpp_extension.BuildExtension },
+    classifiers = [
+        'Development Status :: 4 - Beta',
+        'Intended Audience :: Developers',
+        'Intended Audience :: Education',
+        'Intended Audience :: Science/Research',
+        'License :: OSI Approved :: Apache Software License',
+        'Programming Language :: Python :: 3.6',
+        'Topic :: Scientific/Engineering :: Mathematics',
+        'Topic :: Software Development :: Libraries :: Python Modules',
+        'Topic :: Software Development :: Libraries',
+    ])